@@ -0,0 +1,326 @@
+/*************************************************************************
+ * Draws all the live bubbles from one vertex buffer in a single call:  *
+ * point sprites from outside the tank, and one shared sphere mesh      *
+ * instanced at every bubble from inside the submarine, with a draw for *
+ * each level of detail                                                 *
+ *************************************************************************/
+
+#define BUBBLE_SEGMENTS 10
+#define BUBBLE_SPRITE_SIZE 16
+#define BUBBLE_LIGHTS 7
+#define BUBBLE_OFFSET_ATTRIBUTE 3
+
+/* the fixed function lighting at eye, with normal, for the enabled
+   lights, and the end of main(). Instanced shaders do it themselves as
+   conventional lighting can't see what each instance is moved by */
+#define SHADER_LIGHTING \
+  "  vec4 sum = gl_FrontLightModelProduct.sceneColor;\n" \
+  "  vec3 toLight, halfway;\n" \
+  "  float diffuse, spot, distance, attenuation;\n" \
+  "  int i;\n", \
+  "  for(i = 0; i < 7; i++) {\n" \
+  "    if(lightOn[i] == 0) continue;\n" \
+  "    toLight = gl_LightSource[i].position.xyz - eye.xyz * gl_LightSource[i].position.w;\n" \
+  "    distance = length(toLight);\n" \
+  "    toLight = toLight / distance;\n" \
+  "    attenuation = 1.0;\n" \
+  "    if(gl_LightSource[i].position.w != 0.0)\n" \
+  "      attenuation = 1.0 / (gl_LightSource[i].constantAttenuation +\n" \
+  "        distance * (gl_LightSource[i].linearAttenuation +\n" \
+  "        distance * gl_LightSource[i].quadraticAttenuation));\n", \
+  "    if(gl_LightSource[i].spotCutoff < 180.0) {\n" \
+  "      spot = dot(-toLight, normalize(gl_LightSource[i].spotDirection));\n" \
+  "      if(spot < gl_LightSource[i].spotCosCutoff) continue;\n" \
+  "      attenuation *= pow(spot, gl_LightSource[i].spotExponent);\n" \
+  "    }\n", \
+  "    diffuse = max(dot(normal, toLight), 0.0);\n" \
+  "    sum += attenuation * (gl_FrontLightProduct[i].ambient +\n" \
+  "                          diffuse * gl_FrontLightProduct[i].diffuse);\n" \
+  "    if(diffuse > 0.0) {\n" \
+  "      halfway = normalize(toLight + vec3(0.0, 0.0, 1.0));\n" \
+  "      sum += attenuation * pow(max(dot(normal, halfway), 0.0),\n" \
+  "        gl_FrontMaterial.shininess) * gl_FrontLightProduct[i].specular;\n" \
+  "    }\n" \
+  "  }\n", \
+  "  colour = vec4(sum.rgb, gl_FrontMaterial.diffuse.a);\n" \
+  "  gl_Position = gl_ProjectionMatrix * eye;\n" \
+  "}\n"
+
+GLuint bubblePositionBuffer = 0;
+GLuint bubbleSphereBuffer = 0;
+GLuint bubbleSpriteTexture = 0;
+GLuint bubbleProgram = 0;
+GLint bubbleLightsUniform = -1;
+int usePointSprites = 0;
+
+/* spheres as triangles, interleaved normal then vertex, each level of
+   detail after the last */
+int bubbleSegments[LOD_LEVELS] = {16, BUBBLE_SEGMENTS, 6};
+float *bubbleSphere = NULL;
+int bubbleSphereVertices = 0;
+int bubbleSphereFirst[LOD_LEVELS], bubbleSphereCount[LOD_LEVELS];
+
+void InitBubbleRenderer(void);
+void BuildBubbleSpheres(float);
+void BuildBubbleSprite(void);
+GLuint BuildBubbleProgram(void);
+GLuint CompileShader(GLenum, const char **, int);
+GLvoid *UploadBubblePositions(float *, int);
+void DrawBubblePoints(float *, int);
+void DrawBubbleSpheres(float *, int[LOD_LEVELS]);
+void BubbleCentre(float *, int, GLfloat[3]);
+
+/* instanced sphere vertex shader, each offset by its bubble's position */
+const char *bubbleVertexShader[] = {
+  "#version 120\n"
+  "attribute vec3 offset;\n"
+  "uniform int lightOn[7];\n"
+  "varying vec4 colour;\n"
+  "void main() {\n"
+  "  vec4 eye = gl_ModelViewMatrix * vec4(gl_Vertex.xyz + offset, 1.0);\n"
+  "  vec3 normal = normalize(gl_NormalMatrix * gl_Normal);\n",
+  SHADER_LIGHTING
+};
+
+const char *bubbleFragmentShader[] = {
+  "#version 120\n"
+  "varying vec4 colour;\n"
+  "void main() {\n"
+  "  gl_FragColor = colour;\n"
+  "}\n"
+};
+
+void InitBubbleRenderer(void) {
+  BuildBubbleSpheres(BUBBLE_RADIUS);
+
+  if(haveBuffers) {
+    glGenBuffers(1, &bubblePositionBuffer);
+    glGenBuffers(1, &bubbleSphereBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, bubbleSphereBuffer);
+    glBufferData(GL_ARRAY_BUFFER, bubbleSphereVertices * 6 * sizeof(float),
+		 bubbleSphere, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+  if(haveInstancing) bubbleProgram = BuildBubbleProgram();
+
+  /* round sprites need 2.0, otherwise stay with smooth points */
+  if(GLVersionAtLeast(2, 0)) {
+    usePointSprites = 1;
+    BuildBubbleSprite();
+  }
+}
+
+void BuildBubbleSpheres(float radius) {
+  int i, j, k, level, segments, n = 0;
+  int corners[6][2] = {{0, 0}, {1, 0}, {1, 1}, {0, 0}, {1, 1}, {0, 1}};
+  double theta, phi;
+  float *v;
+
+  bubbleSphereVertices = 0;
+  for(level = 0; level < LOD_LEVELS; level++) {
+    bubbleSphereFirst[level] = bubbleSphereVertices;
+    bubbleSphereCount[level] = bubbleSegments[level] * bubbleSegments[level] * 6;
+    bubbleSphereVertices += bubbleSphereCount[level];
+  }
+  bubbleSphere = malloc(bubbleSphereVertices * 6 * sizeof(float));
+  if(bubbleSphere == NULL) {
+    fprintf(stderr, "ERROR: Unable to allocate the bubble mesh\n");
+    exit(1);
+  }
+
+  /* two triangles for each stack and slice */
+  for(level = 0; level < LOD_LEVELS; level++) {
+    segments = bubbleSegments[level];
+    for(i = 0; i < segments; i++) {
+      for(j = 0; j < segments; j++) {
+	for(k = 0; k < 6; k++) {
+	  phi = PI * (i + corners[k][0]) / segments;
+	  theta = 2 * PI * (j + corners[k][1]) / segments;
+	  v = bubbleSphere + 6 * n++;
+	  v[0] = sin(phi) * cos(theta);
+	  v[1] = sin(phi) * sin(theta);
+	  v[2] = cos(phi);
+	  v[3] = radius * v[0];
+	  v[4] = radius * v[1];
+	  v[5] = radius * v[2];
+	}
+      }
+    }
+  }
+}
+
+/* white disc, fading out at the edge */
+void BuildBubbleSprite(void) {
+  GLubyte sprite[BUBBLE_SPRITE_SIZE][BUBBLE_SPRITE_SIZE][4];
+  float dx, dy, r, alpha;
+  int i, j;
+
+  for(i = 0; i < BUBBLE_SPRITE_SIZE; i++) {
+    for(j = 0; j < BUBBLE_SPRITE_SIZE; j++) {
+      dx = (j + 0.5) / BUBBLE_SPRITE_SIZE * 2 - 1;
+      dy = (i + 0.5) / BUBBLE_SPRITE_SIZE * 2 - 1;
+      r = sqrt(dx*dx + dy*dy);
+      alpha = r < 0.7 ? 1.0 : r < 1.0 ? (1.0 - r) / 0.3 : 0.0;
+      sprite[i][j][0] = sprite[i][j][1] = sprite[i][j][2] = 255;
+      sprite[i][j][3] = (GLubyte) (alpha * 255);
+    }
+  }
+
+  glGenTextures(1, &bubbleSpriteTexture);
+  StateBindTexture(bubbleSpriteTexture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, BUBBLE_SPRITE_SIZE, BUBBLE_SPRITE_SIZE,
+	       0, GL_RGBA, GL_UNSIGNED_BYTE, sprite);
+}
+
+GLuint BuildBubbleProgram(void) {
+  GLuint program;
+  GLint linked;
+  char log[1024];
+
+  program = glCreateProgram();
+  glAttachShader(program, CompileShader(GL_VERTEX_SHADER, bubbleVertexShader,
+					sizeof(bubbleVertexShader) / sizeof(char *)));
+  glAttachShader(program, CompileShader(GL_FRAGMENT_SHADER, bubbleFragmentShader,
+					sizeof(bubbleFragmentShader) / sizeof(char *)));
+  glBindAttribLocation(program, BUBBLE_OFFSET_ATTRIBUTE, "offset");
+  glLinkProgram(program);
+  glGetProgramiv(program, GL_LINK_STATUS, &linked);
+  if(!linked) {
+    glGetProgramInfoLog(program, sizeof(log), NULL, log);
+    fprintf(stderr, "WARNING: Bubble shader did not link, not instancing\n%s\n", log);
+    return 0;
+  }
+  bubbleLightsUniform = glGetUniformLocation(program, "lightOn");
+  return program;
+}
+
+GLuint CompileShader(GLenum type, const char **source, int parts) {
+  GLuint shader;
+  GLint compiled;
+  char log[1024];
+
+  shader = glCreateShader(type);
+  glShaderSource(shader, parts, source, NULL);
+  glCompileShader(shader);
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+  if(!compiled) {
+    glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+    fprintf(stderr, "WARNING: Shader did not compile\n%s\n", log);
+  }
+  return shader;
+}
+
+/* send the interleaved x, y, z of every bubble to the buffer,
+   returns what to pass as the pointer */
+GLvoid *UploadBubblePositions(float *bubblePositions, int count) {
+  if(!haveBuffers) return bubblePositions;
+  glBindBuffer(GL_ARRAY_BUFFER, bubblePositionBuffer);
+  /* orphan last frame's storage rather than wait for it */
+  glBufferData(GL_ARRAY_BUFFER, count * 3 * sizeof(float), NULL, GL_STREAM_DRAW);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, count * 3 * sizeof(float), bubblePositions);
+  return NULL;
+}
+
+void DrawBubblePoints(float *bubblePositions, int count) {
+  GLvoid *positions;
+
+  if(count == 0) return;
+  positions = UploadBubblePositions(bubblePositions, count);
+
+  if(usePointSprites) {
+    StateEnable(GL_POINT_SMOOTH, 0);
+    StateEnable(GL_POINT_SPRITE, 1);
+    glTexEnvi(GL_POINT_SPRITE, GL_COORD_REPLACE, GL_TRUE);
+    glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+    StateBindTexture(bubbleSpriteTexture);
+    StateEnable(GL_TEXTURE_2D, 1);
+  }
+
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glVertexPointer(3, GL_FLOAT, 0, positions);
+  glDrawArrays(GL_POINTS, 0, count);
+  glDisableClientState(GL_VERTEX_ARRAY);
+
+  if(usePointSprites) {
+    StateEnable(GL_TEXTURE_2D, 0);
+    StateEnable(GL_POINT_SPRITE, 0);
+    StateEnable(GL_POINT_SMOOTH, 1);
+  }
+  if(haveBuffers) glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/* the bubbles in order of level of detail, counts[level] at each */
+void DrawBubbleSpheres(float *bubblePositions, int counts[LOD_LEVELS]) {
+  GLint lightOn[BUBBLE_LIGHTS];
+  GLvoid *positions;
+  char *sphere = haveBuffers ? NULL : (char *) bubbleSphere;
+  int i, level, first, count = 0;
+
+  for(level = 0; level < LOD_LEVELS; level++) count += counts[level];
+  if(count == 0) return;
+  positions = UploadBubblePositions(bubblePositions, count);
+
+  if(bubbleProgram) {
+    glVertexAttribDivisor(BUBBLE_OFFSET_ATTRIBUTE, 1);
+    glEnableVertexAttribArray(BUBBLE_OFFSET_ATTRIBUTE);
+  }
+
+  if(haveBuffers) glBindBuffer(GL_ARRAY_BUFFER, bubbleSphereBuffer);
+  glEnableClientState(GL_NORMAL_ARRAY);
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glNormalPointer(GL_FLOAT, 6 * sizeof(float), sphere);
+  glVertexPointer(3, GL_FLOAT, 6 * sizeof(float), sphere + 3 * sizeof(float));
+
+  if(bubbleProgram) {
+    for(i = 0; i < BUBBLE_LIGHTS; i++) lightOn[i] = StateEnabled(GL_LIGHT0 + i);
+    glUseProgram(bubbleProgram);
+    glUniform1iv(bubbleLightsUniform, BUBBLE_LIGHTS, lightOn);
+    /* every bubble at a level in one draw, offset by its position */
+    for(first = 0, level = 0; level < LOD_LEVELS; first += counts[level++]) {
+      if(counts[level] == 0) continue;
+      glVertexAttribPointer(BUBBLE_OFFSET_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, 0,
+			    (char *) positions + first * 3 * sizeof(float));
+      glDrawArraysInstanced(GL_TRIANGLES, bubbleSphereFirst[level], bubbleSphereCount[level],
+			    counts[level]);
+    }
+    glUseProgram(0);
+    glDisableVertexAttribArray(BUBBLE_OFFSET_ATTRIBUTE);
+    glVertexAttribDivisor(BUBBLE_OFFSET_ATTRIBUTE, 0);
+  }
+  else {
+    /* no instancing, but still only one copy of each level */
+    for(i = 0, level = 0; level < LOD_LEVELS; level++) {
+      for(first = i; i < first + counts[level]; i++) {
+	glPushMatrix();
+	  glTranslatef(bubblePositions[3*i], bubblePositions[3*i+1], bubblePositions[3*i+2]);
+	  glDrawArrays(GL_TRIANGLES, bubbleSphereFirst[level], bubbleSphereCount[level]);
+	glPopMatrix();
+      }
+    }
+  }
+
+  glDisableClientState(GL_NORMAL_ARRAY);
+  glDisableClientState(GL_VERTEX_ARRAY);
+  if(haveBuffers) glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/* middle of the box around them all, for sorting them as one */
+void BubbleCentre(float *bubblePositions, int count, GLfloat centre[3]) {
+  float low[3], high[3];
+  int i, k;
+
+  if(count == 0) {
+    centre[0] = centre[1] = centre[2] = 0.0;
+    return;
+  }
+  for(k = 0; k < 3; k++) low[k] = high[k] = bubblePositions[k];
+  for(i = 1; i < count; i++) {
+    for(k = 0; k < 3; k++) {
+      if(bubblePositions[3*i+k] < low[k]) low[k] = bubblePositions[3*i+k];
+      if(bubblePositions[3*i+k] > high[k]) high[k] = bubblePositions[3*i+k];
+    }
+  }
+  for(k = 0; k < 3; k++) centre[k] = (low[k] + high[k]) / 2;
+}
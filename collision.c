@@ -0,0 +1,516 @@
+/*************************************************************************
+ * A world of static colliders, half spaces, boxes and triangles, that  *
+ * moving oriented boxes are swept through. Each step every body's box  *
+ * from where it starts to where it would end up is put in a sweep and  *
+ * prune broadphase along x, kept sorted with an insertion sort since   *
+ * little moves between steps, and only the pairs whose bounds overlap  *
+ * on all three axes get a narrowphase. That is a separating axis test  *
+ * of the box against the collider along the box's motion, giving the   *
+ * first time in the step they touch, so nothing tunnels however fast   *
+ * it goes, or how deep they already are if they start overlapping      *
+ *************************************************************************/
+
+#define COLLIDE_PLANE 0
+#define COLLIDE_BOX 1
+#define COLLIDE_TRIANGLE 2
+
+#define COLLISION_FAR 1e30	/* the end of anything unbounded */
+#define COLLISION_AXES 15	/* tried at most, for two boxes */
+
+/* centre plus or minus half along each axis, axes[i] being of unit length */
+typedef struct {
+  float centre[3];
+  float axes[3][3];
+  float half[3];
+} orientedBox;
+
+typedef struct {
+  int type;
+  float normal[3], distance;	/* plane, normal . x >= distance is open water */
+  int centreOnly;		/* plane only keeps a box's centre out */
+  orientedBox box;		/* box */
+  float corners[3][3];		/* triangle */
+  float low[3], high[3];	/* bounds of the solid */
+} collider;
+
+/* the broadphase's end of a collider or body along x */
+typedef struct {
+  float value;
+  int proxy;			/* colliders first, then bodies */
+  int isEnd;
+} sweepPoint;
+
+/* the earliest thing a body runs into */
+typedef struct {
+  int collider;
+  float time;			/* fraction of the motion, < 0 if already overlapping */
+  float normal[3];		/* out of the collider */
+  float depth;			/* how far in, if already overlapping */
+} contact;
+
+typedef struct {
+  collider *colliders;
+  int colliderCount, colliderSize;
+  orientedBox *bodies;		/* where each starts the step */
+  float (*motions)[3];		/* and how far it would move */
+  float (*bodyLow)[3], (*bodyHigh)[3];
+  int bodyCount, bodySize;
+  sweepPoint *points;		/* two for every collider and body, in order */
+  int pointCount;
+  int *active;			/* proxies open during the sweep */
+  int (*pairs)[2];		/* body, collider found by the last sweep */
+  int pairCount, pairSize;
+  int tests;			/* narrowphase tests, this step */
+} collisionWorld;
+
+void InitCollisionWorld(collisionWorld *);
+void AddPlaneCollider(collisionWorld *, float[3], float, int);
+void AddBoxCollider(collisionWorld *, float[3], float[3]);
+void AddTriangleCollider(collisionWorld *, float[3], float[3], float[3]);
+void AddMeshColliders(collisionWorld *, mesh *);
+int AddCollisionBody(collisionWorld *);
+void MoveCollisionBody(collisionWorld *, int, orientedBox *, float[3]);
+void FindCollisionPairs(collisionWorld *);
+void ReportCollisions(collisionWorld *);
+int WaterBounds(collisionWorld *, float[3], float[3]);
+int FirstContact(collisionWorld *, int, contact *);
+int SweepBox(collider *, orientedBox *, float[3], contact *);
+void BoxBounds(orientedBox *, float[3], float[3]);
+float BoxReach(orientedBox *, float[3]);
+void ColliderInterval(collider *, float[3], float *, float *);
+int ColliderAxes(collider *, orientedBox *, float[COLLISION_AXES][3]);
+int AddAxis(float[COLLISION_AXES][3], int, float[3]);
+void Cross(float[3], float[3], float[3]);
+collider *NewCollider(collisionWorld *, int);
+void AddSweepPoints(collisionWorld *, int, float, float);
+void SortSweepPoints(collisionWorld *);
+void AddCollisionPair(collisionWorld *, int, int);
+float ProxyLow(collisionWorld *, int, int);
+float ProxyHigh(collisionWorld *, int, int);
+
+void InitCollisionWorld(collisionWorld *w) {
+  memset(w, 0, sizeof(collisionWorld));
+}
+
+/* open water on the side normal points to, normal of unit length.
+   Planes along an axis are bounded on that axis, the rest are
+   everywhere */
+void AddPlaneCollider(collisionWorld *w, float normal[3], float distance, int centreOnly) {
+  collider *c = NewCollider(w, COLLIDE_PLANE);
+  int k;
+
+  memcpy(c->normal, normal, sizeof(c->normal));
+  c->distance = distance;
+  c->centreOnly = centreOnly;
+  for(k = 0; k < 3; k++) {
+    c->low[k] = -COLLISION_FAR;
+    c->high[k] = COLLISION_FAR;
+    if(normal[k] == 1.0) c->high[k] = distance;
+    if(normal[k] == -1.0) c->low[k] = -distance;
+  }
+  AddSweepPoints(w, w->colliderCount - 1, c->low[0], c->high[0]);
+}
+
+/* lined up with the axes */
+void AddBoxCollider(collisionWorld *w, float low[3], float high[3]) {
+  collider *c = NewCollider(w, COLLIDE_BOX);
+  int k;
+
+  memset(&c->box, 0, sizeof(orientedBox));
+  for(k = 0; k < 3; k++) {
+    c->box.centre[k] = (low[k] + high[k]) / 2;
+    c->box.half[k] = (high[k] - low[k]) / 2;
+    c->box.axes[k][k] = 1.0;
+  }
+  BoxBounds(&c->box, c->low, c->high);
+  AddSweepPoints(w, w->colliderCount - 1, c->low[0], c->high[0]);
+}
+
+void AddTriangleCollider(collisionWorld *w, float a[3], float b[3], float c[3]) {
+  collider *t = NewCollider(w, COLLIDE_TRIANGLE);
+  int i, k;
+
+  memcpy(t->corners[0], a, sizeof(t->corners[0]));
+  memcpy(t->corners[1], b, sizeof(t->corners[1]));
+  memcpy(t->corners[2], c, sizeof(t->corners[2]));
+  for(k = 0; k < 3; k++) {
+    t->low[k] = t->high[k] = a[k];
+    for(i = 1; i < 3; i++) {
+      if(t->corners[i][k] < t->low[k]) t->low[k] = t->corners[i][k];
+      if(t->corners[i][k] > t->high[k]) t->high[k] = t->corners[i][k];
+    }
+  }
+  AddSweepPoints(w, w->colliderCount - 1, t->low[0], t->high[0]);
+}
+
+/* every triangle of a mesh that hasn't been uploaded yet, in the
+   coordinates it was built in */
+void AddMeshColliders(collisionWorld *w, mesh *m) {
+  meshPart *part;
+  GLuint *index;
+
+  for(part = m->parts; part < m->parts + m->partCount; part++) {
+    if(part->mode != GL_TRIANGLES) continue;
+    for(index = m->indices + part->first; index < m->indices + part->first + part->count;
+	index += 3)
+      AddTriangleCollider(w, m->vertices[index[0]].position, m->vertices[index[1]].position,
+			  m->vertices[index[2]].position);
+  }
+}
+
+/* returns the body's number, it goes nowhere until it is moved */
+int AddCollisionBody(collisionWorld *w) {
+  int body = w->bodyCount, k;
+
+  if(w->bodyCount == w->bodySize) {
+    w->bodySize = w->bodySize ? 2 * w->bodySize : 4;
+    w->bodies = realloc(w->bodies, w->bodySize * sizeof(orientedBox));
+    w->motions = realloc(w->motions, w->bodySize * sizeof(w->motions[0]));
+    w->bodyLow = realloc(w->bodyLow, w->bodySize * sizeof(w->bodyLow[0]));
+    w->bodyHigh = realloc(w->bodyHigh, w->bodySize * sizeof(w->bodyHigh[0]));
+    if(w->bodies == NULL || w->motions == NULL || w->bodyLow == NULL || w->bodyHigh == NULL) {
+      fprintf(stderr, "ERROR: Unable to allocate %d collision bodies\n", w->bodySize);
+      exit(1);
+    }
+  }
+  w->bodyCount++;
+  memset(&w->bodies[body], 0, sizeof(orientedBox));
+  for(k = 0; k < 3; k++) w->motions[body][k] = w->bodyLow[body][k] = w->bodyHigh[body][k] = 0.0;
+  AddSweepPoints(w, w->colliderCount + body, 0.0, 0.0);
+  return body;
+}
+
+/* where a body starts this step and how far it would go, bounded from
+   start to finish for the broadphase */
+void MoveCollisionBody(collisionWorld *w, int body, orientedBox *b, float motion[3]) {
+  float low[3], high[3];
+  int k;
+
+  w->bodies[body] = *b;
+  memcpy(w->motions[body], motion, sizeof(w->motions[0]));
+  BoxBounds(b, low, high);
+  for(k = 0; k < 3; k++) {
+    w->bodyLow[body][k] = low[k] + (motion[k] < 0.0 ? motion[k] : 0.0);
+    w->bodyHigh[body][k] = high[k] + (motion[k] > 0.0 ? motion[k] : 0.0);
+  }
+}
+
+/* the pairs of a body and anything else whose bounds overlap, from a
+   sweep along x with the ends kept sorted from the last step. Two static
+   colliders are never paired */
+void FindCollisionPairs(collisionWorld *w) {
+  int i, j, proxy, other, activeCount = 0;
+  int colliders = w->colliderCount;
+
+  PROFILE_BEGIN("FindCollisionPairs");
+  for(i = 0; i < w->pointCount; i++) {
+    proxy = w->points[i].proxy;
+    w->points[i].value = w->points[i].isEnd ? ProxyHigh(w, proxy, 0) : ProxyLow(w, proxy, 0);
+  }
+  SortSweepPoints(w);
+
+  w->pairCount = 0;
+  w->tests = 0;
+  for(i = 0; i < w->pointCount; i++) {
+    proxy = w->points[i].proxy;
+    if(w->points[i].isEnd) {
+      for(j = 0; j < activeCount && w->active[j] != proxy; j++);
+      if(j < activeCount) w->active[j] = w->active[--activeCount];
+      continue;
+    }
+    for(j = 0; j < activeCount; j++) {
+      other = w->active[j];
+      if(proxy < colliders && other < colliders) continue;
+      if(ProxyLow(w, proxy, 1) > ProxyHigh(w, other, 1) ||
+	 ProxyLow(w, other, 1) > ProxyHigh(w, proxy, 1) ||
+	 ProxyLow(w, proxy, 2) > ProxyHigh(w, other, 2) ||
+	 ProxyLow(w, other, 2) > ProxyHigh(w, proxy, 2)) continue;
+      /* the body first */
+      if(proxy >= colliders) AddCollisionPair(w, proxy - colliders, other);
+      else AddCollisionPair(w, other - colliders, proxy);
+    }
+    w->active[activeCount++] = proxy;
+  }
+  PROFILE_END();
+}
+
+void ReportCollisions(collisionWorld *w) {
+  printf("Collisions: %d colliders, %d bodies, %d pairs from the broadphase, %d tested\n",
+	 w->colliderCount, w->bodyCount, w->pairCount, w->tests);
+}
+
+/* the box the planes along the axes close the open water into, returns 0
+   if they don't along every axis */
+int WaterBounds(collisionWorld *w, float low[3], float high[3]) {
+  collider *c;
+  int k;
+
+  for(k = 0; k < 3; k++) {
+    low[k] = -COLLISION_FAR;
+    high[k] = COLLISION_FAR;
+  }
+  for(c = w->colliders; c < w->colliders + w->colliderCount; c++) {
+    if(c->type != COLLIDE_PLANE) continue;
+    for(k = 0; k < 3; k++) {
+      if(c->normal[k] == 1.0 && c->distance > low[k]) low[k] = c->distance;
+      if(c->normal[k] == -1.0 && -c->distance < high[k]) high[k] = -c->distance;
+    }
+  }
+  for(k = 0; k < 3; k++)
+    if(low[k] == -COLLISION_FAR || high[k] == COLLISION_FAR || high[k] < low[k]) return 0;
+  return 1;
+}
+
+/* what the body runs into first among the colliders it was paired with,
+   preferring the deepest it already overlaps. Returns 0 for nothing */
+int FirstContact(collisionWorld *w, int body, contact *first) {
+  contact c;
+  int i, found = 0;
+
+  for(i = 0; i < w->pairCount; i++) {
+    /* other bodies are for whoever moves them to sort out */
+    if(w->pairs[i][0] != body || w->pairs[i][1] >= w->colliderCount) continue;
+    w->tests++;
+    if(!SweepBox(&w->colliders[w->pairs[i][1]], &w->bodies[body], w->motions[body], &c)) continue;
+    c.collider = w->pairs[i][1];
+    if(!found) *first = c;
+    else if(c.time < 0.0) {
+      if(first->time >= 0.0 || c.depth > first->depth) *first = c;
+    }
+    else if(first->time >= 0.0 && c.time < first->time) *first = c;
+    found = 1;
+  }
+  return found;
+}
+
+/* the box moving by motion against the collider, projected on every axis
+   that could separate them: when along each the two first and last
+   overlap, and the latest first overlap is when they touch, if it comes
+   before every last one. Returns 0 if they never touch this step */
+int SweepBox(collider *c, orientedBox *b, float motion[3], contact *hit) {
+  float axes[COLLISION_AXES][3];
+  float low, high, centre, reach, speed, enter, leave, depth;
+  float first = -COLLISION_FAR, last = COLLISION_FAR;
+  int i, n, entering = -1, deepest = -1;
+  float side = 0.0, deepSide = 0.0;
+
+  hit->depth = COLLISION_FAR;
+  n = ColliderAxes(c, b, axes);
+  for(i = 0; i < n; i++) {
+    ColliderInterval(c, axes[i], &low, &high);
+    centre = b->centre[0] * axes[i][0] + b->centre[1] * axes[i][1] + b->centre[2] * axes[i][2];
+    reach = c->type == COLLIDE_PLANE && c->centreOnly ? 0.0 : BoxReach(b, axes[i]);
+    speed = motion[0] * axes[i][0] + motion[1] * axes[i][1] + motion[2] * axes[i][2];
+
+    /* how far in they are now, and out which side is shortest */
+    depth = centre + reach - low < high - (centre - reach) ? centre + reach - low :
+      high - (centre - reach);
+    if(depth < hit->depth) {
+      hit->depth = depth;
+      deepest = i;
+      deepSide = centre + reach - low < high - (centre - reach) ? -1.0 : 1.0;
+    }
+
+    if(speed == 0.0) {
+      if(depth < 0.0) return 0;
+      continue;
+    }
+    enter = (low - (centre + reach)) / speed;
+    leave = (high - (centre - reach)) / speed;
+    if(enter > leave) {
+      depth = enter;
+      enter = leave;
+      leave = depth;
+    }
+    if(enter > first) {
+      first = enter;
+      entering = i;
+      side = speed > 0.0 ? -1.0 : 1.0;
+    }
+    if(leave < last) last = leave;
+    if(first > last || first > 1.0 || last < 0.0) return 0;
+  }
+
+  if(hit->depth >= 0.0) {
+    /* already overlapping, out the shallowest way */
+    hit->time = -1.0;
+    for(i = 0; i < 3; i++) hit->normal[i] = axes[deepest][i] * deepSide;
+    return 1;
+  }
+  hit->time = first;
+  hit->depth = 0.0;
+  for(i = 0; i < 3; i++) hit->normal[i] = axes[entering][i] * side;
+  return 1;
+}
+
+void BoxBounds(orientedBox *b, float low[3], float high[3]) {
+  float reach;
+  int k;
+
+  for(k = 0; k < 3; k++) {
+    reach = fabs(b->axes[0][k]) * b->half[0] + fabs(b->axes[1][k]) * b->half[1] +
+      fabs(b->axes[2][k]) * b->half[2];
+    low[k] = b->centre[k] - reach;
+    high[k] = b->centre[k] + reach;
+  }
+}
+
+/* half the box's length along a unit axis */
+float BoxReach(orientedBox *b, float axis[3]) {
+  int i;
+  float reach = 0.0;
+
+  for(i = 0; i < 3; i++)
+    reach += b->half[i] * fabs(b->axes[i][0] * axis[0] + b->axes[i][1] * axis[1] +
+			       b->axes[i][2] * axis[2]);
+  return reach;
+}
+
+/* where the solid starts and ends along a unit axis */
+void ColliderInterval(collider *c, float axis[3], float *low, float *high) {
+  float centre, reach, d;
+  int i;
+
+  switch(c->type) {
+  case COLLIDE_PLANE:
+    /* only ever asked along its normal */
+    *low = -COLLISION_FAR;
+    *high = c->distance;
+    break;
+  case COLLIDE_BOX:
+    centre = c->box.centre[0] * axis[0] + c->box.centre[1] * axis[1] + c->box.centre[2] * axis[2];
+    reach = BoxReach(&c->box, axis);
+    *low = centre - reach;
+    *high = centre + reach;
+    break;
+  default:
+    *low = *high = c->corners[0][0] * axis[0] + c->corners[0][1] * axis[1] +
+      c->corners[0][2] * axis[2];
+    for(i = 1; i < 3; i++) {
+      d = c->corners[i][0] * axis[0] + c->corners[i][1] * axis[1] + c->corners[i][2] * axis[2];
+      if(d < *low) *low = d;
+      if(d > *high) *high = d;
+    }
+  }
+}
+
+/* the separating axes to try: a plane's normal, or both shapes' faces and
+   the crosses of their edges. Returns how many */
+int ColliderAxes(collider *c, orientedBox *b, float axes[COLLISION_AXES][3]) {
+  float edges[3][3], normal[3], across[3];
+  int i, j, k, n = 0;
+
+  if(c->type == COLLIDE_PLANE) {
+    memcpy(axes[0], c->normal, sizeof(axes[0]));
+    return 1;
+  }
+  for(i = 0; i < 3; i++) n = AddAxis(axes, n, b->axes[i]);
+  if(c->type == COLLIDE_BOX) {
+    for(i = 0; i < 3; i++) {
+      n = AddAxis(axes, n, c->box.axes[i]);
+      memcpy(edges[i], c->box.axes[i], sizeof(edges[i]));
+    }
+  }
+  else {
+    for(i = 0; i < 3; i++)
+      for(k = 0; k < 3; k++) edges[i][k] = c->corners[(i + 1) % 3][k] - c->corners[i][k];
+    Cross(edges[0], edges[1], normal);
+    n = AddAxis(axes, n, normal);
+  }
+  for(i = 0; i < 3; i++)
+    for(j = 0; j < 3; j++) {
+      Cross(b->axes[i], edges[j], across);
+      n = AddAxis(axes, n, across);
+    }
+  return n;
+}
+
+/* normalised onto the end of axes, unless it is too short to point
+   anywhere, from parallel edges */
+int AddAxis(float axes[COLLISION_AXES][3], int n, float axis[3]) {
+  float length = sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+
+  if(length < 1e-6 || n == COLLISION_AXES) return n;
+  axes[n][0] = axis[0] / length;
+  axes[n][1] = axis[1] / length;
+  axes[n][2] = axis[2] / length;
+  return n + 1;
+}
+
+void Cross(float a[3], float b[3], float result[3]) {
+  result[0] = a[1] * b[2] - a[2] * b[1];
+  result[1] = a[2] * b[0] - a[0] * b[2];
+  result[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+collider *NewCollider(collisionWorld *w, int type) {
+  if(w->bodyCount > 0) {
+    fprintf(stderr, "ERROR: Colliders must all be added before any body\n");
+    exit(1);
+  }
+  if(w->colliderCount == w->colliderSize) {
+    w->colliderSize = w->colliderSize ? 2 * w->colliderSize : 16;
+    w->colliders = realloc(w->colliders, w->colliderSize * sizeof(collider));
+    if(w->colliders == NULL) {
+      fprintf(stderr, "ERROR: Unable to allocate %d colliders\n", w->colliderSize);
+      exit(1);
+    }
+  }
+  w->colliders[w->colliderCount].type = type;
+  return &w->colliders[w->colliderCount++];
+}
+
+void AddSweepPoints(collisionWorld *w, int proxy, float low, float high) {
+  int proxies = w->colliderCount + w->bodyCount;
+
+  w->points = realloc(w->points, (w->pointCount + 2) * sizeof(sweepPoint));
+  w->active = realloc(w->active, proxies * sizeof(int));
+  if(w->points == NULL || w->active == NULL) {
+    fprintf(stderr, "ERROR: Unable to allocate the collision broadphase\n");
+    exit(1);
+  }
+  w->points[w->pointCount].value = low;
+  w->points[w->pointCount].proxy = proxy;
+  w->points[w->pointCount++].isEnd = 0;
+  w->points[w->pointCount].value = high;
+  w->points[w->pointCount].proxy = proxy;
+  w->points[w->pointCount++].isEnd = 1;
+}
+
+/* nearly in order already, so an insertion sort is about linear. Starts
+   come before ends at the same place so touching bounds overlap */
+void SortSweepPoints(collisionWorld *w) {
+  sweepPoint p;
+  int i, j;
+
+  for(i = 1; i < w->pointCount; i++) {
+    p = w->points[i];
+    for(j = i; j > 0 && (w->points[j-1].value > p.value ||
+			 (w->points[j-1].value == p.value && w->points[j-1].isEnd && !p.isEnd)); j--)
+      w->points[j] = w->points[j-1];
+    w->points[j] = p;
+  }
+}
+
+void AddCollisionPair(collisionWorld *w, int body, int other) {
+  if(w->pairCount == w->pairSize) {
+    w->pairSize = w->pairSize ? 2 * w->pairSize : 64;
+    w->pairs = realloc(w->pairs, w->pairSize * sizeof(w->pairs[0]));
+    if(w->pairs == NULL) {
+      fprintf(stderr, "ERROR: Unable to allocate %d collision pairs\n", w->pairSize);
+      exit(1);
+    }
+  }
+  w->pairs[w->pairCount][0] = body;
+  w->pairs[w->pairCount++][1] = other;
+}
+
+float ProxyLow(collisionWorld *w, int proxy, int axis) {
+  if(proxy < w->colliderCount) return w->colliders[proxy].low[axis];
+  return w->bodyLow[proxy - w->colliderCount][axis];
+}
+
+float ProxyHigh(collisionWorld *w, int proxy, int axis) {
+  if(proxy < w->colliderCount) return w->colliders[proxy].high[axis];
+  return w->bodyHigh[proxy - w->colliderCount][axis];
+}
@@ -0,0 +1,278 @@
+/*************************************************************************
+ * Frustum culling. The view volume comes from the projection set in    *
+ * Reshape() and whatever matrix things are drawn with, as six planes   *
+ * in that matrix's own coordinates, so boxes never need transforming.  *
+ * The static scenery goes in a bounding volume hierarchy over its mesh *
+ * parts, built once, so whole branches are thrown away or taken with   *
+ * one test each. Moving meshes are tested a part at a time and bubbles *
+ * one at a time                                                        *
+ *************************************************************************/
+
+/* what a box or sphere test says */
+#define CULL_OUTSIDE 0
+#define CULL_PARTIAL 1
+#define CULL_INSIDE 2
+
+/* left, right, bottom, top, near, far, each a x + b y + c z + d >= 0
+   inside, with (a, b, c) of unit length */
+typedef struct {
+  GLfloat planes[6][4];
+} frustum;
+
+/* one part in world coordinates, or a branch over a run of them */
+typedef struct {
+  GLfloat low[3], high[3];
+  int first, count;		/* in the tree's leaves */
+  int left, right;		/* children in nodes[], -1 for a leaf */
+} cullNode;
+
+typedef struct {
+  mesh *m;
+  meshPart *part;
+} cullLeaf;
+
+typedef struct {
+  cullNode *nodes;
+  int nodeCount;
+  cullLeaf *leaves;
+  int leafCount;
+} cullTree;
+
+/* this frame's */
+typedef struct {
+  int partsVisible, partsCulled;
+  int nodesTested;
+  int bubblesVisible, bubblesCulled;
+  int subsVisible, subsCulled;
+} cullCounts;
+
+int culling = 1;
+GLfloat cullProjection[16];
+GLfloat *viewMatrix;		/* the camera's */
+frustum viewFrustum;		/* in world coordinates */
+cullCounts cullCount;
+
+void SetCullProjection(void);
+void StartCullFrame(GLfloat *);
+void ExtractFrustum(frustum *, GLfloat *);
+int BoxInFrustum(frustum *, GLfloat[3], GLfloat[3]);
+int SphereInFrustum(frustum *, GLfloat[3], GLfloat);
+void BuildCullTree(cullTree *, mesh **, int);
+void QueueVisible(renderQueue *, cullTree *, GLfloat *, int);
+void QueueCulledMesh(renderQueue *, mesh *, GLfloat *, int);
+float *VisiblePoints(frameArena *, float *, int, float, int *);
+void ReportCulling(void);
+int BuildCullNode(cullTree *, int, int);
+void QueueCullNode(renderQueue *, cullTree *, int, GLfloat *, int);
+int CompareLeaves(const void *, const void *);
+
+/* the axis CompareLeaves() sorts along */
+int cullAxis;
+
+/* call whenever the projection changes, with it current */
+void SetCullProjection(void) {
+  glGetFloatv(GL_PROJECTION_MATRIX, cullProjection);
+}
+
+/* world is the camera's modelview */
+void StartCullFrame(GLfloat *world) {
+  memset(&cullCount, 0, sizeof(cullCount));
+  viewMatrix = world;
+  ExtractFrustum(&viewFrustum, world);
+}
+
+/* the planes of projection times modelview (Gribb and Hartmann 2001),
+   so they are in the coordinates modelview is applied to */
+void ExtractFrustum(frustum *f, GLfloat *modelview) {
+  GLfloat m[16], length;
+  int i, j;
+
+  for(i = 0; i < 4; i++)
+    for(j = 0; j < 4; j++)
+      m[4*j+i] = cullProjection[i] * modelview[4*j] + cullProjection[4+i] * modelview[4*j+1] +
+	cullProjection[8+i] * modelview[4*j+2] + cullProjection[12+i] * modelview[4*j+3];
+
+  /* the bottom row plus or minus each of the others */
+  for(i = 0; i < 6; i++) {
+    for(j = 0; j < 4; j++)
+      f->planes[i][j] = m[4*j+3] + (i % 2 ? -m[4*j+i/2] : m[4*j+i/2]);
+    length = sqrt(f->planes[i][0] * f->planes[i][0] + f->planes[i][1] * f->planes[i][1] +
+		  f->planes[i][2] * f->planes[i][2]);
+    for(j = 0; j < 4; j++) f->planes[i][j] /= length;
+  }
+}
+
+int BoxInFrustum(frustum *f, GLfloat low[3], GLfloat high[3]) {
+  GLfloat centre[3], extent[3], distance, reach;
+  int result = CULL_INSIDE;
+  int i, k;
+
+  for(k = 0; k < 3; k++) {
+    centre[k] = (low[k] + high[k]) / 2;
+    extent[k] = (high[k] - low[k]) / 2;
+  }
+  for(i = 0; i < 6; i++) {
+    distance = f->planes[i][0] * centre[0] + f->planes[i][1] * centre[1] +
+      f->planes[i][2] * centre[2] + f->planes[i][3];
+    reach = fabs(f->planes[i][0]) * extent[0] + fabs(f->planes[i][1]) * extent[1] +
+      fabs(f->planes[i][2]) * extent[2];
+    if(distance < -reach) return CULL_OUTSIDE;
+    if(distance < reach) result = CULL_PARTIAL;
+  }
+  return result;
+}
+
+int SphereInFrustum(frustum *f, GLfloat centre[3], GLfloat radius) {
+  GLfloat distance;
+  int result = CULL_INSIDE;
+  int i;
+
+  for(i = 0; i < 6; i++) {
+    distance = f->planes[i][0] * centre[0] + f->planes[i][1] * centre[1] +
+      f->planes[i][2] * centre[2] + f->planes[i][3];
+    if(distance < -radius) return CULL_OUTSIDE;
+    if(distance < radius) result = CULL_PARTIAL;
+  }
+  return result;
+}
+
+/* over every part of the meshes, which must be uploaded and drawn with
+   the world matrix */
+void BuildCullTree(cullTree *t, mesh **m, int meshCount) {
+  int i, j, parts = 0;
+
+  for(i = 0; i < meshCount; i++) parts += m[i]->partCount;
+  t->leaves = malloc((parts + 1) * sizeof(cullLeaf));
+  t->nodes = malloc((2 * parts + 1) * sizeof(cullNode));
+  if(t->leaves == NULL || t->nodes == NULL) {
+    fprintf(stderr, "ERROR: Unable to allocate the culling tree\n");
+    exit(1);
+  }
+  t->leafCount = t->nodeCount = 0;
+  for(i = 0; i < meshCount; i++)
+    for(j = 0; j < m[i]->partCount; j++) {
+      /* nothing to draw, nothing to cull */
+      if(m[i]->parts[j].count == 0) continue;
+      t->leaves[t->leafCount].m = m[i];
+      t->leaves[t->leafCount].part = &m[i]->parts[j];
+      t->leafCount++;
+    }
+  if(t->leafCount > 0) BuildCullNode(t, 0, t->leafCount);
+}
+
+/* the parts in view, from the root down */
+void QueueVisible(renderQueue *q, cullTree *t, GLfloat *world, int pass) {
+  if(t->nodeCount > 0) QueueCullNode(q, t, 0, world, pass);
+}
+
+/* the parts of m in view, its matrix being where it is */
+void QueueCulledMesh(renderQueue *q, mesh *m, GLfloat *matrix, int pass) {
+  frustum f;
+  int i;
+
+  if(culling) ExtractFrustum(&f, matrix);
+  for(i = 0; i < m->partCount; i++) {
+    if(culling && BoxInFrustum(&f, m->parts[i].low, m->parts[i].high) == CULL_OUTSIDE) {
+      cullCount.partsCulled++;
+      continue;
+    }
+    QueueMeshPart(q, m, &m->parts[i], matrix, pass);
+    cullCount.partsVisible++;
+  }
+}
+
+/* those of the interleaved x, y, z points within radius of the view,
+   copied into the arena. Just points when culling is off */
+float *VisiblePoints(frameArena *a, float *points, int count, float radius, int *visible) {
+  float *kept;
+  int i, n = 0;
+
+  *visible = count;
+  if(!culling) return points;
+  kept = ArenaAlloc(a, count * 3 * sizeof(float) + 1);
+  for(i = 0; i < count; i++) {
+    if(SphereInFrustum(&viewFrustum, points + 3*i, radius) == CULL_OUTSIDE) continue;
+    kept[3*n] = points[3*i];
+    kept[3*n+1] = points[3*i+1];
+    kept[3*n+2] = points[3*i+2];
+    n++;
+  }
+  *visible = n;
+  return kept;
+}
+
+void ReportCulling(void) {
+  printf("Culling%s: %d parts visible, %d culled, %d tree nodes tested, "
+	 "%d bubbles visible, %d culled, %d submarines visible, %d culled\n",
+	 culling ? "" : " (off)", cullCount.partsVisible, cullCount.partsCulled,
+	 cullCount.nodesTested, cullCount.bubblesVisible, cullCount.bubblesCulled,
+	 cullCount.subsVisible, cullCount.subsCulled);
+}
+
+/* leaves first to first+count-1, split in half along the longest axis
+   of their centres. Returns the node */
+int BuildCullNode(cullTree *t, int first, int count) {
+  int node = t->nodeCount++;
+  cullNode *n = &t->nodes[node];
+  GLfloat low[3], high[3];
+  meshPart *part;
+  int i, k;
+
+  for(k = 0; k < 3; k++) {
+    n->low[k] = low[k] = 1e30;
+    n->high[k] = high[k] = -1e30;
+  }
+  for(i = first; i < first + count; i++) {
+    part = t->leaves[i].part;
+    for(k = 0; k < 3; k++) {
+      if(part->low[k] < n->low[k]) n->low[k] = part->low[k];
+      if(part->high[k] > n->high[k]) n->high[k] = part->high[k];
+      if(part->centre[k] < low[k]) low[k] = part->centre[k];
+      if(part->centre[k] > high[k]) high[k] = part->centre[k];
+    }
+  }
+  n->first = first;
+  n->count = count;
+  n->left = n->right = -1;
+  if(count == 1) return node;
+
+  cullAxis = 0;
+  for(k = 1; k < 3; k++) if(high[k] - low[k] > high[cullAxis] - low[cullAxis]) cullAxis = k;
+  qsort(t->leaves + first, count, sizeof(cullLeaf), CompareLeaves);
+  n->left = BuildCullNode(t, first, count / 2);
+  n->right = BuildCullNode(t, first + count / 2, count - count / 2);
+  return node;
+}
+
+void QueueCullNode(renderQueue *q, cullTree *t, int node, GLfloat *world, int pass) {
+  cullNode *n = &t->nodes[node];
+  int inside = CULL_INSIDE;
+  int i;
+
+  if(culling) {
+    cullCount.nodesTested++;
+    inside = BoxInFrustum(&viewFrustum, n->low, n->high);
+  }
+  if(inside == CULL_OUTSIDE) {
+    cullCount.partsCulled += n->count;
+    return;
+  }
+  if(inside == CULL_INSIDE || n->left < 0) {
+    /* all of it, without testing any further down */
+    for(i = n->first; i < n->first + n->count; i++)
+      QueueMeshPart(q, t->leaves[i].m, t->leaves[i].part, world, pass);
+    cullCount.partsVisible += n->count;
+    return;
+  }
+  QueueCullNode(q, t, n->left, world, pass);
+  QueueCullNode(q, t, n->right, world, pass);
+}
+
+int CompareLeaves(const void *a, const void *b) {
+  GLfloat x = ((const cullLeaf *) a)->part->centre[cullAxis];
+  GLfloat y = ((const cullLeaf *) b)->part->centre[cullAxis];
+
+  if(x < y) return -1;
+  if(x > y) return 1;
+  return 0;
+}
@@ -0,0 +1,415 @@
+/*************************************************************************
+ * Signed distance to the nearest thing in a collision world, baked     *
+ * once onto a grid over the open water and read back with trilinear    *
+ * interpolation, so colliding a particle costs the same eight lookups  *
+ * however much is in the tank. The slope of the interpolation is the   *
+ * way out of whatever it has hit. Planes and boxes have an inside and  *
+ * go negative in it; triangles don't, so they count by how far away    *
+ * they are and a particle keeps off either side. Planes that only keep *
+ * a box's centre out, like the surface, are left out so the bubbles    *
+ * can still reach it and burst. Only the band of grid round each       *
+ * collider is baked, a slice at a time across the thread pool, and     *
+ * particles are collided 8 at a time with AVX2 gathers, with a scalar  *
+ * loop for other CPUs and for the leftovers                            *
+ *************************************************************************/
+
+/* spacing of the grid, small enough to keep the corners of the shelf */
+#define FIELD_CELL 0.5
+/* past the walls, so what is pushed through them is still pushed back */
+#define FIELD_MARGIN 2.0
+/* only baked this close to something, further is left at this. Lookups
+   within a cell and a bubble of anything never see the difference */
+#define FIELD_BAND 4.0
+#define FIELD_FAR 1e30
+
+typedef struct {
+  float *distance;		/* x fastest, then y, then z */
+  int size[3];			/* grid points along each axis */
+  float origin[3];		/* where the first one is */
+  float cell, inverse;		/* inverse is 1 / cell */
+  collisionWorld *w;		/* what it was baked from */
+  double bakeTime;		/* in seconds */
+} distanceField;
+
+/* what every chunk of a collision needs to know */
+typedef struct {
+  distanceField *f;
+  particles *p;
+  float radius, bounce;
+} fieldCollision;
+
+void BakeDistanceField(distanceField *, collisionWorld *);
+void BakeFieldChunk(void *, int, int);
+float ColliderDistance(collider *, float[3]);
+float BoxDistance(orientedBox *, float[3]);
+float TriangleDistance(float[3][3], float[3]);
+float LookupDistance(distanceField *, float, float, float, float[3]);
+void CollideParticles(distanceField *, particles *, float, float);
+void CollideParticleChunk(void *, int, int);
+void CollideParticlesScalar(fieldCollision *, int, int);
+int CollideParticlesAVX2(fieldCollision *, int, int);
+void ReportDistanceField(distanceField *);
+
+/* over the open water between the world's planes, which must close it in
+   along every axis */
+void BakeDistanceField(distanceField *f, collisionWorld *w) {
+  float low[3], high[3];
+  double start = Now();
+  long i, points;
+  int k;
+
+  PROFILE_BEGIN("BakeDistanceField");
+  if(!WaterBounds(w, low, high)) {
+    fprintf(stderr, "ERROR: Distance field needs the water closed in by planes along every axis\n");
+    exit(1);
+  }
+  for(k = 0; k < 3; k++) {
+    f->origin[k] = low[k] - FIELD_MARGIN;
+    f->size[k] = (int) ceil((high[k] - low[k] + 2 * FIELD_MARGIN) / FIELD_CELL) + 1;
+  }
+  f->cell = FIELD_CELL;
+  f->inverse = 1.0 / FIELD_CELL;
+  f->w = w;
+  points = (long) f->size[0] * f->size[1] * f->size[2];
+  f->distance = malloc(points * sizeof(float));
+  if(f->distance == NULL) {
+    fprintf(stderr, "ERROR: Unable to allocate %dx%dx%d distance field\n",
+	    f->size[0], f->size[1], f->size[2]);
+    exit(1);
+  }
+  for(i = 0; i < points; i++) f->distance[i] = FIELD_BAND;
+  ParallelFor(BakeFieldChunk, f, f->size[2], 1);
+  f->bakeTime = Now() - start;
+  PROFILE_END();
+}
+
+/* slices begin to end-1 along z, each point the nearest of whatever is
+   within the band of it */
+void BakeFieldChunk(void *data, int begin, int end) {
+  distanceField *f = data;
+  collider *c;
+  float point[3], low, high, distance;
+  float *out;
+  int first[3], last[3], i, j, k;
+
+  for(c = f->w->colliders; c < f->w->colliders + f->w->colliderCount; c++) {
+    if(c->type == COLLIDE_PLANE && c->centreOnly) continue;
+    /* the grid points round the solid's bounds, in these slices */
+    for(k = 0; k < 3; k++) {
+      low = ceil((c->low[k] - FIELD_BAND - f->origin[k]) * f->inverse);
+      high = floor((c->high[k] + FIELD_BAND - f->origin[k]) * f->inverse);
+      first[k] = low < 0.0 ? 0 : low > f->size[k] ? f->size[k] : (int) low;
+      last[k] = high < -1.0 ? -1 : high > f->size[k] - 1 ? f->size[k] - 1 : (int) high;
+    }
+    if(first[2] < begin) first[2] = begin;
+    if(last[2] > end - 1) last[2] = end - 1;
+    for(k = first[2]; k <= last[2]; k++) {
+      point[2] = f->origin[2] + k * f->cell;
+      for(j = first[1]; j <= last[1]; j++) {
+	point[1] = f->origin[1] + j * f->cell;
+	out = f->distance + first[0] + f->size[0] * (j + (long) f->size[1] * k);
+	for(i = first[0]; i <= last[0]; i++, out++) {
+	  point[0] = f->origin[0] + i * f->cell;
+	  distance = ColliderDistance(c, point);
+	  if(distance < *out) *out = distance;
+	}
+      }
+    }
+  }
+}
+
+/* negative inside a plane's or box's solid */
+float ColliderDistance(collider *c, float point[3]) {
+  switch(c->type) {
+  case COLLIDE_PLANE:
+    return c->normal[0] * point[0] + c->normal[1] * point[1] + c->normal[2] * point[2] -
+      c->distance;
+  case COLLIDE_BOX:
+    return BoxDistance(&c->box, point);
+  default:
+    return TriangleDistance(c->corners, point);
+  }
+}
+
+/* negative inside, by how far it is to the nearest face */
+float BoxDistance(orientedBox *b, float point[3]) {
+  float along, outside = 0.0, inside = -FIELD_FAR;
+  int j;
+
+  for(j = 0; j < 3; j++) {
+    along = fabs((point[0] - b->centre[0]) * b->axes[j][0] +
+		 (point[1] - b->centre[1]) * b->axes[j][1] +
+		 (point[2] - b->centre[2]) * b->axes[j][2]) - b->half[j];
+    if(along > 0.0) outside += along * along;
+    if(along > inside) inside = along;
+  }
+  return outside > 0.0 ? sqrt(outside) : inside;
+}
+
+/* to the nearest point of the triangle, by which of its corners, edges or
+   face that is (Ericson 2005, 5.1.5) */
+float TriangleDistance(float corners[3][3], float point[3]) {
+  float ab[3], ac[3], ap[3], bp[3], cp[3], nearest[3];
+  float d1, d2, d3, d4, d5, d6, va, vb, vc, v, w, denominator;
+  int k;
+
+  for(k = 0; k < 3; k++) {
+    ab[k] = corners[1][k] - corners[0][k];
+    ac[k] = corners[2][k] - corners[0][k];
+    ap[k] = point[k] - corners[0][k];
+    bp[k] = point[k] - corners[1][k];
+    cp[k] = point[k] - corners[2][k];
+  }
+  d1 = ab[0] * ap[0] + ab[1] * ap[1] + ab[2] * ap[2];
+  d2 = ac[0] * ap[0] + ac[1] * ap[1] + ac[2] * ap[2];
+  d3 = ab[0] * bp[0] + ab[1] * bp[1] + ab[2] * bp[2];
+  d4 = ac[0] * bp[0] + ac[1] * bp[1] + ac[2] * bp[2];
+  d5 = ab[0] * cp[0] + ab[1] * cp[1] + ab[2] * cp[2];
+  d6 = ac[0] * cp[0] + ac[1] * cp[1] + ac[2] * cp[2];
+  va = d3 * d6 - d5 * d4;
+  vb = d5 * d2 - d1 * d6;
+  vc = d1 * d4 - d3 * d2;
+
+  if(d1 <= 0.0 && d2 <= 0.0) v = w = 0.0;
+  else if(d3 >= 0.0 && d4 <= d3) {
+    v = 1.0;
+    w = 0.0;
+  }
+  else if(d6 >= 0.0 && d5 <= d6) {
+    v = 0.0;
+    w = 1.0;
+  }
+  else if(vc <= 0.0 && d1 >= 0.0 && d3 <= 0.0) {
+    v = d1 / (d1 - d3);
+    w = 0.0;
+  }
+  else if(vb <= 0.0 && d2 >= 0.0 && d6 <= 0.0) {
+    v = 0.0;
+    w = d2 / (d2 - d6);
+  }
+  else if(va <= 0.0 && d4 - d3 >= 0.0 && d5 - d6 >= 0.0) {
+    w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+    v = 1.0 - w;
+  }
+  else {
+    denominator = 1.0 / (va + vb + vc);
+    v = vb * denominator;
+    w = vc * denominator;
+  }
+  for(k = 0; k < 3; k++) nearest[k] = point[k] - corners[0][k] - ab[k] * v - ac[k] * w;
+  return sqrt(nearest[0] * nearest[0] + nearest[1] * nearest[1] + nearest[2] * nearest[2]);
+}
+
+/* interpolated between the eight grid points round x, y, z, with the
+   slope there, uphill and not of unit length. Outside the grid it is
+   whatever is at the nearest edge */
+float LookupDistance(distanceField *f, float x, float y, float z, float slope[3]) {
+  float g[3], t[3], c[8];
+  float *d;
+  int cell[3], k, sx = f->size[0], sxy = f->size[0] * f->size[1];
+  float c00, c10, c01, c11, c0, c1, e0, e1;
+
+  g[0] = (x - f->origin[0]) * f->inverse;
+  g[1] = (y - f->origin[1]) * f->inverse;
+  g[2] = (z - f->origin[2]) * f->inverse;
+  for(k = 0; k < 3; k++) {
+    if(g[k] < 0.0f) g[k] = 0.0f;
+    if(g[k] > f->size[k] - 1) g[k] = f->size[k] - 1;
+    cell[k] = (int) g[k];
+    if(cell[k] > f->size[k] - 2) cell[k] = f->size[k] - 2;
+    t[k] = g[k] - cell[k];
+  }
+  d = f->distance + cell[0] + sx * cell[1] + sxy * cell[2];
+  c[0] = d[0];
+  c[1] = d[1];
+  c[2] = d[sx];
+  c[3] = d[sx + 1];
+  c[4] = d[sxy];
+  c[5] = d[sxy + 1];
+  c[6] = d[sxy + sx];
+  c[7] = d[sxy + sx + 1];
+
+  /* along x, then y, then z */
+  c00 = c[0] + t[0] * (c[1] - c[0]);
+  c10 = c[2] + t[0] * (c[3] - c[2]);
+  c01 = c[4] + t[0] * (c[5] - c[4]);
+  c11 = c[6] + t[0] * (c[7] - c[6]);
+  c0 = c00 + t[1] * (c10 - c00);
+  c1 = c01 + t[1] * (c11 - c01);
+  e0 = (c[1] - c[0]) + t[1] * ((c[3] - c[2]) - (c[1] - c[0]));
+  e1 = (c[5] - c[4]) + t[1] * ((c[7] - c[6]) - (c[5] - c[4]));
+  slope[0] = e0 + t[2] * (e1 - e0);
+  slope[1] = (c10 - c00) + t[2] * ((c11 - c01) - (c10 - c00));
+  slope[2] = c1 - c0;
+  return c0 + t[2] * (c1 - c0);
+}
+
+/* push every particle closer than radius to anything back out along the
+   slope of the field, and bounce it if it was heading further in. Each
+   particle only changes itself, so chunks never share anything they write */
+void CollideParticles(distanceField *f, particles *p, float radius, float bounce) {
+  fieldCollision c;
+
+  PROFILE_BEGIN("CollideParticles");
+  c.f = f;
+  c.p = p;
+  c.radius = radius;
+  c.bounce = bounce;
+  ParallelFor(CollideParticleChunk, &c, p->count, PARTICLE_GRAIN);
+  PROFILE_END();
+}
+
+/* no gather before AVX2, so SSE gets the scalar loop */
+void CollideParticleChunk(void *data, int begin, int end) {
+  fieldCollision *c = data;
+  int done = begin;
+
+#ifdef PARTICLES_X86
+  if(particleKernel == PARTICLES_AVX2) done = CollideParticlesAVX2(c, begin, end);
+#endif
+  CollideParticlesScalar(c, done, end);
+}
+
+void CollideParticlesScalar(fieldCollision *c, int begin, int end) {
+  particles *p = c->p;
+  float slope[3], distance, length, along;
+  int i;
+
+  for(i = begin; i < end; i++) {
+    distance = LookupDistance(c->f, p->x[i], p->y[i], p->z[i], slope);
+    if(distance >= c->radius) continue;
+    length = sqrt(slope[0] * slope[0] + slope[1] * slope[1] + slope[2] * slope[2]);
+    /* flat, in the middle of something, with no way out */
+    if(length < 1e-6f) continue;
+    length = 1.0f / length;
+    slope[0] *= length;
+    slope[1] *= length;
+    slope[2] *= length;
+    p->x[i] += slope[0] * (c->radius - distance);
+    p->y[i] += slope[1] * (c->radius - distance);
+    p->z[i] += slope[2] * (c->radius - distance);
+    along = p->xVelocity[i] * slope[0] + p->yVelocity[i] * slope[1] + p->zVelocity[i] * slope[2];
+    if(along >= 0.0f) continue;
+    along *= 1.0f + c->bounce;
+    p->xVelocity[i] -= along * slope[0];
+    p->yVelocity[i] -= along * slope[1];
+    p->zVelocity[i] -= along * slope[2];
+  }
+}
+
+#ifdef PARTICLES_X86
+/* same as the scalar loop, but for the last bit or so of the slope where
+   -ffast-math estimates the vector square root and divide. Returns where
+   it got up to */
+__attribute__((target("avx2")))
+int CollideParticlesAVX2(fieldCollision *c, int begin, int end) {
+  distanceField *f = c->f;
+  particles *p = c->p;
+  __m256 zero = _mm256_setzero_ps();
+  __m256 unit = _mm256_set1_ps(1.0f);
+  __m256 radius = _mm256_set1_ps(c->radius);
+  __m256 rebound = _mm256_set1_ps(1.0f + c->bounce);
+  __m256 flat = _mm256_set1_ps(1e-6f);
+  __m256 inverse = _mm256_set1_ps(f->inverse);
+  __m256 origin[3], top[3];
+  __m256i last[3];
+  __m256i sx = _mm256_set1_epi32(f->size[0]);
+  __m256i sxy = _mm256_set1_epi32(f->size[0] * f->size[1]);
+  __m256i one = _mm256_set1_epi32(1);
+  __m256 g[3], t[3], v[3], position[3], corner[8];
+  __m256 c00, c10, c01, c11, c0, c1, e0, e1, slope[3];
+  __m256 distance, length, along, hit, push;
+  __m256i cell[3], index, up;
+  float *lanes[3], *velocities[3];
+  int i, k;
+
+  lanes[0] = p->x;
+  lanes[1] = p->y;
+  lanes[2] = p->z;
+  velocities[0] = p->xVelocity;
+  velocities[1] = p->yVelocity;
+  velocities[2] = p->zVelocity;
+  for(k = 0; k < 3; k++) {
+    origin[k] = _mm256_set1_ps(f->origin[k]);
+    top[k] = _mm256_set1_ps(f->size[k] - 1);
+    last[k] = _mm256_set1_epi32(f->size[k] - 2);
+  }
+
+  for(i = begin; i + 8 <= end; i += 8) {
+    for(k = 0; k < 3; k++) {
+      position[k] = _mm256_loadu_ps(lanes[k] + i);
+      g[k] = _mm256_mul_ps(_mm256_sub_ps(position[k], origin[k]), inverse);
+      g[k] = _mm256_min_ps(_mm256_max_ps(g[k], zero), top[k]);
+      cell[k] = _mm256_min_epi32(_mm256_cvttps_epi32(g[k]), last[k]);
+      t[k] = _mm256_sub_ps(g[k], _mm256_cvtepi32_ps(cell[k]));
+    }
+    index = _mm256_add_epi32(cell[0], _mm256_add_epi32(_mm256_mullo_epi32(cell[1], sx),
+						       _mm256_mullo_epi32(cell[2], sxy)));
+    corner[0] = _mm256_i32gather_ps(f->distance, index, 4);
+    corner[1] = _mm256_i32gather_ps(f->distance, _mm256_add_epi32(index, one), 4);
+    up = _mm256_add_epi32(index, sx);
+    corner[2] = _mm256_i32gather_ps(f->distance, up, 4);
+    corner[3] = _mm256_i32gather_ps(f->distance, _mm256_add_epi32(up, one), 4);
+    index = _mm256_add_epi32(index, sxy);
+    corner[4] = _mm256_i32gather_ps(f->distance, index, 4);
+    corner[5] = _mm256_i32gather_ps(f->distance, _mm256_add_epi32(index, one), 4);
+    up = _mm256_add_epi32(index, sx);
+    corner[6] = _mm256_i32gather_ps(f->distance, up, 4);
+    corner[7] = _mm256_i32gather_ps(f->distance, _mm256_add_epi32(up, one), 4);
+
+    c00 = _mm256_add_ps(corner[0], _mm256_mul_ps(t[0], _mm256_sub_ps(corner[1], corner[0])));
+    c10 = _mm256_add_ps(corner[2], _mm256_mul_ps(t[0], _mm256_sub_ps(corner[3], corner[2])));
+    c01 = _mm256_add_ps(corner[4], _mm256_mul_ps(t[0], _mm256_sub_ps(corner[5], corner[4])));
+    c11 = _mm256_add_ps(corner[6], _mm256_mul_ps(t[0], _mm256_sub_ps(corner[7], corner[6])));
+    c0 = _mm256_add_ps(c00, _mm256_mul_ps(t[1], _mm256_sub_ps(c10, c00)));
+    c1 = _mm256_add_ps(c01, _mm256_mul_ps(t[1], _mm256_sub_ps(c11, c01)));
+    e0 = _mm256_add_ps(_mm256_sub_ps(corner[1], corner[0]),
+		       _mm256_mul_ps(t[1], _mm256_sub_ps(_mm256_sub_ps(corner[3], corner[2]),
+							 _mm256_sub_ps(corner[1], corner[0]))));
+    e1 = _mm256_add_ps(_mm256_sub_ps(corner[5], corner[4]),
+		       _mm256_mul_ps(t[1], _mm256_sub_ps(_mm256_sub_ps(corner[7], corner[6]),
+							 _mm256_sub_ps(corner[5], corner[4]))));
+    slope[0] = _mm256_add_ps(e0, _mm256_mul_ps(t[2], _mm256_sub_ps(e1, e0)));
+    slope[1] = _mm256_add_ps(_mm256_sub_ps(c10, c00),
+			     _mm256_mul_ps(t[2], _mm256_sub_ps(_mm256_sub_ps(c11, c01),
+							       _mm256_sub_ps(c10, c00))));
+    slope[2] = _mm256_sub_ps(c1, c0);
+    distance = _mm256_add_ps(c0, _mm256_mul_ps(t[2], _mm256_sub_ps(c1, c0)));
+
+    length = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(slope[0], slope[0]),
+							 _mm256_mul_ps(slope[1], slope[1])),
+					   _mm256_mul_ps(slope[2], slope[2])));
+    hit = _mm256_and_ps(_mm256_cmp_ps(distance, radius, _CMP_LT_OQ),
+			_mm256_cmp_ps(length, flat, _CMP_GE_OQ));
+    if(_mm256_movemask_ps(hit) == 0) continue;
+
+    /* out to the radius */
+    push = _mm256_sub_ps(radius, distance);
+    length = _mm256_div_ps(unit, length);
+    for(k = 0; k < 3; k++) {
+      slope[k] = _mm256_mul_ps(slope[k], length);
+      position[k] = _mm256_blendv_ps(position[k],
+				     _mm256_add_ps(position[k], _mm256_mul_ps(slope[k], push)), hit);
+      _mm256_storeu_ps(lanes[k] + i, position[k]);
+      v[k] = _mm256_loadu_ps(velocities[k] + i);
+    }
+    /* and bounced if still heading in */
+    along = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(v[0], slope[0]), _mm256_mul_ps(v[1], slope[1])),
+			  _mm256_mul_ps(v[2], slope[2]));
+    hit = _mm256_and_ps(hit, _mm256_cmp_ps(along, zero, _CMP_LT_OQ));
+    along = _mm256_mul_ps(along, rebound);
+    for(k = 0; k < 3; k++)
+      _mm256_storeu_ps(velocities[k] + i,
+		       _mm256_blendv_ps(v[k], _mm256_sub_ps(v[k], _mm256_mul_ps(along, slope[k])),
+					hit));
+  }
+  return i;
+}
+#endif
+
+void ReportDistanceField(distanceField *f) {
+  printf("Distance field: %dx%dx%d points %.2f apart, %.1f MB, baked in %.1f ms\n",
+	 f->size[0], f->size[1], f->size[2], f->cell,
+	 (double) f->size[0] * f->size[1] * f->size[2] * sizeof(float) / (1024.0 * 1024.0),
+	 f->bakeTime * 1000.0);
+}
@@ -0,0 +1,195 @@
+/*************************************************************************
+ * OpenGL entry points beyond 1.1, looked up at run time through GLUT,   *
+ * or EGL when running headless. The macros let the rest of the program *
+ * call them by their usual names                                        *
+ *************************************************************************/
+
+#ifdef FREEGLUT
+#include <GL/freeglut_ext.h>
+#endif
+
+typedef void (*procedure)(void);
+
+/* buffer objects (1.5) */
+PFNGLGENBUFFERSPROC glGenBuffersProc;
+PFNGLBINDBUFFERPROC glBindBufferProc;
+PFNGLBUFFERDATAPROC glBufferDataProc;
+PFNGLBUFFERSUBDATAPROC glBufferSubDataProc;
+PFNGLMAPBUFFERPROC glMapBufferProc;
+PFNGLUNMAPBUFFERPROC glUnmapBufferProc;
+#define glGenBuffers glGenBuffersProc
+#define glBindBuffer glBindBufferProc
+#define glBufferData glBufferDataProc
+#define glBufferSubData glBufferSubDataProc
+#define glMapBuffer glMapBufferProc
+#define glUnmapBuffer glUnmapBufferProc
+
+/* vertex array objects (3.0) */
+PFNGLGENVERTEXARRAYSPROC glGenVertexArraysProc;
+PFNGLBINDVERTEXARRAYPROC glBindVertexArrayProc;
+#define glGenVertexArrays glGenVertexArraysProc
+#define glBindVertexArray glBindVertexArrayProc
+
+/* compressed textures (1.3) */
+PFNGLCOMPRESSEDTEXIMAGE2DPROC glCompressedTexImage2DProc;
+#define glCompressedTexImage2D glCompressedTexImage2DProc
+
+/* shaders (2.0) */
+PFNGLCREATESHADERPROC glCreateShaderProc;
+PFNGLSHADERSOURCEPROC glShaderSourceProc;
+PFNGLCOMPILESHADERPROC glCompileShaderProc;
+PFNGLGETSHADERIVPROC glGetShaderivProc;
+PFNGLGETSHADERINFOLOGPROC glGetShaderInfoLogProc;
+PFNGLCREATEPROGRAMPROC glCreateProgramProc;
+PFNGLATTACHSHADERPROC glAttachShaderProc;
+PFNGLBINDATTRIBLOCATIONPROC glBindAttribLocationProc;
+PFNGLLINKPROGRAMPROC glLinkProgramProc;
+PFNGLGETPROGRAMIVPROC glGetProgramivProc;
+PFNGLGETPROGRAMINFOLOGPROC glGetProgramInfoLogProc;
+PFNGLUSEPROGRAMPROC glUseProgramProc;
+PFNGLGETUNIFORMLOCATIONPROC glGetUniformLocationProc;
+PFNGLUNIFORM1IVPROC glUniform1ivProc;
+PFNGLVERTEXATTRIBPOINTERPROC glVertexAttribPointerProc;
+PFNGLENABLEVERTEXATTRIBARRAYPROC glEnableVertexAttribArrayProc;
+PFNGLDISABLEVERTEXATTRIBARRAYPROC glDisableVertexAttribArrayProc;
+#define glCreateShader glCreateShaderProc
+#define glShaderSource glShaderSourceProc
+#define glCompileShader glCompileShaderProc
+#define glGetShaderiv glGetShaderivProc
+#define glGetShaderInfoLog glGetShaderInfoLogProc
+#define glCreateProgram glCreateProgramProc
+#define glAttachShader glAttachShaderProc
+#define glBindAttribLocation glBindAttribLocationProc
+#define glLinkProgram glLinkProgramProc
+#define glGetProgramiv glGetProgramivProc
+#define glGetProgramInfoLog glGetProgramInfoLogProc
+#define glUseProgram glUseProgramProc
+#define glGetUniformLocation glGetUniformLocationProc
+#define glUniform1iv glUniform1ivProc
+#define glVertexAttribPointer glVertexAttribPointerProc
+#define glEnableVertexAttribArray glEnableVertexAttribArrayProc
+#define glDisableVertexAttribArray glDisableVertexAttribArrayProc
+
+/* instancing (3.3) */
+PFNGLDRAWARRAYSINSTANCEDPROC glDrawArraysInstancedProc;
+PFNGLDRAWELEMENTSINSTANCEDPROC glDrawElementsInstancedProc;
+PFNGLVERTEXATTRIBDIVISORPROC glVertexAttribDivisorProc;
+#define glDrawArraysInstanced glDrawArraysInstancedProc
+#define glDrawElementsInstanced glDrawElementsInstancedProc
+#define glVertexAttribDivisor glVertexAttribDivisorProc
+
+/* what the context can do */
+int haveBuffers = 0;
+int haveVertexArrays = 0;
+int havePixelBuffers = 0;
+int haveTextureCompression = 0;
+int haveShaders = 0;
+int haveInstancing = 0;
+
+void LoadExtensions(int);
+procedure GetProcedure(char *, int);
+int GLVersionAtLeast(int, int);
+int HaveExtension(char *);
+
+void LoadExtensions(int offscreen) {
+  if(GLVersionAtLeast(1, 5)) {
+    glGenBuffers = (PFNGLGENBUFFERSPROC) GetProcedure("glGenBuffers", offscreen);
+    glBindBuffer = (PFNGLBINDBUFFERPROC) GetProcedure("glBindBuffer", offscreen);
+    glBufferData = (PFNGLBUFFERDATAPROC) GetProcedure("glBufferData", offscreen);
+    glBufferSubData = (PFNGLBUFFERSUBDATAPROC) GetProcedure("glBufferSubData", offscreen);
+    glMapBuffer = (PFNGLMAPBUFFERPROC) GetProcedure("glMapBuffer", offscreen);
+    glUnmapBuffer = (PFNGLUNMAPBUFFERPROC) GetProcedure("glUnmapBuffer", offscreen);
+    haveBuffers = glGenBuffers && glBindBuffer && glBufferData && glBufferSubData;
+  }
+
+  if(GLVersionAtLeast(3, 0)) {
+    glGenVertexArrays = (PFNGLGENVERTEXARRAYSPROC) GetProcedure("glGenVertexArrays", offscreen);
+    glBindVertexArray = (PFNGLBINDVERTEXARRAYPROC) GetProcedure("glBindVertexArray", offscreen);
+    haveVertexArrays = haveBuffers && glGenVertexArrays && glBindVertexArray;
+  }
+
+  /* BC1 and BC3 are S3TC's DXT1 and DXT5 */
+  if(GLVersionAtLeast(1, 3) && HaveExtension("GL_EXT_texture_compression_s3tc")) {
+    glCompressedTexImage2D = (PFNGLCOMPRESSEDTEXIMAGE2DPROC)
+      GetProcedure("glCompressedTexImage2D", offscreen);
+    haveTextureCompression = glCompressedTexImage2D != NULL;
+  }
+
+  /* pixel buffer objects (2.1) */
+  if(GLVersionAtLeast(2, 1))
+    havePixelBuffers = haveBuffers && glMapBuffer && glUnmapBuffer;
+
+  if(GLVersionAtLeast(2, 0)) {
+    glCreateShader = (PFNGLCREATESHADERPROC) GetProcedure("glCreateShader", offscreen);
+    glShaderSource = (PFNGLSHADERSOURCEPROC) GetProcedure("glShaderSource", offscreen);
+    glCompileShader = (PFNGLCOMPILESHADERPROC) GetProcedure("glCompileShader", offscreen);
+    glGetShaderiv = (PFNGLGETSHADERIVPROC) GetProcedure("glGetShaderiv", offscreen);
+    glGetShaderInfoLog = (PFNGLGETSHADERINFOLOGPROC)
+      GetProcedure("glGetShaderInfoLog", offscreen);
+    glCreateProgram = (PFNGLCREATEPROGRAMPROC) GetProcedure("glCreateProgram", offscreen);
+    glAttachShader = (PFNGLATTACHSHADERPROC) GetProcedure("glAttachShader", offscreen);
+    glBindAttribLocation = (PFNGLBINDATTRIBLOCATIONPROC)
+      GetProcedure("glBindAttribLocation", offscreen);
+    glLinkProgram = (PFNGLLINKPROGRAMPROC) GetProcedure("glLinkProgram", offscreen);
+    glGetProgramiv = (PFNGLGETPROGRAMIVPROC) GetProcedure("glGetProgramiv", offscreen);
+    glGetProgramInfoLog = (PFNGLGETPROGRAMINFOLOGPROC)
+      GetProcedure("glGetProgramInfoLog", offscreen);
+    glUseProgram = (PFNGLUSEPROGRAMPROC) GetProcedure("glUseProgram", offscreen);
+    glGetUniformLocation = (PFNGLGETUNIFORMLOCATIONPROC)
+      GetProcedure("glGetUniformLocation", offscreen);
+    glUniform1iv = (PFNGLUNIFORM1IVPROC) GetProcedure("glUniform1iv", offscreen);
+    glVertexAttribPointer = (PFNGLVERTEXATTRIBPOINTERPROC)
+      GetProcedure("glVertexAttribPointer", offscreen);
+    glEnableVertexAttribArray = (PFNGLENABLEVERTEXATTRIBARRAYPROC)
+      GetProcedure("glEnableVertexAttribArray", offscreen);
+    glDisableVertexAttribArray = (PFNGLDISABLEVERTEXATTRIBARRAYPROC)
+      GetProcedure("glDisableVertexAttribArray", offscreen);
+    haveShaders = glCreateShader && glShaderSource && glCompileShader && glGetShaderiv &&
+      glGetShaderInfoLog && glCreateProgram && glAttachShader && glBindAttribLocation &&
+      glLinkProgram && glGetProgramiv && glGetProgramInfoLog && glUseProgram &&
+      glGetUniformLocation && glUniform1iv && glVertexAttribPointer &&
+      glEnableVertexAttribArray && glDisableVertexAttribArray;
+  }
+
+  if(GLVersionAtLeast(3, 3)) {
+    glDrawArraysInstanced = (PFNGLDRAWARRAYSINSTANCEDPROC)
+      GetProcedure("glDrawArraysInstanced", offscreen);
+    glDrawElementsInstanced = (PFNGLDRAWELEMENTSINSTANCEDPROC)
+      GetProcedure("glDrawElementsInstanced", offscreen);
+    glVertexAttribDivisor = (PFNGLVERTEXATTRIBDIVISORPROC)
+      GetProcedure("glVertexAttribDivisor", offscreen);
+    haveInstancing = haveBuffers && haveShaders &&
+      glDrawArraysInstanced && glDrawElementsInstanced && glVertexAttribDivisor;
+  }
+}
+
+procedure GetProcedure(char *name, int offscreen) {
+  if(offscreen) return (procedure) eglGetProcAddress(name);
+#ifdef FREEGLUT
+  return (procedure) glutGetProcAddress(name);
+#else
+  return NULL;
+#endif
+}
+
+int GLVersionAtLeast(int major, int minor) {
+  const char *version = (const char *) glGetString(GL_VERSION);
+  int haveMajor = 0, haveMinor = 0;
+
+  if(version == NULL || sscanf(version, "%d.%d", &haveMajor, &haveMinor) != 2) return 0;
+  return haveMajor > major || (haveMajor == major && haveMinor >= minor);
+}
+
+/* the whole name, not just the start of a longer one */
+int HaveExtension(char *name) {
+  const char *extensions = (const char *) glGetString(GL_EXTENSIONS);
+  const char *found;
+  int length = strlen(name);
+
+  for(found = extensions; found != NULL && (found = strstr(found, name)) != NULL;
+      found += length) {
+    if((found == extensions || found[-1] == ' ') &&
+       (found[length] == ' ' || found[length] == '\0')) return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,498 @@
+/*************************************************************************
+ * Structure-of-arrays store for a fleet of submarines, each with its   *
+ * own position, velocity, dive and turn. The rotation the dive and     *
+ * turn make is kept as the submarine's three axes, worked out once     *
+ * whenever they change, so pushing, colliding and drawing never need   *
+ * the trig. The first submarine is steered from the keyboard and swept *
+ * through the collision world. The rest steer themselves and are moved *
+ * a chunk at a time across the thread pool, 8 at a time (AVX2) or one  *
+ * at a time, kept in open water and out of a few boxes by the box      *
+ * round each hull                                                      *
+ *************************************************************************/
+
+/* the one steered from the keyboard */
+#define PLAYER_SUB 0
+/* submarines per chunk, a multiple of 8 so chunks start vector aligned */
+#define FLEET_GRAIN 1024
+#define FLEET_OBSTACLES 8
+#define FLEET_FAR 1e30
+/* submarines steering themselves pull out of a dive past this */
+#define FLEET_MAX_DIVE 30.0
+
+typedef struct {
+  float *x, *y, *z;
+  float *lastX, *lastY, *lastZ;
+  float *xVelocity, *yVelocity, *zVelocity;
+  float *dive, *turn;		/* degrees */
+  float *diveRate, *turnRate;	/* degrees a second each steers itself by */
+  float *thrust;		/* acceleration along its nose */
+  float *axes[3][3];		/* axes[j][k][i] is part k of submarine i's own axis j */
+  int count, size;
+  float middle[3], half[3];	/* the hull's box in its own coordinates */
+  float low[3], high[3];	/* open water the hull's box stays in */
+  float centreLow[3], centreHigh[3];	/* and the box's centre */
+  float obstacles[FLEET_OBSTACLES][2][3];	/* centre and half size of boxes kept out of */
+  int obstacleCount;
+} fleet;
+
+/* what every chunk of a step needs to know */
+typedef struct {
+  fleet *f;
+  int first;			/* the ones before are moved some other way */
+  float elapsed, resistance, bounce, clearance;
+} fleetStep;
+
+/* what every chunk of a snapshot needs to know */
+typedef struct {
+  fleet *f;
+  float alpha;			/* how far from the last step to this one */
+  float *matrices;
+} fleetPose;
+
+void InitFleet(fleet *, int, float[3], float[3]);
+void KeepFleetInWorld(fleet *, collisionWorld *);
+void AddFleetPlane(fleet *, float[3], float, int);
+void AddFleetObstacle(fleet *, float[3], float[3]);
+int AddSubmarine(fleet *, float, float, float, float, float);
+void OrientSubmarine(fleet *, int);
+void SubmarineAxes(fleet *, int, float[3][3]);
+void SubmarineBox(fleet *, int, orientedBox *);
+void AccelerateSubmarine(fleet *, int, float);
+void SaveFleetPositions(fleet *);
+void SaveFleetChunk(void *, int, int);
+void MoveFleet(fleet *, int, float, float, float, float);
+void MoveFleetChunk(void *, int, int);
+void MoveFleetScalar(fleetStep *, int, int);
+int MoveFleetAVX2(fleetStep *, int, int);
+void FleetMatrices(fleet *, float, float *);
+void FleetMatrixChunk(void *, int, int);
+
+/* room for size submarines with the hull's box from low to high */
+void InitFleet(fleet *f, int size, float hullLow[3], float hullHigh[3]) {
+  float *block;
+  int j, k;
+
+  /* one allocation, split into the separate arrays */
+  block = malloc(23 * (long) size * sizeof(float));
+  if(block == NULL) {
+    fprintf(stderr, "ERROR: Unable to allocate %d submarines\n", size);
+    exit(1);
+  }
+  f->x = block;
+  f->y = block + size;
+  f->z = block + 2*size;
+  f->lastX = block + 3*size;
+  f->lastY = block + 4*size;
+  f->lastZ = block + 5*size;
+  f->xVelocity = block + 6*size;
+  f->yVelocity = block + 7*size;
+  f->zVelocity = block + 8*size;
+  f->dive = block + 9*size;
+  f->turn = block + 10*size;
+  f->diveRate = block + 11*size;
+  f->turnRate = block + 12*size;
+  f->thrust = block + 13*size;
+  for(j = 0; j < 3; j++)
+    for(k = 0; k < 3; k++) f->axes[j][k] = block + (14 + 3*j + k) * size;
+  f->count = 0;
+  f->size = size;
+
+  for(k = 0; k < 3; k++) {
+    f->middle[k] = (hullLow[k] + hullHigh[k]) / 2;
+    f->half[k] = (hullHigh[k] - hullLow[k]) / 2;
+    f->low[k] = f->centreLow[k] = -FLEET_FAR;
+    f->high[k] = f->centreHigh[k] = FLEET_FAR;
+  }
+  f->obstacleCount = 0;
+  ChooseParticleKernel();
+}
+
+/* the planes and boxes of w, and one box round all its triangles, which
+   is close enough for something as compact as the aerator */
+void KeepFleetInWorld(fleet *f, collisionWorld *w) {
+  float low[3], high[3];
+  int i, k, triangles = 0;
+
+  for(k = 0; k < 3; k++) {
+    low[k] = FLEET_FAR;
+    high[k] = -FLEET_FAR;
+  }
+  for(i = 0; i < w->colliderCount; i++) {
+    switch(w->colliders[i].type) {
+    case COLLIDE_PLANE:
+      AddFleetPlane(f, w->colliders[i].normal, w->colliders[i].distance,
+		    w->colliders[i].centreOnly);
+      break;
+    case COLLIDE_BOX:
+      AddFleetObstacle(f, w->colliders[i].low, w->colliders[i].high);
+      break;
+    case COLLIDE_TRIANGLE:
+      for(k = 0; k < 3; k++) {
+	if(w->colliders[i].low[k] < low[k]) low[k] = w->colliders[i].low[k];
+	if(w->colliders[i].high[k] > high[k]) high[k] = w->colliders[i].high[k];
+      }
+      triangles++;
+      break;
+    }
+  }
+  if(triangles > 0) AddFleetObstacle(f, low, high);
+}
+
+/* normal . x >= distance is open water, as for AddPlaneCollider(), but
+   square to the axes */
+void AddFleetPlane(fleet *f, float normal[3], float distance, int centreOnly) {
+  int k;
+
+  for(k = 0; k < 3 && fabs(normal[k]) < 0.999; k++);
+  if(k == 3) {
+    fprintf(stderr, "WARNING: Fleet ignores a plane not square to the axes\n");
+    return;
+  }
+  if(normal[k] > 0.0) {
+    if(centreOnly) f->centreLow[k] = distance;
+    else f->low[k] = distance;
+  }
+  else {
+    if(centreOnly) f->centreHigh[k] = -distance;
+    else f->high[k] = -distance;
+  }
+}
+
+void AddFleetObstacle(fleet *f, float low[3], float high[3]) {
+  int k;
+
+  if(f->obstacleCount == FLEET_OBSTACLES) {
+    fprintf(stderr, "WARNING: More than %d fleet obstacles, ignoring the rest\n",
+	    FLEET_OBSTACLES);
+    return;
+  }
+  for(k = 0; k < 3; k++) {
+    f->obstacles[f->obstacleCount][0][k] = (low[k] + high[k]) / 2;
+    f->obstacles[f->obstacleCount][1][k] = (high[k] - low[k]) / 2;
+  }
+  f->obstacleCount++;
+}
+
+/* still, and not steering itself. Returns which it is, -1 if there is
+   no room left */
+int AddSubmarine(fleet *f, float x, float y, float z, float dive, float turn) {
+  int i = f->count;
+
+  if(i == f->size) return -1;
+  f->x[i] = f->lastX[i] = x;
+  f->y[i] = f->lastY[i] = y;
+  f->z[i] = f->lastZ[i] = z;
+  f->xVelocity[i] = f->yVelocity[i] = f->zVelocity[i] = 0.0;
+  f->dive[i] = dive;
+  f->turn[i] = turn;
+  f->diveRate[i] = f->turnRate[i] = 0.0;
+  f->thrust[i] = 0.0;
+  OrientSubmarine(f, i);
+  f->count++;
+  return i;
+}
+
+/* submarine i's axes from its dive and turn, dived then turned. Call
+   whenever either changes */
+void OrientSubmarine(fleet *f, int i) {
+  double dive = f->dive[i] * (PI/180), turn = f->turn[i] * (PI/180);
+
+  f->axes[0][0][i] = cos(dive) * cos(turn);
+  f->axes[0][1][i] = sin(dive);
+  f->axes[0][2][i] = -cos(dive) * sin(turn);
+  f->axes[1][0][i] = -sin(dive) * cos(turn);
+  f->axes[1][1][i] = cos(dive);
+  f->axes[1][2][i] = sin(dive) * sin(turn);
+  f->axes[2][0][i] = sin(turn);
+  f->axes[2][1][i] = 0.0;
+  f->axes[2][2][i] = cos(turn);
+}
+
+void SubmarineAxes(fleet *f, int i, float axes[3][3]) {
+  int j, k;
+
+  for(j = 0; j < 3; j++)
+    for(k = 0; k < 3; k++) axes[j][k] = f->axes[j][k][i];
+}
+
+/* submarine i's collision box where it is now */
+void SubmarineBox(fleet *f, int i, orientedBox *box) {
+  int j, k;
+
+  SubmarineAxes(f, i, box->axes);
+  box->centre[0] = f->x[i];
+  box->centre[1] = f->y[i];
+  box->centre[2] = f->z[i];
+  for(j = 0; j < 3; j++) {
+    box->half[j] = f->half[j];
+    for(k = 0; k < 3; k++) box->centre[k] += box->axes[j][k] * f->middle[j];
+  }
+}
+
+/* the nose is along its own -x */
+void AccelerateSubmarine(fleet *f, int i, float acceleration) {
+  f->xVelocity[i] -= acceleration * f->axes[0][0][i];
+  f->yVelocity[i] -= acceleration * f->axes[0][1][i];
+  f->zVelocity[i] -= acceleration * f->axes[0][2][i];
+}
+
+void SaveFleetPositions(fleet *f) {
+  ParallelFor(SaveFleetChunk, f, f->count, FLEET_GRAIN);
+}
+
+void SaveFleetChunk(void *data, int begin, int end) {
+  fleet *f = data;
+
+  memcpy(f->lastX + begin, f->x + begin, (end - begin) * sizeof(float));
+  memcpy(f->lastY + begin, f->y + begin, (end - begin) * sizeof(float));
+  memcpy(f->lastZ + begin, f->z + begin, (end - begin) * sizeof(float));
+}
+
+/* steer and move every submarine from first on, push them along their
+   noses by their thrust, slow them by the resistance of the water and
+   bounce them off anything they end up in. They are moved a step at a
+   time, not swept, which is fine at the speeds they cruise at */
+void MoveFleet(fleet *f, int first, float elapsed, float resistance, float bounce,
+	       float clearance) {
+  fleetStep s;
+
+  s.f = f;
+  s.first = first;
+  s.elapsed = elapsed;
+  s.resistance = resistance;
+  s.bounce = bounce;
+  s.clearance = clearance;
+  ParallelFor(MoveFleetChunk, &s, f->count, FLEET_GRAIN);
+}
+
+void MoveFleetChunk(void *data, int begin, int end) {
+  fleetStep *s = data;
+  fleet *f = s->f;
+  int i, done;
+
+  if(begin < s->first) begin = s->first;
+  if(begin >= end) return;
+
+  /* steering needs the trig, so one at a time */
+  for(i = begin; i < end; i++) {
+    if(f->diveRate[i] == 0.0 && f->turnRate[i] == 0.0) continue;
+    f->dive[i] += f->diveRate[i] * s->elapsed;
+    if(fabs(f->dive[i]) > FLEET_MAX_DIVE && f->dive[i] * f->diveRate[i] > 0.0)
+      f->diveRate[i] = -f->diveRate[i];
+    f->turn[i] += f->turnRate[i] * s->elapsed;
+    if(f->turn[i] > 360.0) f->turn[i] -= 360.0;
+    if(f->turn[i] < 0.0) f->turn[i] += 360.0;
+    OrientSubmarine(f, i);
+  }
+
+  done = begin;
+#ifdef PARTICLES_X86
+  /* no SSE2 version, as without blends it is mostly masking */
+  if(particleKernel == PARTICLES_AVX2) done = MoveFleetAVX2(s, begin, end);
+#endif
+  MoveFleetScalar(s, done, end);
+}
+
+void MoveFleetScalar(fleetStep *s, int begin, int end) {
+  fleet *f = s->f;
+  float a[3][3], position[3], velocity[3], centre[3], reach[3], d[3], depth[3];
+  float thrust, low, high, push, sign;
+  int i, j, k, o;
+
+  for(i = begin; i < end; i++) {
+    SubmarineAxes(f, i, a);
+    position[0] = f->x[i];
+    position[1] = f->y[i];
+    position[2] = f->z[i];
+    velocity[0] = f->xVelocity[i];
+    velocity[1] = f->yVelocity[i];
+    velocity[2] = f->zVelocity[i];
+    thrust = f->thrust[i] * s->elapsed;
+
+    /* the world box round the hull once it has moved */
+    for(k = 0; k < 3; k++) {
+      velocity[k] -= thrust * a[0][k];
+      position[k] += velocity[k] * s->elapsed;
+      centre[k] = position[k];
+      reach[k] = 0.0;
+      for(j = 0; j < 3; j++) {
+	centre[k] += a[j][k] * f->middle[j];
+	reach[k] += (float) fabs(a[j][k]) * f->half[j];
+      }
+    }
+
+    /* back into open water */
+    for(k = 0; k < 3; k++) {
+      low = f->low[k] + reach[k];
+      if(f->centreLow[k] > low) low = f->centreLow[k];
+      high = f->high[k] - reach[k];
+      if(f->centreHigh[k] < high) high = f->centreHigh[k];
+      if(centre[k] < low) {
+	push = low - centre[k] + s->clearance;
+	position[k] += push;
+	centre[k] += push;
+	if(velocity[k] < 0.0) velocity[k] *= -s->bounce;
+      }
+      if(centre[k] > high) {
+	push = centre[k] - high + s->clearance;
+	position[k] -= push;
+	centre[k] -= push;
+	if(velocity[k] > 0.0) velocity[k] *= -s->bounce;
+      }
+    }
+
+    /* and out of each box the shortest way */
+    for(o = 0; o < f->obstacleCount; o++) {
+      for(k = 0; k < 3; k++) {
+	d[k] = centre[k] - f->obstacles[o][0][k];
+	depth[k] = reach[k] + f->obstacles[o][1][k] - (float) fabs(d[k]);
+      }
+      if(depth[0] <= 0.0 || depth[1] <= 0.0 || depth[2] <= 0.0) continue;
+      k = depth[0] <= depth[1] && depth[0] <= depth[2] ? 0 : depth[1] <= depth[2] ? 1 : 2;
+      sign = d[k] < 0.0 ? -1.0 : 1.0;
+      push = sign * (depth[k] + s->clearance);
+      position[k] += push;
+      centre[k] += push;
+      if(velocity[k] * sign < 0.0) velocity[k] *= -s->bounce;
+    }
+
+    /* water resistance */
+    for(k = 0; k < 3; k++) velocity[k] -= s->resistance * s->elapsed * velocity[k];
+
+    f->x[i] = position[0];
+    f->y[i] = position[1];
+    f->z[i] = position[2];
+    f->xVelocity[i] = velocity[0];
+    f->yVelocity[i] = velocity[1];
+    f->zVelocity[i] = velocity[2];
+  }
+}
+
+#ifdef PARTICLES_X86
+/* same as the scalar loop, returns where it got up to */
+__attribute__((target("avx2")))
+int MoveFleetAVX2(fleetStep *s, int begin, int end) {
+  fleet *f = s->f;
+  __m256 dt = _mm256_set1_ps(s->elapsed);
+  __m256 damping = _mm256_set1_ps(s->resistance * s->elapsed);
+  __m256 rebound = _mm256_set1_ps(-s->bounce);
+  __m256 clearance = _mm256_set1_ps(s->clearance);
+  __m256 zero = _mm256_setzero_ps();
+  __m256 one = _mm256_set1_ps(1.0f);
+  __m256 minusOne = _mm256_set1_ps(-1.0f);
+  __m256 signBit = _mm256_set1_ps(-0.0f);
+  __m256 a[3][3], position[3], velocity[3], centre[3], reach[3], d[3], depth[3], pick[3];
+  __m256 thrust, limit, hit, push, sign;
+  int i, j, k, o;
+
+  for(i = begin; i + 8 <= end; i += 8) {
+    for(j = 0; j < 3; j++)
+      for(k = 0; k < 3; k++) a[j][k] = _mm256_loadu_ps(f->axes[j][k] + i);
+    position[0] = _mm256_loadu_ps(f->x + i);
+    position[1] = _mm256_loadu_ps(f->y + i);
+    position[2] = _mm256_loadu_ps(f->z + i);
+    velocity[0] = _mm256_loadu_ps(f->xVelocity + i);
+    velocity[1] = _mm256_loadu_ps(f->yVelocity + i);
+    velocity[2] = _mm256_loadu_ps(f->zVelocity + i);
+    thrust = _mm256_mul_ps(_mm256_loadu_ps(f->thrust + i), dt);
+
+    for(k = 0; k < 3; k++) {
+      velocity[k] = _mm256_sub_ps(velocity[k], _mm256_mul_ps(thrust, a[0][k]));
+      position[k] = _mm256_add_ps(position[k], _mm256_mul_ps(velocity[k], dt));
+      centre[k] = position[k];
+      reach[k] = zero;
+      for(j = 0; j < 3; j++) {
+	centre[k] = _mm256_add_ps(centre[k], _mm256_mul_ps(a[j][k], _mm256_set1_ps(f->middle[j])));
+	reach[k] = _mm256_add_ps(reach[k], _mm256_mul_ps(_mm256_andnot_ps(signBit, a[j][k]),
+							 _mm256_set1_ps(f->half[j])));
+      }
+    }
+
+    for(k = 0; k < 3; k++) {
+      limit = _mm256_max_ps(_mm256_add_ps(_mm256_set1_ps(f->low[k]), reach[k]),
+			    _mm256_set1_ps(f->centreLow[k]));
+      hit = _mm256_cmp_ps(centre[k], limit, _CMP_LT_OQ);
+      push = _mm256_and_ps(hit, _mm256_add_ps(_mm256_sub_ps(limit, centre[k]), clearance));
+      position[k] = _mm256_add_ps(position[k], push);
+      centre[k] = _mm256_add_ps(centre[k], push);
+      hit = _mm256_and_ps(hit, _mm256_cmp_ps(velocity[k], zero, _CMP_LT_OQ));
+      velocity[k] = _mm256_blendv_ps(velocity[k], _mm256_mul_ps(velocity[k], rebound), hit);
+
+      limit = _mm256_min_ps(_mm256_sub_ps(_mm256_set1_ps(f->high[k]), reach[k]),
+			    _mm256_set1_ps(f->centreHigh[k]));
+      hit = _mm256_cmp_ps(centre[k], limit, _CMP_GT_OQ);
+      push = _mm256_and_ps(hit, _mm256_add_ps(_mm256_sub_ps(centre[k], limit), clearance));
+      position[k] = _mm256_sub_ps(position[k], push);
+      centre[k] = _mm256_sub_ps(centre[k], push);
+      hit = _mm256_and_ps(hit, _mm256_cmp_ps(velocity[k], zero, _CMP_GT_OQ));
+      velocity[k] = _mm256_blendv_ps(velocity[k], _mm256_mul_ps(velocity[k], rebound), hit);
+    }
+
+    for(o = 0; o < f->obstacleCount; o++) {
+      for(k = 0; k < 3; k++) {
+	d[k] = _mm256_sub_ps(centre[k], _mm256_set1_ps(f->obstacles[o][0][k]));
+	depth[k] = _mm256_sub_ps(_mm256_add_ps(reach[k], _mm256_set1_ps(f->obstacles[o][1][k])),
+				 _mm256_andnot_ps(signBit, d[k]));
+      }
+      hit = _mm256_and_ps(_mm256_cmp_ps(depth[0], zero, _CMP_GT_OQ),
+			  _mm256_and_ps(_mm256_cmp_ps(depth[1], zero, _CMP_GT_OQ),
+					_mm256_cmp_ps(depth[2], zero, _CMP_GT_OQ)));
+      if(_mm256_movemask_ps(hit) == 0) continue;
+      /* the shallowest axis, the first of any equal */
+      pick[0] = _mm256_and_ps(_mm256_cmp_ps(depth[0], depth[1], _CMP_LE_OQ),
+			      _mm256_cmp_ps(depth[0], depth[2], _CMP_LE_OQ));
+      pick[1] = _mm256_andnot_ps(pick[0], _mm256_cmp_ps(depth[1], depth[2], _CMP_LE_OQ));
+      pick[2] = _mm256_andnot_ps(_mm256_or_ps(pick[0], pick[1]), hit);
+      pick[0] = _mm256_and_ps(pick[0], hit);
+      pick[1] = _mm256_and_ps(pick[1], hit);
+      for(k = 0; k < 3; k++) {
+	sign = _mm256_blendv_ps(one, minusOne, _mm256_cmp_ps(d[k], zero, _CMP_LT_OQ));
+	push = _mm256_and_ps(pick[k], _mm256_mul_ps(sign, _mm256_add_ps(depth[k], clearance)));
+	position[k] = _mm256_add_ps(position[k], push);
+	centre[k] = _mm256_add_ps(centre[k], push);
+	hit = _mm256_and_ps(pick[k], _mm256_cmp_ps(_mm256_mul_ps(velocity[k], sign), zero,
+						   _CMP_LT_OQ));
+	velocity[k] = _mm256_blendv_ps(velocity[k], _mm256_mul_ps(velocity[k], rebound), hit);
+      }
+    }
+
+    for(k = 0; k < 3; k++)
+      velocity[k] = _mm256_sub_ps(velocity[k], _mm256_mul_ps(damping, velocity[k]));
+
+    _mm256_storeu_ps(f->x + i, position[0]);
+    _mm256_storeu_ps(f->y + i, position[1]);
+    _mm256_storeu_ps(f->z + i, position[2]);
+    _mm256_storeu_ps(f->xVelocity + i, velocity[0]);
+    _mm256_storeu_ps(f->yVelocity + i, velocity[1]);
+    _mm256_storeu_ps(f->zVelocity + i, velocity[2]);
+  }
+  return i;
+}
+#endif
+
+/* each submarine as the top three rows of its matrix, 12 floats, at
+   alpha of the way from the last step to this one */
+void FleetMatrices(fleet *f, float alpha, float *matrices) {
+  fleetPose p;
+
+  p.f = f;
+  p.alpha = alpha;
+  p.matrices = matrices;
+  ParallelFor(FleetMatrixChunk, &p, f->count, FLEET_GRAIN);
+}
+
+void FleetMatrixChunk(void *data, int begin, int end) {
+  fleetPose *p = data;
+  fleet *f = p->f;
+  float *m;
+  int i, j, k;
+
+  for(i = begin; i < end; i++) {
+    m = p->matrices + 12 * i;
+    for(k = 0; k < 3; k++)
+      for(j = 0; j < 3; j++) m[4*k+j] = f->axes[j][k][i];
+    m[3] = f->lastX[i] + (f->x[i] - f->lastX[i]) * p->alpha;
+    m[7] = f->lastY[i] + (f->y[i] - f->lastY[i]) * p->alpha;
+    m[11] = f->lastZ[i] + (f->z[i] - f->lastZ[i]) * p->alpha;
+  }
+}
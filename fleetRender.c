@@ -0,0 +1,217 @@
+/*************************************************************************
+ * Draws a whole fleet from the one submarine mesh: the submarines in   *
+ * view are sorted by level of detail and their matrices streamed to a  *
+ * buffer, then each part of each level is drawn once, instanced at     *
+ * every submarine at that level. Without instancing it falls back to a *
+ * draw of each part for each submarine                                 *
+ *************************************************************************/
+
+/* and the two after, a row of the matrix each */
+#define FLEET_ROW_ATTRIBUTE 3
+
+GLuint fleetInstanceBuffer = 0;
+GLuint fleetProgram = 0;
+GLint fleetLightsUniform = -1;
+/* the level each submarine was last drawn at, -1 for none yet */
+int *fleetLevels = NULL;
+int fleetLevelSize = 0;
+
+void InitFleetRenderer(void);
+GLuint BuildFleetProgram(void);
+float *VisibleFleet(frameArena *, float *, int, int, lodMesh *, int[LOD_LEVELS]);
+void DrawFleetInstances(lodMesh *, float *, int[LOD_LEVELS]);
+void SetFleetRows(int);
+void InstanceModelview(GLfloat *, float *, GLfloat[16]);
+
+/* instanced submarine vertex shader, each turned and moved by the three
+   rows of its matrix */
+const char *fleetVertexShader[] = {
+  "#version 120\n"
+  "attribute vec4 row0, row1, row2;\n"
+  "uniform int lightOn[7];\n"
+  "varying vec4 colour;\n"
+  "void main() {\n"
+  "  vec4 world = vec4(dot(row0, gl_Vertex), dot(row1, gl_Vertex), dot(row2, gl_Vertex), 1.0);\n"
+  "  vec3 turned = vec3(dot(row0.xyz, gl_Normal), dot(row1.xyz, gl_Normal),\n"
+  "                     dot(row2.xyz, gl_Normal));\n"
+  "  vec4 eye = gl_ModelViewMatrix * world;\n"
+  "  vec3 normal = normalize(gl_NormalMatrix * turned);\n",
+  SHADER_LIGHTING
+};
+
+void InitFleetRenderer(void) {
+  if(!haveInstancing) return;
+  glGenBuffers(1, &fleetInstanceBuffer);
+  fleetProgram = BuildFleetProgram();
+}
+
+GLuint BuildFleetProgram(void) {
+  GLuint program;
+  GLint linked;
+  char log[1024];
+
+  program = glCreateProgram();
+  glAttachShader(program, CompileShader(GL_VERTEX_SHADER, fleetVertexShader,
+					sizeof(fleetVertexShader) / sizeof(char *)));
+  glAttachShader(program, CompileShader(GL_FRAGMENT_SHADER, bubbleFragmentShader,
+					sizeof(bubbleFragmentShader) / sizeof(char *)));
+  glBindAttribLocation(program, FLEET_ROW_ATTRIBUTE, "row0");
+  glBindAttribLocation(program, FLEET_ROW_ATTRIBUTE + 1, "row1");
+  glBindAttribLocation(program, FLEET_ROW_ATTRIBUTE + 2, "row2");
+  glLinkProgram(program);
+  glGetProgramiv(program, GL_LINK_STATUS, &linked);
+  if(!linked) {
+    glGetProgramInfoLog(program, sizeof(log), NULL, log);
+    fprintf(stderr, "WARNING: Fleet shader did not link, not instancing\n%s\n", log);
+    return 0;
+  }
+  fleetLightsUniform = glGetUniformLocation(program, "lightOn");
+  return program;
+}
+
+/* the 12 float matrices of those in view, but not skip, copied into the
+   arena in order of their level in the world view, with how many are at
+   each. Each keeps its level from one frame to the next, like any other
+   copy of a lodMesh */
+float *VisibleFleet(frameArena *a, float *matrices, int count, int skip, lodMesh *l,
+		    int counts[LOD_LEVELS]) {
+  unsigned char *levels = ArenaAlloc(a, count + 1);
+  float *sorted = ArenaAlloc(a, count * 12 * sizeof(float) + 1);
+  GLfloat centre[3];
+  float *m;
+  int next[LOD_LEVELS];
+  int i, k, sum;
+
+  if(count > fleetLevelSize) {
+    fleetLevels = realloc(fleetLevels, count * sizeof(int));
+    if(fleetLevels == NULL) {
+      fprintf(stderr, "ERROR: Unable to allocate levels of %d submarines\n", count);
+      exit(1);
+    }
+    for(i = fleetLevelSize; i < count; i++) fleetLevels[i] = -1;
+    fleetLevelSize = count;
+  }
+
+  memset(counts, 0, LOD_LEVELS * sizeof(int));
+  for(i = 0; i < count; i++) {
+    levels[i] = LOD_LEVELS;
+    if(i == skip) continue;
+    m = matrices + 12 * i;
+    for(k = 0; k < 3; k++)
+      centre[k] = m[4*k] * l->centre[0] + m[4*k+1] * l->centre[1] + m[4*k+2] * l->centre[2] +
+	m[4*k+3];
+    if(culling && SphereInFrustum(&viewFrustum, centre, l->radius) == CULL_OUTSIDE) {
+      cullCount.subsCulled++;
+      continue;
+    }
+    cullCount.subsVisible++;
+    if(fixedLevel >= 0) fleetLevels[i] = fixedLevel < LOD_LEVELS ? fixedLevel : LOD_LEVELS - 1;
+    else fleetLevels[i] = ChooseLevel(l->segments, fleetLevels[i],
+				      ProjectedSize(viewMatrix, centre, l->radius));
+    levels[i] = fleetLevels[i];
+    counts[levels[i]]++;
+  }
+  for(sum = 0, i = 0; i < LOD_LEVELS; i++) {
+    next[i] = sum;
+    sum += counts[i];
+    meshesAtLevel[i] += counts[i];
+  }
+  for(i = 0; i < count; i++)
+    if(levels[i] < LOD_LEVELS)
+      memcpy(sorted + 12 * next[levels[i]]++, matrices + 12 * i, 12 * sizeof(float));
+  return sorted;
+}
+
+/* the matrices in order of level of detail, counts[level] at each, drawn
+   with the world matrix current */
+void DrawFleetInstances(lodMesh *l, float *matrices, int counts[LOD_LEVELS]) {
+  GLint lightOn[BUBBLE_LIGHTS];
+  GLfloat modelview[16];
+  material *current = NULL, *mat;
+  meshPart *part;
+  mesh *m;
+  int i, j, level, first, count = 0;
+
+  for(level = 0; level < LOD_LEVELS; level++) count += counts[level];
+  if(count == 0) return;
+
+  if(fleetProgram) {
+    glBindBuffer(GL_ARRAY_BUFFER, fleetInstanceBuffer);
+    /* orphan last frame's storage rather than wait for it */
+    glBufferData(GL_ARRAY_BUFFER, count * 12 * sizeof(float), NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, count * 12 * sizeof(float), matrices);
+    for(i = 0; i < BUBBLE_LIGHTS; i++) lightOn[i] = StateEnabled(GL_LIGHT0 + i);
+    glUseProgram(fleetProgram);
+    glUniform1iv(fleetLightsUniform, BUBBLE_LIGHTS, lightOn);
+  }
+
+  for(first = 0, level = 0; level < LOD_LEVELS; first += counts[level++]) {
+    if(counts[level] == 0) continue;
+    m = &l->levels[level];
+    SwitchMesh(NULL, m);
+    if(fleetProgram) SetFleetRows(first);
+    for(part = m->parts; part < m->parts + m->partCount; part++) {
+      if(part->count == 0) continue;
+      mat = &materials[part->material];
+      ApplyMaterial(mat, current);
+      current = mat;
+      if(fleetProgram) {
+	/* every submarine at this level in one draw */
+	glDrawElementsInstanced(part->mode, part->count, m->indexType,
+				(char *) NULL + (long) part->first * m->indexBytes, counts[level]);
+	continue;
+      }
+      for(j = first; j < first + counts[level]; j++) {
+	InstanceModelview(viewMatrix, matrices + 12 * j, modelview);
+	glPushMatrix();
+	  glLoadMatrixf(modelview);
+	  DrawMeshPart(m, part);
+	glPopMatrix();
+      }
+    }
+    if(fleetProgram) {
+      for(i = 0; i < 3; i++) {
+	glDisableVertexAttribArray(FLEET_ROW_ATTRIBUTE + i);
+	glVertexAttribDivisor(FLEET_ROW_ATTRIBUTE + i, 0);
+      }
+    }
+    SwitchMesh(m, NULL);
+  }
+
+  if(fleetProgram) {
+    glUseProgram(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+  /* as the rest of the drawing expects */
+  if(current != NULL && current->texture != NULL) StateEnable(GL_TEXTURE_2D, 0);
+  if(current != NULL && current->twoSided) StateLightModeli(GL_LIGHT_MODEL_TWO_SIDE, GL_FALSE);
+}
+
+/* the rows of each matrix from first on, one submarine at a time */
+void SetFleetRows(int first) {
+  int i;
+
+  glBindBuffer(GL_ARRAY_BUFFER, fleetInstanceBuffer);
+  for(i = 0; i < 3; i++) {
+    glVertexAttribPointer(FLEET_ROW_ATTRIBUTE + i, 4, GL_FLOAT, GL_FALSE, 12 * sizeof(float),
+			  (char *) NULL + (first * 12 + 4 * i) * sizeof(float));
+    glVertexAttribDivisor(FLEET_ROW_ATTRIBUTE + i, 1);
+    glEnableVertexAttribArray(FLEET_ROW_ATTRIBUTE + i);
+  }
+}
+
+/* view times the matrix whose top three rows are rows */
+void InstanceModelview(GLfloat *view, float *rows, GLfloat result[16]) {
+  GLfloat column[4];
+  int i, j;
+
+  for(j = 0; j < 4; j++) {
+    column[0] = rows[j];
+    column[1] = rows[4+j];
+    column[2] = rows[8+j];
+    column[3] = j == 3 ? 1.0 : 0.0;
+    for(i = 0; i < 4; i++)
+      result[4*j+i] = view[i] * column[0] + view[4+i] * column[1] + view[8+i] * column[2] +
+	view[12+i] * column[3];
+  }
+}
@@ -0,0 +1,515 @@
+/*************************************************************************
+ * A coarse grid of the water's velocity over the tank, stirred by the  *
+ * submarines and the bubble emitters, that carries the bubbles along.  *
+ * Stable fluids (Stam 1999): each step the velocity is carried along   *
+ * by itself, tracing each cell back and interpolating where it came    *
+ * from, then the divergence is taken out by solving for the pressure   *
+ * with Jacobi iterations. Every pass is split into slices across the   *
+ * thread pool, with AVX2 for the tracing, the pressure and the drag on *
+ * the bubbles and scalar loops for other CPUs and the leftovers. The   *
+ * pressure solve takes a fixed number of iterations so a run repeats.  *
+ * Given a time budget it stops early once the step has used it up, so  *
+ * a fine grid can't hold up the frame, at the cost of the repeats and  *
+ * a little divergence left in the water. A layer of cells round the    *
+ * outside mirrors the one inside it so the walls let nothing through.  *
+ * The shelf and the aerator aren't in the grid and the water goes      *
+ * straight through them                                                *
+ *************************************************************************/
+
+/* along the tank's longest side */
+#define FLUID_CELLS 24
+/* pressure iterations a step at most, and at least however long they take */
+#define FLUID_ITERATIONS 40
+#define FLUID_MIN_ITERATIONS 4
+/* milliseconds a step, 0 for no limit so runs repeat */
+#define FLUID_BUDGET 0.0
+/* how quickly the water slows by itself, per second */
+#define FLUID_DECAY 0.5
+
+typedef struct {
+  int n[3];			/* cells inside along each axis, with one more either side */
+  int sx, sxy;			/* how far apart neighbours in y and z are */
+  float low[3];			/* the corner of the first cell inside */
+  float cell, inverse;		/* inverse is 1 / cell */
+  float *velocity[3], *traced[3];
+  float *pressure, *solving, *divergence;
+  double budget;		/* seconds a step, 0 for none */
+  /* since the start */
+  int steps, iterations, cutShort;
+  double time;
+} fluidGrid;
+
+/* what every chunk of a pass needs to know */
+typedef struct {
+  fluidGrid *f;
+  float elapsed;
+  float *from, *to;		/* the pressure, being solved */
+  particles *p;			/* being dragged along */
+  float rate;
+} fluidPass;
+
+void InitFluid(fluidGrid *, collisionWorld *, int, double);
+void StirFluid(fluidGrid *, float[3], float[3], float[3], float);
+void StepFluid(fluidGrid *, float);
+void MirrorVelocity(fluidGrid *);
+void TraceFluidChunk(void *, int, int);
+void TraceRowScalar(fluidGrid *, int, int, int, float);
+int TraceRowAVX2(fluidGrid *, int, int, float);
+void DivergenceChunk(void *, int, int);
+void PressureChunk(void *, int, int);
+void PressureRowScalar(fluidGrid *, float *, float *, long, int);
+int PressureRowAVX2(fluidGrid *, float *, float *, long);
+void ProjectChunk(void *, int, int);
+void SampleVelocity(fluidGrid *, float[3], float[3]);
+void DragParticles(fluidGrid *, particles *, float);
+void DragParticleChunk(void *, int, int);
+void DragParticlesScalar(fluidPass *, int, int);
+int DragParticlesAVX2(fluidPass *, int, int);
+#ifdef PARTICLES_X86
+void SampleVelocityAVX2(fluidGrid *, __m256[3], __m256[3]);
+#endif
+void ReportFluid(fluidGrid *);
+
+/* still water filling the box the world's planes close in, cells across
+   its longest side, budget in milliseconds */
+void InitFluid(fluidGrid *f, collisionWorld *w, int cells, double budget) {
+  float low[3], high[3], longest = 0.0;
+  float *block;
+  long total;
+  int k;
+
+  if(!WaterBounds(w, low, high)) {
+    fprintf(stderr, "ERROR: Water velocity needs the water closed in by planes along every axis\n");
+    exit(1);
+  }
+  for(k = 0; k < 3; k++)
+    if(high[k] - low[k] > longest) longest = high[k] - low[k];
+  f->cell = longest / cells;
+  f->inverse = 1.0 / f->cell;
+  /* centred on the water, at least two cells across to interpolate between */
+  for(k = 0; k < 3; k++) {
+    f->n[k] = (int) ceil((high[k] - low[k]) * f->inverse - 1e-3);
+    if(f->n[k] < 2) f->n[k] = 2;
+    f->low[k] = (low[k] + high[k] - f->n[k] * f->cell) / 2;
+  }
+  f->sx = f->n[0] + 2;
+  f->sxy = f->sx * (f->n[1] + 2);
+  total = (long) f->sxy * (f->n[2] + 2);
+
+  /* one allocation, split into the separate arrays */
+  block = calloc(9 * total, sizeof(float));
+  if(block == NULL) {
+    fprintf(stderr, "ERROR: Unable to allocate %dx%dx%d water velocity cells\n",
+	    f->n[0], f->n[1], f->n[2]);
+    exit(1);
+  }
+  for(k = 0; k < 3; k++) {
+    f->velocity[k] = block + k * total;
+    f->traced[k] = block + (3 + k) * total;
+  }
+  f->pressure = block + 6 * total;
+  f->solving = block + 7 * total;
+  f->divergence = block + 8 * total;
+  f->budget = budget / 1000.0;
+  f->steps = f->iterations = f->cutShort = 0;
+  f->time = 0.0;
+}
+
+/* the water in every cell that overlaps low to high takes up rate of the
+   difference from velocity */
+void StirFluid(fluidGrid *f, float low[3], float high[3], float velocity[3], float rate) {
+  int first[3], last[3], i, j, k, c;
+  float *v;
+
+  if(rate > 1.0) rate = 1.0;
+  for(k = 0; k < 3; k++) {
+    first[k] = (int) floor((low[k] - f->low[k]) * f->inverse) + 1;
+    last[k] = (int) floor((high[k] - f->low[k]) * f->inverse) + 1;
+    if(first[k] < 1) first[k] = 1;
+    if(last[k] > f->n[k]) last[k] = f->n[k];
+  }
+  for(c = 0; c < 3; c++)
+    for(k = first[2]; k <= last[2]; k++)
+      for(j = first[1]; j <= last[1]; j++)
+	for(v = f->velocity[c] + first[0] + f->sx * j + f->sxy * k,
+	      i = first[0]; i <= last[0]; i++, v++)
+	  *v += (velocity[c] - *v) * rate;
+}
+
+/* carry the water along by itself, then take out what would squash it */
+void StepFluid(fluidGrid *f, float elapsed) {
+  fluidPass pass;
+  double start = Now();
+  float *swap;
+  int c, iteration;
+
+  PROFILE_BEGIN("StepFluid");
+  pass.f = f;
+  pass.elapsed = elapsed;
+  ParallelFor(TraceFluidChunk, &pass, f->n[2], 1);
+  for(c = 0; c < 3; c++) {
+    swap = f->velocity[c];
+    f->velocity[c] = f->traced[c];
+    f->traced[c] = swap;
+  }
+  MirrorVelocity(f);
+  ParallelFor(DivergenceChunk, &pass, f->n[2], 1);
+
+  /* from last step's pressure, which is most of the way there already */
+  for(iteration = 0; iteration < FLUID_ITERATIONS; iteration++) {
+    if(iteration >= FLUID_MIN_ITERATIONS && f->budget > 0.0 && Now() - start > f->budget) {
+      f->cutShort++;
+      break;
+    }
+    pass.from = f->pressure;
+    pass.to = f->solving;
+    ParallelFor(PressureChunk, &pass, f->n[2], 1);
+    f->solving = f->pressure;
+    f->pressure = pass.to;
+  }
+  ParallelFor(ProjectChunk, &pass, f->n[2], 1);
+  MirrorVelocity(f);
+
+  f->steps++;
+  f->iterations += iteration;
+  f->time += Now() - start;
+  PROFILE_END();
+}
+
+/* the layer outside each wall the same as the one inside, but going the
+   other way through it, so nothing crosses the wall */
+void MirrorVelocity(fluidGrid *f) {
+  int wall[3][2], step[3], i, j, k, c, side, a, b;
+  long inside, outside;
+
+  step[0] = 1;
+  step[1] = f->sx;
+  step[2] = f->sxy;
+  for(k = 0; k < 3; k++) {
+    wall[k][0] = 0;
+    wall[k][1] = f->n[k] + 1;
+  }
+  for(k = 0; k < 3; k++) {
+    /* the other two axes, along the wall */
+    a = (k + 1) % 3;
+    b = (k + 2) % 3;
+    for(side = 0; side < 2; side++)
+      for(i = 1; i <= f->n[a]; i++)
+	for(j = 1; j <= f->n[b]; j++) {
+	  outside = (long) wall[k][side] * step[k] + (long) i * step[a] + (long) j * step[b];
+	  inside = outside + (side == 0 ? step[k] : -step[k]);
+	  for(c = 0; c < 3; c++)
+	    f->velocity[c][outside] = c == k ? -f->velocity[c][inside] : f->velocity[c][inside];
+	}
+  }
+}
+
+/* slices begin to end-1 of the cells inside, each taking the velocity from
+   where the water in it was a step ago */
+void TraceFluidChunk(void *data, int begin, int end) {
+  fluidPass *pass = data;
+  fluidGrid *f = pass->f;
+  int j, k, done;
+
+  for(k = begin + 1; k <= end; k++)
+    for(j = 1; j <= f->n[1]; j++) {
+      done = 1;
+#ifdef PARTICLES_X86
+      if(particleKernel == PARTICLES_AVX2) done = TraceRowAVX2(f, j, k, pass->elapsed);
+#endif
+      TraceRowScalar(f, done, j, k, pass->elapsed);
+    }
+}
+
+/* cells first to the end of row j of slice k */
+void TraceRowScalar(fluidGrid *f, int first, int j, int k, float elapsed) {
+  float back = elapsed * f->inverse, from[3], velocity[3];
+  long cell;
+  int i, c;
+
+  for(i = first; i <= f->n[0]; i++) {
+    cell = i + (long) f->sx * j + (long) f->sxy * k;
+    from[0] = i - back * f->velocity[0][cell];
+    from[1] = j - back * f->velocity[1][cell];
+    from[2] = k - back * f->velocity[2][cell];
+    SampleVelocity(f, from, velocity);
+    for(c = 0; c < 3; c++) f->traced[c][cell] = velocity[c];
+  }
+}
+
+/* in cells, where a whole number is the middle of that cell, clamped to
+   the middles of the cells inside so only they are interpolated between */
+void SampleVelocity(fluidGrid *f, float at[3], float velocity[3]) {
+  float t[3], g, c00, c10, c01, c11, c0, c1;
+  float *v;
+  long cell;
+  int i[3], c, k;
+
+  for(k = 0; k < 3; k++) {
+    g = at[k];
+    if(g < 1.0f) g = 1.0f;
+    if(g > f->n[k]) g = f->n[k];
+    i[k] = (int) g;
+    if(i[k] > f->n[k] - 1) i[k] = f->n[k] - 1;
+    t[k] = g - i[k];
+  }
+  cell = i[0] + (long) f->sx * i[1] + (long) f->sxy * i[2];
+  for(c = 0; c < 3; c++) {
+    v = f->velocity[c] + cell;
+    c00 = v[0] + t[0] * (v[1] - v[0]);
+    c10 = v[f->sx] + t[0] * (v[f->sx + 1] - v[f->sx]);
+    c01 = v[f->sxy] + t[0] * (v[f->sxy + 1] - v[f->sxy]);
+    c11 = v[f->sxy + f->sx] + t[0] * (v[f->sxy + f->sx + 1] - v[f->sxy + f->sx]);
+    c0 = c00 + t[1] * (c10 - c00);
+    c1 = c01 + t[1] * (c11 - c01);
+    velocity[c] = c0 + t[2] * (c1 - c0);
+  }
+}
+
+/* kept scaled for the pressure solve: what it adds to each cell's six
+   neighbours to balance them, once a step so it has no kernel of its own */
+void DivergenceChunk(void *data, int begin, int end) {
+  fluidPass *pass = data;
+  fluidGrid *f = pass->f;
+  float scale = -0.5 * f->cell;
+  long cell;
+  int i, j, k;
+
+  for(k = begin + 1; k <= end; k++)
+    for(j = 1; j <= f->n[1]; j++)
+      for(i = 1; i <= f->n[0]; i++) {
+	cell = i + (long) f->sx * j + (long) f->sxy * k;
+	f->divergence[cell] = scale *
+	  ((f->velocity[0][cell + 1] - f->velocity[0][cell - 1]) +
+	   (f->velocity[1][cell + f->sx] - f->velocity[1][cell - f->sx]) +
+	   (f->velocity[2][cell + f->sxy] - f->velocity[2][cell - f->sxy]));
+      }
+}
+
+/* one Jacobi iteration of slices begin to end-1, from pass->from to
+   pass->to, then the layer outside the walls the same as inside so the
+   pressure pushes nothing through them */
+void PressureChunk(void *data, int begin, int end) {
+  fluidPass *pass = data;
+  fluidGrid *f = pass->f;
+  float *to = pass->to;
+  long row, slice;
+  int i, j, k, done;
+
+  for(k = begin + 1; k <= end; k++) {
+    slice = (long) f->sxy * k;
+    for(j = 1; j <= f->n[1]; j++) {
+      row = slice + (long) f->sx * j;
+      done = 1;
+#ifdef PARTICLES_X86
+      if(particleKernel == PARTICLES_AVX2) done = PressureRowAVX2(f, pass->from, to, row);
+#endif
+      PressureRowScalar(f, pass->from, to, row, done);
+      to[row] = to[row + 1];
+      to[row + f->n[0] + 1] = to[row + f->n[0]];
+    }
+    for(i = 1; i <= f->n[0]; i++) {
+      to[slice + i] = to[slice + f->sx + i];
+      to[slice + (long) f->sx * (f->n[1] + 1) + i] = to[slice + (long) f->sx * f->n[1] + i];
+    }
+  }
+  /* the slices outside the ends, from the slices inside them */
+  if(begin == 0) memcpy(to, to + f->sxy, f->sxy * sizeof(float));
+  if(end == f->n[2])
+    memcpy(to + (long) f->sxy * (f->n[2] + 1), to + (long) f->sxy * f->n[2], f->sxy * sizeof(float));
+}
+
+/* cells first to the end of the row starting at row */
+void PressureRowScalar(fluidGrid *f, float *from, float *to, long row, int first) {
+  long cell;
+
+  for(cell = row + first; cell <= row + f->n[0]; cell++)
+    to[cell] = (from[cell - 1] + from[cell + 1] + from[cell - f->sx] + from[cell + f->sx] +
+		from[cell - f->sxy] + from[cell + f->sxy] + f->divergence[cell]) * (1.0f / 6.0f);
+}
+
+/* take the pressure's slope off the velocity, and let it slow a little */
+void ProjectChunk(void *data, int begin, int end) {
+  fluidPass *pass = data;
+  fluidGrid *f = pass->f;
+  float scale = 0.5 * f->inverse, keep = 1.0 - FLUID_DECAY * pass->elapsed;
+  float *p = f->pressure;
+  long cell;
+  int i, j, k;
+
+  for(k = begin + 1; k <= end; k++)
+    for(j = 1; j <= f->n[1]; j++)
+      for(i = 1; i <= f->n[0]; i++) {
+	cell = i + (long) f->sx * j + (long) f->sxy * k;
+	f->velocity[0][cell] = (f->velocity[0][cell] - scale * (p[cell + 1] - p[cell - 1])) * keep;
+	f->velocity[1][cell] = (f->velocity[1][cell] - scale * (p[cell + f->sx] - p[cell - f->sx])) *
+	  keep;
+	f->velocity[2][cell] = (f->velocity[2][cell] - scale * (p[cell + f->sxy] - p[cell - f->sxy])) *
+	  keep;
+      }
+}
+
+/* every particle takes up rate of the difference between its velocity
+   and the water's where it is */
+void DragParticles(fluidGrid *f, particles *p, float rate) {
+  fluidPass pass;
+
+  PROFILE_BEGIN("DragParticles");
+  pass.f = f;
+  pass.p = p;
+  pass.rate = rate > 1.0 ? 1.0 : rate;
+  ParallelFor(DragParticleChunk, &pass, p->count, PARTICLE_GRAIN);
+  PROFILE_END();
+}
+
+void DragParticleChunk(void *data, int begin, int end) {
+  fluidPass *pass = data;
+  int done = begin;
+
+#ifdef PARTICLES_X86
+  if(particleKernel == PARTICLES_AVX2) done = DragParticlesAVX2(pass, begin, end);
+#endif
+  DragParticlesScalar(pass, done, end);
+}
+
+void DragParticlesScalar(fluidPass *pass, int begin, int end) {
+  fluidGrid *f = pass->f;
+  particles *p = pass->p;
+  float at[3], water[3];
+  int i;
+
+  for(i = begin; i < end; i++) {
+    /* in cells, the middle of the first one inside being 1 */
+    at[0] = (p->x[i] - f->low[0]) * f->inverse + 0.5f;
+    at[1] = (p->y[i] - f->low[1]) * f->inverse + 0.5f;
+    at[2] = (p->z[i] - f->low[2]) * f->inverse + 0.5f;
+    SampleVelocity(f, at, water);
+    p->xVelocity[i] += (water[0] - p->xVelocity[i]) * pass->rate;
+    p->yVelocity[i] += (water[1] - p->yVelocity[i]) * pass->rate;
+    p->zVelocity[i] += (water[2] - p->zVelocity[i]) * pass->rate;
+  }
+}
+
+#ifdef PARTICLES_X86
+/* same as SampleVelocity(), 8 points at a time */
+__attribute__((target("avx2")))
+void SampleVelocityAVX2(fluidGrid *f, __m256 at[3], __m256 velocity[3]) {
+  __m256 g, t[3], corner[8], c00, c10, c01, c11, c0, c1;
+  __m256i i[3], cell, up, across, one = _mm256_set1_epi32(1);
+  __m256i sx = _mm256_set1_epi32(f->sx), sxy = _mm256_set1_epi32(f->sxy);
+  int c, k;
+
+  for(k = 0; k < 3; k++) {
+    g = _mm256_min_ps(_mm256_max_ps(at[k], _mm256_set1_ps(1.0f)), _mm256_set1_ps(f->n[k]));
+    i[k] = _mm256_min_epi32(_mm256_cvttps_epi32(g), _mm256_set1_epi32(f->n[k] - 1));
+    t[k] = _mm256_sub_ps(g, _mm256_cvtepi32_ps(i[k]));
+  }
+  cell = _mm256_add_epi32(i[0], _mm256_add_epi32(_mm256_mullo_epi32(i[1], sx),
+						 _mm256_mullo_epi32(i[2], sxy)));
+  up = _mm256_add_epi32(cell, sx);
+  across = _mm256_add_epi32(cell, sxy);
+  for(c = 0; c < 3; c++) {
+    corner[0] = _mm256_i32gather_ps(f->velocity[c], cell, 4);
+    corner[1] = _mm256_i32gather_ps(f->velocity[c], _mm256_add_epi32(cell, one), 4);
+    corner[2] = _mm256_i32gather_ps(f->velocity[c], up, 4);
+    corner[3] = _mm256_i32gather_ps(f->velocity[c], _mm256_add_epi32(up, one), 4);
+    corner[4] = _mm256_i32gather_ps(f->velocity[c], across, 4);
+    corner[5] = _mm256_i32gather_ps(f->velocity[c], _mm256_add_epi32(across, one), 4);
+    corner[6] = _mm256_i32gather_ps(f->velocity[c], _mm256_add_epi32(across, sx), 4);
+    corner[7] = _mm256_i32gather_ps(f->velocity[c],
+				    _mm256_add_epi32(_mm256_add_epi32(across, sx), one), 4);
+    c00 = _mm256_add_ps(corner[0], _mm256_mul_ps(t[0], _mm256_sub_ps(corner[1], corner[0])));
+    c10 = _mm256_add_ps(corner[2], _mm256_mul_ps(t[0], _mm256_sub_ps(corner[3], corner[2])));
+    c01 = _mm256_add_ps(corner[4], _mm256_mul_ps(t[0], _mm256_sub_ps(corner[5], corner[4])));
+    c11 = _mm256_add_ps(corner[6], _mm256_mul_ps(t[0], _mm256_sub_ps(corner[7], corner[6])));
+    c0 = _mm256_add_ps(c00, _mm256_mul_ps(t[1], _mm256_sub_ps(c10, c00)));
+    c1 = _mm256_add_ps(c01, _mm256_mul_ps(t[1], _mm256_sub_ps(c11, c01)));
+    velocity[c] = _mm256_add_ps(c0, _mm256_mul_ps(t[2], _mm256_sub_ps(c1, c0)));
+  }
+}
+
+/* same as the scalar loop, returns where it got up to */
+__attribute__((target("avx2")))
+int TraceRowAVX2(fluidGrid *f, int j, int k, float elapsed) {
+  __m256 back = _mm256_set1_ps(elapsed * f->inverse);
+  __m256 lanes = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+  __m256 from[3], velocity[3];
+  long row = (long) f->sx * j + (long) f->sxy * k;
+  int i, c;
+
+  for(i = 1; i + 8 <= f->n[0] + 1; i += 8) {
+    from[0] = _mm256_sub_ps(_mm256_add_ps(_mm256_set1_ps(i), lanes),
+			    _mm256_mul_ps(back, _mm256_loadu_ps(f->velocity[0] + row + i)));
+    from[1] = _mm256_sub_ps(_mm256_set1_ps(j),
+			    _mm256_mul_ps(back, _mm256_loadu_ps(f->velocity[1] + row + i)));
+    from[2] = _mm256_sub_ps(_mm256_set1_ps(k),
+			    _mm256_mul_ps(back, _mm256_loadu_ps(f->velocity[2] + row + i)));
+    SampleVelocityAVX2(f, from, velocity);
+    for(c = 0; c < 3; c++) _mm256_storeu_ps(f->traced[c] + row + i, velocity[c]);
+  }
+  return i;
+}
+
+/* same as the scalar loop, returns where it got up to */
+__attribute__((target("avx2")))
+int PressureRowAVX2(fluidGrid *f, float *from, float *to, long row) {
+  __m256 sixth = _mm256_set1_ps(1.0f / 6.0f);
+  __m256 sum;
+  float *p;
+  int i;
+
+  for(i = 1; i + 8 <= f->n[0] + 1; i += 8) {
+    p = from + row + i;
+    sum = _mm256_add_ps(_mm256_loadu_ps(p - 1), _mm256_loadu_ps(p + 1));
+    sum = _mm256_add_ps(sum, _mm256_loadu_ps(p - f->sx));
+    sum = _mm256_add_ps(sum, _mm256_loadu_ps(p + f->sx));
+    sum = _mm256_add_ps(sum, _mm256_loadu_ps(p - f->sxy));
+    sum = _mm256_add_ps(sum, _mm256_loadu_ps(p + f->sxy));
+    sum = _mm256_add_ps(sum, _mm256_loadu_ps(f->divergence + row + i));
+    _mm256_storeu_ps(to + row + i, _mm256_mul_ps(sum, sixth));
+  }
+  return i;
+}
+
+/* same as the scalar loop, returns where it got up to */
+__attribute__((target("avx2")))
+int DragParticlesAVX2(fluidPass *pass, int begin, int end) {
+  fluidGrid *f = pass->f;
+  particles *p = pass->p;
+  __m256 rate = _mm256_set1_ps(pass->rate);
+  __m256 half = _mm256_set1_ps(0.5f);
+  __m256 inverse = _mm256_set1_ps(f->inverse);
+  __m256 at[3], water[3], v;
+  float *positions[3], *velocities[3];
+  int i, k;
+
+  positions[0] = p->x;
+  positions[1] = p->y;
+  positions[2] = p->z;
+  velocities[0] = p->xVelocity;
+  velocities[1] = p->yVelocity;
+  velocities[2] = p->zVelocity;
+  for(i = begin; i + 8 <= end; i += 8) {
+    for(k = 0; k < 3; k++)
+      at[k] = _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(positions[k] + i),
+							_mm256_set1_ps(f->low[k])), inverse), half);
+    SampleVelocityAVX2(f, at, water);
+    for(k = 0; k < 3; k++) {
+      v = _mm256_loadu_ps(velocities[k] + i);
+      _mm256_storeu_ps(velocities[k] + i,
+		       _mm256_add_ps(v, _mm256_mul_ps(_mm256_sub_ps(water[k], v), rate)));
+    }
+  }
+  return i;
+}
+#endif
+
+void ReportFluid(fluidGrid *f) {
+  printf("Water: %dx%dx%d cells of %.2f, %.3f ms and %.1f pressure iterations a step",
+	 f->n[0], f->n[1], f->n[2], f->cell, f->steps ? f->time * 1000.0 / f->steps : 0.0,
+	 f->steps ? (double) f->iterations / f->steps : 0.0);
+  if(f->budget > 0.0)
+    printf(", %d of %d steps over the %.2f ms budget", f->cutShort, f->steps,
+	   f->budget * 1000.0);
+  printf("\n");
+}
@@ -0,0 +1,1424 @@
+/*************************************************************************
+ * Every GL entry point the program calls goes through here. Each call  *
+ * is counted for the frame, with the draws, vertices, state changes,   *
+ * texture binds and bytes uploaded, and can be recorded to a capture   *
+ * file. A capture holds everything from the start, so it can be        *
+ * replayed without the program, drawing the last frame over and over   *
+ * to benchmark the driver on its own. The macros at the end send the   *
+ * rest of the program's calls to the wrappers                          *
+ *************************************************************************/
+
+#define CAPTURE_MAGIC "SUBCAP1"
+#define CAPTURE_MAX_ARGS 16
+#define CAPTURE_MAX_NAMES 1024
+/* pixels along either side of an image */
+#define CAPTURE_MAX_SIZE 65536
+#define REPLAY_FRAMES 100
+
+/* what a call does, for the frame totals */
+#define KIND_STATE 0
+#define KIND_DRAW 1
+#define KIND_BIND 2		/* texture binds */
+#define KIND_UPLOAD 3
+#define KIND_QUERY 4
+#define KIND_OTHER 5
+
+/* entry points, in the order of callNames[] */
+#define CALL_CLEAR 0
+#define CALL_CLEAR_COLOR 1
+#define CALL_FLUSH 2
+#define CALL_FINISH 3
+#define CALL_VIEWPORT 4
+#define CALL_MATRIX_MODE 5
+#define CALL_LOAD_IDENTITY 6
+#define CALL_LOAD_MATRIX 7
+#define CALL_PUSH_MATRIX 8
+#define CALL_POP_MATRIX 9
+#define CALL_TRANSLATE 10
+#define CALL_ROTATE 11
+#define CALL_LOOK_AT 12
+#define CALL_PERSPECTIVE 13
+#define CALL_ENABLE 14
+#define CALL_DISABLE 15
+#define CALL_SHADE_MODEL 16
+#define CALL_BLEND_FUNC 17
+#define CALL_HINT 18
+#define CALL_POINT_SIZE 19
+#define CALL_PIXEL_STORE 20
+#define CALL_TEX_ENV_F 21
+#define CALL_TEX_ENV_I 22
+#define CALL_LIGHT_FV 23
+#define CALL_LIGHT_MODEL_FV 24
+#define CALL_LIGHT_MODEL_I 25
+#define CALL_MATERIAL_FV 26
+#define CALL_COLOR 27
+#define CALL_RASTER_POS 28
+#define CALL_BITMAP 29
+#define CALL_GEN_TEXTURES 30
+#define CALL_DELETE_TEXTURES 31
+#define CALL_BIND_TEXTURE 32
+#define CALL_TEX_PARAMETER 33
+#define CALL_TEX_IMAGE 34
+#define CALL_COMPRESSED_TEX_IMAGE 35
+#define CALL_GEN_BUFFERS 36
+#define CALL_BIND_BUFFER 37
+#define CALL_BUFFER_DATA 38
+#define CALL_BUFFER_SUB_DATA 39
+#define CALL_MAP_BUFFER 40
+#define CALL_UNMAP_BUFFER 41
+#define CALL_GEN_VERTEX_ARRAYS 42
+#define CALL_BIND_VERTEX_ARRAY 43
+#define CALL_ENABLE_CLIENT_STATE 44
+#define CALL_DISABLE_CLIENT_STATE 45
+#define CALL_VERTEX_POINTER 46
+#define CALL_NORMAL_POINTER 47
+#define CALL_TEX_COORD_POINTER 48
+#define CALL_VERTEX_ATTRIB_POINTER 49
+#define CALL_ENABLE_VERTEX_ATTRIB_ARRAY 50
+#define CALL_DISABLE_VERTEX_ATTRIB_ARRAY 51
+#define CALL_VERTEX_ATTRIB_DIVISOR 52
+#define CALL_CREATE_SHADER 53
+#define CALL_SHADER_SOURCE 54
+#define CALL_COMPILE_SHADER 55
+#define CALL_GET_SHADER 56
+#define CALL_GET_SHADER_INFO_LOG 57
+#define CALL_CREATE_PROGRAM 58
+#define CALL_ATTACH_SHADER 59
+#define CALL_BIND_ATTRIB_LOCATION 60
+#define CALL_LINK_PROGRAM 61
+#define CALL_GET_PROGRAM 62
+#define CALL_GET_PROGRAM_INFO_LOG 63
+#define CALL_USE_PROGRAM 64
+#define CALL_GET_UNIFORM_LOCATION 65
+#define CALL_UNIFORM_1IV 66
+#define CALL_GET_FLOAT 67
+#define CALL_IS_ENABLED 68
+#define CALL_DRAW_ARRAYS 69
+#define CALL_DRAW_ELEMENTS 70
+#define CALL_DRAW_ARRAYS_INSTANCED 71
+#define CALL_DRAW_ELEMENTS_INSTANCED 72
+#define CAPTURE_CALLS 73
+
+/* objects renamed on replay */
+#define NAME_BUFFER 0
+#define NAME_TEXTURE 1
+#define NAME_VERTEX_ARRAY 2
+#define NAME_PROGRAM 3		/* shaders and programs share names */
+#define NAME_UNIFORM 4		/* locations, offset by one for -1 */
+#define NAME_KINDS 5
+
+typedef struct {
+  int calls, draws, state, binds;
+  long vertices, uploaded;
+  int count[CAPTURE_CALLS];
+  double seconds;		/* from the start of this frame to the next */
+} frameStats;
+
+/* calls recorded, each an op, its arguments and any data it points to */
+typedef struct {
+  char *data;
+  long size, used;
+} captureStream;
+
+typedef struct {
+  char magic[8];
+  int width, height;
+  long frameStart;		/* where the last frame starts */
+  long size;
+} captureHeader;
+
+char *callNames[CAPTURE_CALLS] = {
+  "glClear", "glClearColor", "glFlush", "glFinish", "glViewport",
+  "glMatrixMode", "glLoadIdentity", "glLoadMatrixf", "glPushMatrix", "glPopMatrix",
+  "glTranslatef", "glRotatef", "gluLookAt", "gluPerspective",
+  "glEnable", "glDisable", "glShadeModel", "glBlendFunc", "glHint", "glPointSize",
+  "glPixelStorei", "glTexEnvf", "glTexEnvi", "glLightfv", "glLightModelfv",
+  "glLightModeli", "glMaterialfv", "glColor3f", "glRasterPos2f", "glBitmap",
+  "glGenTextures", "glDeleteTextures", "glBindTexture", "glTexParameteri",
+  "glTexImage2D", "glCompressedTexImage2D",
+  "glGenBuffers", "glBindBuffer", "glBufferData", "glBufferSubData",
+  "glMapBuffer", "glUnmapBuffer", "glGenVertexArrays", "glBindVertexArray",
+  "glEnableClientState", "glDisableClientState", "glVertexPointer",
+  "glNormalPointer", "glTexCoordPointer", "glVertexAttribPointer",
+  "glEnableVertexAttribArray", "glDisableVertexAttribArray", "glVertexAttribDivisor",
+  "glCreateShader", "glShaderSource", "glCompileShader", "glGetShaderiv",
+  "glGetShaderInfoLog", "glCreateProgram", "glAttachShader", "glBindAttribLocation",
+  "glLinkProgram", "glGetProgramiv", "glGetProgramInfoLog", "glUseProgram",
+  "glGetUniformLocation", "glUniform1iv", "glGetFloatv", "glIsEnabled",
+  "glDrawArrays", "glDrawElements", "glDrawArraysInstanced", "glDrawElementsInstanced"};
+
+char callKinds[CAPTURE_CALLS] = {
+  KIND_OTHER, KIND_STATE, KIND_OTHER, KIND_OTHER, KIND_STATE,
+  KIND_STATE, KIND_STATE, KIND_STATE, KIND_STATE, KIND_STATE,
+  KIND_STATE, KIND_STATE, KIND_STATE, KIND_STATE,
+  KIND_STATE, KIND_STATE, KIND_STATE, KIND_STATE, KIND_STATE, KIND_STATE,
+  KIND_STATE, KIND_STATE, KIND_STATE, KIND_STATE, KIND_STATE,
+  KIND_STATE, KIND_STATE, KIND_STATE, KIND_STATE, KIND_DRAW,
+  KIND_OTHER, KIND_OTHER, KIND_BIND, KIND_STATE,
+  KIND_UPLOAD, KIND_UPLOAD,
+  KIND_OTHER, KIND_STATE, KIND_UPLOAD, KIND_UPLOAD,
+  KIND_OTHER, KIND_UPLOAD, KIND_OTHER, KIND_STATE,
+  KIND_STATE, KIND_STATE, KIND_STATE,
+  KIND_STATE, KIND_STATE, KIND_STATE,
+  KIND_STATE, KIND_STATE, KIND_STATE,
+  KIND_OTHER, KIND_OTHER, KIND_OTHER, KIND_QUERY,
+  KIND_QUERY, KIND_OTHER, KIND_OTHER, KIND_OTHER,
+  KIND_OTHER, KIND_QUERY, KIND_QUERY, KIND_STATE,
+  KIND_QUERY, KIND_STATE, KIND_QUERY, KIND_QUERY,
+  KIND_DRAW, KIND_DRAW, KIND_DRAW, KIND_DRAW};
+
+/* the arguments each call is recorded with, -1 for as many as its pname
+   takes after the others */
+signed char callArgs[CAPTURE_CALLS] = {
+  1, 4, 0, 0, 4,
+  1, 0, 16, 0, 0,
+  3, 4, 9, 4,
+  1, 1, 1, 2, 2, 1,
+  2, 3, 3, -1, -1,
+  2, -1, 3, 2, 6,
+  1, 1, 2, 3,
+  9, 8,
+  1, 2, 3, 3,
+  0, 1, 1, 1,
+  1, 1, 4,
+  3, 4, 6,
+  1, 1, 2,
+  2, 1, 1, 0,
+  0, 1, 2, 2,
+  1, 0, 0, 1,
+  2, 2, 0, 0,
+  3, 4, 4, 5};
+
+frameStats thisFrame, lastFrame;
+double frameStarted = 0.0;
+
+int capturing = 0;
+captureStream capture;
+long captureFrameStart = 0;
+int captureWidth, captureHeight;
+/* to know what a mapped buffer holds, and whether pixels come from one */
+GLuint captureUnpackBuffer = 0;
+long captureBufferSizes[3];	/* array, element and pixel unpack */
+GLenum captureMappedTarget;
+void *captureMapped = NULL;
+
+GLuint replayNames[NAME_KINDS][CAPTURE_MAX_NAMES];
+/* set by a name past the end of replayNames */
+int replayBadName = 0;
+/* the captured name of the pixel unpack buffer bound on replay */
+GLuint replayUnpackBuffer = 0;
+
+void StartCaptureFrame(void);
+void CountCall(int, long, long);
+void StartCapture(int, int);
+void SaveCapture(char *);
+void ReportCalls(void);
+void RunReplay(char *, int, char *);
+void Record(int, int, double, double, double, double, const void *, long);
+void RecordArgs(int, int, double *, const void *, long);
+void AppendCapture(const void *, long);
+int ReplayCalls(char *, long, long, frameStats *);
+int CallFits(int, int, double *, char *, long);
+int ImageFits(double, double);
+long CompressedBytes(GLsizei, GLsizei, GLenum);
+GLuint ReplayName(int, GLuint);
+void SetReplayName(int, GLuint, GLuint);
+void RenameObjects(int, int, GLuint *);
+int LightParams(GLenum);
+int BufferSlot(GLenum);
+long PixelBytes(GLsizei, GLsizei, GLenum, GLenum);
+
+/* the wrappers */
+void CaptureClear(GLbitfield);
+void CaptureClearColor(GLclampf, GLclampf, GLclampf, GLclampf);
+void CaptureFlush(void);
+void CaptureFinish(void);
+void CaptureViewport(GLint, GLint, GLsizei, GLsizei);
+void CaptureMatrixMode(GLenum);
+void CaptureLoadIdentity(void);
+void CaptureLoadMatrixf(const GLfloat *);
+void CapturePushMatrix(void);
+void CapturePopMatrix(void);
+void CaptureTranslatef(GLfloat, GLfloat, GLfloat);
+void CaptureRotatef(GLfloat, GLfloat, GLfloat, GLfloat);
+void CaptureLookAt(GLdouble, GLdouble, GLdouble, GLdouble, GLdouble, GLdouble,
+		   GLdouble, GLdouble, GLdouble);
+void CapturePerspective(GLdouble, GLdouble, GLdouble, GLdouble);
+void CaptureEnable(GLenum);
+void CaptureDisable(GLenum);
+void CaptureShadeModel(GLenum);
+void CaptureBlendFunc(GLenum, GLenum);
+void CaptureHint(GLenum, GLenum);
+void CapturePointSize(GLfloat);
+void CapturePixelStorei(GLenum, GLint);
+void CaptureTexEnvf(GLenum, GLenum, GLfloat);
+void CaptureTexEnvi(GLenum, GLenum, GLint);
+void CaptureLightfv(GLenum, GLenum, const GLfloat *);
+void CaptureLightModelfv(GLenum, const GLfloat *);
+void CaptureLightModeli(GLenum, GLint);
+void CaptureMaterialfv(GLenum, GLenum, const GLfloat *);
+void CaptureColor3f(GLfloat, GLfloat, GLfloat);
+void CaptureRasterPos2f(GLfloat, GLfloat);
+void CaptureBitmap(GLsizei, GLsizei, GLfloat, GLfloat, GLfloat, GLfloat, const GLubyte *);
+void CaptureGenTextures(GLsizei, GLuint *);
+void CaptureDeleteTextures(GLsizei, const GLuint *);
+void CaptureBindTexture(GLenum, GLuint);
+void CaptureTexParameteri(GLenum, GLenum, GLint);
+void CaptureTexImage2D(GLenum, GLint, GLint, GLsizei, GLsizei, GLint, GLenum, GLenum,
+		       const GLvoid *);
+void CaptureCompressedTexImage2D(GLenum, GLint, GLenum, GLsizei, GLsizei, GLint, GLsizei,
+				 const GLvoid *);
+void CaptureGenBuffers(GLsizei, GLuint *);
+void CaptureBindBuffer(GLenum, GLuint);
+void CaptureBufferData(GLenum, GLsizeiptr, const GLvoid *, GLenum);
+void CaptureBufferSubData(GLenum, GLintptr, GLsizeiptr, const GLvoid *);
+void *CaptureMapBuffer(GLenum, GLenum);
+GLboolean CaptureUnmapBuffer(GLenum);
+void CaptureGenVertexArrays(GLsizei, GLuint *);
+void CaptureBindVertexArray(GLuint);
+void CaptureEnableClientState(GLenum);
+void CaptureDisableClientState(GLenum);
+void CaptureVertexPointer(GLint, GLenum, GLsizei, const GLvoid *);
+void CaptureNormalPointer(GLenum, GLsizei, const GLvoid *);
+void CaptureTexCoordPointer(GLint, GLenum, GLsizei, const GLvoid *);
+void CaptureVertexAttribPointer(GLuint, GLint, GLenum, GLboolean, GLsizei, const GLvoid *);
+void CaptureEnableVertexAttribArray(GLuint);
+void CaptureDisableVertexAttribArray(GLuint);
+void CaptureVertexAttribDivisor(GLuint, GLuint);
+GLuint CaptureCreateShader(GLenum);
+void CaptureShaderSource(GLuint, GLsizei, const GLchar **, const GLint *);
+void CaptureCompileShader(GLuint);
+void CaptureGetShaderiv(GLuint, GLenum, GLint *);
+void CaptureGetShaderInfoLog(GLuint, GLsizei, GLsizei *, GLchar *);
+GLuint CaptureCreateProgram(void);
+void CaptureAttachShader(GLuint, GLuint);
+void CaptureBindAttribLocation(GLuint, GLuint, const GLchar *);
+void CaptureLinkProgram(GLuint);
+void CaptureGetProgramiv(GLuint, GLenum, GLint *);
+void CaptureGetProgramInfoLog(GLuint, GLsizei, GLsizei *, GLchar *);
+void CaptureUseProgram(GLuint);
+GLint CaptureGetUniformLocation(GLuint, const GLchar *);
+void CaptureUniform1iv(GLint, GLsizei, const GLint *);
+void CaptureGetFloatv(GLenum, GLfloat *);
+GLboolean CaptureIsEnabled(GLenum);
+void CaptureDrawArrays(GLenum, GLint, GLsizei);
+void CaptureDrawElements(GLenum, GLsizei, GLenum, const GLvoid *);
+void CaptureDrawArraysInstanced(GLenum, GLint, GLsizei, GLsizei);
+void CaptureDrawElementsInstanced(GLenum, GLsizei, GLenum, const GLvoid *, GLsizei);
+
+/* at the start of each frame, the last one's totals are kept for showing */
+void StartCaptureFrame(void) {
+  double now = Now();
+
+  if(frameStarted > 0.0) thisFrame.seconds = now - frameStarted;
+  frameStarted = now;
+  lastFrame = thisFrame;
+  memset(&thisFrame, 0, sizeof(thisFrame));
+  if(capturing) captureFrameStart = capture.used;
+}
+
+void CountCall(int call, long vertices, long bytes) {
+  thisFrame.count[call]++;
+  thisFrame.calls++;
+  switch(callKinds[call]) {
+  case KIND_STATE: thisFrame.state++; break;
+  case KIND_DRAW: thisFrame.draws++; break;
+  case KIND_BIND: thisFrame.binds++; break;
+  }
+  thisFrame.vertices += vertices;
+  thisFrame.uploaded += bytes;
+}
+
+/* record everything from now on. Vertex arrays must come from buffers,
+   as arrays in client memory can't be copied */
+void StartCapture(int width, int height) {
+  if(!haveBuffers) {
+    fprintf(stderr, "WARNING: Capturing needs buffer objects, not capturing\n");
+    return;
+  }
+  capture.size = 1024 * 1024;
+  capture.data = malloc(capture.size);
+  if(capture.data == NULL) {
+    fprintf(stderr, "ERROR: Unable to allocate %ld byte capture\n", capture.size);
+    exit(1);
+  }
+  capture.used = 0;
+  captureWidth = width;
+  captureHeight = height;
+  capturing = 1;
+}
+
+/* everything recorded, ending with the last frame */
+void SaveCapture(char *file) {
+  captureHeader header;
+  FILE *out;
+  int ok;
+
+  if(!capturing) return;
+  capturing = 0;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CAPTURE_MAGIC, 8);
+  header.width = captureWidth;
+  header.height = captureHeight;
+  header.frameStart = captureFrameStart;
+  header.size = capture.used;
+
+  out = fopen(file, "wb");
+  if(out == NULL) {
+    fprintf(stderr, "WARNING: Unable to write capture %s\n", file);
+    return;
+  }
+  ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+    fwrite(capture.data, 1, capture.used, out) == (size_t) capture.used;
+  if(fclose(out) != 0 || !ok) fprintf(stderr, "WARNING: Unable to write capture %s\n", file);
+  else printf("Capture: %ld bytes, the last frame %ld, written to %s\n",
+	      capture.used, capture.used - captureFrameStart, file);
+  free(capture.data);
+}
+
+/* the last frame, by entry point */
+void ReportCalls(void) {
+  int i, column = 0;
+
+  printf("GL calls: %d, %d draws, %ld vertices, %d state changes, %d texture binds, "
+	 "%ld bytes uploaded\n", thisFrame.calls, thisFrame.draws, thisFrame.vertices,
+	 thisFrame.state, thisFrame.binds, thisFrame.uploaded);
+  for(i = 0; i < CAPTURE_CALLS; i++) {
+    if(thisFrame.count[i] == 0) continue;
+    printf("%-26s %4d%s", callNames[i], thisFrame.count[i], ++column % 3 ? "  " : "\n");
+  }
+  if(column % 3) printf("\n");
+}
+
+/* set up everything before the last frame once, then time drawing the
+   last frame again and again. The last one drawn can be saved */
+void RunReplay(char *file, int frames, char *snapshot) {
+  captureHeader *header;
+  frameStats stats;
+  timings t;
+  unsigned char *data;
+  char *calls;
+  long size;
+  double start;
+  int i;
+
+  data = map_file(file, &size);
+  header = (captureHeader *) data;
+  if(data == NULL || size < (long) sizeof(captureHeader) ||
+     memcmp(header->magic, CAPTURE_MAGIC, 8) != 0 ||
+     header->size != size - (long) sizeof(captureHeader) ||
+     header->frameStart < 0 || header->frameStart > header->size) {
+    fprintf(stderr, "ERROR: %s is not a capture\n", file);
+    exit(1);
+  }
+  calls = (char *) data + sizeof(captureHeader);
+
+  InitHeadless(header->width, header->height);
+  LoadExtensions(1);
+  memset(&stats, 0, sizeof(stats));
+  if(!ReplayCalls(calls, 0, header->frameStart, &stats)) {
+    fprintf(stderr, "ERROR: %s is not a capture\n", file);
+    exit(1);
+  }
+  glFinish();
+
+  InitTimings(&t, frames);
+  for(i = 0; i < frames; i++) {
+    memset(&stats, 0, sizeof(stats));
+    start = Now();
+    if(!ReplayCalls(calls, header->frameStart, header->size, &stats)) {
+      fprintf(stderr, "ERROR: %s is not a capture\n", file);
+      exit(1);
+    }
+    glFinish();
+    AddTiming(&t, Now() - start);
+  }
+
+  printf("Replay: %s at %dx%d, %d frames\n", file, header->width, header->height, frames);
+  printf("%d calls a frame, %d draws, %ld vertices, %d state changes, %d texture binds, "
+	 "%ld bytes uploaded\n", stats.calls, stats.draws, stats.vertices, stats.state,
+	 stats.binds, stats.uploaded);
+  printf("%-12s %10s %10s %10s %10s\n", "(ms)", "min", "median", "p99", "max");
+  ReportTimings("frame", &t);
+  if(snapshot != NULL) SaveSnapshot(snapshot, header->width, header->height);
+  unmap_file(data, size);
+}
+
+/* a call with up to four arguments */
+void Record(int call, int argc, double a, double b, double c, double d,
+	    const void *data, long bytes) {
+  double args[4];
+
+  if(!capturing) return;
+  args[0] = a;
+  args[1] = b;
+  args[2] = c;
+  args[3] = d;
+  RecordArgs(call, argc, args, data, bytes);
+}
+
+void RecordArgs(int call, int argc, double *args, const void *data, long bytes) {
+  int header[2];
+
+  if(!capturing) return;
+  header[0] = call;
+  header[1] = argc;
+  AppendCapture(header, sizeof(header));
+  AppendCapture(args, argc * sizeof(double));
+  AppendCapture(&bytes, sizeof(bytes));
+  if(bytes > 0) AppendCapture(data, bytes);
+}
+
+void AppendCapture(const void *data, long bytes) {
+  char *grown;
+
+  if(capture.used + bytes > capture.size) {
+    while(capture.used + bytes > capture.size) capture.size *= 2;
+    grown = realloc(capture.data, capture.size);
+    if(grown == NULL) {
+      fprintf(stderr, "ERROR: Unable to grow capture to %ld bytes\n", capture.size);
+      exit(1);
+    }
+    capture.data = grown;
+  }
+  memcpy(capture.data + capture.used, data, bytes);
+  capture.used += bytes;
+}
+
+/* make the calls recorded between from and to, returns 0 at a bad one */
+int ReplayCalls(char *calls, long from, long to, frameStats *stats) {
+  double a[CAPTURE_MAX_ARGS];
+  GLfloat f[16];
+  int header[2];
+  long bytes;
+  char *data;
+  GLuint name;
+  int i;
+
+  replayBadName = 0;
+  while(from < to) {
+    if(from + (long) sizeof(header) > to) {
+      fprintf(stderr, "WARNING: Capture ends inside a call, stopping\n");
+      return 0;
+    }
+    memcpy(header, calls + from, sizeof(header));
+    from += sizeof(header);
+    if(header[0] < 0 || header[0] >= CAPTURE_CALLS || header[1] < 0 || header[1] > CAPTURE_MAX_ARGS) {
+      fprintf(stderr, "WARNING: Bad call in capture, stopping\n");
+      return 0;
+    }
+    if(from + header[1] * (long) sizeof(double) + (long) sizeof(bytes) > to) {
+      fprintf(stderr, "WARNING: Capture ends inside a call, stopping\n");
+      return 0;
+    }
+    memcpy(a, calls + from, header[1] * sizeof(double));
+    from += header[1] * sizeof(double);
+    memcpy(&bytes, calls + from, sizeof(bytes));
+    from += sizeof(bytes);
+    if(bytes < 0 || bytes > to - from) {
+      fprintf(stderr, "WARNING: Bad data of %ld bytes in capture, stopping\n", bytes);
+      return 0;
+    }
+    data = bytes > 0 ? calls + from : NULL;
+    from += bytes;
+    if(!CallFits(header[0], header[1], a, data, bytes)) {
+      fprintf(stderr, "WARNING: Bad %s in capture, stopping\n", callNames[header[0]]);
+      return 0;
+    }
+    for(i = 0; i < header[1]; i++) f[i] = (GLfloat) a[i];
+
+    stats->count[header[0]]++;
+    stats->calls++;
+    if(callKinds[header[0]] == KIND_STATE) stats->state++;
+    if(callKinds[header[0]] == KIND_DRAW) stats->draws++;
+    if(callKinds[header[0]] == KIND_BIND) stats->binds++;
+    if(callKinds[header[0]] == KIND_UPLOAD) stats->uploaded += bytes;
+
+    switch(header[0]) {
+    case CALL_CLEAR: glClear((GLbitfield) a[0]); break;
+    case CALL_CLEAR_COLOR: glClearColor(f[0], f[1], f[2], f[3]); break;
+    case CALL_FLUSH: glFlush(); break;
+    case CALL_VIEWPORT: glViewport((GLint) a[0], (GLint) a[1], (GLsizei) a[2], (GLsizei) a[3]); break;
+    case CALL_MATRIX_MODE: glMatrixMode((GLenum) a[0]); break;
+    case CALL_LOAD_IDENTITY: glLoadIdentity(); break;
+    case CALL_LOAD_MATRIX: glLoadMatrixf(f); break;
+    case CALL_PUSH_MATRIX: glPushMatrix(); break;
+    case CALL_POP_MATRIX: glPopMatrix(); break;
+    case CALL_TRANSLATE: glTranslatef(f[0], f[1], f[2]); break;
+    case CALL_ROTATE: glRotatef(f[0], f[1], f[2], f[3]); break;
+    case CALL_LOOK_AT: gluLookAt(a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7], a[8]); break;
+    case CALL_PERSPECTIVE: gluPerspective(a[0], a[1], a[2], a[3]); break;
+    case CALL_ENABLE: glEnable((GLenum) a[0]); break;
+    case CALL_DISABLE: glDisable((GLenum) a[0]); break;
+    case CALL_SHADE_MODEL: glShadeModel((GLenum) a[0]); break;
+    case CALL_BLEND_FUNC: glBlendFunc((GLenum) a[0], (GLenum) a[1]); break;
+    case CALL_HINT: glHint((GLenum) a[0], (GLenum) a[1]); break;
+    case CALL_POINT_SIZE: glPointSize(f[0]); break;
+    case CALL_PIXEL_STORE: glPixelStorei((GLenum) a[0], (GLint) a[1]); break;
+    case CALL_TEX_ENV_F: glTexEnvf((GLenum) a[0], (GLenum) a[1], f[2]); break;
+    case CALL_TEX_ENV_I: glTexEnvi((GLenum) a[0], (GLenum) a[1], (GLint) a[2]); break;
+    case CALL_LIGHT_FV: glLightfv((GLenum) a[0], (GLenum) a[1], f + 2); break;
+    case CALL_LIGHT_MODEL_FV: glLightModelfv((GLenum) a[0], f + 1); break;
+    case CALL_LIGHT_MODEL_I: glLightModeli((GLenum) a[0], (GLint) a[1]); break;
+    case CALL_MATERIAL_FV: glMaterialfv((GLenum) a[0], (GLenum) a[1], f + 2); break;
+    case CALL_COLOR: glColor3f(f[0], f[1], f[2]); break;
+    case CALL_RASTER_POS: glRasterPos2f(f[0], f[1]); break;
+    case CALL_BITMAP:
+      glBitmap((GLsizei) a[0], (GLsizei) a[1], f[2], f[3], f[4], f[5], (GLubyte *) data);
+      break;
+    case CALL_GEN_TEXTURES: RenameObjects(NAME_TEXTURE, (int) a[0], (GLuint *) data); break;
+    case CALL_DELETE_TEXTURES:
+      for(i = 0; i < (int) a[0]; i++) {
+	name = ReplayName(NAME_TEXTURE, ((GLuint *) data)[i]);
+	glDeleteTextures(1, &name);
+      }
+      break;
+    case CALL_BIND_TEXTURE: glBindTexture((GLenum) a[0], ReplayName(NAME_TEXTURE, (GLuint) a[1])); break;
+    case CALL_TEX_PARAMETER: glTexParameteri((GLenum) a[0], (GLenum) a[1], (GLint) a[2]); break;
+    case CALL_TEX_IMAGE:
+      glTexImage2D((GLenum) a[0], (GLint) a[1], (GLint) a[2], (GLsizei) a[3], (GLsizei) a[4],
+		   (GLint) a[5], (GLenum) a[6], (GLenum) a[7],
+		   a[8] >= 0 ? (GLvoid *) (long) a[8] : data);
+      break;
+    case CALL_COMPRESSED_TEX_IMAGE:
+      glCompressedTexImage2D((GLenum) a[0], (GLint) a[1], (GLenum) a[2], (GLsizei) a[3],
+			     (GLsizei) a[4], (GLint) a[5], (GLsizei) a[6],
+			     a[7] >= 0 ? (GLvoid *) (long) a[7] : data);
+      break;
+    case CALL_GEN_BUFFERS: RenameObjects(NAME_BUFFER, (int) a[0], (GLuint *) data); break;
+    case CALL_BIND_BUFFER:
+      glBindBuffer((GLenum) a[0], ReplayName(NAME_BUFFER, (GLuint) a[1]));
+      if((GLenum) a[0] == GL_PIXEL_UNPACK_BUFFER) replayUnpackBuffer = (GLuint) a[1];
+      break;
+    case CALL_BUFFER_DATA: glBufferData((GLenum) a[0], (GLsizeiptr) a[1], data, (GLenum) a[2]); break;
+    case CALL_BUFFER_SUB_DATA:
+      glBufferSubData((GLenum) a[0], (GLintptr) a[1], (GLsizeiptr) a[2], data);
+      break;
+    case CALL_UNMAP_BUFFER:
+      /* what was written to the mapped buffer */
+      glBufferSubData((GLenum) a[0], 0, bytes, data);
+      break;
+    case CALL_GEN_VERTEX_ARRAYS: RenameObjects(NAME_VERTEX_ARRAY, (int) a[0], (GLuint *) data); break;
+    case CALL_BIND_VERTEX_ARRAY: glBindVertexArray(ReplayName(NAME_VERTEX_ARRAY, (GLuint) a[0])); break;
+    case CALL_ENABLE_CLIENT_STATE: glEnableClientState((GLenum) a[0]); break;
+    case CALL_DISABLE_CLIENT_STATE: glDisableClientState((GLenum) a[0]); break;
+    case CALL_VERTEX_POINTER:
+      glVertexPointer((GLint) a[0], (GLenum) a[1], (GLsizei) a[2], (GLvoid *) (long) a[3]);
+      break;
+    case CALL_NORMAL_POINTER:
+      glNormalPointer((GLenum) a[0], (GLsizei) a[1], (GLvoid *) (long) a[2]);
+      break;
+    case CALL_TEX_COORD_POINTER:
+      glTexCoordPointer((GLint) a[0], (GLenum) a[1], (GLsizei) a[2], (GLvoid *) (long) a[3]);
+      break;
+    case CALL_VERTEX_ATTRIB_POINTER:
+      glVertexAttribPointer((GLuint) a[0], (GLint) a[1], (GLenum) a[2], (GLboolean) a[3],
+			    (GLsizei) a[4], (GLvoid *) (long) a[5]);
+      break;
+    case CALL_ENABLE_VERTEX_ATTRIB_ARRAY: glEnableVertexAttribArray((GLuint) a[0]); break;
+    case CALL_DISABLE_VERTEX_ATTRIB_ARRAY: glDisableVertexAttribArray((GLuint) a[0]); break;
+    case CALL_VERTEX_ATTRIB_DIVISOR: glVertexAttribDivisor((GLuint) a[0], (GLuint) a[1]); break;
+    case CALL_CREATE_SHADER:
+      SetReplayName(NAME_PROGRAM, (GLuint) a[1], glCreateShader((GLenum) a[0]));
+      break;
+    case CALL_SHADER_SOURCE:
+      glShaderSource(ReplayName(NAME_PROGRAM, (GLuint) a[0]), 1, (const GLchar **) &data, NULL);
+      break;
+    case CALL_COMPILE_SHADER: glCompileShader(ReplayName(NAME_PROGRAM, (GLuint) a[0])); break;
+    case CALL_CREATE_PROGRAM:
+      SetReplayName(NAME_PROGRAM, (GLuint) a[0], glCreateProgram());
+      break;
+    case CALL_ATTACH_SHADER:
+      glAttachShader(ReplayName(NAME_PROGRAM, (GLuint) a[0]), ReplayName(NAME_PROGRAM, (GLuint) a[1]));
+      break;
+    case CALL_BIND_ATTRIB_LOCATION:
+      glBindAttribLocation(ReplayName(NAME_PROGRAM, (GLuint) a[0]), (GLuint) a[1], data);
+      break;
+    case CALL_LINK_PROGRAM: glLinkProgram(ReplayName(NAME_PROGRAM, (GLuint) a[0])); break;
+    case CALL_USE_PROGRAM: glUseProgram(ReplayName(NAME_PROGRAM, (GLuint) a[0])); break;
+    case CALL_GET_UNIFORM_LOCATION:
+      SetReplayName(NAME_UNIFORM, (GLint) a[1] + 1,
+		    glGetUniformLocation(ReplayName(NAME_PROGRAM, (GLuint) a[0]), data) + 1);
+      break;
+    case CALL_UNIFORM_1IV:
+      glUniform1iv((GLint) ReplayName(NAME_UNIFORM, (GLint) a[0] + 1) - 1, (GLsizei) a[1],
+		   (GLint *) data);
+      break;
+    case CALL_DRAW_ARRAYS:
+      glDrawArrays((GLenum) a[0], (GLint) a[1], (GLsizei) a[2]);
+      stats->vertices += (long) a[2];
+      break;
+    case CALL_DRAW_ELEMENTS:
+      glDrawElements((GLenum) a[0], (GLsizei) a[1], (GLenum) a[2], (GLvoid *) (long) a[3]);
+      stats->vertices += (long) a[1];
+      break;
+    case CALL_DRAW_ARRAYS_INSTANCED:
+      glDrawArraysInstanced((GLenum) a[0], (GLint) a[1], (GLsizei) a[2], (GLsizei) a[3]);
+      stats->vertices += (long) a[2] * (long) a[3];
+      break;
+    case CALL_DRAW_ELEMENTS_INSTANCED:
+      glDrawElementsInstanced((GLenum) a[0], (GLsizei) a[1], (GLenum) a[2],
+			      (GLvoid *) (long) a[3], (GLsizei) a[4]);
+      stats->vertices += (long) a[1] * (long) a[4];
+      break;
+    }
+    if(replayBadName) {
+      fprintf(stderr, "WARNING: Object past %d in capture, stopping\n", CAPTURE_MAX_NAMES);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* whether a call has the arguments it was recorded with and all the data
+   it reads, none of which a corrupt capture can be trusted for */
+int CallFits(int call, int argc, double *a, char *data, long bytes) {
+  int expected = callArgs[call];
+
+  if(expected < 0) {
+    /* pname is the last of the fixed arguments */
+    expected = call == CALL_LIGHT_MODEL_FV ? 1 : 2;
+    if(argc < expected) return 0;
+    expected += LightParams((GLenum) a[expected - 1]);
+  }
+  if(argc != expected) return 0;
+
+  switch(call) {
+  case CALL_BITMAP:
+    return ImageFits(a[0], a[1]) && ((long) a[0] + 7) / 8 * (long) a[1] <= bytes;
+  case CALL_GEN_TEXTURES: case CALL_DELETE_TEXTURES:
+  case CALL_GEN_BUFFERS: case CALL_GEN_VERTEX_ARRAYS:
+    return a[0] >= 0 && a[0] <= bytes / (long) sizeof(GLuint);
+  case CALL_TEX_IMAGE:
+    /* an offset into the unpack buffer, or pixels inline */
+    if(a[8] >= 0) return replayUnpackBuffer != 0;
+    return data == NULL ||
+      (ImageFits(a[3], a[4]) &&
+       PixelBytes((GLsizei) a[3], (GLsizei) a[4], (GLenum) a[6], (GLenum) a[7]) <= bytes);
+  case CALL_COMPRESSED_TEX_IMAGE:
+    if(a[7] >= 0) return replayUnpackBuffer != 0;
+    return data == NULL ||
+      (ImageFits(a[3], a[4]) && a[6] <= bytes &&
+       CompressedBytes((GLsizei) a[3], (GLsizei) a[4], (GLenum) a[2]) == (long) a[6]);
+  case CALL_BUFFER_DATA:
+    return data == NULL || (a[1] >= 0 && a[1] <= bytes);
+  case CALL_BUFFER_SUB_DATA:
+    return a[2] >= 0 && a[2] <= bytes;
+  case CALL_UNIFORM_1IV:
+    return a[1] >= 0 && a[1] <= bytes / (long) sizeof(GLint);
+  case CALL_SHADER_SOURCE: case CALL_BIND_ATTRIB_LOCATION: case CALL_GET_UNIFORM_LOCATION:
+    return data != NULL && memchr(data, 0, bytes) != NULL;
+  }
+  return 1;
+}
+
+int ImageFits(double width, double height) {
+  return width >= 0 && height >= 0 && width <= CAPTURE_MAX_SIZE && height <= CAPTURE_MAX_SIZE;
+}
+
+/* of the compressed formats the textures are uploaded in, -1 for others */
+long CompressedBytes(GLsizei width, GLsizei height, GLenum internal) {
+  if(internal == GL_COMPRESSED_RGB_S3TC_DXT1_EXT) return CompressedSize(width, height, TEXTURE_BC1);
+  if(internal == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT) return CompressedSize(width, height, TEXTURE_BC3);
+  return -1;
+}
+
+/* the replay's own name for a captured one, 0 and replayBadName set for
+   one past the end */
+GLuint ReplayName(int kind, GLuint captured) {
+  if(captured >= CAPTURE_MAX_NAMES) {
+    replayBadName = 1;
+    return 0;
+  }
+  return replayNames[kind][captured];
+}
+
+void SetReplayName(int kind, GLuint captured, GLuint name) {
+  if(captured >= CAPTURE_MAX_NAMES) {
+    replayBadName = 1;
+    return;
+  }
+  replayNames[kind][captured] = name;
+}
+
+/* make as many objects as were made when capturing */
+void RenameObjects(int kind, int n, GLuint *captured) {
+  GLuint name;
+  int i;
+
+  for(i = 0; i < n; i++) {
+    switch(kind) {
+    case NAME_BUFFER: glGenBuffers(1, &name); break;
+    case NAME_TEXTURE: glGenTextures(1, &name); break;
+    default: glGenVertexArrays(1, &name); break;
+    }
+    SetReplayName(kind, captured[i], name);
+  }
+}
+
+/* floats glLightfv takes for pname */
+int LightParams(GLenum pname) {
+  switch(pname) {
+  case GL_AMBIENT: case GL_DIFFUSE: case GL_SPECULAR: case GL_POSITION: case GL_EMISSION:
+  case GL_AMBIENT_AND_DIFFUSE: case GL_LIGHT_MODEL_AMBIENT:
+    return 4;
+  case GL_SPOT_DIRECTION:
+    return 3;
+  }
+  return 1;
+}
+
+int BufferSlot(GLenum target) {
+  return target == GL_ARRAY_BUFFER ? 0 : target == GL_ELEMENT_ARRAY_BUFFER ? 1 : 2;
+}
+
+/* unpacked with an alignment of 1 */
+long PixelBytes(GLsizei width, GLsizei height, GLenum format, GLenum type) {
+  int components = format == GL_RGBA ? 4 : format == GL_RGB ? 3 :
+    format == GL_LUMINANCE_ALPHA ? 2 : 1;
+
+  return (long) width * height * components * (type == GL_FLOAT ? 4 : 1);
+}
+
+/**************************************************/
+/* WRAPPERS                                       */
+/**************************************************/
+
+void CaptureClear(GLbitfield mask) {
+  CountCall(CALL_CLEAR, 0, 0);
+  Record(CALL_CLEAR, 1, mask, 0, 0, 0, NULL, 0);
+  glClear(mask);
+}
+
+void CaptureClearColor(GLclampf r, GLclampf g, GLclampf b, GLclampf a) {
+  CountCall(CALL_CLEAR_COLOR, 0, 0);
+  Record(CALL_CLEAR_COLOR, 4, r, g, b, a, NULL, 0);
+  glClearColor(r, g, b, a);
+}
+
+void CaptureFlush(void) {
+  CountCall(CALL_FLUSH, 0, 0);
+  Record(CALL_FLUSH, 0, 0, 0, 0, 0, NULL, 0);
+  glFlush();
+}
+
+/* counted but not recorded, the replay waits for itself */
+void CaptureFinish(void) {
+  CountCall(CALL_FINISH, 0, 0);
+  glFinish();
+}
+
+void CaptureViewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+  CountCall(CALL_VIEWPORT, 0, 0);
+  Record(CALL_VIEWPORT, 4, x, y, width, height, NULL, 0);
+  glViewport(x, y, width, height);
+}
+
+void CaptureMatrixMode(GLenum mode) {
+  CountCall(CALL_MATRIX_MODE, 0, 0);
+  Record(CALL_MATRIX_MODE, 1, mode, 0, 0, 0, NULL, 0);
+  glMatrixMode(mode);
+}
+
+void CaptureLoadIdentity(void) {
+  CountCall(CALL_LOAD_IDENTITY, 0, 0);
+  Record(CALL_LOAD_IDENTITY, 0, 0, 0, 0, 0, NULL, 0);
+  glLoadIdentity();
+}
+
+void CaptureLoadMatrixf(const GLfloat *m) {
+  double args[16];
+  int i;
+
+  CountCall(CALL_LOAD_MATRIX, 0, 0);
+  for(i = 0; i < 16; i++) args[i] = m[i];
+  RecordArgs(CALL_LOAD_MATRIX, 16, args, NULL, 0);
+  glLoadMatrixf(m);
+}
+
+void CapturePushMatrix(void) {
+  CountCall(CALL_PUSH_MATRIX, 0, 0);
+  Record(CALL_PUSH_MATRIX, 0, 0, 0, 0, 0, NULL, 0);
+  glPushMatrix();
+}
+
+void CapturePopMatrix(void) {
+  CountCall(CALL_POP_MATRIX, 0, 0);
+  Record(CALL_POP_MATRIX, 0, 0, 0, 0, 0, NULL, 0);
+  glPopMatrix();
+}
+
+void CaptureTranslatef(GLfloat x, GLfloat y, GLfloat z) {
+  CountCall(CALL_TRANSLATE, 0, 0);
+  Record(CALL_TRANSLATE, 3, x, y, z, 0, NULL, 0);
+  glTranslatef(x, y, z);
+}
+
+void CaptureRotatef(GLfloat angle, GLfloat x, GLfloat y, GLfloat z) {
+  CountCall(CALL_ROTATE, 0, 0);
+  Record(CALL_ROTATE, 4, angle, x, y, z, NULL, 0);
+  glRotatef(angle, x, y, z);
+}
+
+/* GLU calls GL itself, so it is recorded as the GLU call */
+void CaptureLookAt(GLdouble eyeX, GLdouble eyeY, GLdouble eyeZ, GLdouble x, GLdouble y,
+		   GLdouble z, GLdouble upX, GLdouble upY, GLdouble upZ) {
+  double args[9];
+
+  CountCall(CALL_LOOK_AT, 0, 0);
+  args[0] = eyeX; args[1] = eyeY; args[2] = eyeZ;
+  args[3] = x; args[4] = y; args[5] = z;
+  args[6] = upX; args[7] = upY; args[8] = upZ;
+  RecordArgs(CALL_LOOK_AT, 9, args, NULL, 0);
+  gluLookAt(eyeX, eyeY, eyeZ, x, y, z, upX, upY, upZ);
+}
+
+void CapturePerspective(GLdouble fovy, GLdouble aspect, GLdouble zNear, GLdouble zFar) {
+  CountCall(CALL_PERSPECTIVE, 0, 0);
+  Record(CALL_PERSPECTIVE, 4, fovy, aspect, zNear, zFar, NULL, 0);
+  gluPerspective(fovy, aspect, zNear, zFar);
+}
+
+void CaptureEnable(GLenum cap) {
+  CountCall(CALL_ENABLE, 0, 0);
+  Record(CALL_ENABLE, 1, cap, 0, 0, 0, NULL, 0);
+  glEnable(cap);
+}
+
+void CaptureDisable(GLenum cap) {
+  CountCall(CALL_DISABLE, 0, 0);
+  Record(CALL_DISABLE, 1, cap, 0, 0, 0, NULL, 0);
+  glDisable(cap);
+}
+
+void CaptureShadeModel(GLenum mode) {
+  CountCall(CALL_SHADE_MODEL, 0, 0);
+  Record(CALL_SHADE_MODEL, 1, mode, 0, 0, 0, NULL, 0);
+  glShadeModel(mode);
+}
+
+void CaptureBlendFunc(GLenum source, GLenum destination) {
+  CountCall(CALL_BLEND_FUNC, 0, 0);
+  Record(CALL_BLEND_FUNC, 2, source, destination, 0, 0, NULL, 0);
+  glBlendFunc(source, destination);
+}
+
+void CaptureHint(GLenum target, GLenum mode) {
+  CountCall(CALL_HINT, 0, 0);
+  Record(CALL_HINT, 2, target, mode, 0, 0, NULL, 0);
+  glHint(target, mode);
+}
+
+void CapturePointSize(GLfloat size) {
+  CountCall(CALL_POINT_SIZE, 0, 0);
+  Record(CALL_POINT_SIZE, 1, size, 0, 0, 0, NULL, 0);
+  glPointSize(size);
+}
+
+void CapturePixelStorei(GLenum pname, GLint param) {
+  CountCall(CALL_PIXEL_STORE, 0, 0);
+  Record(CALL_PIXEL_STORE, 2, pname, param, 0, 0, NULL, 0);
+  glPixelStorei(pname, param);
+}
+
+void CaptureTexEnvf(GLenum target, GLenum pname, GLfloat param) {
+  CountCall(CALL_TEX_ENV_F, 0, 0);
+  Record(CALL_TEX_ENV_F, 3, target, pname, param, 0, NULL, 0);
+  glTexEnvf(target, pname, param);
+}
+
+void CaptureTexEnvi(GLenum target, GLenum pname, GLint param) {
+  CountCall(CALL_TEX_ENV_I, 0, 0);
+  Record(CALL_TEX_ENV_I, 3, target, pname, param, 0, NULL, 0);
+  glTexEnvi(target, pname, param);
+}
+
+void CaptureLightfv(GLenum light, GLenum pname, const GLfloat *v) {
+  double args[6];
+  int i, n = LightParams(pname);
+
+  CountCall(CALL_LIGHT_FV, 0, 0);
+  args[0] = light;
+  args[1] = pname;
+  for(i = 0; i < n; i++) args[2+i] = v[i];
+  RecordArgs(CALL_LIGHT_FV, 2 + n, args, NULL, 0);
+  glLightfv(light, pname, v);
+}
+
+void CaptureLightModelfv(GLenum pname, const GLfloat *v) {
+  double args[5];
+  int i, n = LightParams(pname);
+
+  CountCall(CALL_LIGHT_MODEL_FV, 0, 0);
+  args[0] = pname;
+  for(i = 0; i < n; i++) args[1+i] = v[i];
+  RecordArgs(CALL_LIGHT_MODEL_FV, 1 + n, args, NULL, 0);
+  glLightModelfv(pname, v);
+}
+
+void CaptureLightModeli(GLenum pname, GLint param) {
+  CountCall(CALL_LIGHT_MODEL_I, 0, 0);
+  Record(CALL_LIGHT_MODEL_I, 2, pname, param, 0, 0, NULL, 0);
+  glLightModeli(pname, param);
+}
+
+void CaptureMaterialfv(GLenum face, GLenum pname, const GLfloat *v) {
+  double args[6];
+  int i, n = LightParams(pname);
+
+  CountCall(CALL_MATERIAL_FV, 0, 0);
+  args[0] = face;
+  args[1] = pname;
+  for(i = 0; i < n; i++) args[2+i] = v[i];
+  RecordArgs(CALL_MATERIAL_FV, 2 + n, args, NULL, 0);
+  glMaterialfv(face, pname, v);
+}
+
+void CaptureColor3f(GLfloat r, GLfloat g, GLfloat b) {
+  CountCall(CALL_COLOR, 0, 0);
+  Record(CALL_COLOR, 3, r, g, b, 0, NULL, 0);
+  glColor3f(r, g, b);
+}
+
+void CaptureRasterPos2f(GLfloat x, GLfloat y) {
+  CountCall(CALL_RASTER_POS, 0, 0);
+  Record(CALL_RASTER_POS, 2, x, y, 0, 0, NULL, 0);
+  glRasterPos2f(x, y);
+}
+
+/* unpacked with an alignment of 1 */
+void CaptureBitmap(GLsizei width, GLsizei height, GLfloat x, GLfloat y, GLfloat moveX,
+		   GLfloat moveY, const GLubyte *bitmap) {
+  double args[6];
+
+  CountCall(CALL_BITMAP, 0, 0);
+  args[0] = width; args[1] = height;
+  args[2] = x; args[3] = y;
+  args[4] = moveX; args[5] = moveY;
+  RecordArgs(CALL_BITMAP, 6, args, bitmap, bitmap != NULL ? (long) (width + 7) / 8 * height : 0);
+  glBitmap(width, height, x, y, moveX, moveY, bitmap);
+}
+
+void CaptureGenTextures(GLsizei n, GLuint *names) {
+  CountCall(CALL_GEN_TEXTURES, 0, 0);
+  glGenTextures(n, names);
+  Record(CALL_GEN_TEXTURES, 1, n, 0, 0, 0, names, n * sizeof(GLuint));
+}
+
+void CaptureDeleteTextures(GLsizei n, const GLuint *names) {
+  CountCall(CALL_DELETE_TEXTURES, 0, 0);
+  Record(CALL_DELETE_TEXTURES, 1, n, 0, 0, 0, names, n * sizeof(GLuint));
+  glDeleteTextures(n, names);
+}
+
+void CaptureBindTexture(GLenum target, GLuint name) {
+  CountCall(CALL_BIND_TEXTURE, 0, 0);
+  Record(CALL_BIND_TEXTURE, 2, target, name, 0, 0, NULL, 0);
+  glBindTexture(target, name);
+}
+
+void CaptureTexParameteri(GLenum target, GLenum pname, GLint param) {
+  CountCall(CALL_TEX_PARAMETER, 0, 0);
+  Record(CALL_TEX_PARAMETER, 3, target, pname, param, 0, NULL, 0);
+  glTexParameteri(target, pname, param);
+}
+
+/* pixels from a bound unpack buffer are an offset, counted when the
+   buffer was filled */
+void CaptureTexImage2D(GLenum target, GLint level, GLint internal, GLsizei width,
+		       GLsizei height, GLint border, GLenum format, GLenum type,
+		       const GLvoid *pixels) {
+  double args[9];
+  long bytes = captureUnpackBuffer || pixels == NULL ? 0 : PixelBytes(width, height, format, type);
+
+  CountCall(CALL_TEX_IMAGE, 0, bytes);
+  args[0] = target; args[1] = level; args[2] = internal;
+  args[3] = width; args[4] = height; args[5] = border;
+  args[6] = format; args[7] = type;
+  args[8] = captureUnpackBuffer ? (double) (long) pixels : -1;
+  RecordArgs(CALL_TEX_IMAGE, 9, args, pixels, bytes);
+  glTexImage2D(target, level, internal, width, height, border, format, type, pixels);
+}
+
+void CaptureCompressedTexImage2D(GLenum target, GLint level, GLenum internal, GLsizei width,
+				 GLsizei height, GLint border, GLsizei size, const GLvoid *data) {
+  double args[8];
+  long bytes = captureUnpackBuffer || data == NULL ? 0 : size;
+
+  CountCall(CALL_COMPRESSED_TEX_IMAGE, 0, bytes);
+  args[0] = target; args[1] = level; args[2] = internal;
+  args[3] = width; args[4] = height; args[5] = border;
+  args[6] = size;
+  args[7] = captureUnpackBuffer ? (double) (long) data : -1;
+  RecordArgs(CALL_COMPRESSED_TEX_IMAGE, 8, args, data, bytes);
+  glCompressedTexImage2D(target, level, internal, width, height, border, size, data);
+}
+
+void CaptureGenBuffers(GLsizei n, GLuint *names) {
+  CountCall(CALL_GEN_BUFFERS, 0, 0);
+  glGenBuffers(n, names);
+  Record(CALL_GEN_BUFFERS, 1, n, 0, 0, 0, names, n * sizeof(GLuint));
+}
+
+void CaptureBindBuffer(GLenum target, GLuint name) {
+  CountCall(CALL_BIND_BUFFER, 0, 0);
+  if(target == GL_PIXEL_UNPACK_BUFFER) captureUnpackBuffer = name;
+  Record(CALL_BIND_BUFFER, 2, target, name, 0, 0, NULL, 0);
+  glBindBuffer(target, name);
+}
+
+void CaptureBufferData(GLenum target, GLsizeiptr size, const GLvoid *data, GLenum usage) {
+  long bytes = data != NULL ? size : 0;
+
+  CountCall(CALL_BUFFER_DATA, 0, bytes);
+  captureBufferSizes[BufferSlot(target)] = size;
+  Record(CALL_BUFFER_DATA, 3, target, size, usage, 0, data, bytes);
+  glBufferData(target, size, data, usage);
+}
+
+void CaptureBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const GLvoid *data) {
+  CountCall(CALL_BUFFER_SUB_DATA, 0, size);
+  Record(CALL_BUFFER_SUB_DATA, 3, target, offset, size, 0, data, size);
+  glBufferSubData(target, offset, size, data);
+}
+
+/* recorded when it is unmapped, with whatever was written */
+void *CaptureMapBuffer(GLenum target, GLenum access) {
+  CountCall(CALL_MAP_BUFFER, 0, 0);
+  captureMappedTarget = target;
+  captureMapped = glMapBuffer(target, access);
+  return captureMapped;
+}
+
+GLboolean CaptureUnmapBuffer(GLenum target) {
+  long bytes = captureBufferSizes[BufferSlot(target)];
+
+  CountCall(CALL_UNMAP_BUFFER, 0, bytes);
+  if(captureMapped != NULL && target == captureMappedTarget)
+    Record(CALL_UNMAP_BUFFER, 1, target, 0, 0, 0, captureMapped, bytes);
+  captureMapped = NULL;
+  return glUnmapBuffer(target);
+}
+
+void CaptureGenVertexArrays(GLsizei n, GLuint *names) {
+  CountCall(CALL_GEN_VERTEX_ARRAYS, 0, 0);
+  glGenVertexArrays(n, names);
+  Record(CALL_GEN_VERTEX_ARRAYS, 1, n, 0, 0, 0, names, n * sizeof(GLuint));
+}
+
+void CaptureBindVertexArray(GLuint name) {
+  CountCall(CALL_BIND_VERTEX_ARRAY, 0, 0);
+  Record(CALL_BIND_VERTEX_ARRAY, 1, name, 0, 0, 0, NULL, 0);
+  glBindVertexArray(name);
+}
+
+void CaptureEnableClientState(GLenum array) {
+  CountCall(CALL_ENABLE_CLIENT_STATE, 0, 0);
+  Record(CALL_ENABLE_CLIENT_STATE, 1, array, 0, 0, 0, NULL, 0);
+  glEnableClientState(array);
+}
+
+void CaptureDisableClientState(GLenum array) {
+  CountCall(CALL_DISABLE_CLIENT_STATE, 0, 0);
+  Record(CALL_DISABLE_CLIENT_STATE, 1, array, 0, 0, 0, NULL, 0);
+  glDisableClientState(array);
+}
+
+/* pointers are offsets into the bound buffer */
+void CaptureVertexPointer(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer) {
+  CountCall(CALL_VERTEX_POINTER, 0, 0);
+  Record(CALL_VERTEX_POINTER, 4, size, type, stride, (long) pointer, NULL, 0);
+  glVertexPointer(size, type, stride, pointer);
+}
+
+void CaptureNormalPointer(GLenum type, GLsizei stride, const GLvoid *pointer) {
+  CountCall(CALL_NORMAL_POINTER, 0, 0);
+  Record(CALL_NORMAL_POINTER, 3, type, stride, (long) pointer, 0, NULL, 0);
+  glNormalPointer(type, stride, pointer);
+}
+
+void CaptureTexCoordPointer(GLint size, GLenum type, GLsizei stride, const GLvoid *pointer) {
+  CountCall(CALL_TEX_COORD_POINTER, 0, 0);
+  Record(CALL_TEX_COORD_POINTER, 4, size, type, stride, (long) pointer, NULL, 0);
+  glTexCoordPointer(size, type, stride, pointer);
+}
+
+void CaptureVertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalised,
+				GLsizei stride, const GLvoid *pointer) {
+  double args[6];
+
+  CountCall(CALL_VERTEX_ATTRIB_POINTER, 0, 0);
+  args[0] = index; args[1] = size; args[2] = type;
+  args[3] = normalised; args[4] = stride; args[5] = (long) pointer;
+  RecordArgs(CALL_VERTEX_ATTRIB_POINTER, 6, args, NULL, 0);
+  glVertexAttribPointer(index, size, type, normalised, stride, pointer);
+}
+
+void CaptureEnableVertexAttribArray(GLuint index) {
+  CountCall(CALL_ENABLE_VERTEX_ATTRIB_ARRAY, 0, 0);
+  Record(CALL_ENABLE_VERTEX_ATTRIB_ARRAY, 1, index, 0, 0, 0, NULL, 0);
+  glEnableVertexAttribArray(index);
+}
+
+void CaptureDisableVertexAttribArray(GLuint index) {
+  CountCall(CALL_DISABLE_VERTEX_ATTRIB_ARRAY, 0, 0);
+  Record(CALL_DISABLE_VERTEX_ATTRIB_ARRAY, 1, index, 0, 0, 0, NULL, 0);
+  glDisableVertexAttribArray(index);
+}
+
+void CaptureVertexAttribDivisor(GLuint index, GLuint divisor) {
+  CountCall(CALL_VERTEX_ATTRIB_DIVISOR, 0, 0);
+  Record(CALL_VERTEX_ATTRIB_DIVISOR, 2, index, divisor, 0, 0, NULL, 0);
+  glVertexAttribDivisor(index, divisor);
+}
+
+GLuint CaptureCreateShader(GLenum type) {
+  GLuint shader = glCreateShader(type);
+
+  CountCall(CALL_CREATE_SHADER, 0, 0);
+  Record(CALL_CREATE_SHADER, 2, type, shader, 0, 0, NULL, 0);
+  return shader;
+}
+
+/* recorded as one string */
+void CaptureShaderSource(GLuint shader, GLsizei count, const GLchar **strings,
+			 const GLint *lengths) {
+  char *source;
+  long bytes = 1;
+  int i;
+
+  CountCall(CALL_SHADER_SOURCE, 0, 0);
+  if(capturing) {
+    for(i = 0; i < count; i++) bytes += lengths != NULL ? lengths[i] : strlen(strings[i]);
+    source = malloc(bytes);
+    if(source == NULL) {
+      fprintf(stderr, "ERROR: Unable to allocate %ld bytes of shader source\n", bytes);
+      exit(1);
+    }
+    for(bytes = 0, i = 0; i < count; i++) {
+      memcpy(source + bytes, strings[i], lengths != NULL ? lengths[i] : strlen(strings[i]));
+      bytes += lengths != NULL ? lengths[i] : strlen(strings[i]);
+    }
+    source[bytes++] = '\0';
+    Record(CALL_SHADER_SOURCE, 1, shader, 0, 0, 0, source, bytes);
+    free(source);
+  }
+  glShaderSource(shader, count, strings, lengths);
+}
+
+void CaptureCompileShader(GLuint shader) {
+  CountCall(CALL_COMPILE_SHADER, 0, 0);
+  Record(CALL_COMPILE_SHADER, 1, shader, 0, 0, 0, NULL, 0);
+  glCompileShader(shader);
+}
+
+void CaptureGetShaderiv(GLuint shader, GLenum pname, GLint *param) {
+  CountCall(CALL_GET_SHADER, 0, 0);
+  glGetShaderiv(shader, pname, param);
+}
+
+void CaptureGetShaderInfoLog(GLuint shader, GLsizei size, GLsizei *length, GLchar *log) {
+  CountCall(CALL_GET_SHADER_INFO_LOG, 0, 0);
+  glGetShaderInfoLog(shader, size, length, log);
+}
+
+GLuint CaptureCreateProgram(void) {
+  GLuint program = glCreateProgram();
+
+  CountCall(CALL_CREATE_PROGRAM, 0, 0);
+  Record(CALL_CREATE_PROGRAM, 1, program, 0, 0, 0, NULL, 0);
+  return program;
+}
+
+void CaptureAttachShader(GLuint program, GLuint shader) {
+  CountCall(CALL_ATTACH_SHADER, 0, 0);
+  Record(CALL_ATTACH_SHADER, 2, program, shader, 0, 0, NULL, 0);
+  glAttachShader(program, shader);
+}
+
+void CaptureBindAttribLocation(GLuint program, GLuint index, const GLchar *name) {
+  CountCall(CALL_BIND_ATTRIB_LOCATION, 0, 0);
+  Record(CALL_BIND_ATTRIB_LOCATION, 2, program, index, 0, 0, name, strlen(name) + 1);
+  glBindAttribLocation(program, index, name);
+}
+
+void CaptureLinkProgram(GLuint program) {
+  CountCall(CALL_LINK_PROGRAM, 0, 0);
+  Record(CALL_LINK_PROGRAM, 1, program, 0, 0, 0, NULL, 0);
+  glLinkProgram(program);
+}
+
+void CaptureGetProgramiv(GLuint program, GLenum pname, GLint *param) {
+  CountCall(CALL_GET_PROGRAM, 0, 0);
+  glGetProgramiv(program, pname, param);
+}
+
+void CaptureGetProgramInfoLog(GLuint program, GLsizei size, GLsizei *length, GLchar *log) {
+  CountCall(CALL_GET_PROGRAM_INFO_LOG, 0, 0);
+  glGetProgramInfoLog(program, size, length, log);
+}
+
+void CaptureUseProgram(GLuint program) {
+  CountCall(CALL_USE_PROGRAM, 0, 0);
+  Record(CALL_USE_PROGRAM, 1, program, 0, 0, 0, NULL, 0);
+  glUseProgram(program);
+}
+
+/* recorded so the replay can look up its own */
+GLint CaptureGetUniformLocation(GLuint program, const GLchar *name) {
+  GLint location = glGetUniformLocation(program, name);
+
+  CountCall(CALL_GET_UNIFORM_LOCATION, 0, 0);
+  Record(CALL_GET_UNIFORM_LOCATION, 2, program, location, 0, 0, name, strlen(name) + 1);
+  return location;
+}
+
+void CaptureUniform1iv(GLint location, GLsizei count, const GLint *v) {
+  CountCall(CALL_UNIFORM_1IV, 0, 0);
+  Record(CALL_UNIFORM_1IV, 2, location, count, 0, 0, v, count * sizeof(GLint));
+  glUniform1iv(location, count, v);
+}
+
+void CaptureGetFloatv(GLenum pname, GLfloat *v) {
+  CountCall(CALL_GET_FLOAT, 0, 0);
+  glGetFloatv(pname, v);
+}
+
+GLboolean CaptureIsEnabled(GLenum cap) {
+  CountCall(CALL_IS_ENABLED, 0, 0);
+  return glIsEnabled(cap);
+}
+
+void CaptureDrawArrays(GLenum mode, GLint first, GLsizei count) {
+  CountCall(CALL_DRAW_ARRAYS, count, 0);
+  Record(CALL_DRAW_ARRAYS, 3, mode, first, count, 0, NULL, 0);
+  glDrawArrays(mode, first, count);
+}
+
+/* indices are an offset into the bound element buffer */
+void CaptureDrawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices) {
+  CountCall(CALL_DRAW_ELEMENTS, count, 0);
+  Record(CALL_DRAW_ELEMENTS, 4, mode, count, type, (long) indices, NULL, 0);
+  glDrawElements(mode, count, type, indices);
+}
+
+void CaptureDrawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instances) {
+  CountCall(CALL_DRAW_ARRAYS_INSTANCED, (long) count * instances, 0);
+  Record(CALL_DRAW_ARRAYS_INSTANCED, 4, mode, first, count, instances, NULL, 0);
+  glDrawArraysInstanced(mode, first, count, instances);
+}
+
+void CaptureDrawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices,
+				  GLsizei instances) {
+  double args[5];
+
+  CountCall(CALL_DRAW_ELEMENTS_INSTANCED, (long) count * instances, 0);
+  args[0] = mode; args[1] = count; args[2] = type;
+  args[3] = (long) indices; args[4] = instances;
+  RecordArgs(CALL_DRAW_ELEMENTS_INSTANCED, 5, args, NULL, 0);
+  glDrawElementsInstanced(mode, count, type, indices, instances);
+}
+
+/* from here on every call goes through the wrappers */
+#undef glBindBuffer
+#undef glBufferData
+#undef glBufferSubData
+#undef glCompressedTexImage2D
+#undef glGenBuffers
+#undef glMapBuffer
+#undef glUnmapBuffer
+#undef glGenVertexArrays
+#undef glBindVertexArray
+#undef glCreateShader
+#undef glShaderSource
+#undef glCompileShader
+#undef glGetShaderiv
+#undef glGetShaderInfoLog
+#undef glCreateProgram
+#undef glAttachShader
+#undef glBindAttribLocation
+#undef glLinkProgram
+#undef glGetProgramiv
+#undef glGetProgramInfoLog
+#undef glUseProgram
+#undef glGetUniformLocation
+#undef glUniform1iv
+#undef glVertexAttribPointer
+#undef glEnableVertexAttribArray
+#undef glDisableVertexAttribArray
+#undef glDrawArraysInstanced
+#undef glDrawElementsInstanced
+#undef glVertexAttribDivisor
+#define glClear CaptureClear
+#define glClearColor CaptureClearColor
+#define glFlush CaptureFlush
+#define glFinish CaptureFinish
+#define glViewport CaptureViewport
+#define glMatrixMode CaptureMatrixMode
+#define glLoadIdentity CaptureLoadIdentity
+#define glLoadMatrixf CaptureLoadMatrixf
+#define glPushMatrix CapturePushMatrix
+#define glPopMatrix CapturePopMatrix
+#define glTranslatef CaptureTranslatef
+#define glRotatef CaptureRotatef
+#define gluLookAt CaptureLookAt
+#define gluPerspective CapturePerspective
+#define glEnable CaptureEnable
+#define glDisable CaptureDisable
+#define glShadeModel CaptureShadeModel
+#define glBlendFunc CaptureBlendFunc
+#define glHint CaptureHint
+#define glPointSize CapturePointSize
+#define glPixelStorei CapturePixelStorei
+#define glTexEnvf CaptureTexEnvf
+#define glTexEnvi CaptureTexEnvi
+#define glLightfv CaptureLightfv
+#define glLightModelfv CaptureLightModelfv
+#define glLightModeli CaptureLightModeli
+#define glMaterialfv CaptureMaterialfv
+#define glColor3f CaptureColor3f
+#define glRasterPos2f CaptureRasterPos2f
+#define glBitmap CaptureBitmap
+#define glGenTextures CaptureGenTextures
+#define glDeleteTextures CaptureDeleteTextures
+#define glBindTexture CaptureBindTexture
+#define glTexParameteri CaptureTexParameteri
+#define glTexImage2D CaptureTexImage2D
+#define glCompressedTexImage2D CaptureCompressedTexImage2D
+#define glGenBuffers CaptureGenBuffers
+#define glBindBuffer CaptureBindBuffer
+#define glBufferData CaptureBufferData
+#define glBufferSubData CaptureBufferSubData
+#define glMapBuffer CaptureMapBuffer
+#define glUnmapBuffer CaptureUnmapBuffer
+#define glGenVertexArrays CaptureGenVertexArrays
+#define glBindVertexArray CaptureBindVertexArray
+#define glEnableClientState CaptureEnableClientState
+#define glDisableClientState CaptureDisableClientState
+#define glVertexPointer CaptureVertexPointer
+#define glNormalPointer CaptureNormalPointer
+#define glTexCoordPointer CaptureTexCoordPointer
+#define glVertexAttribPointer CaptureVertexAttribPointer
+#define glEnableVertexAttribArray CaptureEnableVertexAttribArray
+#define glDisableVertexAttribArray CaptureDisableVertexAttribArray
+#define glVertexAttribDivisor CaptureVertexAttribDivisor
+#define glCreateShader CaptureCreateShader
+#define glShaderSource CaptureShaderSource
+#define glCompileShader CaptureCompileShader
+#define glGetShaderiv CaptureGetShaderiv
+#define glGetShaderInfoLog CaptureGetShaderInfoLog
+#define glCreateProgram CaptureCreateProgram
+#define glAttachShader CaptureAttachShader
+#define glBindAttribLocation CaptureBindAttribLocation
+#define glLinkProgram CaptureLinkProgram
+#define glGetProgramiv CaptureGetProgramiv
+#define glGetProgramInfoLog CaptureGetProgramInfoLog
+#define glUseProgram CaptureUseProgram
+#define glGetUniformLocation CaptureGetUniformLocation
+#define glUniform1iv CaptureUniform1iv
+#define glGetFloatv CaptureGetFloatv
+#define glIsEnabled CaptureIsEnabled
+#define glDrawArrays CaptureDrawArrays
+#define glDrawElements CaptureDrawElements
+#define glDrawArraysInstanced CaptureDrawArraysInstanced
+#define glDrawElementsInstanced CaptureDrawElementsInstanced
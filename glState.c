@@ -0,0 +1,248 @@
+/*************************************************************************
+ * The GL state the scene changes every frame, as it was last set, so   *
+ * calls that would leave it as it is never reach the driver. Enables,  *
+ * lights, materials, the light model and the bound texture are kept    *
+ * track of, starting unknown. Anything that changes them behind the    *
+ * tracker's back must call ForgetState() afterwards                    *
+ *************************************************************************/
+
+#define STATE_LIGHTS 8
+
+/* kinds of call, for counting */
+#define STATE_ENABLE 0
+#define STATE_LIGHT 1
+#define STATE_MATERIAL 2
+#define STATE_TEXTURE 3
+#define STATE_KINDS 4
+
+/* one parameter of up to four floats */
+typedef struct {
+  GLfloat v[4];
+  int known;
+} stateValue;
+
+typedef struct {
+  stateValue ambient, diffuse, specular;
+  stateValue position, direction;	/* in eye coordinates */
+  stateValue cutoff;
+} lightState;
+
+typedef struct {
+  stateValue ambient, diffuse, specular, emission, shininess;
+} materialState;
+
+/* the enables kept track of, anything else always goes through */
+GLenum stateCaps[] = {GL_LIGHT0, GL_LIGHT1, GL_LIGHT2, GL_LIGHT3,
+		      GL_LIGHT4, GL_LIGHT5, GL_LIGHT6, GL_LIGHT7,
+		      GL_LIGHTING, GL_TEXTURE_2D, GL_BLEND, GL_DEPTH_TEST,
+		      GL_POINT_SMOOTH, GL_POINT_SPRITE};
+#define STATE_CAPS (sizeof(stateCaps) / sizeof(stateCaps[0]))
+
+signed char stateEnabled[STATE_CAPS];	/* -1 if unknown */
+lightState stateLights[STATE_LIGHTS];
+materialState stateMaterials[2];	/* front and back */
+stateValue stateModelAmbient, stateTwoSide;
+GLuint stateTexture;
+int stateTextureKnown;
+
+/* since ResetStateCounters() */
+int stateIssued[STATE_KINDS], stateSkipped[STATE_KINDS];
+char *stateKindNames[STATE_KINDS] = {"enables", "lights", "materials", "textures"};
+
+void StateEnable(GLenum, int);
+int StateEnabled(GLenum);
+void StateLightfv(GLenum, GLenum, GLfloat *);
+void StateLightf(GLenum, GLenum, GLfloat);
+void StatePlaceLight(GLenum, GLenum, GLfloat *, GLfloat *);
+void StateMaterialfv(GLenum, GLenum, GLfloat *);
+void StateMaterialf(GLenum, GLenum, GLfloat);
+void StateLightModelfv(GLenum, GLfloat *);
+void StateLightModeli(GLenum, GLint);
+void StateBindTexture(GLuint);
+void ForgetState(void);
+void ResetStateCounters(void);
+void ReportState(void);
+int StateCap(GLenum);
+stateValue *LightValue(GLenum, GLenum);
+int SameValue(stateValue *, GLfloat *, int);
+void SetValue(stateValue *, GLfloat *, int);
+int CountStateCall(int, int);
+
+void StateEnable(GLenum cap, int on) {
+  int i = StateCap(cap);
+
+  on = on != 0;
+  if(!CountStateCall(STATE_ENABLE, i < 0 || stateEnabled[i] != on)) return;
+  if(on) glEnable(cap);
+  else glDisable(cap);
+  if(i >= 0) stateEnabled[i] = on;
+}
+
+/* from the tracker when it knows, saving a round trip */
+int StateEnabled(GLenum cap) {
+  int i = StateCap(cap);
+
+  if(i >= 0 && stateEnabled[i] >= 0) return stateEnabled[i];
+  return glIsEnabled(cap);
+}
+
+/* colours and the spot cutoff, which don't depend on the modelview */
+void StateLightfv(GLenum light, GLenum pname, GLfloat *v) {
+  stateValue *s = LightValue(light, pname);
+  int n = pname == GL_SPOT_CUTOFF ? 1 : 4;
+
+  if(!CountStateCall(STATE_LIGHT, s == NULL || !SameValue(s, v, n))) return;
+  glLightfv(light, pname, v);
+  if(s != NULL) SetValue(s, v, n);
+}
+
+void StateLightf(GLenum light, GLenum pname, GLfloat v) {
+  StateLightfv(light, pname, &v);
+}
+
+/* GL_POSITION or GL_SPOT_DIRECTION, which GL keeps in eye coordinates.
+   modelview must be the current modelview matrix, it is used to tell
+   whether the light has really moved */
+void StatePlaceLight(GLenum light, GLenum pname, GLfloat *v, GLfloat *modelview) {
+  stateValue *s = LightValue(light, pname);
+  GLfloat eye[4];
+  int n = pname == GL_POSITION ? 4 : 3;
+  int i;
+
+  for(i = 0; i < n; i++)
+    eye[i] = modelview[i] * v[0] + modelview[4+i] * v[1] + modelview[8+i] * v[2] +
+      (n == 4 ? modelview[12+i] * v[3] : 0.0);
+  if(!CountStateCall(STATE_LIGHT, s == NULL || !SameValue(s, eye, n))) return;
+  glLightfv(light, pname, v);
+  if(s != NULL) SetValue(s, eye, n);
+}
+
+void StateMaterialfv(GLenum face, GLenum pname, GLfloat *v) {
+  materialState *m;
+  stateValue *s[4];
+  int n = pname == GL_SHININESS ? 1 : 4;
+  int count = 0, changed = 0;
+  int f, i;
+
+  for(f = 0; f < 2; f++) {
+    if(face != GL_FRONT_AND_BACK && face != (f == 0 ? GL_FRONT : GL_BACK)) continue;
+    m = &stateMaterials[f];
+    switch(pname) {
+    case GL_AMBIENT_AND_DIFFUSE:
+      s[count++] = &m->ambient;
+      s[count++] = &m->diffuse;
+      break;
+    case GL_AMBIENT: s[count++] = &m->ambient; break;
+    case GL_DIFFUSE: s[count++] = &m->diffuse; break;
+    case GL_SPECULAR: s[count++] = &m->specular; break;
+    case GL_EMISSION: s[count++] = &m->emission; break;
+    case GL_SHININESS: s[count++] = &m->shininess; break;
+    default: changed = 1;
+    }
+  }
+  for(i = 0; i < count; i++) changed |= !SameValue(s[i], v, n);
+  if(!CountStateCall(STATE_MATERIAL, changed)) return;
+  glMaterialfv(face, pname, v);
+  for(i = 0; i < count; i++) SetValue(s[i], v, n);
+}
+
+void StateMaterialf(GLenum face, GLenum pname, GLfloat v) {
+  StateMaterialfv(face, pname, &v);
+}
+
+/* GL_LIGHT_MODEL_AMBIENT */
+void StateLightModelfv(GLenum pname, GLfloat *v) {
+  stateValue *s = pname == GL_LIGHT_MODEL_AMBIENT ? &stateModelAmbient : NULL;
+
+  if(!CountStateCall(STATE_LIGHT, s == NULL || !SameValue(s, v, 4))) return;
+  glLightModelfv(pname, v);
+  if(s != NULL) SetValue(s, v, 4);
+}
+
+/* GL_LIGHT_MODEL_TWO_SIDE */
+void StateLightModeli(GLenum pname, GLint i) {
+  stateValue *s = pname == GL_LIGHT_MODEL_TWO_SIDE ? &stateTwoSide : NULL;
+  GLfloat v = (GLfloat) i;
+
+  if(!CountStateCall(STATE_LIGHT, s == NULL || !SameValue(s, &v, 1))) return;
+  glLightModeli(pname, i);
+  if(s != NULL) SetValue(s, &v, 1);
+}
+
+/* to GL_TEXTURE_2D */
+void StateBindTexture(GLuint name) {
+  if(!CountStateCall(STATE_TEXTURE, !stateTextureKnown || stateTexture != name)) return;
+  glBindTexture(GL_TEXTURE_2D, name);
+  stateTexture = name;
+  stateTextureKnown = 1;
+}
+
+/* everything could have changed */
+void ForgetState(void) {
+  memset(stateEnabled, -1, sizeof(stateEnabled));
+  memset(stateLights, 0, sizeof(stateLights));
+  memset(stateMaterials, 0, sizeof(stateMaterials));
+  stateModelAmbient.known = stateTwoSide.known = 0;
+  stateTextureKnown = 0;
+}
+
+/* at the start of each frame */
+void ResetStateCounters(void) {
+  memset(stateIssued, 0, sizeof(stateIssued));
+  memset(stateSkipped, 0, sizeof(stateSkipped));
+}
+
+/* calls made and dropped since the counters were reset */
+void ReportState(void) {
+  int issued = 0, skipped = 0;
+  int i;
+
+  printf("%-12s %8s %8s\n", "GL state", "issued", "skipped");
+  for(i = 0; i < STATE_KINDS; i++) {
+    printf("%-12s %8d %8d\n", stateKindNames[i], stateIssued[i], stateSkipped[i]);
+    issued += stateIssued[i];
+    skipped += stateSkipped[i];
+  }
+  printf("%-12s %8d %8d\n", "total", issued, skipped);
+}
+
+/* where cap is in stateCaps[], -1 if it isn't kept track of */
+int StateCap(GLenum cap) {
+  int i;
+
+  for(i = 0; i < (int) STATE_CAPS; i++) if(stateCaps[i] == cap) return i;
+  return -1;
+}
+
+/* NULL if it isn't kept track of */
+stateValue *LightValue(GLenum light, GLenum pname) {
+  lightState *l;
+
+  if(light < GL_LIGHT0 || light >= GL_LIGHT0 + STATE_LIGHTS) return NULL;
+  l = &stateLights[light - GL_LIGHT0];
+  switch(pname) {
+  case GL_AMBIENT: return &l->ambient;
+  case GL_DIFFUSE: return &l->diffuse;
+  case GL_SPECULAR: return &l->specular;
+  case GL_POSITION: return &l->position;
+  case GL_SPOT_DIRECTION: return &l->direction;
+  case GL_SPOT_CUTOFF: return &l->cutoff;
+  }
+  return NULL;
+}
+
+int SameValue(stateValue *s, GLfloat *v, int n) {
+  return s->known && memcmp(s->v, v, n * sizeof(GLfloat)) == 0;
+}
+
+void SetValue(stateValue *s, GLfloat *v, int n) {
+  memcpy(s->v, v, n * sizeof(GLfloat));
+  s->known = 1;
+}
+
+/* returns changed, so the call is made only if it is needed */
+int CountStateCall(int kind, int changed) {
+  if(changed) stateIssued[kind]++;
+  else stateSkipped[kind]++;
+  return changed;
+}
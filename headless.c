@@ -0,0 +1,111 @@
+/*************************************************************************
+ * Offscreen rendering through EGL so the program can run on machines    *
+ * with no display and no GPU (Mesa's surfaceless platform + llvmpipe)   *
+ *************************************************************************/
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+void InitHeadless(int, int);
+void SaveSnapshot(char *, int, int);
+
+void InitHeadless(int width, int height) {
+  PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay;
+  PFNGLGENFRAMEBUFFERSPROC genFramebuffers;
+  PFNGLBINDFRAMEBUFFERPROC bindFramebuffer;
+  PFNGLGENRENDERBUFFERSPROC genRenderbuffers;
+  PFNGLBINDRENDERBUFFERPROC bindRenderbuffer;
+  PFNGLRENDERBUFFERSTORAGEPROC renderbufferStorage;
+  PFNGLFRAMEBUFFERRENDERBUFFERPROC framebufferRenderbuffer;
+  PFNGLCHECKFRAMEBUFFERSTATUSPROC checkFramebufferStatus;
+  EGLDisplay display = EGL_NO_DISPLAY;
+  EGLContext context;
+  EGLint major, minor;
+  GLuint framebuffer, renderbuffers[2];
+
+  /* prefer the surfaceless platform, it needs no X server or DRM device */
+  getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+    eglGetProcAddress("eglGetPlatformDisplayEXT");
+  if(getPlatformDisplay != NULL)
+    display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+  if(display == EGL_NO_DISPLAY)
+    display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  if(display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+    fprintf(stderr, "ERROR: Unable to open an EGL display\n");
+    exit(1);
+  }
+
+  /* a compatibility context with no surface */
+  eglBindAPI(EGL_OPENGL_API);
+  context = eglCreateContext(display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, NULL);
+  if(context == EGL_NO_CONTEXT ||
+     !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+    fprintf(stderr, "ERROR: Unable to create an offscreen OpenGL context\n");
+    exit(1);
+  }
+
+  genFramebuffers = (PFNGLGENFRAMEBUFFERSPROC) eglGetProcAddress("glGenFramebuffers");
+  bindFramebuffer = (PFNGLBINDFRAMEBUFFERPROC) eglGetProcAddress("glBindFramebuffer");
+  genRenderbuffers = (PFNGLGENRENDERBUFFERSPROC) eglGetProcAddress("glGenRenderbuffers");
+  bindRenderbuffer = (PFNGLBINDRENDERBUFFERPROC) eglGetProcAddress("glBindRenderbuffer");
+  renderbufferStorage = (PFNGLRENDERBUFFERSTORAGEPROC)
+    eglGetProcAddress("glRenderbufferStorage");
+  framebufferRenderbuffer = (PFNGLFRAMEBUFFERRENDERBUFFERPROC)
+    eglGetProcAddress("glFramebufferRenderbuffer");
+  checkFramebufferStatus = (PFNGLCHECKFRAMEBUFFERSTATUSPROC)
+    eglGetProcAddress("glCheckFramebufferStatus");
+  if(genFramebuffers == NULL || bindFramebuffer == NULL || genRenderbuffers == NULL ||
+     bindRenderbuffer == NULL || renderbufferStorage == NULL ||
+     framebufferRenderbuffer == NULL || checkFramebufferStatus == NULL) {
+    fprintf(stderr, "ERROR: Framebuffer objects are not supported\n");
+    exit(1);
+  }
+
+  /* there is no window so render into a framebuffer object instead */
+  genRenderbuffers(2, renderbuffers);
+  bindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+  renderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+  bindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+  renderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+
+  genFramebuffers(1, &framebuffer);
+  bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  framebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			  GL_RENDERBUFFER, renderbuffers[0]);
+  framebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+			  GL_RENDERBUFFER, renderbuffers[1]);
+  if(checkFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    fprintf(stderr, "ERROR: Offscreen framebuffer is incomplete\n");
+    exit(1);
+  }
+
+  fprintf(stderr, "Headless rendering with %s (EGL %d.%d)\n",
+	  glGetString(GL_RENDERER), major, minor);
+}
+
+/* write the current frame as a binary PPM, top row first */
+void SaveSnapshot(char *fileName, int width, int height) {
+  FILE *outFile;
+  unsigned char *pixels;
+  int i;
+
+  pixels = malloc(width * height * 3);
+  if(pixels == NULL) {
+    fprintf(stderr, "ERROR: Unable to allocate snapshot buffer\n");
+    return;
+  }
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+
+  outFile = fopen(fileName, "wb");
+  if(outFile == NULL) {
+    fprintf(stderr, "Can not open file %s\n", fileName);
+    free(pixels);
+    return;
+  }
+  fprintf(outFile, "P6\n%d %d\n255\n", width, height);
+  for(i = height - 1; i >= 0; i--)
+    fwrite(pixels + i * width * 3, 1, width * 3, outFile);
+  fclose(outFile);
+  free(pixels);
+}
@@ -0,0 +1,151 @@
+/*************************************************************************
+ * Levels of detail. A lodMesh is built several times over, finest      *
+ * first, by a function given how many segments to go round its curves  *
+ * with. Each frame every copy drawn gets the coarsest level that keeps *
+ * the segments about LOD_EDGE_PIXELS long at the size its bounding     *
+ * sphere comes out on the screen. Each copy remembers its level and    *
+ * only changes once well past the size it changes at, so one sitting   *
+ * on the boundary doesn't flicker between the two                      *
+ *************************************************************************/
+
+#define LOD_LEVELS 3
+/* about what the fixed view has always been drawn with */
+#define LOD_EDGE_PIXELS 10.0
+#define LOD_HYSTERESIS 0.15
+#define LOD_NAME 24
+
+typedef struct {
+  mesh levels[LOD_LEVELS];	/* finest first */
+  int segments[LOD_LEVELS];
+  char names[LOD_LEVELS][LOD_NAME];
+  GLfloat centre[3], radius;	/* bounding sphere of the finest */
+} lodMesh;
+
+int lodViewHeight = 1;		/* in pixels */
+int fixedLevel = -1;		/* every copy at this level instead */
+int meshesAtLevel[LOD_LEVELS];	/* this frame's */
+int pointsAtLevel[LOD_LEVELS];
+
+void BuildLodMesh(lodMesh *, char *, void (*)(mesh *, int), int[LOD_LEVELS]);
+void SetLodViewport(int);
+void StartLodFrame(void);
+void QueueLodMesh(renderQueue *, lodMesh *, int *, GLfloat *, int);
+float *PointsByLevel(frameArena *, float *, int, GLfloat, int[LOD_LEVELS], int[LOD_LEVELS]);
+void ReportLod(void);
+float ProjectedSize(GLfloat *, GLfloat[3], GLfloat);
+int ChooseLevel(int[LOD_LEVELS], int, float);
+float LevelLimit(int[LOD_LEVELS], int);
+
+/* build(m, segments) adds one level to m, which is then uploaded */
+void BuildLodMesh(lodMesh *l, char *name, void (*build)(mesh *, int), int segments[LOD_LEVELS]) {
+  GLfloat low[3], high[3];
+  meshPart *part;
+  int i, k;
+
+  for(k = 0; k < 3; k++) {
+    low[k] = 1e30;
+    high[k] = -1e30;
+  }
+  for(i = 0; i < LOD_LEVELS; i++) {
+    l->segments[i] = segments[i];
+    sprintf(l->names[i], "%.*s %d", LOD_NAME - 12, name, segments[i]);
+    InitMesh(&l->levels[i], l->names[i]);
+    build(&l->levels[i], segments[i]);
+    UploadMesh(&l->levels[i]);
+  }
+  for(part = l->levels[0].parts; part < l->levels[0].parts + l->levels[0].partCount; part++)
+    for(k = 0; k < 3; k++) {
+      if(part->low[k] < low[k]) low[k] = part->low[k];
+      if(part->high[k] > high[k]) high[k] = part->high[k];
+    }
+  for(k = 0; k < 3; k++) l->centre[k] = (low[k] + high[k]) / 2;
+  l->radius = sqrt((high[0] - low[0]) * (high[0] - low[0]) + (high[1] - low[1]) * (high[1] - low[1]) +
+		   (high[2] - low[2]) * (high[2] - low[2])) / 2;
+}
+
+/* with the projection culling uses */
+void SetLodViewport(int height) {
+  lodViewHeight = height;
+}
+
+void StartLodFrame(void) {
+  memset(meshesAtLevel, 0, sizeof(meshesAtLevel));
+  memset(pointsAtLevel, 0, sizeof(pointsAtLevel));
+}
+
+/* one copy of l, drawn through matrix. level is the copy's own, -1 to
+   start with */
+void QueueLodMesh(renderQueue *q, lodMesh *l, int *level, GLfloat *matrix, int pass) {
+  if(fixedLevel >= 0) *level = fixedLevel < LOD_LEVELS ? fixedLevel : LOD_LEVELS - 1;
+  else *level = ChooseLevel(l->segments, *level, ProjectedSize(matrix, l->centre, l->radius));
+  meshesAtLevel[*level]++;
+  QueueCulledMesh(q, &l->levels[*level], matrix, pass);
+}
+
+/* interleaved x, y, z points of the same radius, copied into the arena
+   in order of their level in the world view, with how many are at each.
+   Points have nothing to tell them apart from one frame to the next, so
+   they change level without any hysteresis */
+float *PointsByLevel(frameArena *a, float *points, int count, GLfloat radius,
+		     int segments[LOD_LEVELS], int counts[LOD_LEVELS]) {
+  unsigned char *levels = ArenaAlloc(a, count + 1);
+  float *sorted = ArenaAlloc(a, count * 3 * sizeof(float) + 1);
+  int next[LOD_LEVELS];
+  int i, j, sum;
+
+  memset(counts, 0, LOD_LEVELS * sizeof(int));
+  for(i = 0; i < count; i++) {
+    if(fixedLevel >= 0) levels[i] = fixedLevel < LOD_LEVELS ? fixedLevel : LOD_LEVELS - 1;
+    else levels[i] = ChooseLevel(segments, -1, ProjectedSize(viewMatrix, points + 3*i, radius));
+    counts[levels[i]]++;
+  }
+  for(sum = 0, i = 0; i < LOD_LEVELS; i++) {
+    next[i] = sum;
+    sum += counts[i];
+    pointsAtLevel[i] += counts[i];
+  }
+  for(i = 0; i < count; i++) {
+    j = next[levels[i]]++;
+    sorted[3*j] = points[3*i];
+    sorted[3*j+1] = points[3*i+1];
+    sorted[3*j+2] = points[3*i+2];
+  }
+  return sorted;
+}
+
+void ReportLod(void) {
+  int i;
+
+  printf("Detail levels%s:", fixedLevel >= 0 ? " (fixed)" : "");
+  for(i = 0; i < LOD_LEVELS; i++) printf(" %d", meshesAtLevel[i]);
+  printf(" meshes,");
+  for(i = 0; i < LOD_LEVELS; i++) printf(" %d", pointsAtLevel[i]);
+  printf(" bubbles, finest first\n");
+}
+
+/* pixels across the screen a sphere at centre, seen through matrix,
+   would be */
+float ProjectedSize(GLfloat *matrix, GLfloat centre[3], GLfloat radius) {
+  GLfloat z = -(matrix[2] * centre[0] + matrix[6] * centre[1] + matrix[10] * centre[2] + matrix[14]);
+
+  /* close enough to be all round the eye */
+  if(z <= radius) return 1e30;
+  return radius * cullProjection[5] * lodViewHeight / z;
+}
+
+/* from level, or from scratch if it is -1 */
+int ChooseLevel(int segments[LOD_LEVELS], int level, float pixels) {
+  if(level < 0) {
+    for(level = LOD_LEVELS - 1; level > 0 && pixels > LevelLimit(segments, level); level--);
+    return level;
+  }
+  while(level > 0 && pixels > LevelLimit(segments, level) * (1.0 + LOD_HYSTERESIS)) level--;
+  while(level < LOD_LEVELS - 1 && pixels < LevelLimit(segments, level + 1) * (1.0 - LOD_HYSTERESIS))
+    level++;
+  return level;
+}
+
+/* the most pixels across a level is good for */
+float LevelLimit(int segments[LOD_LEVELS], int level) {
+  return segments[level] * LOD_EDGE_PIXELS / PI;
+}
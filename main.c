@@ -9,42 +9,58 @@
 #include <windows.h>
 #endif
 
-#include "textureLoad.c"
-
-#define WIN_X 400
-#define WIN_Y 400
-
 /* in case math.h does not define PI */
 #ifndef PI
 #define PI 3.141593
 #endif
 
-/* types */
-typedef struct {
-  GLfloat position[3];
-  GLfloat xVelocity, yVelocity, zVelocity;
-  int active;
-} bubble;
+#include "textureLoad.c"
+#include "textureCompress.c"
+#include "textureCache.c"
+#include "timer.c"
+#include "profiler.c"
+#include "headless.c"
+#include "extensions.c"
+#include "glCapture.c"
+#include "glState.c"
+#include "mesh.c"
+#include "renderQueue.c"
+#include "cull.c"
+#include "lod.c"
+#include "threadPool.c"
+#include "textureStream.c"
+#include "random.c"
+#include "particles.c"
+#include "spatialHash.c"
+#include "collision.c"
+#include "distanceField.c"
+#include "fluid.c"
+#include "fleet.c"
+#include "simulation.c"
+#include "bubbleRender.c"
+#include "fleetRender.c"
+#include "statsOverlay.c"
+
+#define WIN_X 400
+#define WIN_Y 400
 
 /* Constants */
 #define NUMBER_OF_TEXTURES 3
 #define SAND 0
 #define GROUND 1
 #define WOOD 2
-#define CONE_SEGMENTS 10
-#define MAX_BUBBLES 60
-#define TIME_BETWEEN_BUBBLES 0.3
-#define BOUYANCY 10
-#define BUBBLE_BOUNCE 0.3
-#define SUBMARINE_SEGMENTS 16
+#define MAX_SEGMENTS 64
 #define OUTSIDE 0
 #define IN_SUB 1
 #define SUB_ACCELERATION 0.4
-#define WATER_RESISTANCE 0.7
-#define SUB_BOUNCE 0.5
 #define WATER_SIDES_SUBDIVISION 3
-#define WATER_TOP_SUBDIVISION 10
+#define WATER_TOP_SUBDIVISION 256
 #define SPOTLIGHT_WIDTH 30
+#define SCALING_STEPS 50
+#define HASHING_STEPS 20
+/* bubbles a unit cube in the hashing benchmark, whatever their number */
+#define HASHING_DENSITY 0.5
+#define BENCHMARK_TIME_STEP (1.0/60.0)
 
 /* Variables */
 GLuint textures[NUMBER_OF_TEXTURES];
@@ -56,24 +72,64 @@ int light3 = 1;
 int light4 = 1;
 int light5 = 1;
 int light6 = 1;
-bubble bubbles[MAX_BUBBLES];
 int viewPosition = OUTSIDE;
-struct {
-  GLfloat x, y, z;
-  GLfloat xVelocity, yVelocity, zVelocity;
-  GLfloat dive;
-  GLfloat turn;
-} sub;
-
-
-/* Display lists */
-GLuint ground;
-GLuint tank;
-GLuint waterBack;
-GLuint waterFront;
-GLuint lights;
-GLuint aerator;
-GLuint submarine;
+
+/* Command line options */
+int headless = 0;
+int noDraw = 0;
+int benchmarkFrames = 0;
+float fixedTimeStep = 0.0;
+char *snapshotFile = NULL;
+int threadCount = 0;
+unsigned int randomSeed;
+int seedGiven = 0;
+int scaling = 0;
+int hashing = 0;
+int decodeRuns = 0;
+int startupRuns = 0;
+int noCompress = 0;
+char *captureFile = NULL;
+char *replayFile = NULL;
+
+/* Windowed frame rate */
+#define TARGET_FRAME_RATE 60.0
+double targetFrameRate = TARGET_FRAME_RATE;
+framePacer pacer;
+
+/* Benchmark results */
+int benchmarkFrame = 0;
+timings simulationTimes;
+timings displayTimes;
+
+
+/* Everything drawn in a frame */
+renderQueue frameQueue;
+/* and everything that never moves, for culling */
+cullTree scenery;
+
+/* Meshes */
+mesh ground;
+mesh tank;
+mesh waterBack;
+mesh waterFront;
+lodMesh lights;
+lodMesh aerator;
+lodMesh submarine;
+
+/* segments round each level of detail, finest first. The middle ones
+   are what they have always been drawn with */
+int lightSegments[LOD_LEVELS] = {30, 15, 8};
+int aeratorSegments[LOD_LEVELS] = {20, 10, 6};
+int submarineSegments[LOD_LEVELS] = {32, 16, 8};
+
+/* the level each copy was last drawn at */
+int lightLevels[6] = {-1, -1, -1, -1, -1, -1};
+int aeratorLevel = -1;
+int submarineLevel = -1;
+
+GLfloat fakeLightPositions[][3] = {{-30.0, 54.0, 12.0}, {-30.0, 54.0, -12.0},
+				   {0.0, 54.0, 12.0}, {0.0, 54.0, -12.0},
+				   {30.0, 54.0, 12.0}, {30.0, 54.0, -12.0}};
 
 /* Callbacks */
 void Display(void);
@@ -81,6 +137,7 @@ void Reshape(int, int);
 void Special(int, int, int);
 void Keyboard(unsigned char, int, int);
 void Idle(void);
+void BenchmarkIdle(void);
 void Menu(int);
 
 /* Initialisation */
@@ -93,28 +150,78 @@ void InitLights(void);
 void InitAerator(void);
 void InitBubbles(void);
 void InitSubmarine(void);
+void InitCulling(void);
+void InitColliders(void);
+void BuildLight(mesh *, int);
+void BuildAerator(mesh *, int);
+void BuildSubmarine(mesh *, int);
 
 /* Drawing functions */
-void DrawLights(void);
+void PlaceLights(GLfloat *);
 void DrawBubbles(void);
 void DrawSubmarine(void);
+void DrawFleet(void);
+
+/* Benchmark functions */
+void ParseArguments(int, char *[]);
+void RunBenchmark(void);
+int BenchmarkFrame(void);
+void ReportBenchmark(void);
+void RunScalingBenchmark(void);
+void RunHashingBenchmark(void);
+void RunDecodeBenchmark(void);
+void RunStartupBenchmark(void);
+void TimeStartup(timings *, timings *);
 
 /* Helper functions */
-int HitShelf(bubble);
-int HitWall(bubble);
-void AccelerateSubmarine(GLfloat);
-void CollisionDetection(void);
-void SubdivideXY(GLfloat[3], GLfloat[3], GLfloat*, int);
-void SubdivideYZ(GLfloat[3], GLfloat[3], GLfloat*, int);
-void SubdivideXZ(GLfloat[3], GLfloat[3], GLfloat*, int);
-float RandF(void);
 void Normalise(GLfloat[3]);
 
 int main(int argc, char *argv[]) {
-  glutInit(&argc, argv);
-  glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
-  glutInitWindowSize(WIN_X, WIN_Y);
-  glutCreateWindow("CGV Assessment 2001 - Candidate 28420");
+  PROFILE_THREAD("main", -1);
+  ParseArguments(argc, argv);
+  InitThreadPool(threadCount);
+
+  if(scaling) {
+    RunScalingBenchmark();
+    return 0;
+  }
+  if(hashing) {
+    RunHashingBenchmark();
+    return 0;
+  }
+  if(decodeRuns) {
+    RunDecodeBenchmark();
+    return 0;
+  }
+  if(replayFile != NULL) {
+    RunReplay(replayFile, benchmarkFrames ? benchmarkFrames : REPLAY_FRAMES, snapshotFile);
+    return 0;
+  }
+
+  /* random unless asked to repeat a run */
+  if(!seedGiven) randomSeed = (unsigned int) time(NULL);
+  InitColliders();
+  InitSimulation(randomSeed);
+
+  if(noDraw) {
+    /* simulation only, no GL context at all */
+    RunBenchmark();
+    return 0;
+  }
+
+  if(headless) {
+    /* no display, render offscreen */
+    InitHeadless(WIN_X, WIN_Y);
+  }
+  else {
+    glutInit(&argc, argv);
+    glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
+    glutInitWindowSize(WIN_X, WIN_Y);
+    glutCreateWindow("CGV Assessment 2001 - Candidate 28420");
+  }
+  LoadExtensions(headless);
+  if(captureFile != NULL) StartCapture(WIN_X, WIN_Y);
+  ForgetState();
 
   printf("\n\n**************************************************\n");
   printf("*     CGV Assessment 2001 - Candidate 28420      *\n");
@@ -129,23 +236,61 @@ int main(int argc, char *argv[]) {
   printf("RIGHT ARROW\tRotate submarine to starboard\n");
   printf("i\t\tSwitch view to inside submarine (also in MMB menu)\n");
   printf("o\t\tSwitch view to outside submarine (also in MMB menu)\n");
+  printf("s\t\tShow and hide the GL call totals\n");
+  printf("c\t\tLook from the next submarine of the fleet\n");
   printf("ESC\t\tExit program (also in MMB menu)\n\n");
+  printf("OPTIONS:\n\n");
+  printf("-headless\t\tRender offscreen without a window\n");
+  printf("-benchmark N\t\tRender N frames flat out with a fixed time step and report timings\n");
+  printf("-timestep SECS\t\tSimulated time per benchmark frame (default %.4f)\n",
+	 BENCHMARK_TIME_STEP);
+  printf("-fps N\t\t\tWindowed frame rate to aim for, 0 for no limit (default %.0f)\n",
+	 TARGET_FRAME_RATE);
+  printf("-nodraw\t\t\tBenchmark the simulation only, without any rendering\n");
+  printf("-snapshot FILE.ppm\tSave the last headless frame\n");
+  printf("-view outside|inside\tStarting view\n");
+  printf("-bubbles N\t\tMaximum number of bubbles (default %d)\n", MAX_BUBBLES);
+  printf("-emitter X,Y,Z,RATE,BURST Another bubble source, RATE bursts of BURST a second\n");
+  printf("-simd scalar|sse|avx2\tBubble update kernel (default widest supported)\n");
+  printf("-fleet N\t\tSubmarines in the tank, yours and N-1 more (default 1)\n");
+  printf("-camera N\t\tSubmarine of the fleet to look from inside (default 0, yours)\n");
+  printf("-seed N\t\t\tRandom seed, to repeat a run (default the time)\n");
+  printf("-threads N\t\tWorker threads for the simulation (default one per CPU)\n");
+  printf("-scaling\t\tTime the bubble update on 1 to N threads and exit\n");
+  printf("-hashing\t\tTime the bubble interactions for a thousand to a million\n"
+	 "\t\t\tbubbles and exit\n");
+  printf("-nointeract\t\tBubbles pass through each other and the submarine\n");
+  printf("-fluid N\t\tCells of water velocity along the tank, 0 for still water (default %d)\n",
+	 FLUID_CELLS);
+  printf("-fluidbudget MS\t\tMost time a step spends on the water's pressure, runs no\n"
+	 "\t\t\tlonger repeat (default %.2f, no limit)\n", FLUID_BUDGET);
+  printf("-decode N\t\tTime loading the textures N times and exit\n");
+  printf("-nocache\t\tDon't use or write the texture cache\n");
+  printf("-nocompress\t\tKeep textures as RGBA instead of BC1/BC3\n");
+  printf("-startup N\t\tTime to the first frame and to all textures loaded, with\n"
+	 "\t\t\ta cold and warm cache, and exit\n");
+  printf("-stats\t\t\tShow the last frame's GL call totals over the view\n");
+  printf("-nocull\t\t\tDraw everything, whether it is in view or not\n");
+  printf("-lod N\t\t\tDraw everything at level of detail N, 0 the finest, instead\n"
+	 "\t\t\tof by its size on the screen\n");
+  printf("-capture FILE\t\tRecord every GL call of a benchmark run to replay\n");
+  printf("-replay FILE\t\tTime drawing the last frame of a capture, -benchmark N\n"
+	 "\t\t\ttimes (default %d), and exit\n", REPLAY_FRAMES);
+  printf("-trace FILE.json\tWrite the timing zones as a Chrome trace on exit\n\n");
 
   glClearColor(0.3, 0.3, 0.3, 1.0); /* Grey background */
   /* smooth shading */
   glShadeModel(GL_SMOOTH);
-  glEnable(GL_DEPTH_TEST);
+  StateEnable(GL_DEPTH_TEST, 1);
   /* enable lighting */
-  glEnable(GL_LIGHTING);
+  StateEnable(GL_LIGHTING, 1);
   /* enable blending */
   glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-  glEnable(GL_BLEND);
-
-  /* initialise random numbers */
-  srand((unsigned int) time(NULL));
+  StateEnable(GL_BLEND, 1);
 
   /* Initialise */
-  InitMenu();
+  if(!headless) InitMenu();
+  InitRenderQueue(&frameQueue);
   InitTextures();
   InitGround();
   InitTank();
@@ -154,13 +299,35 @@ int main(int argc, char *argv[]) {
   InitAerator();
   InitBubbles();
   InitSubmarine();
+  InitCulling();
+
+  if(headless) {
+    Reshape(WIN_X, WIN_Y);
+    if(startupRuns) {
+      RunStartupBenchmark();
+      return 0;
+    }
+    /* render the same frames every time, whatever the disk is doing */
+    FinishTextureLoading();
+    if(benchmarkFrames) RunBenchmark();
+    else {
+      /* nothing to interact with, just render one frame */
+      Display();
+    }
+    if(snapshotFile != NULL) SaveSnapshot(snapshotFile, WIN_X, WIN_Y);
+    return 0;
+  }
 
   /* register callbacks */
   glutDisplayFunc(Display);
   glutReshapeFunc(Reshape);
   glutSpecialFunc(Special);
   glutKeyboardFunc(Keyboard);
-  glutIdleFunc(Idle);
+  if(benchmarkFrames) glutIdleFunc(BenchmarkIdle);
+  else {
+    InitPacer(&pacer, targetFrameRate);
+    glutIdleFunc(Idle);
+  }
 
   glutMainLoop();
 
@@ -174,6 +341,17 @@ int main(int argc, char *argv[]) {
 void Display() {
   GLfloat ambientUnderwaterLight[] = {0.5, 0.5, 1.0, 1.0};
   GLfloat ambientLight[] = {0.7, 0.7, 0.7, 1.0};
+  GLfloat origin[3] = {0.0, 0.0, 0.0};
+  snapshot *view = CurrentSnapshot();
+  GLfloat *world, bubbleCentre[3];
+  int i;
+
+  PROFILE_BEGIN("Display");
+  StartCaptureFrame();
+  /* swap in any textures that have finished loading, one a frame */
+  if(texturesPending) UploadLoadedTextures(1);
+  ResetRenderQueue(&frameQueue);
+  ResetStateCounters();
 
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -184,37 +362,49 @@ void Display() {
     gluLookAt(100.0, 50.0, 150.0,
 	      0.0, 25.0, 0.0,
 	      0.0, 1.0, 0.0);
-    glLightModelfv(GL_LIGHT_MODEL_AMBIENT, ambientLight);
+    StateLightModelfv(GL_LIGHT_MODEL_AMBIENT, ambientLight);
   }
   else {
     /* set the viewpoint to point in the direction of the sub */
-    glRotatef(sub.dive, 1.0, 0.0, 0.0);
-    glRotatef(-sub.turn-90.0, 0.0, 1.0, 0.0);
+    glRotatef(view->dive, 1.0, 0.0, 0.0);
+    glRotatef(-view->turn-90.0, 0.0, 1.0, 0.0);
     /* translate to the position of the sub */
-    glTranslatef(-sub.x, -sub.y, -sub.z);
+    glTranslatef(-view->sub[0], -view->sub[1], -view->sub[2]);
     /* underwater lighting effect */
-    glLightModelfv(GL_LIGHT_MODEL_AMBIENT, ambientUnderwaterLight);
+    StateLightModelfv(GL_LIGHT_MODEL_AMBIENT, ambientUnderwaterLight);
   }
 
-  /* Draw the scene */
-  DrawLights();
-  if(light0) glEnable(GL_LIGHT0); else glDisable(GL_LIGHT0);
-  if(light1) glEnable(GL_LIGHT1); else glDisable(GL_LIGHT1);
-  if(light2) glEnable(GL_LIGHT2); else glDisable(GL_LIGHT2);
-  if(light3) glEnable(GL_LIGHT3); else glDisable(GL_LIGHT3);
-  if(light4) glEnable(GL_LIGHT4); else glDisable(GL_LIGHT4);
-  if(light5) glEnable(GL_LIGHT5); else glDisable(GL_LIGHT5);
-  if(light6) glEnable(GL_LIGHT6); else glDisable(GL_LIGHT6);
-  glCallList(ground);
-  glCallList(tank);
-  glCallList(waterBack);
-  glCallList(aerator);
-  DrawBubbles();
-  if(viewPosition != IN_SUB) DrawSubmarine();
-  glCallList(waterFront);
+  /* Draw the scene, or as much of it as is in view */
+  world = QueueMatrix(&frameQueue);
+  StartCullFrame(world);
+  StartLodFrame();
+  PlaceLights(world);
+  StateEnable(GL_LIGHT0, light0);
+  StateEnable(GL_LIGHT1, light1);
+  StateEnable(GL_LIGHT2, light2);
+  StateEnable(GL_LIGHT3, light3);
+  StateEnable(GL_LIGHT4, light4);
+  StateEnable(GL_LIGHT5, light5);
+  StateEnable(GL_LIGHT6, light6);
+  QueueVisible(&frameQueue, &scenery, world, PASS_WORLD);
+  for(i = 0; i < 6; i++)
+    QueueLodMesh(&frameQueue, &lights, &lightLevels[i],
+		 QueueTranslated(&frameQueue, world, fakeLightPositions[i]), PASS_WORLD);
+  QueueLodMesh(&frameQueue, &aerator, &aeratorLevel, world, PASS_WORLD);
+  BubbleCentre(view->bubbles, view->count, bubbleCentre);
+  QueueDraw(&frameQueue, DrawBubbles, world, bubbleCentre, 1, PASS_WORLD);
+  if(view->subs > 1) QueueDraw(&frameQueue, DrawFleet, world, view->sub, 0, PASS_WORLD);
+  else if(viewPosition != IN_SUB) DrawSubmarine();
+  if(statsOverlay) QueueDraw(&frameQueue, DrawStatsOverlay, world, origin, 0, PASS_OVERLAY);
+  SubmitRenderQueue(&frameQueue);
 
   glFlush();
-  glutSwapBuffers();
+  if(!headless) {
+    PROFILE_BEGIN("glutSwapBuffers");
+    glutSwapBuffers();
+    PROFILE_END();
+  }
+  PROFILE_END();
   return;
 }
 
@@ -222,6 +412,8 @@ void Reshape(int w, int h) {
   glMatrixMode(GL_PROJECTION);
   glLoadIdentity();
   gluPerspective(45.0, (float)w/(float)h, 1.0, 400.0);
+  SetCullProjection();
+  SetLodViewport(h);
   glMatrixMode(GL_MODELVIEW);
   glLoadIdentity();
   glViewport(0, 0, w, h);
@@ -259,11 +451,11 @@ void Keyboard(unsigned char key, int x, int y) {
     break;
   case 'f':
     /* Move the sub forwards */
-    AccelerateSubmarine(SUB_ACCELERATION);
+    PushSubmarine(SUB_ACCELERATION);
     break;
   case 'j':
     /* Move the sub backwards */
-    AccelerateSubmarine(-SUB_ACCELERATION);
+    PushSubmarine(-SUB_ACCELERATION);
     break;
   case 'i':
     viewPosition = IN_SUB;
@@ -271,6 +463,12 @@ void Keyboard(unsigned char key, int x, int y) {
   case 'o':
     viewPosition = OUTSIDE;
     break;
+  case 's':
+    statsOverlay = !statsOverlay;
+    break;
+  case 'c':
+    NextCamera();
+    break;
   case 27:
     /* exit */
     printf("\n");
@@ -284,60 +482,58 @@ void Special(int key, int x, int y) {
   switch(key) {
   case GLUT_KEY_UP:
     /* Tilt submarine up */
-    sub.dive -= 1.0;
-    if(sub.dive < -60.0) sub.dive = -60.0;
+    SteerSubmarine(-1.0, 0.0);
     break;
   case GLUT_KEY_DOWN:
     /* Tilt submarine down */
-    sub.dive += 1.0;
-    if(sub.dive > 60.0) sub.dive = 60.0;
+    SteerSubmarine(1.0, 0.0);
     break;
   case GLUT_KEY_LEFT:
     /* Rotate submarine to port */
-    sub.turn += 2.0;
-    if(sub.turn > 360.0) sub.turn -= 360.0;
+    SteerSubmarine(0.0, 2.0);
     break;
   case GLUT_KEY_RIGHT:
     /* Rotate submarine to starboard */
-    sub.turn -= 2.0;
-    if(sub.turn < 0.0) sub.turn += 360.0;
+    SteerSubmarine(0.0, -2.0);
     break;
   }
 }
 
 void Idle() {
-  static clock_t old = 0, last = 0;
+  static double old = 0.0, last = 0.0;
   static int ticks = 0;
-  clock_t new, elapsed;
-  float elapsedSecs;
-  GLfloat velAdj;
-  static float t = 0;
+  double new;
+
+  /* rather than spinning, wait for the next frame to be due */
+  PROFILE_BEGIN("PaceFrame");
+  new = PaceFrame(&pacer);
+  PROFILE_END();
 
+  PROFILE_BEGIN("Idle");
+  if(last == 0.0) old = last = new;
   ticks++;
-  new=clock();
 
   /* if 0.5 seconds passed, calculate average frame rate */
-  if((new - old)/CLOCKS_PER_SEC > 0.5) {
-    elapsed=(new - old);
+  if(new - old > 0.5) {
+    fprintf(stderr, "FPS: %.1f   \r", ticks / (new - old));
     old = new;
-    fprintf(stderr, "FPS: %.1f   \r",  ticks * (float) CLOCKS_PER_SEC / (float) elapsed);
     ticks = 0;
   }
   
-  /* update submarine position */
-  elapsedSecs = (new - last)/(float)CLOCKS_PER_SEC;
-  velAdj = WATER_RESISTANCE * elapsedSecs;
-  sub.x += sub.xVelocity * elapsedSecs;
-  sub.y += sub.yVelocity * elapsedSecs;
-  sub.z += sub.zVelocity * elapsedSecs;
-  CollisionDetection();
-  /* water resistance */
-  sub.xVelocity -= velAdj * sub.xVelocity;
-  sub.yVelocity -= velAdj * sub.yVelocity;
-  sub.zVelocity -= velAdj * sub.zVelocity;
+  /* move everything on in whole simulation steps, in the background */
+  UpdateSimulation(new - last);
   
   last = new;
   glutPostRedisplay();
+  PROFILE_END();
+}
+
+void BenchmarkIdle() {
+  if(!BenchmarkFrame()) {
+    ReportBenchmark();
+    if(captureFile != NULL) SaveCapture(captureFile);
+    exit(0);
+  }
 }
 
 /**************************************************/
@@ -345,67 +541,62 @@ void Idle() {
 /**************************************************/
 
 void InitMenu(void) {
+  PROFILE_BEGIN("InitMenu");
   glutCreateMenu(Menu);
   glutAddMenuEntry("Fixed View", OUTSIDE);
   glutAddMenuEntry("Submarine View", IN_SUB);
   glutAddMenuEntry("Exit", -1);
   glutAttachMenu(GLUT_MIDDLE_BUTTON);
+  PROFILE_END();
 }
 
 void InitTextures(void) {
-  GLubyte textureBuffer[256][256][4];
+  GLubyte white[4] = {255, 255, 255, 255};
   int i;
 
+  PROFILE_BEGIN("InitTextures");
+  compressTextures = haveTextureCompression && !noCompress;
   glGenTextures(NUMBER_OF_TEXTURES, textures);
 
   for(i = 0; i < NUMBER_OF_TEXTURES; i++) {
-    /* load the texture */
-    open_image_file(textureFiles[i], textureBuffer);
-    
-    /* apply the texture */
-    glBindTexture(GL_TEXTURE_2D, textures[i]);
+    /* plain white until the texture is loaded, or for good if the file
+       is missing */
+    StateBindTexture(textures[i]);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 256, 256,
-		 0, GL_RGBA, GL_UNSIGNED_BYTE, textureBuffer);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white);
+    QueueTexture(textureFiles[i], textures[i]);
   }
+  StartTextureLoading();
+  PROFILE_END();
 }
 
 void InitGround(void) {
   GLfloat groundVertices[][3] = {{-75.0, -5.0, 50.0}, {-75.0, -5.0, -50.0},
 			       {75.0, -5.0, -50.0}, {75.0, -5.0, 50.0}};
   GLfloat groundColor[] = {1.0, 1.0, 1.0, 1.0};
-  
-  ground = glGenLists(1);
-  if(ground != 0) {
-    glNewList(ground, GL_COMPILE);
-    
-      /* set the material properties of the ground */
-      glMaterialfv(GL_FRONT, GL_AMBIENT_AND_DIFFUSE, groundColor);
-      glMaterialfv(GL_FRONT, GL_SPECULAR, groundColor);
-      glMaterialf(GL_FRONT, GL_SHININESS, 0);
-      /* Select the ground texture and enable it */
-      glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
-      glBindTexture(GL_TEXTURE_2D, textures[GROUND]);
-      glEnable(GL_TEXTURE_2D);
-      /* draw the ground */
-      glBegin(GL_QUADS);
-        glNormal3f(0.0, 1.0, 0.0);
-	glTexCoord2i(0,1); glVertex3fv(groundVertices[0]);
-	glTexCoord2i(1,1); glVertex3fv(groundVertices[1]);
-	glTexCoord2i(1,0); glVertex3fv(groundVertices[2]);
-	glTexCoord2i(0,0); glVertex3fv(groundVertices[3]);
-      glEnd();
-      
-      glDisable(GL_TEXTURE_2D);
-    glEndList();
-  }
-  else {
-    fprintf(stderr, "ERROR: Unable to create display list for ground");
-    exit(1);
-  }
+  material groundMaterial;
+
+  PROFILE_BEGIN("InitGround");
+  InitMesh(&ground, "ground");
+
+  /* set the material properties of the ground, with the ground texture */
+  InitMaterial(&groundMaterial, GL_FRONT, groundColor, 0);
+  groundMaterial.texture = &textures[GROUND];
+  MeshMaterial(&ground, &groundMaterial);
+  /* draw the ground */
+  MeshBegin(&ground, GL_QUADS);
+    MeshNormal(&ground, 0.0, 1.0, 0.0);
+    MeshTexCoord(&ground, 0,1); MeshVertex(&ground, groundVertices[0]);
+    MeshTexCoord(&ground, 1,1); MeshVertex(&ground, groundVertices[1]);
+    MeshTexCoord(&ground, 1,0); MeshVertex(&ground, groundVertices[2]);
+    MeshTexCoord(&ground, 0,0); MeshVertex(&ground, groundVertices[3]);
+  MeshEnd(&ground);
+
+  UploadMesh(&ground);
+  PROFILE_END();
 }
 
 void InitTank(void) {
@@ -428,563 +619,428 @@ void InitTank(void) {
 			      {40.0, 60.0, -15.0}, {40.0, 60.0, 15.0}};
   GLfloat lidNormals[][3] = {{-0.707, 0.707, 0.0}, {0.0, 0.707, -0.707},
 			     {0.707, 0.707, 0.0}, {0.0, 0.707, 0.707}};
-  int i, j;
-
-  tank = glGenLists(1);
-  if(tank != 0) {
-    glNewList(tank, GL_COMPILE);
-
-    /* Set the material properties of the glass */
-    glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, tankColor);
-    glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, tankColor);
-    glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 100);
-    /* Draw the glass */
-      for(i = 0; i < 4; i++) {
-	glBegin(GL_LINE_LOOP);
-	  glNormal3fv(glassNormals[i]);
-	  glVertex3fv(glassVertices[i]);
-	  glVertex3fv(glassVertices[i+4]);
-	  if(i == 3) { /* last edge */
-	    glVertex3fv(glassVertices[4]);
-	    glVertex3fv(glassVertices[0]);
-	  }
-	  else { /* other edges */
-	    glVertex3fv(glassVertices[i+5]);
-	    glVertex3fv(glassVertices[i+1]);
-	  }
-	glEnd();
-      }
+  material tankMaterial;
+  int i;
+
+  PROFILE_BEGIN("InitTank");
+  InitMesh(&tank, "tank");
+
+  /* Set the material properties of the glass */
+  InitMaterial(&tankMaterial, GL_FRONT_AND_BACK, tankColor, 100);
+  MeshMaterial(&tank, &tankMaterial);
+  /* Draw the glass */
+    for(i = 0; i < 4; i++) {
+      MeshBegin(&tank, GL_LINE_LOOP);
+	MeshNormalv(&tank, glassNormals[i]);
+	MeshVertex(&tank, glassVertices[i]);
+	MeshVertex(&tank, glassVertices[i+4]);
+	if(i == 3) { /* last edge */
+	  MeshVertex(&tank, glassVertices[4]);
+	  MeshVertex(&tank, glassVertices[0]);
+	}
+	else { /* other edges */
+	  MeshVertex(&tank, glassVertices[i+5]);
+	  MeshVertex(&tank, glassVertices[i+1]);
+	}
+      MeshEnd(&tank);
+    }
 
-      /* set the material properties of the sand */
-      glMaterialfv(GL_FRONT, GL_AMBIENT_AND_DIFFUSE, sandColor);
-      glMaterialfv(GL_FRONT, GL_SPECULAR, sandColor);
-      glMaterialf(GL_FRONT, GL_SHININESS, 0);
-      /* Select the sand texture and enable it */
-      glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
-      glBindTexture(GL_TEXTURE_2D, textures[SAND]);
-      glEnable(GL_TEXTURE_2D);
-      /* Draw the bottom of the tank */
-      glBegin(GL_QUADS);
-        glNormal3f(0.0, 1.0, 0.0);
-	  glTexCoord2f(0.0, 0.0);
-	  glVertex3fv(glassVertices[0]);
-	  glTexCoord2f(0.0, 1.0);
-	  glVertex3fv(glassVertices[1]);
-	  glTexCoord2f(1.0, 1.0);
-	  glVertex3fv(glassVertices[2]);
-	  glTexCoord2f(1.0, 0.0);
-	  glVertex3fv(glassVertices[3]);
-      glEnd();
-
-      /* Select the wood texture for the base and the lid */
-      glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
-      glBindTexture(GL_TEXTURE_2D, textures[WOOD]);
-      glEnable(GL_TEXTURE_2D);
-
-      /* Set the material properties of the base */
-      glMaterialfv(GL_FRONT, GL_AMBIENT_AND_DIFFUSE, baseColor);
-      glMaterialfv(GL_FRONT, GL_SPECULAR, baseColor);
-      glMaterialf(GL_FRONT, GL_SHININESS, 64);
-     
-      /* Draw the base */
-      glBegin(GL_QUADS);
-      for(i = 0; i < 4; i++) {
-	glNormal3fv(baseNormals[i]);
-        glTexCoord2i(1,0);
-	glVertex3fv(glassVertices[i]);
-        glTexCoord2i(0,0);
-	glVertex3fv(baseVertices[i]);
+    /* set the material properties of the sand, with the sand texture */
+    InitMaterial(&tankMaterial, GL_FRONT, sandColor, 0);
+    tankMaterial.texture = &textures[SAND];
+    MeshMaterial(&tank, &tankMaterial);
+    /* Draw the bottom of the tank */
+    MeshBegin(&tank, GL_QUADS);
+      MeshNormal(&tank, 0.0, 1.0, 0.0);
+	MeshTexCoord(&tank, 0.0, 0.0);
+	MeshVertex(&tank, glassVertices[0]);
+	MeshTexCoord(&tank, 0.0, 1.0);
+	MeshVertex(&tank, glassVertices[1]);
+	MeshTexCoord(&tank, 1.0, 1.0);
+	MeshVertex(&tank, glassVertices[2]);
+	MeshTexCoord(&tank, 1.0, 0.0);
+	MeshVertex(&tank, glassVertices[3]);
+    MeshEnd(&tank);
+
+    /* Set the material properties of the base, with the wood texture */
+    InitMaterial(&tankMaterial, GL_FRONT, baseColor, 64);
+    tankMaterial.texture = &textures[WOOD];
+    MeshMaterial(&tank, &tankMaterial);
+
+    /* Draw the base */
+    MeshBegin(&tank, GL_QUADS);
+    for(i = 0; i < 4; i++) {
+      MeshNormalv(&tank, baseNormals[i]);
+      MeshTexCoord(&tank, 1,0);
+      MeshVertex(&tank, glassVertices[i]);
+      MeshTexCoord(&tank, 0,0);
+      MeshVertex(&tank, baseVertices[i]);
+      if(i == 3) { /* last side */
+	MeshTexCoord(&tank, 0,1);
+	MeshVertex(&tank, baseVertices[0]);
+	MeshTexCoord(&tank, 1,1);
+	MeshVertex(&tank, glassVertices[0]);
+      }
+      else { /* other sides */
+	MeshTexCoord(&tank, 0,1);
+	MeshVertex(&tank, baseVertices[i+1]);
+	MeshTexCoord(&tank, 1,1);
+	MeshVertex(&tank, glassVertices[i+1]);
+      }
+    }
+    MeshEnd(&tank);
+
+    /* Set the material properties of the lid, also wood */
+    InitMaterial(&tankMaterial, GL_FRONT_AND_BACK, lidColor, 64);
+    tankMaterial.texture = &textures[WOOD];
+    MeshMaterial(&tank, &tankMaterial);
+
+    /* Draw the sides of the lid */
+    MeshBegin(&tank, GL_QUADS);
+      for(i = 0; i< 4; i++) {
+	MeshNormalv(&tank, lidNormals[i]);
+	MeshTexCoord(&tank, 1, 0);
+	MeshVertex(&tank, glassVertices[i+4]);
+	MeshTexCoord(&tank, 0, 0);
+	MeshVertex(&tank, lidVertices[i]);
 	if(i == 3) { /* last side */
-	  glTexCoord2i(0,1);
-	  glVertex3fv(baseVertices[0]);
-	  glTexCoord2i(1,1);
-	  glVertex3fv(glassVertices[0]);
+	  MeshTexCoord(&tank, 0, 1);
+	  MeshVertex(&tank, lidVertices[0]);
+	  MeshTexCoord(&tank, 1, 1);
+	  MeshVertex(&tank, glassVertices[4]);
 	}
 	else { /* other sides */
-	  glTexCoord2i(0,1);
-	  glVertex3fv(baseVertices[i+1]);
-	  glTexCoord2i(1,1);
-	  glVertex3fv(glassVertices[i+1]);
+	  MeshTexCoord(&tank, 0, 1);
+	  MeshVertex(&tank, lidVertices[i+1]);
+	  MeshTexCoord(&tank, 1, 1);
+	  MeshVertex(&tank, glassVertices[i+5]);
 	}
       }
-      glEnd();
-
-      /* Set the material properties of the lid */
-      glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, lidColor);
-      glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, lidColor);
-      glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 64);
-
-      /* Draw the sides of the lid */
-      glBegin(GL_QUADS);
-        for(i = 0; i< 4; i++) {
-	  glNormal3fv(lidNormals[i]);
-	  glTexCoord2i(1, 0);
-	  glVertex3fv(glassVertices[i+4]);
-	  glTexCoord2i(0, 0);
-	  glVertex3fv(lidVertices[i]);
-	  if(i == 3) { /* last side */
-	    glTexCoord2i(0, 1);
-	    glVertex3fv(lidVertices[0]);
-	    glTexCoord2i(1, 1);
-	    glVertex3fv(glassVertices[4]);
-	  }
-	  else { /* other sides */
-	    glTexCoord2i(0, 1);
-	    glVertex3fv(lidVertices[i+1]);
-	    glTexCoord2i(1, 1);
-	    glVertex3fv(glassVertices[i+5]);
-	  }
-	}
 
-	/* Draw the top of the lid */
-	/* REF ? */
-	glNormal3f(0.0, 1.0, 0.0);
-	glTexCoord2i(1, 0); glVertex3fv(lidVertices[0]);
-	glTexCoord2i(0, 0); glVertex3fv(lidVertices[1]);
-	glTexCoord2i(0, 1); glVertex3fv(lidVertices[2]);
-	glTexCoord2i(1, 1); glVertex3fv(lidVertices[3]);
-      glEnd();
-
-      glDisable(GL_TEXTURE_2D);
-
-      /* Set the material properties of the shelf */
-      glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, shelfColor);
-      glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, shelfColor);
-      glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 64);
-
-      /* Draw the shelf */
-      glPushMatrix();
-	glTranslatef(0.0, 20.5, -20.0); 
-        glScalef(20.0, 1.0, 10.0);
-        glutSolidCube(1.0);
-      glPopMatrix();
-
-    glEndList();
-  }
-  else {
-    fprintf(stderr, "ERROR: Unable to create display list for tank\n");
-    exit(1);
-  }
-  
+      /* Draw the top of the lid */
+      /* REF ? */
+      MeshNormal(&tank, 0.0, 1.0, 0.0);
+      MeshTexCoord(&tank, 1, 0); MeshVertex(&tank, lidVertices[0]);
+      MeshTexCoord(&tank, 0, 0); MeshVertex(&tank, lidVertices[1]);
+      MeshTexCoord(&tank, 0, 1); MeshVertex(&tank, lidVertices[2]);
+      MeshTexCoord(&tank, 1, 1); MeshVertex(&tank, lidVertices[3]);
+    MeshEnd(&tank);
+
+    /* Set the material properties of the shelf */
+    InitMaterial(&tankMaterial, GL_FRONT_AND_BACK, shelfColor, 64);
+    MeshMaterial(&tank, &tankMaterial);
+
+    /* Draw the shelf */
+    MeshPushMatrix(&tank);
+      MeshTranslate(&tank, 0.0, 20.5, -20.0);
+      MeshScale(&tank, 20.0, 1.0, 10.0);
+      MeshCube(&tank, 1.0);
+    MeshPopMatrix(&tank);
+
+  UploadMesh(&tank);
+  PROFILE_END();
 }
 
 void InitWater(void) {
-  int i, j;
   GLfloat waterColor[] = {0.2, 0.2, 0.8, 0.3};
   GLfloat waterVertices[][3] = {{-50.0, 0.0, -25.0}, {50.0, 0.0, -25.0},
 				 {50.0, 0.0, 25.0}, {-50.0, 0.0, 25.0},
 				 {-50.0, 40.0, -25.0}, {50.0, 40.0, -25.0},
 				 {50.0, 40.0, 25.0}, {-50.0, 40.0, 25.0}};
-  GLfloat topVertices[WATER_TOP_SUBDIVISION+1][WATER_TOP_SUBDIVISION+1][3];
-  GLfloat sideVertices[WATER_SIDES_SUBDIVISION+1][WATER_SIDES_SUBDIVISION+1][3];
-
-  waterBack = glGenLists(1);
-  if(waterBack != 0) {
-    waterFront = waterBack + 1;
-
-    /* Create the back of the water */
-    glNewList(waterBack, GL_COMPILE);
-      /* Set the material properties to water */
-      glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, waterColor);
-      glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, waterColor);
-      glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 100);
-
-      /* subdivide the plane */
-      SubdivideXY(waterVertices[0], 
-		  waterVertices[5], 
-		  (GLfloat *)sideVertices, 
-		  WATER_SIDES_SUBDIVISION);
-
-      /* draw the back of the water */
-      glBegin(GL_QUADS);
-        glNormal3f(0.0, 0.0, -1.0);
-        for(i = 0; i < WATER_SIDES_SUBDIVISION; i++) {
-	  for(j = 0; j < WATER_SIDES_SUBDIVISION; j++) {
-	    glVertex3fv(sideVertices[i][j]);
-	    glVertex3fv(sideVertices[i+1][j]);
-	    glVertex3fv(sideVertices[i+1][j+1]);
-	    glVertex3fv(sideVertices[i][j+1]);	    
-	  }
-	}
-      glEnd();
-    glEndList();
-
-    /* Create the front of the water */
-    glNewList(waterFront, GL_COMPILE);
-      /* Set the material properties to water */
-      glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, waterColor);
-      glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, waterColor);
-      glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, 100);    
-
-      /***** draw the top *****/
-      /* subdivide the plane */
-      SubdivideXZ(waterVertices[4], 
-		  waterVertices[6],
-		  (GLfloat *)topVertices,
-		  WATER_TOP_SUBDIVISION);
-
-      /* draw the water */
-      glBegin(GL_QUADS);
-        glNormal3f(0.0, 1.0, 0.0);
-        for(i = 0; i < WATER_TOP_SUBDIVISION; i++) {
-	  for(j = 0; j < WATER_TOP_SUBDIVISION; j++) {
-	    glVertex3fv(topVertices[i][j]);
-	    glVertex3fv(topVertices[i+1][j]);
-	    glVertex3fv(topVertices[i+1][j+1]);
-	    glVertex3fv(topVertices[i][j+1]);	    
-	  }
-	}
-      glEnd();
-
-      /***** draw the RHS *****/
-      /* subdivide the plane */
-      SubdivideYZ(waterVertices[1], 
-		  waterVertices[6], 
-		  (GLfloat *)sideVertices,
-		  WATER_SIDES_SUBDIVISION);
-
-      /* draw the water */
-      glBegin(GL_QUADS);
-        glNormal3f(1.0, 0.0, 0.0);
-        for(i = 0; i < WATER_SIDES_SUBDIVISION; i++) {
-	  for(j = 0; j < WATER_SIDES_SUBDIVISION; j++) {
-	    glVertex3fv(sideVertices[i][j]);
-	    glVertex3fv(sideVertices[i+1][j]);
-	    glVertex3fv(sideVertices[i+1][j+1]);
-	    glVertex3fv(sideVertices[i][j+1]);	    
-	  }
-	}
-      glEnd();
-
-      /***** draw the front *****/
-      /* subdivide the plane */
-      SubdivideXY(waterVertices[2], 
-		  waterVertices[7], 
-		  (GLfloat *)sideVertices,
-		  WATER_SIDES_SUBDIVISION);
-      
-      /* draw the water */
-      glBegin(GL_QUADS);
-        glNormal3f(0.0, 0.0, 1.0);
-        for(i = 0; i < WATER_SIDES_SUBDIVISION; i++) {
-	  for(j = 0; j < WATER_SIDES_SUBDIVISION; j++) {
-	    glVertex3fv(sideVertices[i][j]);
-	    glVertex3fv(sideVertices[i+1][j]);
-	    glVertex3fv(sideVertices[i+1][j+1]);
-	    glVertex3fv(sideVertices[i][j+1]);	    
-	  }
-	}
-      glEnd();
-
-      /***** draw the LHS *****/
-      /* subdivide the plane */
-      SubdivideYZ(waterVertices[3],
-		  waterVertices[4],
-		  (GLfloat *)sideVertices,
-		  WATER_SIDES_SUBDIVISION);
-
-      /* draw the water */
-      glBegin(GL_QUADS);
-        glNormal3f(-1.0, 0.0, 0.0);
-        for(i = 0; i < WATER_SIDES_SUBDIVISION; i++) {
-	  for(j = 0; j < WATER_SIDES_SUBDIVISION; j++) {
-	    glVertex3fv(sideVertices[i][j]);
-	    glVertex3fv(sideVertices[i+1][j]);
-	    glVertex3fv(sideVertices[i+1][j+1]);
-	    glVertex3fv(sideVertices[i][j+1]);	    
-	  }
-	}
-      glEnd();
-
-    glEndList();
-  }
-  else {
-    fprintf(stderr, "ERROR: Unable to create display list for the water\n");
-    exit(1);
-  }
+  material waterMaterial;
+
+  PROFILE_BEGIN("InitWater");
+  /* Set the material properties to water */
+  InitMaterial(&waterMaterial, GL_FRONT_AND_BACK, waterColor, 100);
+
+  /* Create the back of the water */
+  InitMesh(&waterBack, "water back");
+    MeshMaterial(&waterBack, &waterMaterial);
+    MeshNormal(&waterBack, 0.0, 0.0, -1.0);
+    MeshGrid(&waterBack, waterVertices[0], waterVertices[5], 0, 1,
+	     WATER_SIDES_SUBDIVISION, WATER_SIDES_SUBDIVISION);
+  UploadMesh(&waterBack);
+
+  /* Create the front of the water */
+  InitMesh(&waterFront, "water front");
+    MeshMaterial(&waterFront, &waterMaterial);
+
+    /***** draw the top *****/
+    MeshNormal(&waterFront, 0.0, 1.0, 0.0);
+    MeshGrid(&waterFront, waterVertices[4], waterVertices[6], 0, 2,
+	     WATER_TOP_SUBDIVISION, WATER_TOP_SUBDIVISION);
+
+    /***** draw the RHS *****/
+    MeshNormal(&waterFront, 1.0, 0.0, 0.0);
+    MeshGrid(&waterFront, waterVertices[1], waterVertices[6], 1, 2,
+	     WATER_SIDES_SUBDIVISION, WATER_SIDES_SUBDIVISION);
+
+    /***** draw the front *****/
+    MeshNormal(&waterFront, 0.0, 0.0, 1.0);
+    MeshGrid(&waterFront, waterVertices[2], waterVertices[7], 0, 1,
+	     WATER_SIDES_SUBDIVISION, WATER_SIDES_SUBDIVISION);
+
+    /***** draw the LHS *****/
+    MeshNormal(&waterFront, -1.0, 0.0, 0.0);
+    MeshGrid(&waterFront, waterVertices[3], waterVertices[4], 1, 2,
+	     WATER_SIDES_SUBDIVISION, WATER_SIDES_SUBDIVISION);
+
+  UploadMesh(&waterFront);
+  PROFILE_END();
 }
 
 void InitLights(void) {
-  int i, j;
+  int i;
   GLfloat roomLightColor[] = {0.04, 0.04, 0.03, 1.0};
-  GLfloat realLightPositions[][4] = {{0.0, 400.0, 100.0, 1.0}, 
-				     {-30.0, 50.0, 12.0, 1.0}, {-30.0, 50.0, -12.0, 1.0}, 
-				     {0.0, 50.0, 12.0, 1.0}, {0.0, 50.0, -12.0, 1.0}, 
-				     {30.0, 50.0, 12.0, 1.0}, {30.0, 50.0, -12.0, 1.0}};
-				 
-  GLfloat lightDirection[3] = {0.0, -1.0, 0.0};
+
+  PROFILE_BEGIN("InitLights");
+  BuildLodMesh(&lights, "light", BuildLight, lightSegments);
+
+  /* The real lights, placed by PlaceLights() */
+  /* room light */
+  StateLightfv(GL_LIGHT0, GL_AMBIENT, roomLightColor);
+  StateLightfv(GL_LIGHT0, GL_DIFFUSE, roomLightColor);
+  StateLightfv(GL_LIGHT0, GL_SPECULAR, roomLightColor);
+  StateLightf(GL_LIGHT0, GL_SPOT_CUTOFF, 180.0);
+
+  /* spot lights */
+  for(i = 1; i <= 6; i++) StateLightf(GL_LIGHT0 + i, GL_SPOT_CUTOFF, SPOTLIGHT_WIDTH);
+  PROFILE_END();
+}
+
+/* one of the fake lights, around the origin. The shade has two thirds
+   as many sides as the bulb has segments */
+void BuildLight(mesh *m, int segments) {
+  int i;
   GLfloat fakeLightColor[] = {1.0, 1.0, 0.8, 1.0};
   GLfloat lightEmission[] = {1.0, 1.0, 1.0, 1.0};
   GLfloat black[] = {0.0, 0.0, 0.0, 1.0};
-  GLfloat fakeLightPositions[][3] = {{-30.0, 54.0, 12.0}, {-30.0, 54.0, -12.0},
-				     {0.0, 54.0, 12.0}, {0.0, 54.0, -12.0},
-				     {30.0, 54.0, 12.0}, {30.0, 54.0, -12.0}};
-  GLfloat lightShadeVertices[CONE_SEGMENTS*2][3];
-  GLfloat lightShadeNormals[CONE_SEGMENTS][3];
+  GLfloat lightShadeVertices[MAX_SEGMENTS*2][3];
+  GLfloat lightShadeNormals[MAX_SEGMENTS][3];
   GLfloat lightRadius = 3;
-
+  int sides = segments * 2 / 3;
+  material lightMaterial;
 
   /* Calculate the light shade */
-  for(i = 0; i < CONE_SEGMENTS; i++) {
-    lightShadeNormals[i][0] = sin((2*PI/CONE_SEGMENTS)*i);
+  for(i = 0; i < sides; i++) {
+    lightShadeNormals[i][0] = sin((2*PI/sides)*i);
     lightShadeNormals[i][1] = 0.0;
-    lightShadeNormals[i][2] = cos((2*PI/CONE_SEGMENTS)*i);
+    lightShadeNormals[i][2] = cos((2*PI/sides)*i);
     lightShadeVertices[i][0] = (lightRadius + 0.2) * lightShadeNormals[i][0];
     lightShadeVertices[i][1] = -lightRadius;
     lightShadeVertices[i][2] = (lightRadius + 0.2) * lightShadeNormals[i][2];
-    lightShadeVertices[i+CONE_SEGMENTS][0] = lightShadeVertices[i][0];
-    lightShadeVertices[i+CONE_SEGMENTS][1] = lightRadius;
-    lightShadeVertices[i+CONE_SEGMENTS][2] = lightShadeVertices[i][2];
+    lightShadeVertices[i+sides][0] = lightShadeVertices[i][0];
+    lightShadeVertices[i+sides][1] = lightRadius;
+    lightShadeVertices[i+sides][2] = lightShadeVertices[i][2];
   }
 
-  lights = glGenLists(1);
-  if(lights != 0) {
-    glNewList(lights, GL_COMPILE);
-
-      /* Set the light properties */
-      glMaterialfv(GL_FRONT, GL_AMBIENT_AND_DIFFUSE, fakeLightColor);
-      glMaterialfv(GL_FRONT, GL_SPECULAR, fakeLightColor);
-      glMaterialfv(GL_FRONT, GL_EMISSION, lightEmission);
-      glMaterialf(GL_FRONT, GL_SHININESS, 128);
-      /* draw the lights */
-      for(i = 0; i < 6; i++) {
-	glPushMatrix();
-	  glTranslatef(fakeLightPositions[i][0],
-		       fakeLightPositions[i][1],
-		       fakeLightPositions[i][2]);
-	  glutSolidSphere(lightRadius, 15, 15);
-	glPopMatrix();
-      }
-      /* draw the shades */
-      glMaterialfv(GL_FRONT, GL_AMBIENT_AND_DIFFUSE, black);
-      glMaterialfv(GL_FRONT, GL_SPECULAR, black);
-      glMaterialfv(GL_FRONT, GL_EMISSION, black);
-      glMaterialf(GL_FRONT, GL_SHININESS, 128);
-      for(i = 0; i < 6; i++) {
-	glPushMatrix();
-	  glTranslatef(fakeLightPositions[i][0],
-		       fakeLightPositions[i][1],
-		       fakeLightPositions[i][2]);
-	  glBegin(GL_QUAD_STRIP);
-	    for(j = 0; j < CONE_SEGMENTS; j++) {
-	      glNormal3fv(lightShadeNormals[j]);
-	      glVertex3fv(lightShadeVertices[j]);
-	      glVertex3fv(lightShadeVertices[j+CONE_SEGMENTS]);
-	    }
-	    glNormal3fv(lightShadeNormals[0]);
-	    glVertex3fv(lightShadeVertices[0]);
-	    glVertex3fv(lightShadeVertices[CONE_SEGMENTS]);
-	  glEnd();
-	glPopMatrix();
+    /* Set the light properties */
+    InitMaterial(&lightMaterial, GL_FRONT, fakeLightColor, 128);
+    memcpy(lightMaterial.emission, lightEmission, sizeof(lightEmission));
+    MeshMaterial(m, &lightMaterial);
+    /* draw the light */
+    MeshSphere(m, lightRadius, segments, segments);
+    /* draw the shade */
+    InitMaterial(&lightMaterial, GL_FRONT, black, 128);
+    MeshMaterial(m, &lightMaterial);
+    MeshBegin(m, GL_QUAD_STRIP);
+      for(i = 0; i < sides; i++) {
+	MeshNormalv(m, lightShadeNormals[i]);
+	MeshVertex(m, lightShadeVertices[i]);
+	MeshVertex(m, lightShadeVertices[i+sides]);
       }
-
-
-      /* Place the real lights */
-      /* room light */
-      glLightfv(GL_LIGHT0, GL_AMBIENT, roomLightColor);
-      glLightfv(GL_LIGHT0, GL_DIFFUSE, roomLightColor);
-      glLightfv(GL_LIGHT0, GL_SPECULAR, roomLightColor);
-      glLightfv(GL_LIGHT0, GL_POSITION, realLightPositions[0]);
-      glLightf(GL_LIGHT0, GL_SPOT_CUTOFF, 180.0);
-      
-      /* spot lights */
-      glLightfv(GL_LIGHT1, GL_POSITION, realLightPositions[1]);
-      glLightfv(GL_LIGHT1, GL_SPOT_DIRECTION, lightDirection);
-      glLightf(GL_LIGHT1, GL_SPOT_CUTOFF, SPOTLIGHT_WIDTH);
-      
-      glLightfv(GL_LIGHT2, GL_POSITION, realLightPositions[2]);
-      glLightfv(GL_LIGHT2, GL_SPOT_DIRECTION, lightDirection);
-      glLightf(GL_LIGHT2, GL_SPOT_CUTOFF, SPOTLIGHT_WIDTH);
-
-      glLightfv(GL_LIGHT3, GL_POSITION, realLightPositions[3]);
-      glLightfv(GL_LIGHT3, GL_SPOT_DIRECTION, lightDirection);
-      glLightf(GL_LIGHT3, GL_SPOT_CUTOFF, SPOTLIGHT_WIDTH);
-      
-      glLightfv(GL_LIGHT4, GL_POSITION, realLightPositions[4]);
-      glLightfv(GL_LIGHT4, GL_SPOT_DIRECTION, lightDirection);
-      glLightf(GL_LIGHT4, GL_SPOT_CUTOFF, SPOTLIGHT_WIDTH);
-
-      glLightfv(GL_LIGHT5, GL_POSITION, realLightPositions[5]);
-      glLightfv(GL_LIGHT5, GL_SPOT_DIRECTION, lightDirection);
-      glLightf(GL_LIGHT5, GL_SPOT_CUTOFF, SPOTLIGHT_WIDTH);
-      
-      glLightfv(GL_LIGHT6, GL_POSITION, realLightPositions[6]);
-      glLightfv(GL_LIGHT6, GL_SPOT_DIRECTION, lightDirection);
-      glLightf(GL_LIGHT6, GL_SPOT_CUTOFF, SPOTLIGHT_WIDTH);
-
-    glEndList();
-  }
-  else {
-    fprintf(stderr, "ERROR: Unable to create display list for lights\n");
-    exit(1);
-  }
+      MeshNormalv(m, lightShadeNormals[0]);
+      MeshVertex(m, lightShadeVertices[0]);
+      MeshVertex(m, lightShadeVertices[sides]);
+    MeshEnd(m);
 }
 
 void InitAerator(void) {
+  PROFILE_BEGIN("InitAerator");
+  BuildLodMesh(&aerator, "aerator", BuildAerator, aeratorSegments);
+  PROFILE_END();
+}
+
+void BuildAerator(mesh *m, int segments) {
   int i;
   GLfloat topRadius = 1.0;
   GLfloat bottomRadius = 4.0;
   GLfloat height = 7.0;
-  GLfloat aeratorVertices[CONE_SEGMENTS*2][3];
-  GLfloat aeratorNormals[CONE_SEGMENTS][3];
+  GLfloat aeratorVertices[MAX_SEGMENTS*2][3];
+  GLfloat aeratorNormals[MAX_SEGMENTS][3];
   GLfloat aeratorInsideColor[] = {0.0, 0.0, 1.0, 1.0};
   GLfloat aeratorOutsideColor[] = {0.2, 0.07, 0.02, 1.0};
-
-  aerator = glGenLists(1);
-  if(aerator != 0) {
-
-    /* Calculate the aerator */
-    for(i = 0; i < CONE_SEGMENTS; i++) {
-      aeratorVertices[i][0] = bottomRadius * sin((2*PI/CONE_SEGMENTS)*i);
-      aeratorVertices[i][1] = 0.0;
-      aeratorVertices[i][2] = bottomRadius * cos((2*PI/CONE_SEGMENTS)*i);
-      aeratorVertices[i+CONE_SEGMENTS][0] = topRadius * sin((2*PI/CONE_SEGMENTS)*i);
-      aeratorVertices[i+CONE_SEGMENTS][1] = height;
-      aeratorVertices[i+CONE_SEGMENTS][2] = topRadius * cos((2*PI/CONE_SEGMENTS)*i);
-      aeratorNormals[i][0] = height * sin((2*PI/CONE_SEGMENTS)*i);
-      aeratorNormals[i][1] = bottomRadius - topRadius;
-      aeratorNormals[i][2] = height * cos((2*PI/CONE_SEGMENTS)*i);
-      Normalise(aeratorNormals[i]);
-    }
-
-    glNewList(aerator, GL_COMPILE);
-      glPushMatrix();
-        glTranslatef(0.0, 0.0, -20.0);
-	glLightModeli(GL_LIGHT_MODEL_TWO_SIDE, GL_TRUE);
-	/* set the material properties for the outdide... */
-	glMaterialfv(GL_FRONT, GL_AMBIENT_AND_DIFFUSE, aeratorOutsideColor);
-	glMaterialfv(GL_FRONT, GL_SPECULAR, aeratorOutsideColor);
-	glMaterialf(GL_FRONT, GL_SHININESS, 0);
-	/* ...and for the inside */
-	glMaterialfv(GL_BACK, GL_AMBIENT_AND_DIFFUSE, aeratorInsideColor);
-	glMaterialfv(GL_BACK, GL_SPECULAR, aeratorInsideColor);
-	glMaterialf(GL_BACK, GL_SHININESS, 128);
-	
-	/* Draw the aerator */
-	glBegin(GL_QUAD_STRIP);
-	  for(i = 0; i < CONE_SEGMENTS; i++) {
-	    glNormal3fv(aeratorNormals[i]);
-	    glVertex3fv(aeratorVertices[i+CONE_SEGMENTS]);
-	    glVertex3fv(aeratorVertices[i]);
-	  }
-	  glNormal3fv(aeratorNormals[0]);
-	  glVertex3fv(aeratorVertices[CONE_SEGMENTS]);
-	  glVertex3fv(aeratorVertices[0]);
-	glEnd();
-
-	glLightModeli(GL_LIGHT_MODEL_TWO_SIDE, GL_FALSE);
-      
-      glPopMatrix();
-    glEndList();
-  }
-  else {
-    fprintf(stderr, "ERROR: Unable to create display list for aerator\n");
-    exit(1);
+  material aeratorMaterial;
+
+  /* Calculate the aerator */
+  for(i = 0; i < segments; i++) {
+    aeratorVertices[i][0] = bottomRadius * sin((2*PI/segments)*i);
+    aeratorVertices[i][1] = 0.0;
+    aeratorVertices[i][2] = bottomRadius * cos((2*PI/segments)*i);
+    aeratorVertices[i+segments][0] = topRadius * sin((2*PI/segments)*i);
+    aeratorVertices[i+segments][1] = height;
+    aeratorVertices[i+segments][2] = topRadius * cos((2*PI/segments)*i);
+    aeratorNormals[i][0] = height * sin((2*PI/segments)*i);
+    aeratorNormals[i][1] = bottomRadius - topRadius;
+    aeratorNormals[i][2] = height * cos((2*PI/segments)*i);
+    Normalise(aeratorNormals[i]);
   }
+
+    MeshPushMatrix(m);
+      MeshTranslate(m, 0.0, 0.0, -20.0);
+      /* set the material properties for the outdide... */
+      InitMaterial(&aeratorMaterial, GL_FRONT, aeratorOutsideColor, 0);
+      /* ...and for the inside, lit from both sides */
+      aeratorMaterial.twoSided = 1;
+      memcpy(aeratorMaterial.backColor, aeratorInsideColor, sizeof(aeratorInsideColor));
+      aeratorMaterial.backShininess = 128;
+      MeshMaterial(m, &aeratorMaterial);
+
+      /* Draw the aerator */
+      MeshBegin(m, GL_QUAD_STRIP);
+	for(i = 0; i < segments; i++) {
+	  MeshNormalv(m, aeratorNormals[i]);
+	  MeshVertex(m, aeratorVertices[i+segments]);
+	  MeshVertex(m, aeratorVertices[i]);
+	}
+	MeshNormalv(m, aeratorNormals[0]);
+	MeshVertex(m, aeratorVertices[segments]);
+	MeshVertex(m, aeratorVertices[0]);
+      MeshEnd(m);
+    MeshPopMatrix(m);
 }
 
-void InitBubbles(void) {
+/* what the submarine can run into, with no GL so the simulation can
+   have it on its own */
+void InitColliders(void) {
+  /* open water is inside the glass and under the surface, which only
+     stops the submarine's middle so it can come up out of the water */
+  GLfloat planes[][4] = {{0.0, 1.0, 0.0, 0.0}, {0.0, -1.0, 0.0, -40.0},
+			 {1.0, 0.0, 0.0, -50.0}, {-1.0, 0.0, 0.0, -50.0},
+			 {0.0, 0.0, 1.0, -25.0}, {0.0, 0.0, -1.0, -25.0}};
+  GLfloat shelfLow[] = {-10.0, 20.0, -25.0};
+  GLfloat shelfHigh[] = {10.0, 21.0, -15.0};
+  mesh aeratorCollider;
   int i;
 
-  /* Disable all the bubbles */
-  for(i = 0; i < MAX_BUBBLES; i++) bubbles[i].active = 0;
+  PROFILE_BEGIN("InitColliders");
+  InitCollisionWorld(&tankWorld);
+  for(i = 0; i < 6; i++) AddPlaneCollider(&tankWorld, planes[i], planes[i][3], i == 1);
+  AddBoxCollider(&tankWorld, shelfLow, shelfHigh);
+  /* the aerator's own triangles, as it is usually drawn */
+  InitMesh(&aeratorCollider, "aerator collider");
+  BuildAerator(&aeratorCollider, aeratorSegments[1]);
+  AddMeshColliders(&tankWorld, &aeratorCollider);
+  FreeMesh(&aeratorCollider);
+  PROFILE_END();
+}
+
+void InitBubbles(void) {
+  PROFILE_BEGIN("InitBubbles");
   /* set point characteristics */
   glPointSize(4);
-  glEnable(GL_POINT_SMOOTH);
+  StateEnable(GL_POINT_SMOOTH, 1);
   glHint(GL_POINT_SMOOTH_HINT, GL_FASTEST);
+  InitBubbleRenderer();
+  PROFILE_END();
 }
 
 void InitSubmarine(void) {
+  PROFILE_BEGIN("InitSubmarine");
+  BuildLodMesh(&submarine, "submarine", BuildSubmarine, submarineSegments);
+  InitFleetRenderer();
+  PROFILE_END();
+}
+
+void BuildSubmarine(mesh *m, int segments) {
   int i;
   const GLfloat radius = 1.5;
   GLfloat submarineColor[] = {0.0124, 0.1288, 0.1992, 1.0};
-  GLfloat propellerGuardVertices[SUBMARINE_SEGMENTS*2][3];
-  GLfloat propellerGuardNormals[SUBMARINE_SEGMENTS][3];
-
-  submarine = glGenLists(1);
-  if(submarine != 0) {
-    glNewList(submarine, GL_COMPILE);
-
-      /* Set the material properties of the submarine */
-      glMaterialfv(GL_FRONT, GL_AMBIENT_AND_DIFFUSE, submarineColor);
-      glMaterialfv(GL_FRONT, GL_SPECULAR, submarineColor);
-      glMaterialf(GL_FRONT, GL_SHININESS, 100);
-      
-      /* Draw the body */
-      glPushMatrix();
-        glScalef(4.0, 1.0, 1.0);
-	glutSolidSphere(1.5, SUBMARINE_SEGMENTS, SUBMARINE_SEGMENTS);
-      glPopMatrix();
-
-      /* calculate the propeller_guard */
-      for(i = 0; i < SUBMARINE_SEGMENTS; i++) {
-	propellerGuardNormals[i][0] = 0.0;
-	propellerGuardNormals[i][1] = sin((2*PI/SUBMARINE_SEGMENTS)*i);
-	propellerGuardNormals[i][2] = cos((2*PI/SUBMARINE_SEGMENTS)*i);
-	propellerGuardVertices[i][0] = 5.5;
-	propellerGuardVertices[i][1] = radius * propellerGuardNormals[i][1]; 
-	propellerGuardVertices[i][2] = radius * propellerGuardNormals[i][2];
-	propellerGuardVertices[i+SUBMARINE_SEGMENTS][0] = 6.5;
-	propellerGuardVertices[i+SUBMARINE_SEGMENTS][1] = propellerGuardVertices[i][1];
-	propellerGuardVertices[i+SUBMARINE_SEGMENTS][2] = propellerGuardVertices[i][2];
+  GLfloat propellerGuardVertices[MAX_SEGMENTS*2][3];
+  GLfloat propellerGuardNormals[MAX_SEGMENTS][3];
+  material submarineMaterial;
+
+    /* Set the material properties of the submarine */
+    InitMaterial(&submarineMaterial, GL_FRONT, submarineColor, 100);
+    MeshMaterial(m, &submarineMaterial);
+    
+    /* Draw the body */
+    MeshPushMatrix(m);
+      MeshScale(m, 4.0, 1.0, 1.0);
+      MeshSphere(m, 1.5, segments, segments);
+    MeshPopMatrix(m);
+
+    /* calculate the propeller_guard */
+    for(i = 0; i < segments; i++) {
+      propellerGuardNormals[i][0] = 0.0;
+      propellerGuardNormals[i][1] = sin((2*PI/segments)*i);
+      propellerGuardNormals[i][2] = cos((2*PI/segments)*i);
+      propellerGuardVertices[i][0] = 5.5;
+      propellerGuardVertices[i][1] = radius * propellerGuardNormals[i][1]; 
+      propellerGuardVertices[i][2] = radius * propellerGuardNormals[i][2];
+      propellerGuardVertices[i+segments][0] = 6.5;
+      propellerGuardVertices[i+segments][1] = propellerGuardVertices[i][1];
+      propellerGuardVertices[i+segments][2] = propellerGuardVertices[i][2];
+    }
+
+    /* draw the propeller guard */
+    MeshBegin(m, GL_QUAD_STRIP);
+      for(i = 0; i < segments; i++) {
+	MeshNormalv(m, propellerGuardNormals[i]);
+	MeshVertex(m, propellerGuardVertices[i]);
+	MeshVertex(m, propellerGuardVertices[i+segments]);
       }
+      MeshNormalv(m, propellerGuardNormals[0]);
+      MeshVertex(m, propellerGuardVertices[0]);
+      MeshVertex(m, propellerGuardVertices[segments]);	  
+    MeshEnd(m);
+
+    /* draw the tower */
+    MeshPushMatrix(m);
+      MeshTranslate(m, 0.0, 1.5, 0.0);
+      MeshScale(m, 3.0, 1.0, 1.0);
+      MeshCube(m, 1.0);
+    MeshPopMatrix(m);
+
+    /* draw the fins */
+    /* elevators */
+    MeshPushMatrix(m);
+      MeshTranslate(m, -2.5, 0.0, 0.0);
+      MeshScale(m, 3, 1.0, 8.0);
+      MeshCube(m, 0.5);
+    MeshPopMatrix(m);
+    /* steering */
+    MeshPushMatrix(m);
+      MeshTranslate(m, 6.75, 0.0, 0.0);
+      MeshScale(m, 2.0, 8*radius, 1.0);
+      MeshCube(m, 0.25);
+    MeshPopMatrix(m);
+}
 
-      /* draw the propeller guard */
-      glBegin(GL_QUAD_STRIP);
-        for(i = 0; i < SUBMARINE_SEGMENTS; i++) {
-	  glNormal3fv(propellerGuardNormals[i]);
-	  glVertex3fv(propellerGuardVertices[i]);
-	  glVertex3fv(propellerGuardVertices[i+SUBMARINE_SEGMENTS]);
-	}
-	glNormal3fv(propellerGuardNormals[0]);
-	glVertex3fv(propellerGuardVertices[0]);
-	glVertex3fv(propellerGuardVertices[SUBMARINE_SEGMENTS]);	  
-      glEnd();
-
-      /* draw the tower */
-      glPushMatrix();
-        glTranslatef(0.0, 1.5, 0.0);
-	glScalef(3.0, 1.0, 1.0);
-	glutSolidCube(1.0);
-      glPopMatrix();
-
-      /* draw the fins */
-      /* elevators */
-      glPushMatrix();
-        glTranslatef(-2.5, 0.0, 0.0);
-	glScalef(3, 1.0, 8.0);
-	glutSolidCube(0.5);
-      glPopMatrix();
-      /* steering */
-      glPushMatrix();
-        glTranslatef(6.75, 0.0, 0.0);
-	glScalef(2.0, 8*radius, 1.0);
-	glutSolidCube(0.25);
-      glPopMatrix();
-
-    glEndList();
-  }
-  else {
-    fprintf(stderr, "ERROR: Unable to create display list for submarine\n");
-    exit(1);
-  }
+/* the scenery drawn with the world matrix, which all has to be built.
+   Anything with levels of detail is culled a copy at a time instead */
+void InitCulling(void) {
+  mesh *still[] = {&ground, &tank, &waterBack, &waterFront};
 
-  sub.x = 0.0;
-  sub.y = 20.0;
-  sub.z = 0.0;
-  sub.xVelocity = 0.0;
-  sub.yVelocity = 0.0;
-  sub.zVelocity = 0.0;
-  sub.dive = 0.0;
-  sub.turn = 0.0;
+  PROFILE_BEGIN("InitCulling");
+  BuildCullTree(&scenery, still, sizeof(still) / sizeof(still[0]));
+  PROFILE_END();
 }
 
 /**************************************************/
 /* DRAWING FUNCTIONS                              */
 /**************************************************/
-void DrawLights() {
+/* in the current view, and their colours for it */
+void PlaceLights(GLfloat *view) {
   GLfloat lightColor[] = {1.0, 1.0, 1.0, 1.0};
+  GLfloat realLightPositions[][4] = {{0.0, 400.0, 100.0, 1.0}, 
+				     {-30.0, 50.0, 12.0, 1.0}, {-30.0, 50.0, -12.0, 1.0}, 
+				     {0.0, 50.0, 12.0, 1.0}, {0.0, 50.0, -12.0, 1.0}, 
+				     {30.0, 50.0, 12.0, 1.0}, {30.0, 50.0, -12.0, 1.0}};
+  GLfloat lightDirection[3] = {0.0, -1.0, 0.0};
+  int i;
 
+  PROFILE_BEGIN("PlaceLights");
   /* Make the lights blue to give an underwater effect */
   if(viewPosition == IN_SUB) {
     lightColor[0] = 0.4;
@@ -993,313 +1049,391 @@ void DrawLights() {
   }
   else light0 = 1;
 
-  /* Draw the lights */
-  glCallList(lights);
-
-  /* Set the properties of the lights */
-  glLightfv(GL_LIGHT1, GL_AMBIENT, lightColor);
-  glLightfv(GL_LIGHT1, GL_DIFFUSE, lightColor);
-  glLightfv(GL_LIGHT1, GL_SPECULAR, lightColor);
-
-  glLightfv(GL_LIGHT2, GL_AMBIENT, lightColor);
-  glLightfv(GL_LIGHT2, GL_DIFFUSE, lightColor);
-  glLightfv(GL_LIGHT2, GL_SPECULAR, lightColor);
-
-  glLightfv(GL_LIGHT3, GL_AMBIENT, lightColor);
-  glLightfv(GL_LIGHT3, GL_DIFFUSE, lightColor);
-  glLightfv(GL_LIGHT3, GL_SPECULAR, lightColor);
-
-  glLightfv(GL_LIGHT4, GL_AMBIENT, lightColor);
-  glLightfv(GL_LIGHT4, GL_DIFFUSE, lightColor);
-  glLightfv(GL_LIGHT4, GL_SPECULAR, lightColor);
-
-  glLightfv(GL_LIGHT5, GL_AMBIENT, lightColor);
-  glLightfv(GL_LIGHT5, GL_DIFFUSE, lightColor);
-  glLightfv(GL_LIGHT5, GL_SPECULAR, lightColor);
-
-  glLightfv(GL_LIGHT6, GL_AMBIENT, lightColor);
-  glLightfv(GL_LIGHT6, GL_DIFFUSE, lightColor);
-  glLightfv(GL_LIGHT6, GL_SPECULAR, lightColor);
+  /* Place the real lights in the view, which is the current modelview */
+  StatePlaceLight(GL_LIGHT0, GL_POSITION, realLightPositions[0], view);
+  for(i = 1; i <= 6; i++) {
+    StatePlaceLight(GL_LIGHT0 + i, GL_POSITION, realLightPositions[i], view);
+    StatePlaceLight(GL_LIGHT0 + i, GL_SPOT_DIRECTION, lightDirection, view);
+  }
 
+  /* Set the properties of the lights, unchanged unless the view has */
+  for(i = 1; i <= 6; i++) {
+    StateLightfv(GL_LIGHT0 + i, GL_AMBIENT, lightColor);
+    StateLightfv(GL_LIGHT0 + i, GL_DIFFUSE, lightColor);
+    StateLightfv(GL_LIGHT0 + i, GL_SPECULAR, lightColor);
+  }
+  PROFILE_END();
 }
 
 void DrawBubbles(void) {
-  int i;
   GLfloat bubbleColor[] = {0.8, 0.8, 1.0, 0.2};
-  static float timeSinceBubble = 0;
-  static clock_t oldTime = 0;
-  clock_t newTime;
-  float elapsed;
-  GLfloat acceleration;
-  int active = 0;
-
-  newTime = clock();
-  elapsed = (float) (newTime - oldTime)/(float) CLOCKS_PER_SEC;
-  oldTime = newTime;
-  timeSinceBubble += elapsed;
-  acceleration = elapsed * BOUYANCY;
+  GLfloat black[] = {0.0, 0.0, 0.0, 1.0};
+  snapshot *view = CurrentSnapshot();
+  float *visible;
+  int count, levels[LOD_LEVELS];
 
+  PROFILE_BEGIN("DrawBubbles");
   /* Set the material properties of the bubbles */
-  glMaterialfv(GL_FRONT, GL_AMBIENT_AND_DIFFUSE, bubbleColor);
-  glMaterialfv(GL_FRONT, GL_SPECULAR, bubbleColor);
-  glMaterialf(GL_FRONT, GL_SHININESS, 50);
-
-  for(i = 0; i < MAX_BUBBLES; i++) {
-    if(bubbles[i].active) {
-      active++;
-      /* Calculate new bubble position */
-      bubbles[i].position[0] += bubbles[i].xVelocity * elapsed;
-      bubbles[i].position[1] += bubbles[i].yVelocity * elapsed;
-      bubbles[i].position[2] += bubbles[i].zVelocity * elapsed;
-      /* accelerate bubble upwards */
-      bubbles[i].yVelocity += acceleration * (1 + 0.5*(RandF() - 0.5));
-      /* collision detection */
-      if(bubbles[i].position[1] > 40.0) bubbles[i].active = 0; /* burst at water surface */
-      else {
-	if(HitShelf(bubbles[i])) {
-	  /* Move the bubble under the shelf */
-	  bubbles[i].position[1] -= bubbles[i].position[1] - 19.2;
-	  bubbles[i].yVelocity = -bubbles[i].yVelocity * BUBBLE_BOUNCE;
-	}
-	if(HitWall(bubbles[i])) {
-	  /* bounce of wall */
-	  bubbles[i].position[2] -= bubbles[i].position[2] + 24.2;
-	  bubbles[i].zVelocity = -bubbles[i].zVelocity * BUBBLE_BOUNCE;
-	}
-	/* Draw the bubble */
-	if(viewPosition == IN_SUB) {
-	  /* Draw bubbles as spheres when inside the tank */
-	  glPushMatrix();
-	    glTranslatef(bubbles[i].position[0],
-			 bubbles[i].position[1],
-			 bubbles[i].position[2]);
-	    glutSolidSphere(0.8, 10, 10);
-	  glPopMatrix();
-	}
-	else {
-	  /* Draw bubbles as points when outside the tank */
-	  glBegin(GL_POINTS);
-	    glVertex3fv(bubbles[i].position);
-	  glEnd();
-	}
-      }
-    }
-    else if(timeSinceBubble > TIME_BETWEEN_BUBBLES) { /* time to draw a new bubble */
-      /* release a new bubble */
-      bubbles[i].position[0] = 0.0;
-      bubbles[i].position[1] = 7.0;
-      bubbles[i].position[2] = -20.0;
-      bubbles[i].xVelocity = 4 * (RandF() - 0.5);
-      bubbles[i].yVelocity = 0.0;
-      bubbles[i].zVelocity = 4 * (RandF() - 0.5);
-      bubbles[i].active = 1;
-      timeSinceBubble -= TIME_BETWEEN_BUBBLES;
-    }
+  StateMaterialfv(GL_FRONT, GL_AMBIENT_AND_DIFFUSE, bubbleColor);
+  StateMaterialfv(GL_FRONT, GL_SPECULAR, bubbleColor);
+  StateMaterialfv(GL_FRONT, GL_EMISSION, black);
+  StateMaterialf(GL_FRONT, GL_SHININESS, 50);
+
+  if(viewPosition == IN_SUB) {
+    /* Draw bubbles as spheres when inside the tank */
+    visible = VisiblePoints(&frameQueue.arena, view->bubbles, view->count, BUBBLE_RADIUS, &count);
+    visible = PointsByLevel(&frameQueue.arena, visible, count, BUBBLE_RADIUS, bubbleSegments, levels);
+    DrawBubbleSpheres(visible, levels);
   }
-  if(active == MAX_BUBBLES) fprintf(stderr, "WARNING: MAX BUBBLES REACHED               \n");
-  fprintf(stderr, "\t\tActive bubbles: %2i\r", active);
+  else {
+    /* Draw bubbles as points when outside the tank, which GL clips by
+       their centres */
+    visible = VisiblePoints(&frameQueue.arena, view->bubbles, view->count, 0.0, &count);
+    DrawBubblePoints(visible, count);
+  }
+  cullCount.bubblesVisible = count;
+  cullCount.bubblesCulled = view->count - count;
+
+  PROFILE_END();
+
+  if(benchmarkFrames) return;
+  if(view->count == bubbles.size) fprintf(stderr, "WARNING: MAX BUBBLES REACHED               \n");
+  fprintf(stderr, "\t\tActive bubbles: %2i\r", view->count);
 }
 
 void DrawSubmarine(void) {
+  snapshot *view = CurrentSnapshot();
+
   glPushMatrix();
     /* move submarine into position */
-    glTranslatef(sub.x, sub.y, sub.z);
-    glRotatef(sub.turn, 0.0, 1.0, 0.0);
-    glRotatef(sub.dive, 0.0, 0.0, 1.0);
+    glTranslatef(view->sub[0], view->sub[1], view->sub[2]);
+    glRotatef(view->turn, 0.0, 1.0, 0.0);
+    glRotatef(view->dive, 0.0, 0.0, 1.0);
     /* Draw submarine */
-    glCallList(submarine);
+    QueueLodMesh(&frameQueue, &submarine, &submarineLevel, QueueMatrix(&frameQueue), PASS_WORLD);
   glPopMatrix();
 }
 
+/* every submarine in the fleet, but the one looked out of */
+void DrawFleet(void) {
+  snapshot *view = CurrentSnapshot();
+  int counts[LOD_LEVELS];
+  float *visible;
+
+  visible = VisibleFleet(&frameQueue.arena, view->fleet, view->subs,
+			 viewPosition == IN_SUB ? view->camera : -1, &submarine, counts);
+  DrawFleetInstances(&submarine, visible, counts);
+}
+
 /**************************************************/
-/* MISC FUNCTIONS                                 */
+/* BENCHMARK                                      */
 /**************************************************/
-float RandF() {
-  return (float)rand()/(float)RAND_MAX;
+void ParseArguments(int argc, char *argv[]) {
+  float x, y, z, rate;
+  int i, burst;
+
+  /* the aerator */
+  AddEmitter(0.0, 7.0, -20.0, 1.0 / TIME_BETWEEN_BUBBLES, 1);
+
+  /* unknown arguments are left for glutInit */
+  for(i = 1; i < argc; i++) {
+    if(strcmp(argv[i], "-headless") == 0)
+      headless = 1;
+    else if(strcmp(argv[i], "-nodraw") == 0)
+      noDraw = 1;
+    else if(strcmp(argv[i], "-benchmark") == 0 && i+1 < argc)
+      benchmarkFrames = atoi(argv[++i]);
+    else if(strcmp(argv[i], "-timestep") == 0 && i+1 < argc)
+      fixedTimeStep = atof(argv[++i]);
+    else if(strcmp(argv[i], "-snapshot") == 0 && i+1 < argc)
+      snapshotFile = argv[++i];
+    else if(strcmp(argv[i], "-view") == 0 && i+1 < argc)
+      viewPosition = strcmp(argv[++i], "inside") == 0 ? IN_SUB : OUTSIDE;
+    else if(strcmp(argv[i], "-bubbles") == 0 && i+1 < argc)
+      maxBubbles = atoi(argv[++i]);
+    else if(strcmp(argv[i], "-emitter") == 0 && i+1 < argc) {
+      if(sscanf(argv[++i], "%f,%f,%f,%f,%d", &x, &y, &z, &rate, &burst) == 5)
+	AddEmitter(x, y, z, rate, burst);
+      else fprintf(stderr, "WARNING: Ignoring emitter %s, expected X,Y,Z,RATE,BURST\n", argv[i]);
+    }
+    else if(strcmp(argv[i], "-simd") == 0 && i+1 < argc) {
+      if(!SelectParticleKernel(argv[++i]))
+	fprintf(stderr, "WARNING: Unknown SIMD kernel %s, using the default\n", argv[i]);
+    }
+    else if(strcmp(argv[i], "-threads") == 0 && i+1 < argc)
+      threadCount = atoi(argv[++i]);
+    else if(strcmp(argv[i], "-fleet") == 0 && i+1 < argc)
+      fleetSize = atoi(argv[++i]);
+    else if(strcmp(argv[i], "-camera") == 0 && i+1 < argc)
+      cameraSub = atoi(argv[++i]);
+    else if(strcmp(argv[i], "-seed") == 0 && i+1 < argc) {
+      randomSeed = (unsigned int) strtoul(argv[++i], NULL, 0);
+      seedGiven = 1;
+    }
+    else if(strcmp(argv[i], "-scaling") == 0)
+      scaling = 1;
+    else if(strcmp(argv[i], "-hashing") == 0)
+      hashing = 1;
+    else if(strcmp(argv[i], "-nointeract") == 0)
+      bubbleInteraction = 0;
+    else if(strcmp(argv[i], "-fluid") == 0 && i+1 < argc)
+      fluidCells = atoi(argv[++i]);
+    else if(strcmp(argv[i], "-fluidbudget") == 0 && i+1 < argc)
+      fluidBudget = atof(argv[++i]);
+    else if(strcmp(argv[i], "-decode") == 0 && i+1 < argc)
+      decodeRuns = atoi(argv[++i]);
+    else if(strcmp(argv[i], "-nocache") == 0)
+      useTextureCache = 0;
+    else if(strcmp(argv[i], "-nocompress") == 0)
+      noCompress = 1;
+    else if(strcmp(argv[i], "-stats") == 0)
+      statsOverlay = 1;
+    else if(strcmp(argv[i], "-capture") == 0 && i+1 < argc)
+      captureFile = argv[++i];
+    else if(strcmp(argv[i], "-replay") == 0 && i+1 < argc)
+      replayFile = argv[++i];
+    else if(strcmp(argv[i], "-lod") == 0 && i+1 < argc)
+      fixedLevel = atoi(argv[++i]);
+    else if(strcmp(argv[i], "-nocull") == 0)
+      culling = 0;
+    else if(strcmp(argv[i], "-fps") == 0 && i+1 < argc)
+      targetFrameRate = atof(argv[++i]);
+    else if(strcmp(argv[i], "-trace") == 0 && i+1 < argc)
+      SaveTraceAtExit(argv[++i]);
+    else if(strcmp(argv[i], "-startup") == 0 && i+1 < argc) {
+      startupRuns = atoi(argv[++i]);
+      headless = 1;
+    }
+  }
+  if(benchmarkFrames < 0) benchmarkFrames = 0;
+  if(maxBubbles < 1) maxBubbles = 1;
+  if(fleetSize < 1) fleetSize = 1;
+  if(noDraw && !benchmarkFrames) benchmarkFrames = 1000;
+  if(captureFile != NULL && !benchmarkFrames) {
+    fprintf(stderr, "WARNING: -capture needs -benchmark, not capturing\n");
+    captureFile = NULL;
+  }
+  if(benchmarkFrames && fixedTimeStep <= 0.0) fixedTimeStep = BENCHMARK_TIME_STEP;
 }
 
-int HitShelf(bubble b) {
-  if(b.position[1] >= 19.2 && b.position[2] < -15.0 &&
-     b.position[0] > -10.0 && b.position[0] < 10.0) return 1;
-  return 0;
+void RunBenchmark(void) {
+  while(BenchmarkFrame());
+  ReportBenchmark();
+  if(captureFile != NULL) SaveCapture(captureFile);
 }
 
-int HitWall(bubble b) {
-  if(b.position[2] < -24.2) return 1;
-  return 0;
-}
+/* run and time one frame, returns 0 once all frames are done */
+int BenchmarkFrame(void) {
+  double start, simulated, displayed;
 
-void AccelerateSubmarine(GLfloat acceleration) {
-  GLfloat x1, y1, z1;
-  GLfloat x2, y2, z2;
-  double theta;
-
-  /* acceleration vector before rotation is:
-     x = -acceleration
-     y = 0
-     z = 0
-  */
-
-  /* rotate around z axis */
-  theta = sub.dive * (PI/180);
-  x1 = -acceleration*cos(theta);
-  y1 = -acceleration*sin(theta);
-  z1 = 0.0;
-
-  /* rotate around y axis */
-  theta = sub.turn * (PI/180);
-  x2 = x1*cos(theta) + z1*sin(theta);
-  y2 = y1;
-  z2 = -x1*sin(theta) + z1*cos(theta);
-
-  /* add to velocity vector */
-  sub.xVelocity += x2;
-  sub.yVelocity += y2;
-  sub.zVelocity += z2;
-  
+  if(benchmarkFrame == 0) {
+    InitTimings(&simulationTimes, benchmarkFrames);
+    InitTimings(&displayTimes, benchmarkFrames);
+  }
+  if(benchmarkFrame >= benchmarkFrames) return 0;
+
+  start = Now();
+  AdvanceSimulationNow(fixedTimeStep);
+  simulated = Now();
+  AddTiming(&simulationTimes, simulated - start);
+
+  if(!noDraw) {
+    Display();
+    /* wait for the frame to be rendered, not just queued */
+    glFinish();
+    displayed = Now();
+    AddTiming(&displayTimes, displayed - simulated);
+  }
+  benchmarkFrame++;
+  return 1;
 }
 
-void CollisionDetection(void) {
-  int i;
-  GLfloat boundingBox[][3] = {{-6.0, -1.5, -2.0}, {-6.0, -1.5, 2.0},
-			       {-6.0, 2.0, -2.0}, {-6.0, 2.0, 2.0},
-			      {7.25, 2.0, 2.0}, {7.25, 2.0, -2.0},
-			      {7.25, -1.5, 2.0}, {7.25, -1.5, -2.0}};
-  GLfloat xAdj = 0.0, yAdj = 0.0, zAdj = 0.0;
-  GLfloat tmpX, tmpY, tmpZ;
-  GLfloat diveR, turnR;
-  
-  diveR = sub.dive * (PI/180);
-  turnR = sub.turn * (PI/180);
-  /* rotate and translate the bounding box */
-  for(i = 0; i < 8; i++) {
-    /* rotate bounding box around z */
-    tmpX = boundingBox[i][0]*cos(diveR) - boundingBox[i][1]*sin(diveR);
-    tmpY = boundingBox[i][0]*sin(diveR) + boundingBox[i][1]*cos(diveR);
-    tmpZ = boundingBox[i][2];
-    /* rotate bounding box around y */
-    boundingBox[i][0] = tmpX*cos(turnR) + tmpZ*sin(turnR);
-    boundingBox[i][1] = tmpY;
-    boundingBox[i][2] = -tmpX*sin(turnR) + tmpZ*cos(turnR);
-    /* translate bounding box */
-    boundingBox[i][0] += sub.x;
-    boundingBox[i][1] += sub.y;
-    boundingBox[i][2] += sub.z;
+void ReportBenchmark(void) {
+  printf("Benchmark: %d frames at %dx%d, %.4f s per step, %s\n",
+	 benchmarkFrame, WIN_X, WIN_Y, fixedTimeStep,
+	 noDraw ? "simulation only" : headless ? "headless" : "windowed");
+  printf("%d bubble slots, %d submarines, %s kernel, %d threads, seed %u\n",
+	 bubbles.size, subs.count, particleKernelNames[particleKernel], poolSize, randomSeed);
+  printf("%-12s %10s %10s %10s %10s\n", "(ms)", "min", "median", "p99", "max");
+  ReportTimings("simulation", &simulationTimes);
+  ReportTimings("display", &displayTimes);
+  ReportCollisions(&tankWorld);
+  ReportDistanceField(&tankField);
+  if(fluidCells > 0) ReportFluid(&water);
+  if(!noDraw) {
+    ReportRenderQueue(&frameQueue);
+    ReportCulling();
+    ReportLod();
+    ReportState();
+    ReportCalls();
+    ReportMeshes();
+    ReportTextures();
   }
+}
 
-  /* check if any of the bounding box vertices have hit anything */
-  for(i = 0; i < 8; i++) {
-    /* x */
-    if(boundingBox[i][0] < -50.0 && -50.0 - boundingBox[i][0] > xAdj)
-      xAdj = -50.0 - boundingBox[i][0];
-    if(boundingBox[i][0] > 50.0 && 50.0 - boundingBox[i][0] < xAdj)
-      xAdj = 50.0 - boundingBox[i][0];
-    /* y */
-    if(boundingBox[i][1] < 0.0 && 0.0 - boundingBox[i][1] > yAdj)
-      yAdj = 0.0 - boundingBox[i][1];
-    if(i > 5 && boundingBox[i][1] > 40.0 && 40.0 - boundingBox[i][1] < yAdj)
-      yAdj = 40.0 - boundingBox[i][1];
-    /* z */
-    if(boundingBox[i][2] < -25.0 && -25.0 - boundingBox[i][2] > zAdj)
-      zAdj = -25.0 - boundingBox[i][2];
-    if(boundingBox[i][2] > 25.0 && 25.0 - boundingBox[i][2] < zAdj)
-      zAdj = 25.0 - boundingBox[i][2];
-  }
-  if(sub.y > 40.0) yAdj = 40.0 - sub.y;
+/* time the bubble update on more and more threads */
+void RunScalingBenchmark(void) {
+  int sizes[] = {10000, 100000, 1000000};
+  particles p;
+  randomState r;
+  timings t;
+  double start, median, single = 0.0;
+  int s, threads, i, step;
+
+  ChooseParticleKernel();
+  SeedRandom(&r, randomSeed, 0);
+  printf("Scaling: %s kernel, %d steps of %.4f s\n",
+	 particleKernelNames[particleKernel], SCALING_STEPS, SIMULATION_STEP);
+  printf("%10s %8s %10s %8s\n", "particles", "threads", "ms/step", "speedup");
+  for(s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    InitParticles(&p, sizes[s]);
+    for(i = 0; i < sizes[s]; i++) {
+      /* all over the water, already moving */
+      AddParticle(&p, RandomFloat(&r) * 20.0 - 10.0, RandomFloat(&r) * 40.0,
+		  RandomFloat(&r) * 40.0 - 20.0, RandomFloat(&r) * 2.0 - 1.0,
+		  RandomFloat(&r) * 2.0, RandomFloat(&r) * 2.0 - 1.0);
+      p.noise[i] = RandomFloat(&r);
+    }
 
-  /* Adjust submarine position and velocity if we have hit anything */
-  if(xAdj != 0.0) {
-    sub.x += xAdj;
-    sub.xVelocity = -sub.xVelocity * SUB_BOUNCE;
-  }
-  if(yAdj != 0.0) {
-    sub.y += yAdj;
-    sub.yVelocity = -sub.yVelocity * SUB_BOUNCE;
-  }
-  if(zAdj != 0.0) {
-    sub.z += zAdj;
-    sub.zVelocity = -sub.zVelocity * SUB_BOUNCE;
+    for(threads = 1; threads <= poolSize; threads++) {
+      SetActiveThreads(threads);
+      InitTimings(&t, SCALING_STEPS);
+      for(step = 0; step < SCALING_STEPS; step++) {
+	start = Now();
+	MoveParticles(&p, SIMULATION_STEP, BOUYANCY);
+	AddTiming(&t, Now() - start);
+      }
+      median = MedianTiming(&t);
+      if(threads == 1) single = median;
+      printf("%10d %8d %10.3f %8.2f\n", sizes[s], threads, median * 1000.0, single / median);
+      free(t.samples);
+    }
+    FreeParticles(&p);
   }
+  SetActiveThreads(poolSize);
 }
 
-void SubdivideXY(GLfloat v1[3], GLfloat v2[3], GLfloat* vertices, int div) {
-  int i, j, index;
-
-  for(i = 0; i < div+1; i++) {
-    for(j = 0; j < div+1; j++) {
-      index = i*(div+1)*3 + j*3;
-      /* x */
-      if(i == 0)
-	vertices[index] = v1[0];
-      else if(i == div)
-	vertices[index] = v2[0];
-      else
-	vertices[index] = v1[0] + i/(float)div * (v2[0] - v1[0]);
-      /* y */
-      if(j == 0)
-	vertices[index+1] = v1[1];
-      else if(j == div)
-	vertices[index+1] = v2[1];
-      else
-	vertices[index+1] = v1[1] + j/(float)div * (v2[1] - v1[1]);
-      /* z */
-      vertices[index+2] = v1[2];
+/* time the spatial hash and bubble repulsion at the same density for
+   more and more bubbles, which should cost the same per bubble */
+void RunHashingBenchmark(void) {
+  int sizes[] = {1000, 10000, 100000, 1000000};
+  particles p;
+  spatialHash h;
+  randomState r;
+  timings build, repel;
+  double start, side;
+  int s, i, step;
+
+  SeedRandom(&r, randomSeed, 0);
+  InitSpatialHash(&h, BUBBLE_CONTACT);
+  printf("Hashing: %d threads, %d steps, %.1f bubbles a unit cube, about %.1f touching each\n",
+	 activeThreads, HASHING_STEPS, HASHING_DENSITY,
+	 HASHING_DENSITY * 4.0 / 3.0 * PI * BUBBLE_CONTACT * BUBBLE_CONTACT * BUBBLE_CONTACT);
+  printf("%10s %10s %10s %10s\n", "bubbles", "build ms", "repel ms", "ns/bubble");
+  for(s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    InitParticles(&p, sizes[s]);
+    side = pow(sizes[s] / HASHING_DENSITY, 1.0 / 3.0);
+    for(i = 0; i < sizes[s]; i++)
+      AddParticle(&p, RandomFloat(&r) * side, RandomFloat(&r) * side, RandomFloat(&r) * side,
+		  0.0, 0.0, 0.0);
+
+    InitTimings(&build, HASHING_STEPS);
+    InitTimings(&repel, HASHING_STEPS);
+    for(step = 0; step < HASHING_STEPS; step++) {
+      start = Now();
+      BuildSpatialHash(&h, &p);
+      AddTiming(&build, Now() - start);
+      /* no push, so every step finds the same bubbles */
+      start = Now();
+      RepelParticles(&h, BUBBLE_CONTACT, 0.0);
+      AddTiming(&repel, Now() - start);
     }
+    printf("%10d %10.3f %10.3f %10.1f\n", sizes[s], MedianTiming(&build) * 1000.0,
+	   MedianTiming(&repel) * 1000.0,
+	   (MedianTiming(&build) + MedianTiming(&repel)) * 1e9 / sizes[s]);
+    free(build.samples);
+    free(repel.samples);
+    FreeParticles(&p);
   }
+  FreeSpatialHash(&h);
 }
- 
-void SubdivideYZ(GLfloat v1[3], GLfloat v2[3], GLfloat* vertices, int div) {
-  int i, j, index;
-
-  for(i = 0; i < div+1; i++) {
-    for(j = 0; j < div+1; j++) {
-      index = i*(div+1)*3 + j*3;
-      /* x */
-      vertices[index] = v1[0];
-      /* y */
-      if(i == 0)
-	vertices[index+1] = v1[1];
-      else if(i == div)
-	vertices[index+1] = v2[1];
-      else
-	vertices[index+1] = v1[1] + i/(float)div * (v2[1] - v1[1]);
-      /* z */
-      if(j == 0)
-	vertices[index+2] = v1[2];
-      else if(j == div)
-	vertices[index+2] = v2[2];
-      else
-	vertices[index+2] = v1[2] + j/(float)div * (v2[2] - v1[2]);
+
+/* time mapping and decoding each texture file */
+void RunDecodeBenchmark(void) {
+  image texture;
+  timings t;
+  double start, median;
+  int i, run;
+
+  printf("Decode: %d runs\n", decodeRuns);
+  printf("%-12s %10s %10s %10s %10s %10s\n", "(ms)", "min", "median", "p99", "max", "MB/s");
+  for(i = 0; i < NUMBER_OF_TEXTURES; i++) {
+    InitTimings(&t, decodeRuns);
+    for(run = 0; run < decodeRuns; run++) {
+      start = Now();
+      if(!open_image_file(textureFiles[i], &texture)) break;
+      AddTiming(&t, Now() - start);
+      free_image(&texture);
     }
-  }
-} 
-
-void SubdivideXZ(GLfloat v1[3], GLfloat v2[3], GLfloat* vertices, int div) {
-  int i, j, index;
-
-  for(i = 0; i < div+1; i++) {
-    for(j = 0; j < div+1; j++) {
-      index = i*(div+1)*3 + j*3;
-      /* x */
-      if(i == 0)
-	vertices[index] = v1[0];
-      else if(i == div)
-	vertices[index] = v2[0];
-      else
-	vertices[index] = v1[0] + i/(float)div * (v2[0] - v1[0]);
-      /* y */
-      vertices[index+1] = v1[1];
-      /* z */
-      if(j == 0)
-	vertices[index+2] = v1[2];
-      else if(j == div)
-	vertices[index+2] = v2[2];
-      else
-	vertices[index+2] = v1[2] + j/(float)div * (v2[2] - v1[2]);
+    if(t.count == 0) {
+      free(t.samples);
+      continue;
     }
+    median = MedianTiming(&t);
+    printf("%-12s %10.3f %10.3f %10.3f %10.3f %10.1f\n", textureFiles[i],
+	   t.samples[0] * 1000.0, median * 1000.0, t.samples[(int) ((t.count - 1) * 0.99)] * 1000.0,
+	   t.samples[t.count-1] * 1000.0, texture.width * texture.height * 4 / median / 1e6);
+    free(t.samples);
+  }
+}
+
+/* time from starting to load the textures to the first frame, and to
+   having them all, with no cache files and then with them */
+void RunStartupBenchmark(void) {
+  timings coldFrame, coldLoaded, warmFrame, warmLoaded;
+  int run, i;
+
+  FinishTextureLoading();
+  glDeleteTextures(NUMBER_OF_TEXTURES, textures);
+  ForgetState();
+  InitTimings(&coldFrame, startupRuns);
+  InitTimings(&coldLoaded, startupRuns);
+  InitTimings(&warmFrame, startupRuns);
+  InitTimings(&warmLoaded, startupRuns);
+  texturesCached = texturesDecoded = 0;
+  for(run = 0; run < startupRuns; run++) {
+    for(i = 0; i < NUMBER_OF_TEXTURES; i++) RemoveCachedTexture(textureFiles[i]);
+    TimeStartup(&coldFrame, &coldLoaded);
+    TimeStartup(&warmFrame, &warmLoaded);
   }
-} 
 
+  printf("Startup: %d runs of %d textures, %d decoded and %d from the cache%s\n",
+	 startupRuns, NUMBER_OF_TEXTURES, texturesDecoded, texturesCached,
+	 useTextureCache ? "" : " (cache off)");
+  printf("%-12s %10s %10s %10s %10s\n", "(ms)", "min", "median", "p99", "max");
+  ReportTimings("cold frame", &coldFrame);
+  ReportTimings("cold loaded", &coldLoaded);
+  ReportTimings("warm frame", &warmFrame);
+  ReportTimings("warm loaded", &warmLoaded);
+}
+
+void TimeStartup(timings *frame, timings *loaded) {
+  double start = Now();
+
+  InitTextures();
+  Display();
+  glFinish();
+  AddTiming(frame, Now() - start);
+  FinishTextureLoading();
+  glFinish();
+  AddTiming(loaded, Now() - start);
+  glDeleteTextures(NUMBER_OF_TEXTURES, textures);
+  ForgetState();
+}
+
+/**************************************************/
+/* MISC FUNCTIONS                                 */
+/**************************************************/
 GLfloat *CrossProduct(GLfloat m1[3], GLfloat m2[3], GLfloat result[3]) {
   result[0] = m1[1]*m2[2] - m2[1]*m1[2];
   result[1] = m2[0]*m1[2] - m1[0]*m2[2];
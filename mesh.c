@@ -0,0 +1,735 @@
+/*************************************************************************
+ * Static geometry kept on the card. A mesh is built up much like       *
+ * immediate mode, a primitive at a time, but turned into indexed       *
+ * triangles and lines and uploaded once to a vertex buffer, an index   *
+ * buffer and a vertex array object. Runs of indices with the same     *
+ * material are drawn with one call each                                *
+ *************************************************************************/
+
+#include <stddef.h>
+
+#define MAX_MESHES 16
+#define MAX_MATERIALS 64
+#define MESH_STACK 8
+/* post transform vertex cache the triangle order is tuned for */
+#define MESH_CACHE_SIZE 16
+
+/* interleaved in the order of GL_T2F_N3F_V3F */
+typedef struct {
+  GLfloat texCoord[2];
+  GLfloat normal[3];
+  GLfloat position[3];
+} meshVertex;
+
+/* everything a mesh part sets before it is drawn */
+typedef struct {
+  GLenum face;			/* GL_FRONT or GL_FRONT_AND_BACK */
+  GLfloat color[4];		/* ambient, diffuse and specular */
+  GLfloat emission[4];
+  GLfloat shininess;
+  GLuint *texture;		/* where the texture name is kept, NULL for none */
+  int twoSided;			/* back faces lit with the back colour */
+  GLfloat backColor[4];
+  GLfloat backShininess;
+} material;
+
+/* a run of indices drawn with one material */
+typedef struct {
+  int material;			/* in materials[] */
+  GLenum mode;			/* GL_TRIANGLES or GL_LINES */
+  int first, count;
+  GLfloat low[3], high[3];	/* bounding box, for culling */
+  GLfloat centre[3];		/* of its bounding box, for sorting */
+} meshPart;
+
+typedef struct {
+  char *name;
+  meshVertex *vertices;
+  int vertexCount, vertexSize;
+  GLuint *indices;
+  int indexCount, indexSize;
+  meshPart *parts;
+  int partCount, partSize;
+
+  /* once uploaded */
+  GLenum indexType;		/* GL_UNSIGNED_SHORT when the vertices allow */
+  int indexBytes;
+  GLuint vertexBuffer, indexBuffer, vertexArray;
+  float inputMissRatio;		/* vertex cache misses per triangle as built */
+  float missRatio;		/* and after reordering */
+
+  /* while building */
+  material current;
+  int newPart;
+  GLenum primitive;
+  int primitiveStart;
+  GLfloat normal[3], texCoord[2];
+  GLfloat translate[MESH_STACK][3], scale[MESH_STACK][3];
+  int depth;
+} mesh;
+
+mesh *meshes[MAX_MESHES];
+int meshCount = 0;
+
+/* every different material used, so parts can be compared by number */
+material materials[MAX_MATERIALS];
+int materialCount = 0;
+
+void InitMesh(mesh *, char *);
+void InitMaterial(material *, GLenum, GLfloat[4], GLfloat);
+void MeshMaterial(mesh *, material *);
+void MeshBegin(mesh *, GLenum);
+void MeshEnd(mesh *);
+void MeshNormal(mesh *, GLfloat, GLfloat, GLfloat);
+void MeshNormalv(mesh *, GLfloat[3]);
+void MeshTexCoord(mesh *, GLfloat, GLfloat);
+void MeshVertex(mesh *, GLfloat[3]);
+void MeshPushMatrix(mesh *);
+void MeshPopMatrix(mesh *);
+void MeshTranslate(mesh *, GLfloat, GLfloat, GLfloat);
+void MeshScale(mesh *, GLfloat, GLfloat, GLfloat);
+void MeshSphere(mesh *, GLfloat, int, int);
+void MeshCube(mesh *, GLfloat);
+void MeshGrid(mesh *, GLfloat[3], GLfloat[3], int, int, int, int);
+void UploadMesh(mesh *);
+void FreeMesh(mesh *);
+void SwitchMesh(mesh *, mesh *);
+void DrawMeshPart(mesh *, meshPart *);
+void ApplyMaterial(material *, material *);
+int InternMaterial(material *);
+int SameMaterial(material *, material *);
+void ReportMeshes(void);
+void OptimiseMeshPart(mesh *, meshPart *);
+long CacheMisses(GLuint *, int, int *, int);
+void StartMeshPart(mesh *, GLenum);
+void AddMeshIndex(mesh *, GLuint);
+void SetMeshArrays(mesh *);
+void *GrowMeshArray(void *, int *, int, int);
+
+/* an empty mesh, listed for ReportMeshes() */
+void InitMesh(mesh *m, char *name) {
+  GLfloat white[] = {1.0, 1.0, 1.0, 1.0};
+
+  memset(m, 0, sizeof(mesh));
+  m->name = name;
+  m->scale[0][0] = m->scale[0][1] = m->scale[0][2] = 1.0;
+  InitMaterial(&m->current, GL_FRONT, white, 0);
+  m->newPart = 1;
+  if(meshCount < MAX_MESHES) meshes[meshCount++] = m;
+}
+
+/* untextured, not emissive and one sided */
+void InitMaterial(material *mat, GLenum face, GLfloat color[4], GLfloat shininess) {
+  memset(mat, 0, sizeof(material));
+  mat->face = face;
+  memcpy(mat->color, color, sizeof(mat->color));
+  mat->emission[3] = 1.0;
+  mat->shininess = shininess;
+}
+
+/* used for everything after, until the next one */
+void MeshMaterial(mesh *m, material *mat) {
+  m->current = *mat;
+  m->newPart = 1;
+}
+
+/* GL_TRIANGLES, GL_QUADS, GL_QUAD_STRIP or GL_LINE_LOOP */
+void MeshBegin(mesh *m, GLenum primitive) {
+  m->primitive = primitive;
+  m->primitiveStart = m->vertexCount;
+}
+
+/* index the vertices given since MeshBegin() */
+void MeshEnd(mesh *m) {
+  GLenum mode = m->primitive == GL_LINE_LOOP ? GL_LINES : GL_TRIANGLES;
+  int first = m->primitiveStart, n = m->vertexCount - first;
+  int i;
+
+  if(n == 0) return;
+  StartMeshPart(m, mode);
+
+  switch(m->primitive) {
+  case GL_TRIANGLES:
+    for(i = 0; i < n - n % 3; i++) AddMeshIndex(m, first + i);
+    break;
+  case GL_QUADS:
+    /* split along the same diagonal GL_QUADS are, so the shading is the
+       same */
+    for(i = 0; i + 3 < n; i += 4) {
+      AddMeshIndex(m, first + i);
+      AddMeshIndex(m, first + i + 1);
+      AddMeshIndex(m, first + i + 3);
+      AddMeshIndex(m, first + i + 1);
+      AddMeshIndex(m, first + i + 2);
+      AddMeshIndex(m, first + i + 3);
+    }
+    break;
+  case GL_QUAD_STRIP:
+    /* quad i is vertices 2i, 2i+1, 2i+3 and 2i+2 */
+    for(i = 0; i + 3 < n; i += 2) {
+      AddMeshIndex(m, first + i);
+      AddMeshIndex(m, first + i + 1);
+      AddMeshIndex(m, first + i + 3);
+      AddMeshIndex(m, first + i);
+      AddMeshIndex(m, first + i + 3);
+      AddMeshIndex(m, first + i + 2);
+    }
+    break;
+  case GL_LINE_LOOP:
+    for(i = 0; i < n; i++) {
+      AddMeshIndex(m, first + i);
+      AddMeshIndex(m, first + (i + 1) % n);
+    }
+    break;
+  default:
+    fprintf(stderr, "ERROR: Mesh %s can't take primitive %d\n", m->name, (int) m->primitive);
+    exit(1);
+  }
+}
+
+void MeshNormal(mesh *m, GLfloat x, GLfloat y, GLfloat z) {
+  m->normal[0] = x;
+  m->normal[1] = y;
+  m->normal[2] = z;
+}
+
+void MeshNormalv(mesh *m, GLfloat n[3]) {
+  MeshNormal(m, n[0], n[1], n[2]);
+}
+
+void MeshTexCoord(mesh *m, GLfloat s, GLfloat t) {
+  m->texCoord[0] = s;
+  m->texCoord[1] = t;
+}
+
+/* with the current normal and texture coordinate, moved by the current
+   matrix. The normal is divided by the scale but not renormalised, so
+   it lights exactly as it did through the modelview matrix without
+   GL_NORMALIZE */
+void MeshVertex(mesh *m, GLfloat v[3]) {
+  meshVertex *out;
+  int k;
+
+  m->vertices = GrowMeshArray(m->vertices, &m->vertexSize, m->vertexCount + 1, sizeof(meshVertex));
+  out = &m->vertices[m->vertexCount++];
+  out->texCoord[0] = m->texCoord[0];
+  out->texCoord[1] = m->texCoord[1];
+  for(k = 0; k < 3; k++) {
+    out->normal[k] = m->normal[k] / m->scale[m->depth][k];
+    out->position[k] = m->translate[m->depth][k] + m->scale[m->depth][k] * v[k];
+  }
+}
+
+/* the matrix is only ever a translation and a scale */
+void MeshPushMatrix(mesh *m) {
+  if(m->depth + 1 >= MESH_STACK) {
+    fprintf(stderr, "ERROR: Mesh %s matrix stack overflow\n", m->name);
+    exit(1);
+  }
+  memcpy(m->translate[m->depth+1], m->translate[m->depth], sizeof(m->translate[0]));
+  memcpy(m->scale[m->depth+1], m->scale[m->depth], sizeof(m->scale[0]));
+  m->depth++;
+}
+
+void MeshPopMatrix(mesh *m) {
+  if(m->depth > 0) m->depth--;
+}
+
+void MeshTranslate(mesh *m, GLfloat x, GLfloat y, GLfloat z) {
+  m->translate[m->depth][0] += m->scale[m->depth][0] * x;
+  m->translate[m->depth][1] += m->scale[m->depth][1] * y;
+  m->translate[m->depth][2] += m->scale[m->depth][2] * z;
+}
+
+void MeshScale(mesh *m, GLfloat x, GLfloat y, GLfloat z) {
+  m->scale[m->depth][0] *= x;
+  m->scale[m->depth][1] *= y;
+  m->scale[m->depth][2] *= z;
+}
+
+/* laid out like gluSphere(): around the z axis, stacks from +z to -z,
+   but with the vertices shared between neighbouring quads */
+void MeshSphere(mesh *m, GLfloat radius, int slices, int stacks) {
+  GLfloat n[3], v[3];
+  double rho, theta;
+  int base = m->vertexCount;
+  int i, j, a, b;
+
+  /* a grid of vertices, the seam and the poles repeated */
+  for(i = 0; i <= stacks; i++) {
+    rho = PI * i / stacks;
+    for(j = 0; j <= slices; j++) {
+      theta = j == slices ? 0.0 : 2 * PI * j / slices;
+      n[0] = -sin(theta) * sin(rho);
+      n[1] = cos(theta) * sin(rho);
+      n[2] = cos(rho);
+      v[0] = radius * n[0];
+      v[1] = radius * n[1];
+      v[2] = radius * n[2];
+      MeshNormalv(m, n);
+      MeshVertex(m, v);
+    }
+  }
+
+  /* leaving out the triangles that collapse at the poles */
+  StartMeshPart(m, GL_TRIANGLES);
+  for(i = 0; i < stacks; i++) {
+    for(j = 0; j < slices; j++) {
+      a = base + i * (slices + 1) + j;
+      b = a + slices + 1;
+      if(i > 0) {
+	AddMeshIndex(m, a);
+	AddMeshIndex(m, b);
+	AddMeshIndex(m, a + 1);
+      }
+      if(i < stacks - 1) {
+	AddMeshIndex(m, a + 1);
+	AddMeshIndex(m, b);
+	AddMeshIndex(m, b + 1);
+      }
+    }
+  }
+}
+
+/* same cube as glutSolidCube() */
+void MeshCube(mesh *m, GLfloat size) {
+  GLfloat normals[6][3] = {{-1.0, 0.0, 0.0}, {0.0, 1.0, 0.0}, {1.0, 0.0, 0.0},
+			   {0.0, -1.0, 0.0}, {0.0, 0.0, 1.0}, {0.0, 0.0, -1.0}};
+  GLint faces[6][4] = {{0, 1, 2, 3}, {3, 2, 6, 7}, {7, 6, 5, 4},
+		       {4, 5, 1, 0}, {5, 6, 2, 1}, {7, 4, 0, 3}};
+  GLfloat vertices[8][3];
+  int i;
+
+  vertices[0][0] = vertices[1][0] = vertices[2][0] = vertices[3][0] = -size / 2;
+  vertices[4][0] = vertices[5][0] = vertices[6][0] = vertices[7][0] = size / 2;
+  vertices[0][1] = vertices[1][1] = vertices[4][1] = vertices[5][1] = -size / 2;
+  vertices[2][1] = vertices[3][1] = vertices[6][1] = vertices[7][1] = size / 2;
+  vertices[0][2] = vertices[3][2] = vertices[4][2] = vertices[7][2] = -size / 2;
+  vertices[1][2] = vertices[2][2] = vertices[5][2] = vertices[6][2] = size / 2;
+
+  MeshBegin(m, GL_QUADS);
+  for(i = 0; i < 6; i++) {
+    MeshNormalv(m, normals[i]);
+    MeshVertex(m, vertices[faces[i][0]]);
+    MeshVertex(m, vertices[faces[i][1]]);
+    MeshVertex(m, vertices[faces[i][2]]);
+    MeshVertex(m, vertices[faces[i][3]]);
+  }
+  MeshEnd(m);
+}
+
+/* a grid of quads between two opposite corners of a rectangle, across
+   axes u and v (0 is x, 1 y, 2 z), with each vertex shared by the quads
+   around it. Uses the current normal, texture coordinates go from 0 to 1
+   across the grid */
+void MeshGrid(mesh *m, GLfloat from[3], GLfloat to[3], int u, int v,
+	      int uDivisions, int vDivisions) {
+  GLfloat p[3];
+  int base = m->vertexCount;
+  int i, j, a, b;
+
+  memcpy(p, from, sizeof(p));
+  for(i = 0; i <= uDivisions; i++) {
+    for(j = 0; j <= vDivisions; j++) {
+      /* the far edges exactly, so grids that share them meet */
+      p[u] = i == uDivisions ? to[u] : from[u] + i / (float) uDivisions * (to[u] - from[u]);
+      p[v] = j == vDivisions ? to[v] : from[v] + j / (float) vDivisions * (to[v] - from[v]);
+      MeshTexCoord(m, i / (float) uDivisions, j / (float) vDivisions);
+      MeshVertex(m, p);
+    }
+  }
+
+  /* quad a, b, b+1, a+1, split the same way as in MeshEnd(). Each grid
+     is a part of its own so it is sorted on its own */
+  m->newPart = 1;
+  StartMeshPart(m, GL_TRIANGLES);
+  for(i = 0; i < uDivisions; i++) {
+    for(j = 0; j < vDivisions; j++) {
+      a = base + i * (vDivisions + 1) + j;
+      b = a + vDivisions + 1;
+      AddMeshIndex(m, a);
+      AddMeshIndex(m, b);
+      AddMeshIndex(m, a + 1);
+      AddMeshIndex(m, b);
+      AddMeshIndex(m, b + 1);
+      AddMeshIndex(m, a + 1);
+    }
+  }
+}
+
+/* copy the finished mesh to buffers, if there are any, and free the
+   copy in client memory */
+void UploadMesh(mesh *m) {
+  GLushort *shortIndices;
+  long triangles = 0, inputMisses = 0, misses = 0;
+  meshPart *part;
+  int *cache;
+  int i, j, k;
+
+  /* triangles reordered so the vertices they share are still in the
+     vertex cache, counting the misses before and after */
+  cache = malloc((m->vertexCount + 1) * sizeof(int));
+  if(cache == NULL) {
+    fprintf(stderr, "ERROR: Unable to allocate vertex cache for mesh %s\n", m->name);
+    exit(1);
+  }
+  for(i = 0; i < m->partCount; i++) {
+    if(m->parts[i].mode != GL_TRIANGLES) continue;
+    triangles += m->parts[i].count / 3;
+    inputMisses += CacheMisses(m->indices + m->parts[i].first, m->parts[i].count,
+			       cache, m->vertexCount);
+    OptimiseMeshPart(m, &m->parts[i]);
+    misses += CacheMisses(m->indices + m->parts[i].first, m->parts[i].count,
+			  cache, m->vertexCount);
+  }
+  free(cache);
+  m->inputMissRatio = triangles ? (float) inputMisses / triangles : 0.0;
+  m->missRatio = triangles ? (float) misses / triangles : 0.0;
+
+  for(i = 0; i < m->partCount; i++) {
+    part = &m->parts[i];
+    for(k = 0; k < 3; k++) {
+      part->low[k] = 1e30;
+      part->high[k] = -1e30;
+    }
+    for(j = part->first; j < part->first + part->count; j++) {
+      for(k = 0; k < 3; k++) {
+	if(m->vertices[m->indices[j]].position[k] < part->low[k])
+	  part->low[k] = m->vertices[m->indices[j]].position[k];
+	if(m->vertices[m->indices[j]].position[k] > part->high[k])
+	  part->high[k] = m->vertices[m->indices[j]].position[k];
+      }
+    }
+    for(k = 0; k < 3; k++) part->centre[k] = (part->low[k] + part->high[k]) / 2;
+  }
+
+  /* half the size when every vertex can be reached in 16 bits */
+  m->indexType = GL_UNSIGNED_INT;
+  m->indexBytes = sizeof(GLuint);
+  if(m->vertexCount <= 65536) {
+    shortIndices = malloc(m->indexCount * sizeof(GLushort) + 1);
+    if(shortIndices == NULL) {
+      fprintf(stderr, "ERROR: Unable to allocate indices for mesh %s\n", m->name);
+      exit(1);
+    }
+    for(i = 0; i < m->indexCount; i++) shortIndices[i] = (GLushort) m->indices[i];
+    free(m->indices);
+    m->indices = (GLuint *) shortIndices;
+    m->indexType = GL_UNSIGNED_SHORT;
+    m->indexBytes = sizeof(GLushort);
+  }
+
+  if(!haveBuffers) return;
+  glGenBuffers(1, &m->vertexBuffer);
+  glGenBuffers(1, &m->indexBuffer);
+  glBindBuffer(GL_ARRAY_BUFFER, m->vertexBuffer);
+  glBufferData(GL_ARRAY_BUFFER, m->vertexCount * sizeof(meshVertex), m->vertices, GL_STATIC_DRAW);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m->indexBuffer);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, (long) m->indexCount * m->indexBytes, m->indices,
+	       GL_STATIC_DRAW);
+  free(m->vertices);
+  free(m->indices);
+  m->vertices = NULL;
+  m->indices = NULL;
+
+  /* the array setup recorded once, so drawing is a single bind */
+  if(haveVertexArrays) {
+    glGenVertexArrays(1, &m->vertexArray);
+    glBindVertexArray(m->vertexArray);
+    SetMeshArrays(m);
+    glBindVertexArray(0);
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+/* done with a mesh that was never uploaded, which is no longer listed */
+void FreeMesh(mesh *m) {
+  int i;
+
+  free(m->vertices);
+  free(m->indices);
+  free(m->parts);
+  m->vertices = NULL;
+  m->indices = NULL;
+  m->parts = NULL;
+  m->vertexCount = m->indexCount = m->partCount = 0;
+  for(i = 0; i < meshCount && meshes[i] != m; i++);
+  if(i == meshCount) return;
+  memmove(meshes + i, meshes + i + 1, (meshCount - i - 1) * sizeof(mesh *));
+  meshCount--;
+}
+
+/* from one mesh's arrays to another's, either can be NULL for none */
+void SwitchMesh(mesh *from, mesh *to) {
+  if(from == to) return;
+  if(from != NULL && !from->vertexArray) {
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    if(from->vertexBuffer) {
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    }
+  }
+  if(to != NULL && to->vertexArray) glBindVertexArray(to->vertexArray);
+  else {
+    if(from != NULL && from->vertexArray) glBindVertexArray(0);
+    if(to != NULL) SetMeshArrays(to);
+  }
+}
+
+/* with the mesh's arrays already set up by SwitchMesh() */
+void DrawMeshPart(mesh *m, meshPart *part) {
+  char *indices = m->indexBuffer ? NULL : (char *) m->indices;
+
+  glDrawElements(part->mode, part->count, m->indexType,
+		 indices + (long) part->first * m->indexBytes);
+}
+
+/* only what differs from previous, or everything if previous is NULL */
+void ApplyMaterial(material *mat, material *previous) {
+  int all = previous == NULL || previous->face != mat->face;
+
+  if(all || memcmp(mat->color, previous->color, sizeof(mat->color)) != 0) {
+    StateMaterialfv(mat->face, GL_AMBIENT_AND_DIFFUSE, mat->color);
+    StateMaterialfv(mat->face, GL_SPECULAR, mat->color);
+  }
+  if(all || memcmp(mat->emission, previous->emission, sizeof(mat->emission)) != 0)
+    StateMaterialfv(mat->face, GL_EMISSION, mat->emission);
+  if(all || mat->shininess != previous->shininess)
+    StateMaterialf(mat->face, GL_SHININESS, mat->shininess);
+  if(mat->twoSided && (all || !previous->twoSided ||
+		       memcmp(mat->backColor, previous->backColor, sizeof(mat->backColor)) != 0 ||
+		       mat->backShininess != previous->backShininess)) {
+    StateMaterialfv(GL_BACK, GL_AMBIENT_AND_DIFFUSE, mat->backColor);
+    StateMaterialfv(GL_BACK, GL_SPECULAR, mat->backColor);
+    StateMaterialf(GL_BACK, GL_SHININESS, mat->backShininess);
+  }
+  if(all || mat->twoSided != previous->twoSided)
+    StateLightModeli(GL_LIGHT_MODEL_TWO_SIDE, mat->twoSided ? GL_TRUE : GL_FALSE);
+
+  if(mat->texture != NULL) {
+    if(all || previous->texture == NULL) {
+      glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+      StateEnable(GL_TEXTURE_2D, 1);
+    }
+    if(all || previous->texture == NULL || *previous->texture != *mat->texture)
+      StateBindTexture(*mat->texture);
+  }
+  else if(all || previous->texture != NULL) StateEnable(GL_TEXTURE_2D, 0);
+}
+
+/* the number of mat in materials[], adding it if it is new */
+int InternMaterial(material *mat) {
+  int i;
+
+  for(i = 0; i < materialCount; i++) if(SameMaterial(&materials[i], mat)) return i;
+  if(materialCount == MAX_MATERIALS) {
+    fprintf(stderr, "ERROR: More than %d materials\n", MAX_MATERIALS);
+    exit(1);
+  }
+  materials[materialCount] = *mat;
+  return materialCount++;
+}
+
+/* field by field, as the padding between them can differ */
+int SameMaterial(material *a, material *b) {
+  return a->face == b->face && memcmp(a->color, b->color, sizeof(a->color)) == 0 &&
+    memcmp(a->emission, b->emission, sizeof(a->emission)) == 0 &&
+    a->shininess == b->shininess && a->texture == b->texture && a->twoSided == b->twoSided &&
+    (!a->twoSided || (memcmp(a->backColor, b->backColor, sizeof(a->backColor)) == 0 &&
+		      a->backShininess == b->backShininess));
+}
+
+/* geometry sent to the card */
+void ReportMeshes(void) {
+  mesh *m;
+  long bytes, total = 0;
+  int i;
+
+  /* ACMR is vertex cache misses per triangle, as built and as drawn */
+  printf("%-12s %8s %8s %6s %6s %10s %6s %6s\n",
+	 "mesh", "vertices", "indices", "bits", "parts", "bytes", "ACMR", "built");
+  for(i = 0; i < meshCount; i++) {
+    m = meshes[i];
+    bytes = (long) m->vertexCount * sizeof(meshVertex) + (long) m->indexCount * m->indexBytes;
+    printf("%-12s %8d %8d %6d %6d %10ld %6.3f %6.3f\n", m->name, m->vertexCount, m->indexCount,
+	   m->indexBytes * 8, m->partCount, bytes, m->missRatio, m->inputMissRatio);
+    total += bytes;
+  }
+  printf("%-12s %8s %8s %6s %6s %10ld%s\n", "total", "", "", "", "", total,
+	 haveVertexArrays ? "" : haveBuffers ? " (no vertex arrays)" : " (client memory)");
+}
+
+/* Tipsify (Sander, Nehab and Barczak 2007). Fans out from one vertex at
+   a time, emitting all its remaining triangles, then moves to whichever
+   vertex just emitted will still be in the cache for all of its own,
+   falling back to recently used vertices and then to the next in order.
+   The order of separate pieces is kept, which matters for transparent
+   parts */
+void OptimiseMeshPart(mesh *m, meshPart *part) {
+  GLuint *indices = m->indices + part->first;
+  int triangles = part->count / 3;
+  int *live, *offset, *adjacent, *stamp, *deadEnd, *candidates;
+  GLuint *out;
+  char *emitted;
+  int low, high, vertices, time, fan, cursor, deadEnds, candidateCount, outCount;
+  int best, priority, bestPriority;
+  int i, j, k, t, v;
+
+  if(triangles < 2) return;
+  /* the part's vertices, numbered from low */
+  low = high = indices[0];
+  for(i = 0; i < part->count; i++) {
+    if((int) indices[i] < low) low = indices[i];
+    if((int) indices[i] > high) high = indices[i];
+  }
+  vertices = high - low + 1;
+
+  live = calloc(vertices, sizeof(int));
+  offset = calloc(vertices + 1, sizeof(int));
+  stamp = calloc(vertices, sizeof(int));
+  adjacent = malloc(part->count * sizeof(int));
+  deadEnd = malloc(part->count * sizeof(int));
+  candidates = malloc(part->count * sizeof(int));
+  emitted = calloc(triangles, 1);
+  out = malloc(part->count * sizeof(GLuint));
+  if(live == NULL || offset == NULL || stamp == NULL || adjacent == NULL ||
+     deadEnd == NULL || candidates == NULL || emitted == NULL || out == NULL) {
+    fprintf(stderr, "ERROR: Unable to allocate to reorder mesh %s\n", m->name);
+    exit(1);
+  }
+
+  /* the triangles using each vertex */
+  for(i = 0; i < part->count; i++) live[indices[i] - low]++;
+  for(v = 0; v < vertices; v++) offset[v+1] = offset[v] + live[v];
+  for(i = 0; i < part->count; i++) adjacent[offset[indices[i] - low]++] = i / 3;
+  for(v = vertices; v > 0; v--) offset[v] = offset[v-1];
+  offset[0] = 0;
+
+  time = MESH_CACHE_SIZE + 1;
+  fan = indices[0] - low;
+  cursor = 0;
+  deadEnds = 0;
+  outCount = 0;
+  while(fan >= 0) {
+    candidateCount = 0;
+    for(j = offset[fan]; j < offset[fan+1]; j++) {
+      t = adjacent[j];
+      if(emitted[t]) continue;
+      for(k = 0; k < 3; k++) {
+	v = indices[3*t + k] - low;
+	out[outCount++] = indices[3*t + k];
+	deadEnd[deadEnds++] = v;
+	candidates[candidateCount++] = v;
+	live[v]--;
+	/* a miss, it goes in the cache now */
+	if(time - stamp[v] > MESH_CACHE_SIZE) stamp[v] = time++;
+      }
+      emitted[t] = 1;
+    }
+
+    /* the candidate that will still be cached once its triangles are
+       done, the one that has been in longest */
+    best = -1;
+    bestPriority = -1;
+    for(j = 0; j < candidateCount; j++) {
+      v = candidates[j];
+      if(live[v] == 0) continue;
+      priority = 0;
+      if(time - stamp[v] + 2 * live[v] <= MESH_CACHE_SIZE) priority = time - stamp[v];
+      if(priority > bestPriority) {
+	bestPriority = priority;
+	best = v;
+      }
+    }
+    /* a dead end, go back to something recent or on to the next */
+    while(best < 0 && deadEnds > 0) {
+      v = deadEnd[--deadEnds];
+      if(live[v] > 0) best = v;
+    }
+    while(best < 0 && cursor < vertices) {
+      if(live[cursor] > 0) best = cursor;
+      cursor++;
+    }
+    fan = best;
+  }
+
+  memcpy(indices, out, part->count * sizeof(GLuint));
+  free(live);
+  free(offset);
+  free(stamp);
+  free(adjacent);
+  free(deadEnd);
+  free(candidates);
+  free(emitted);
+  free(out);
+}
+
+/* through a FIFO cache of MESH_CACHE_SIZE vertices. stamp has room for
+   every vertex */
+long CacheMisses(GLuint *indices, int count, int *stamp, int vertices) {
+  long misses = 0;
+  int i, time = MESH_CACHE_SIZE + 1;
+
+  memset(stamp, 0, vertices * sizeof(int));
+  for(i = 0; i < count; i++) {
+    if(time - stamp[indices[i]] > MESH_CACHE_SIZE) {
+      stamp[indices[i]] = time++;
+      misses++;
+    }
+  }
+  return misses;
+}
+
+/* carry on with the last part if it draws the same way, otherwise
+   start a new one */
+void StartMeshPart(mesh *m, GLenum mode) {
+  meshPart *part;
+
+  if(!m->newPart && m->parts[m->partCount-1].mode == mode) return;
+  m->parts = GrowMeshArray(m->parts, &m->partSize, m->partCount + 1, sizeof(meshPart));
+  part = &m->parts[m->partCount++];
+  part->material = InternMaterial(&m->current);
+  part->mode = mode;
+  part->first = m->indexCount;
+  part->count = 0;
+  m->newPart = 0;
+}
+
+/* to the last part */
+void AddMeshIndex(mesh *m, GLuint index) {
+  m->indices = GrowMeshArray(m->indices, &m->indexSize, m->indexCount + 1, sizeof(GLuint));
+  m->indices[m->indexCount++] = index;
+  m->parts[m->partCount-1].count++;
+}
+
+/* point the fixed function arrays at the mesh, from its buffers if it
+   has them */
+void SetMeshArrays(mesh *m) {
+  char *vertices = m->vertexBuffer ? NULL : (char *) m->vertices;
+
+  if(m->vertexBuffer) {
+    glBindBuffer(GL_ARRAY_BUFFER, m->vertexBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m->indexBuffer);
+  }
+  glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+  glEnableClientState(GL_NORMAL_ARRAY);
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glTexCoordPointer(2, GL_FLOAT, sizeof(meshVertex), vertices + offsetof(meshVertex, texCoord));
+  glNormalPointer(GL_FLOAT, sizeof(meshVertex), vertices + offsetof(meshVertex, normal));
+  glVertexPointer(3, GL_FLOAT, sizeof(meshVertex), vertices + offsetof(meshVertex, position));
+}
+
+/* room for at least needed elements, doubling as it goes */
+void *GrowMeshArray(void *array, int *size, int needed, int elementSize) {
+  if(needed <= *size) return array;
+  *size = *size * 2 > needed ? *size * 2 : needed + 15;
+  array = realloc(array, (long) *size * elementSize);
+  if(array == NULL) {
+    fprintf(stderr, "ERROR: Unable to allocate %d mesh elements\n", *size);
+    exit(1);
+  }
+  return array;
+}
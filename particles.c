@@ -0,0 +1,288 @@
+/*************************************************************************
+ * Structure-of-arrays particle store for the bubbles. Live particles    *
+ * are kept packed at the front of the arrays so an update never visits *
+ * a dead slot. The update is split into chunks across the thread pool, *
+ * each running 8 (AVX2) or 4 (SSE2) particles at a time with a scalar   *
+ * loop for other CPUs and for the leftovers                            *
+ *************************************************************************/
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PARTICLES_X86
+#include <immintrin.h>
+#endif
+
+typedef struct {
+  float *x, *y, *z;
+  float *lastX, *lastY, *lastZ;
+  float *xVelocity, *yVelocity, *zVelocity;
+  float *noise;		/* random numbers for this step, one per particle */
+  int count;		/* live particles are 0 to count-1 */
+  int size;
+} particles;
+
+/* what every chunk of an update needs to know */
+typedef struct {
+  particles *p;
+  float elapsed, acceleration;
+} particleStep;
+
+/* update kernels */
+#define PARTICLES_AUTO -1
+#define PARTICLES_SCALAR 0
+#define PARTICLES_SSE 1
+#define PARTICLES_AVX2 2
+
+/* particles per chunk, a multiple of 8 so chunks start vector aligned */
+#define PARTICLE_GRAIN 8192
+
+/* where the bubbles burst */
+#define SURFACE_HEIGHT 40.0
+
+int particleKernel = PARTICLES_AUTO;
+char *particleKernelNames[] = {"scalar", "sse", "avx2"};
+
+void InitParticles(particles *, int);
+void FreeParticles(particles *);
+void ChooseParticleKernel(void);
+int SelectParticleKernel(char *);
+int AddParticle(particles *, float, float, float, float, float, float);
+int EmitParticles(particles *, int, float[3], float, float, randomState *);
+void RemoveParticle(particles *, int);
+void SaveParticlePositions(particles *);
+void SaveParticleChunk(void *, int, int);
+void MoveParticles(particles *, float, float);
+void MoveParticleChunk(void *, int, int);
+void UpdateParticlesScalar(particles *, int, int, float, float);
+int UpdateParticlesSSE(particles *, int, int, float, float);
+int UpdateParticlesAVX2(particles *, int, int, float, float);
+void RemoveBurstParticles(particles *);
+
+void InitParticles(particles *p, int size) {
+  float *block;
+
+  /* one allocation, split into the separate arrays */
+  block = malloc(10 * size * sizeof(float));
+  if(block == NULL) {
+    fprintf(stderr, "ERROR: Unable to allocate %d particles\n", size);
+    exit(1);
+  }
+  p->x = block;
+  p->y = block + size;
+  p->z = block + 2*size;
+  p->lastX = block + 3*size;
+  p->lastY = block + 4*size;
+  p->lastZ = block + 5*size;
+  p->xVelocity = block + 6*size;
+  p->yVelocity = block + 7*size;
+  p->zVelocity = block + 8*size;
+  p->noise = block + 9*size;
+  p->count = 0;
+  p->size = size;
+  ChooseParticleKernel();
+}
+
+/* use the widest kernel the CPU supports, unless one was asked for */
+void ChooseParticleKernel(void) {
+  if(particleKernel == PARTICLES_AUTO) particleKernel = PARTICLES_AVX2;
+#ifdef PARTICLES_X86
+  __builtin_cpu_init();
+  if(particleKernel == PARTICLES_AVX2 && !__builtin_cpu_supports("avx2"))
+    particleKernel = PARTICLES_SSE;
+  if(particleKernel == PARTICLES_SSE && !__builtin_cpu_supports("sse2"))
+    particleKernel = PARTICLES_SCALAR;
+#else
+  particleKernel = PARTICLES_SCALAR;
+#endif
+}
+
+void FreeParticles(particles *p) {
+  free(p->x);
+  p->count = p->size = 0;
+}
+
+/* pick a kernel by name, returns 0 if the name is unknown */
+int SelectParticleKernel(char *name) {
+  int i;
+
+  for(i = PARTICLES_SCALAR; i <= PARTICLES_AVX2; i++) {
+    if(strcmp(name, particleKernelNames[i]) == 0) {
+      particleKernel = i;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* returns 0 if there is no room left */
+int AddParticle(particles *p, float x, float y, float z,
+		float xVelocity, float yVelocity, float zVelocity) {
+  int i = p->count;
+
+  if(i == p->size) return 0;
+  p->x[i] = p->lastX[i] = x;
+  p->y[i] = p->lastY[i] = y;
+  p->z[i] = p->lastZ[i] = z;
+  p->xVelocity[i] = xVelocity;
+  p->yVelocity[i] = yVelocity;
+  p->zVelocity[i] = zVelocity;
+  p->count++;
+  return 1;
+}
+
+/* add up to n particles at once, rising from the same point with random
+   horizontal velocities up to spread, and already moved on by age
+   seconds. Returns how many fitted */
+int EmitParticles(particles *p, int n, float position[3], float spread, float age,
+		  randomState *random) {
+  int i, end;
+
+  if(n > p->size - p->count) n = p->size - p->count;
+  end = p->count + n;
+  for(i = p->count; i < end; i++) {
+    p->xVelocity[i] = spread * (RandomFloat(random) - 0.5f);
+    p->yVelocity[i] = 0.0;
+    p->zVelocity[i] = spread * (RandomFloat(random) - 0.5f);
+    p->x[i] = p->lastX[i] = position[0] + p->xVelocity[i] * age;
+    p->y[i] = p->lastY[i] = position[1];
+    p->z[i] = p->lastZ[i] = position[2] + p->zVelocity[i] * age;
+  }
+  p->count = end;
+  return n;
+}
+
+/* move the last particle into the gap to keep the live ones packed */
+void RemoveParticle(particles *p, int i) {
+  int last = --p->count;
+
+  p->x[i] = p->x[last];
+  p->y[i] = p->y[last];
+  p->z[i] = p->z[last];
+  p->lastX[i] = p->lastX[last];
+  p->lastY[i] = p->lastY[last];
+  p->lastZ[i] = p->lastZ[last];
+  p->xVelocity[i] = p->xVelocity[last];
+  p->yVelocity[i] = p->yVelocity[last];
+  p->zVelocity[i] = p->zVelocity[last];
+}
+
+void SaveParticlePositions(particles *p) {
+  ParallelFor(SaveParticleChunk, p, p->count, PARTICLE_GRAIN);
+}
+
+void SaveParticleChunk(void *data, int begin, int end) {
+  particles *p = data;
+
+  memcpy(p->lastX + begin, p->x + begin, (end - begin) * sizeof(float));
+  memcpy(p->lastY + begin, p->y + begin, (end - begin) * sizeof(float));
+  memcpy(p->lastZ + begin, p->z + begin, (end - begin) * sizeof(float));
+}
+
+/* move the particles on and float them up by the buoyancy scaled by
+   noise, leaving what they run into to be collided with afterwards */
+void MoveParticles(particles *p, float elapsed, float buoyancy) {
+  particleStep step;
+
+  step.p = p;
+  step.elapsed = elapsed;
+  step.acceleration = elapsed * buoyancy;
+  ParallelFor(MoveParticleChunk, &step, p->count, PARTICLE_GRAIN);
+}
+
+void MoveParticleChunk(void *data, int begin, int end) {
+  particleStep *s = data;
+  int done = begin;
+
+#ifdef PARTICLES_X86
+  if(particleKernel == PARTICLES_AVX2)
+    done = UpdateParticlesAVX2(s->p, begin, end, s->elapsed, s->acceleration);
+  else if(particleKernel == PARTICLES_SSE)
+    done = UpdateParticlesSSE(s->p, begin, end, s->elapsed, s->acceleration);
+#endif
+  UpdateParticlesScalar(s->p, done, end, s->elapsed, s->acceleration);
+}
+
+void UpdateParticlesScalar(particles *p, int start, int end, float elapsed, float acceleration) {
+  int i;
+
+  for(i = start; i < end; i++) {
+    p->x[i] += p->xVelocity[i] * elapsed;
+    p->y[i] += p->yVelocity[i] * elapsed;
+    p->z[i] += p->zVelocity[i] * elapsed;
+    p->yVelocity[i] += acceleration * (0.75f + 0.5f * p->noise[i]);
+  }
+}
+
+#ifdef PARTICLES_X86
+/* same as the scalar loop, returns where it got up to */
+__attribute__((target("sse2")))
+int UpdateParticlesSSE(particles *p, int begin, int end, float elapsed, float acceleration) {
+  __m128 dt = _mm_set1_ps(elapsed);
+  __m128 acc = _mm_set1_ps(acceleration);
+  __m128 half = _mm_set1_ps(0.5f);
+  __m128 threeQuarters = _mm_set1_ps(0.75f);
+  __m128 x, y, z, vx, vy, vz;
+  int i;
+
+  for(i = begin; i + 4 <= end; i += 4) {
+    x = _mm_loadu_ps(p->x + i);
+    y = _mm_loadu_ps(p->y + i);
+    z = _mm_loadu_ps(p->z + i);
+    vx = _mm_loadu_ps(p->xVelocity + i);
+    vy = _mm_loadu_ps(p->yVelocity + i);
+    vz = _mm_loadu_ps(p->zVelocity + i);
+
+    x = _mm_add_ps(x, _mm_mul_ps(vx, dt));
+    y = _mm_add_ps(y, _mm_mul_ps(vy, dt));
+    z = _mm_add_ps(z, _mm_mul_ps(vz, dt));
+    vy = _mm_add_ps(vy, _mm_mul_ps(acc, _mm_add_ps(threeQuarters,
+      _mm_mul_ps(half, _mm_loadu_ps(p->noise + i)))));
+
+    _mm_storeu_ps(p->x + i, x);
+    _mm_storeu_ps(p->y + i, y);
+    _mm_storeu_ps(p->z + i, z);
+    _mm_storeu_ps(p->yVelocity + i, vy);
+  }
+  return i;
+}
+
+__attribute__((target("avx2")))
+int UpdateParticlesAVX2(particles *p, int begin, int end, float elapsed, float acceleration) {
+  __m256 dt = _mm256_set1_ps(elapsed);
+  __m256 acc = _mm256_set1_ps(acceleration);
+  __m256 half = _mm256_set1_ps(0.5f);
+  __m256 threeQuarters = _mm256_set1_ps(0.75f);
+  __m256 x, y, z, vx, vy, vz;
+  int i;
+
+  for(i = begin; i + 8 <= end; i += 8) {
+    x = _mm256_loadu_ps(p->x + i);
+    y = _mm256_loadu_ps(p->y + i);
+    z = _mm256_loadu_ps(p->z + i);
+    vx = _mm256_loadu_ps(p->xVelocity + i);
+    vy = _mm256_loadu_ps(p->yVelocity + i);
+    vz = _mm256_loadu_ps(p->zVelocity + i);
+
+    x = _mm256_add_ps(x, _mm256_mul_ps(vx, dt));
+    y = _mm256_add_ps(y, _mm256_mul_ps(vy, dt));
+    z = _mm256_add_ps(z, _mm256_mul_ps(vz, dt));
+    vy = _mm256_add_ps(vy, _mm256_mul_ps(acc, _mm256_add_ps(threeQuarters,
+      _mm256_mul_ps(half, _mm256_loadu_ps(p->noise + i)))));
+
+    _mm256_storeu_ps(p->x + i, x);
+    _mm256_storeu_ps(p->y + i, y);
+    _mm256_storeu_ps(p->z + i, z);
+    _mm256_storeu_ps(p->yVelocity + i, vy);
+  }
+  return i;
+}
+#endif
+
+void RemoveBurstParticles(particles *p) {
+  int i = 0;
+
+  while(i < p->count) {
+    /* the replacement needs checking too so don't move on */
+    if(p->y[i] > SURFACE_HEIGHT) RemoveParticle(p, i);
+    else i++;
+  }
+}
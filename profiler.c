@@ -0,0 +1,228 @@
+/*************************************************************************
+ * Timing zones for finding where a frame goes. PROFILE_BEGIN() and     *
+ * PROFILE_END() bracket a piece of code, each thread keeps the zones   *
+ * it has finished in its own ring buffer, oldest overwritten first,    *
+ * and SaveTrace() writes the lot as Chrome trace JSON for              *
+ * chrome://tracing or ui.perfetto.dev. Build without -DPROFILE and the *
+ * macros are empty, so the zones cost nothing at all                   *
+ *************************************************************************/
+
+#ifndef WIN32
+#define THREADS
+#include <pthread.h>
+#endif
+
+#define PROFILE_RING 16384	/* zones kept per thread, a power of 2 */
+#define PROFILE_DEPTH 32	/* zones open at once per thread */
+#define PROFILE_THREADS 64
+#define PROFILE_NAME 32
+
+#ifdef PROFILE
+#define PROFILE_BEGIN(name) ProfileBegin(name)
+#define PROFILE_END() ProfileEnd()
+#define PROFILE_THREAD(name, number) ProfileThread(name, number)
+#else
+#define PROFILE_BEGIN(name)
+#define PROFILE_END()
+#define PROFILE_THREAD(name, number)
+#endif
+
+/* monotonic, in whole nanoseconds */
+typedef struct {
+  long seconds, nanoseconds;
+} profileTime;
+
+typedef struct {
+  const char *name;		/* a string literal, never copied */
+  profileTime start, end;
+} profileZone;
+
+typedef struct {
+  profileZone zones[PROFILE_RING];
+  unsigned long finished;	/* zones ever finished, the next goes at finished % PROFILE_RING */
+  profileZone open[PROFILE_DEPTH];
+  int depth;
+  int thread;
+  char name[PROFILE_NAME];
+} profileRing;
+
+/* every thread that has recorded anything, added to but never removed */
+profileRing *profileRings[PROFILE_THREADS];
+int profileThreads = 0;
+char *traceFile = NULL;
+#ifdef THREADS
+pthread_mutex_t profileLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_key_t profileKey;
+pthread_once_t profileOnce = PTHREAD_ONCE_INIT;
+#else
+profileRing *profileOnly = NULL;
+#endif
+
+void ProfileBegin(const char *);
+void ProfileEnd(void);
+void ProfileThread(const char *, int);
+void SaveTrace(char *);
+void SaveTraceAtExit(char *);
+profileRing *ThreadRing(void);
+void ProfileNow(profileTime *);
+double TraceMicroseconds(profileTime *, profileTime *);
+void WriteTrace(void);
+#ifdef THREADS
+void CreateProfileKey(void);
+#endif
+
+void ProfileBegin(const char *name) {
+  profileRing *ring = ThreadRing();
+
+  if(ring == NULL) return;
+  /* too deep, the matching end is dropped too */
+  if(ring->depth < PROFILE_DEPTH) {
+    ring->open[ring->depth].name = name;
+    ProfileNow(&ring->open[ring->depth].start);
+  }
+  ring->depth++;
+}
+
+void ProfileEnd(void) {
+  profileRing *ring = ThreadRing();
+  profileZone *zone;
+
+  if(ring == NULL || ring->depth == 0) return;
+  if(--ring->depth >= PROFILE_DEPTH) return;
+  zone = &ring->zones[ring->finished % PROFILE_RING];
+  *zone = ring->open[ring->depth];
+  ProfileNow(&zone->end);
+  ring->finished++;
+}
+
+/* what the calling thread is called in the trace, number < 0 for none */
+void ProfileThread(const char *name, int number) {
+  profileRing *ring = ThreadRing();
+
+  if(ring == NULL) return;
+  if(number < 0) sprintf(ring->name, "%.*s", PROFILE_NAME - 1, name);
+  else sprintf(ring->name, "%.*s %d", PROFILE_NAME - 12, name, number);
+}
+
+/* whatever each thread still has, it should be done with by now */
+void SaveTrace(char *file) {
+  FILE *out;
+  profileRing *ring;
+  profileTime *base = NULL;
+  unsigned long first, i, zones = 0, lost = 0;
+  int t, written = 0;
+
+  out = fopen(file, "w");
+  if(out == NULL) {
+    fprintf(stderr, "WARNING: Unable to write trace %s\n", file);
+    return;
+  }
+  /* timestamps from the earliest zone still in a ring */
+  for(t = 0; t < profileThreads; t++) {
+    ring = profileRings[t];
+    first = ring->finished > PROFILE_RING ? ring->finished - PROFILE_RING : 0;
+    for(i = first; i < ring->finished; i++)
+      if(base == NULL || TraceMicroseconds(&ring->zones[i % PROFILE_RING].start, base) < 0.0)
+	base = &ring->zones[i % PROFILE_RING].start;
+  }
+
+  fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+  for(t = 0; t < profileThreads; t++) {
+    ring = profileRings[t];
+    fprintf(out, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+	    "\"args\":{\"name\":\"%s\"}}", written++ ? "," : "", ring->thread, ring->name);
+    first = ring->finished > PROFILE_RING ? ring->finished - PROFILE_RING : 0;
+    for(i = first; i < ring->finished; i++) {
+      fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+	      "\"ts\":%.3f,\"dur\":%.3f}", ring->zones[i % PROFILE_RING].name, ring->thread,
+	      TraceMicroseconds(&ring->zones[i % PROFILE_RING].start, base),
+	      TraceMicroseconds(&ring->zones[i % PROFILE_RING].end,
+				&ring->zones[i % PROFILE_RING].start));
+    }
+    zones += ring->finished - first;
+    lost += first;
+  }
+  fprintf(out, "\n]}\n");
+  fclose(out);
+  printf("Trace of %lu zones on %d threads written to %s", zones, profileThreads, file);
+  if(lost) printf(", the oldest %lu overwritten", lost);
+  printf("\n");
+}
+
+/* however the program ends */
+void SaveTraceAtExit(char *file) {
+#ifdef PROFILE
+  traceFile = file;
+  atexit(WriteTrace);
+#else
+  fprintf(stderr, "WARNING: Built without -DPROFILE, no trace to write to %s\n", file);
+#endif
+}
+
+/* the calling thread's ring, made the first time it is needed.
+   NULL if there are too many threads or no memory */
+profileRing *ThreadRing(void) {
+  profileRing *ring;
+
+#ifdef THREADS
+  pthread_once(&profileOnce, CreateProfileKey);
+  ring = pthread_getspecific(profileKey);
+#else
+  ring = profileOnly;
+#endif
+  if(ring != NULL) return ring;
+
+  ring = malloc(sizeof(profileRing));
+  if(ring == NULL) return NULL;
+  ring->finished = 0;
+  ring->depth = 0;
+#ifdef THREADS
+  pthread_mutex_lock(&profileLock);
+#endif
+  ring->thread = profileThreads;
+  if(profileThreads < PROFILE_THREADS) profileRings[profileThreads++] = ring;
+#ifdef THREADS
+  pthread_mutex_unlock(&profileLock);
+#endif
+  if(ring->thread >= PROFILE_THREADS) {
+    free(ring);
+    return NULL;
+  }
+  sprintf(ring->name, "thread %d", ring->thread);
+#ifdef THREADS
+  pthread_setspecific(profileKey, ring);
+#else
+  profileOnly = ring;
+#endif
+  return ring;
+}
+
+void ProfileNow(profileTime *t) {
+#ifdef WIN32
+  clock_t now = clock();
+
+  t->seconds = now / CLOCKS_PER_SEC;
+  t->nanoseconds = (long) ((now % CLOCKS_PER_SEC) * (1e9 / CLOCKS_PER_SEC));
+#else
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  t->seconds = now.tv_sec;
+  t->nanoseconds = now.tv_nsec;
+#endif
+}
+
+/* a - b */
+double TraceMicroseconds(profileTime *a, profileTime *b) {
+  return (a->seconds - b->seconds) * 1e6 + (a->nanoseconds - b->nanoseconds) * 1e-3;
+}
+
+void WriteTrace(void) {
+  SaveTrace(traceFile);
+}
+
+#ifdef THREADS
+void CreateProfileKey(void) {
+  pthread_key_create(&profileKey, NULL);
+}
+#endif
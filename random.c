@@ -0,0 +1,107 @@
+/*************************************************************************
+ * Seedable random numbers (xoshiro128+). A generator is four words of  *
+ * state, so each thread or chunk of work can have its own and the same *
+ * seed always gives the same run. RandomFloats() steps eight of them   *
+ * side by side so the compiler can keep them in vector registers      *
+ *************************************************************************/
+
+#define RANDOM_LANES 8
+
+/* assumes unsigned int is 32 bits, which it is everywhere this builds */
+typedef struct {
+  unsigned int s[4];
+} randomState;
+
+/* RANDOM_LANES generators, stored lane by lane */
+typedef struct {
+  unsigned int s0[RANDOM_LANES];
+  unsigned int s1[RANDOM_LANES];
+  unsigned int s2[RANDOM_LANES];
+  unsigned int s3[RANDOM_LANES];
+} randomBatch;
+
+void SeedRandom(randomState *, unsigned int, unsigned int);
+unsigned int NextRandom(randomState *);
+float RandomFloat(randomState *);
+void SeedRandomBatch(randomBatch *, unsigned int, unsigned int);
+void RandomFloats(randomBatch *, float *, int);
+unsigned int SplitMix(unsigned int *);
+
+/* different streams from the same seed don't overlap in practice */
+void SeedRandom(randomState *r, unsigned int seed, unsigned int stream) {
+  unsigned int x = stream;
+
+  x = seed ^ SplitMix(&x);
+  r->s[0] = SplitMix(&x);
+  r->s[1] = SplitMix(&x);
+  r->s[2] = SplitMix(&x);
+  r->s[3] = SplitMix(&x);
+  /* all zero state never changes */
+  if((r->s[0] | r->s[1] | r->s[2] | r->s[3]) == 0) r->s[0] = 1;
+}
+
+unsigned int NextRandom(randomState *r) {
+  unsigned int *s = r->s;
+  unsigned int result = s[0] + s[3];
+  unsigned int t = s[1] << 9;
+
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = (s[3] << 11) | (s[3] >> 21);
+  return result;
+}
+
+/* 0 to 1, not including 1. The low bits of xoshiro128+ are weak so use
+   the top 24 */
+float RandomFloat(randomState *r) {
+  return (NextRandom(r) >> 8) * (1.0f / 16777216.0f);
+}
+
+void SeedRandomBatch(randomBatch *b, unsigned int seed, unsigned int stream) {
+  randomState r;
+  int i;
+
+  for(i = 0; i < RANDOM_LANES; i++) {
+    SeedRandom(&r, seed, stream * RANDOM_LANES + i);
+    b->s0[i] = r.s[0];
+    b->s1[i] = r.s[1];
+    b->s2[i] = r.s[2];
+    b->s3[i] = r.s[3];
+  }
+}
+
+/* n floats from 0 to 1, RANDOM_LANES at a time. Working on local copies
+   of the state lets the compiler see the lanes are independent */
+void RandomFloats(randomBatch *b, float *out, int n) {
+  randomBatch s = *b;
+  float f[RANDOM_LANES];
+  unsigned int t[RANDOM_LANES];
+  int i, j;
+
+  for(i = 0; i < n; i += RANDOM_LANES) {
+    for(j = 0; j < RANDOM_LANES; j++) {
+      f[j] = ((s.s0[j] + s.s3[j]) >> 8) * (1.0f / 16777216.0f);
+      t[j] = s.s1[j] << 9;
+      s.s2[j] ^= s.s0[j];
+      s.s3[j] ^= s.s1[j];
+      s.s1[j] ^= s.s2[j];
+      s.s0[j] ^= s.s3[j];
+      s.s2[j] ^= t[j];
+      s.s3[j] = (s.s3[j] << 11) | (s.s3[j] >> 21);
+    }
+    memcpy(out + i, f, (n - i < RANDOM_LANES ? n - i : RANDOM_LANES) * sizeof(float));
+  }
+  *b = s;
+}
+
+/* for turning seeds into state */
+unsigned int SplitMix(unsigned int *x) {
+  unsigned int z = (*x += 0x9e3779b9U);
+
+  z = (z ^ (z >> 16)) * 0x85ebca6bU;
+  z = (z ^ (z >> 13)) * 0xc2b2ae35U;
+  return z ^ (z >> 16);
+}
@@ -0,0 +1,313 @@
+/*************************************************************************
+ * Everything drawn in a frame goes through a render queue. Items are   *
+ * taken from an arena that is emptied at the start of each frame, so   *
+ * nothing is allocated once it has grown to fit the scene. Each item   *
+ * has a sort key, opaque items grouped by texture and material and     *
+ * drawn front to back, then see through ones back to front, and only   *
+ * the state that changes between neighbours is set                     *
+ *************************************************************************/
+
+#define ARENA_ALIGN 16
+#define RENDER_QUEUE_ARENA (64 * 1024)
+#define RENDER_QUEUE_ITEMS 64
+
+/* passes, drawn in order */
+#define PASS_WORLD 0
+#define PASS_OVERLAY 3
+
+/* depth is kept to 16 bits over this range in front of the eye */
+#define RENDER_DEPTH_RANGE 512.0
+
+/* sort keys, highest bits first:
+     pass 2, transparent 1, texture 5, material 8, depth 16 near first
+     pass 2, transparent 1, depth 16 far first, texture 5, material 8 */
+#define KEY_PASS_SHIFT 30
+#define KEY_TRANSPARENT (1U << 29)
+
+/* memory handed out until the next reset. Anything asked for beyond its
+   size comes from the heap, and the arena grows at the next reset so it
+   won't next time */
+typedef struct {
+  char *memory;
+  long size, used;
+  void *spill;			/* heap blocks, each starting with the next */
+  long spilled;			/* bytes in them */
+  int grown;			/* times it has had to grow */
+} frameArena;
+
+typedef struct {
+  unsigned int key;
+  GLfloat *matrix;		/* modelview, shared between items */
+  mesh *m;			/* a mesh part... */
+  meshPart *part;
+  void (*draw)(void);		/* ...or something that draws itself */
+} renderItem;
+
+typedef struct {
+  frameArena arena;
+  renderItem *items;
+  int count, size;
+  /* the last frame submitted */
+  int drawCalls, materialChanges, textureChanges, meshChanges;
+} renderQueue;
+
+void InitArena(frameArena *, long);
+void *ArenaAlloc(frameArena *, long);
+void ResetArena(frameArena *);
+void InitRenderQueue(renderQueue *);
+void ResetRenderQueue(renderQueue *);
+GLfloat *QueueMatrix(renderQueue *);
+GLfloat *QueueTranslated(renderQueue *, GLfloat *, GLfloat[3]);
+void QueueMesh(renderQueue *, mesh *, GLfloat *, int);
+void QueueMeshPart(renderQueue *, mesh *, meshPart *, GLfloat *, int);
+void QueueDraw(renderQueue *, void (*)(void), GLfloat *, GLfloat[3], int, int);
+void SubmitRenderQueue(renderQueue *);
+void ReportRenderQueue(renderQueue *);
+renderItem *NewRenderItem(renderQueue *);
+unsigned int RenderDepth(GLfloat *, GLfloat[3]);
+void SortRenderItems(renderItem *, renderItem *, int);
+
+void InitArena(frameArena *a, long size) {
+  a->memory = malloc(size);
+  if(a->memory == NULL) {
+    fprintf(stderr, "ERROR: Unable to allocate %ld byte frame arena\n", size);
+    exit(1);
+  }
+  a->size = size;
+  a->used = 0;
+  a->spill = NULL;
+  a->spilled = 0;
+  a->grown = 0;
+}
+
+void *ArenaAlloc(frameArena *a, long bytes) {
+  void **block;
+
+  bytes = (bytes + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+  if(a->used + bytes <= a->size) {
+    a->used += bytes;
+    return a->memory + a->used - bytes;
+  }
+  block = malloc(ARENA_ALIGN + bytes);
+  if(block == NULL) {
+    fprintf(stderr, "ERROR: Unable to allocate %ld bytes past the frame arena\n", bytes);
+    exit(1);
+  }
+  *block = a->spill;
+  a->spill = block;
+  a->spilled += bytes;
+  return (char *) block + ARENA_ALIGN;
+}
+
+/* everything handed out is finished with */
+void ResetArena(frameArena *a) {
+  void *next;
+
+  while(a->spill != NULL) {
+    next = *(void **) a->spill;
+    free(a->spill);
+    a->spill = next;
+  }
+  if(a->spilled > 0) {
+    free(a->memory);
+    InitArena(a, (a->size + a->spilled) * 2);
+    a->grown++;
+  }
+  a->used = 0;
+  a->spilled = 0;
+}
+
+void InitRenderQueue(renderQueue *q) {
+  InitArena(&q->arena, RENDER_QUEUE_ARENA);
+  q->items = NULL;
+  q->count = q->size = 0;
+  q->drawCalls = q->materialChanges = q->textureChanges = q->meshChanges = 0;
+}
+
+/* start a new frame */
+void ResetRenderQueue(renderQueue *q) {
+  int grown = q->arena.grown;
+
+  ResetArena(&q->arena);
+  /* the arena keeps its growth, keep room for as many items */
+  if(q->arena.grown != grown) q->size = 0;
+  q->items = q->size > 0 ? ArenaAlloc(&q->arena, q->size * sizeof(renderItem)) : NULL;
+  q->count = 0;
+}
+
+/* the current modelview matrix, for the items that follow */
+GLfloat *QueueMatrix(renderQueue *q) {
+  GLfloat *matrix = ArenaAlloc(&q->arena, 16 * sizeof(GLfloat));
+
+  glGetFloatv(GL_MODELVIEW_MATRIX, matrix);
+  return matrix;
+}
+
+/* matrix moved by offset, as glTranslatef() would, without asking GL */
+GLfloat *QueueTranslated(renderQueue *q, GLfloat *matrix, GLfloat offset[3]) {
+  GLfloat *moved = ArenaAlloc(&q->arena, 16 * sizeof(GLfloat));
+  int i;
+
+  memcpy(moved, matrix, 16 * sizeof(GLfloat));
+  for(i = 0; i < 4; i++)
+    moved[12+i] += matrix[i] * offset[0] + matrix[4+i] * offset[1] + matrix[8+i] * offset[2];
+  return moved;
+}
+
+/* every part of m, seen through matrix */
+void QueueMesh(renderQueue *q, mesh *m, GLfloat *matrix, int pass) {
+  int i;
+
+  for(i = 0; i < m->partCount; i++) QueueMeshPart(q, m, &m->parts[i], matrix, pass);
+}
+
+void QueueMeshPart(renderQueue *q, mesh *m, meshPart *part, GLfloat *matrix, int pass) {
+  renderItem *item = NewRenderItem(q);
+  material *mat = &materials[part->material];
+  unsigned int texture, depth;
+
+  item->matrix = matrix;
+  item->m = m;
+  item->part = part;
+  item->draw = NULL;
+
+  texture = mat->texture != NULL ? *mat->texture & 31 : 0;
+  depth = RenderDepth(matrix, part->centre);
+  if(mat->color[3] < 1.0)
+    item->key = (unsigned int) pass << KEY_PASS_SHIFT | KEY_TRANSPARENT |
+      (0xffff - depth) << 13 | texture << 8 | (part->material & 0xff);
+  else
+    item->key = (unsigned int) pass << KEY_PASS_SHIFT |
+      texture << 24 | (part->material & 0xff) << 16 | depth;
+}
+
+/* something that sets its own state and draws itself, sorted as if it
+   were at centre. The arrays, texturing and two sided lighting are off
+   when it is called */
+void QueueDraw(renderQueue *q, void (*draw)(void), GLfloat *matrix, GLfloat centre[3],
+	       int transparent, int pass) {
+  renderItem *item = NewRenderItem(q);
+  unsigned int depth = RenderDepth(matrix, centre);
+
+  item->matrix = matrix;
+  item->m = NULL;
+  item->part = NULL;
+  item->draw = draw;
+  /* sorted after every mesh part at the same depth */
+  if(transparent)
+    item->key = (unsigned int) pass << KEY_PASS_SHIFT | KEY_TRANSPARENT |
+      (0xffff - depth) << 13 | 0x1fff;
+  else item->key = (unsigned int) pass << KEY_PASS_SHIFT | 0x1fffffffU;
+}
+
+/* draw everything queued, in key order */
+void SubmitRenderQueue(renderQueue *q) {
+  renderItem *sorted, *item;
+  material *current = NULL, *mat;
+  mesh *bound = NULL;
+  GLfloat *matrix = NULL;
+  int i;
+
+  sorted = ArenaAlloc(&q->arena, q->count * sizeof(renderItem));
+  SortRenderItems(q->items, sorted, q->count);
+  q->drawCalls = q->materialChanges = q->textureChanges = q->meshChanges = 0;
+
+  glMatrixMode(GL_MODELVIEW);
+  glPushMatrix();
+  for(i = 0; i < q->count; i++) {
+    item = &sorted[i];
+    if(item->matrix != matrix) {
+      glLoadMatrixf(item->matrix);
+      matrix = item->matrix;
+    }
+
+    if(item->draw != NULL) {
+      /* leave it a clean slate, and trust nothing it leaves */
+      SwitchMesh(bound, NULL);
+      bound = NULL;
+      if(current != NULL && current->texture != NULL) StateEnable(GL_TEXTURE_2D, 0);
+      if(current != NULL && current->twoSided) StateLightModeli(GL_LIGHT_MODEL_TWO_SIDE, GL_FALSE);
+      current = NULL;
+      item->draw();
+      q->drawCalls++;
+      continue;
+    }
+
+    if(item->m != bound) {
+      SwitchMesh(bound, item->m);
+      bound = item->m;
+      q->meshChanges++;
+    }
+    mat = &materials[item->part->material];
+    if(mat != current) {
+      if(mat->texture != NULL &&
+	 (current == NULL || current->texture == NULL || *current->texture != *mat->texture))
+	q->textureChanges++;
+      ApplyMaterial(mat, current);
+      current = mat;
+      q->materialChanges++;
+    }
+    DrawMeshPart(item->m, item->part);
+    q->drawCalls++;
+  }
+
+  /* as the rest of the drawing expects */
+  SwitchMesh(bound, NULL);
+  if(current != NULL && current->texture != NULL) StateEnable(GL_TEXTURE_2D, 0);
+  if(current != NULL && current->twoSided) StateLightModeli(GL_LIGHT_MODEL_TWO_SIDE, GL_FALSE);
+  glPopMatrix();
+}
+
+void ReportRenderQueue(renderQueue *q) {
+  printf("Render queue: %d items, %d material changes, %d texture changes, %d mesh changes\n",
+	 q->count, q->materialChanges, q->textureChanges, q->meshChanges);
+  printf("Frame arena: %ld bytes, %ld used, grown %d times\n",
+	 q->arena.size, q->arena.used, q->arena.grown);
+}
+
+/* room for one more, doubling the item array in the arena when full */
+renderItem *NewRenderItem(renderQueue *q) {
+  renderItem *items;
+
+  if(q->count == q->size) {
+    q->size = q->size > 0 ? q->size * 2 : RENDER_QUEUE_ITEMS;
+    items = ArenaAlloc(&q->arena, q->size * sizeof(renderItem));
+    if(q->count > 0) memcpy(items, q->items, q->count * sizeof(renderItem));
+    q->items = items;
+  }
+  return &q->items[q->count++];
+}
+
+/* distance in front of the eye, as 16 bits */
+unsigned int RenderDepth(GLfloat *matrix, GLfloat centre[3]) {
+  GLfloat z = -(matrix[2] * centre[0] + matrix[6] * centre[1] + matrix[10] * centre[2] + matrix[14]);
+
+  if(z <= 0.0) return 0;
+  if(z >= RENDER_DEPTH_RANGE) return 0xffff;
+  return (unsigned int) (z / RENDER_DEPTH_RANGE * 0xffff);
+}
+
+/* least significant byte first radix sort, stable so items with equal
+   keys stay in the order they were queued. Bytes every key shares are
+   skipped */
+void SortRenderItems(renderItem *in, renderItem *out, int count) {
+  int counts[256];
+  renderItem *from = in, *to = out, *swap;
+  int shift, i, sum, n;
+
+  for(shift = 0; shift < 32; shift += 8) {
+    memset(counts, 0, sizeof(counts));
+    for(i = 0; i < count; i++) counts[(from[i].key >> shift) & 0xff]++;
+    if(count == 0 || counts[(from[0].key >> shift) & 0xff] == count) continue;
+    for(sum = 0, i = 0; i < 256; i++) {
+      n = counts[i];
+      counts[i] = sum;
+      sum += n;
+    }
+    for(i = 0; i < count; i++) to[counts[(from[i].key >> shift) & 0xff]++] = from[i];
+    swap = from;
+    from = to;
+    to = swap;
+  }
+  if(from != out) memcpy(out, from, count * sizeof(renderItem));
+}
@@ -0,0 +1,560 @@
+/*************************************************************************
+ * The submarine and bubble simulation. Runs at a fixed time step so it *
+ * behaves the same whatever the frame rate, and makes no GL calls so   *
+ * it can run (and be profiled) without a rendering context.            *
+ * Interactively it runs on the background thread and publishes each    *
+ * result as a snapshot; drawing always reads the other, finished,      *
+ * snapshot. Bubbles push each other apart and get pushed aside by the  *
+ * submarine, finding what is near them through a spatial hash. There   *
+ * can be a whole fleet of submarines, only the first steered from the  *
+ * keyboard and only it swept through the tank, and any of them can be  *
+ * looked out of. Bubbles are collided with the tank through a distance *
+ * field baked from the same world, and carried along by the water,     *
+ * which the submarines and the emitters stir                           *
+ *************************************************************************/
+
+/* types */
+typedef struct {
+  float position[3];
+  float spread;		/* horizontal speed range of new bubbles */
+  float rate;		/* bursts per second */
+  int burst;		/* bubbles per burst */
+  float timeSinceBurst;
+} emitter;
+
+/* everything needed to draw one moment of the simulation */
+typedef struct {
+  float sub[3];			/* the one looked out of */
+  float dive, turn;
+  int camera;			/* which it is */
+  int subs;
+  float *fleet;			/* 12 floats of matrix for each submarine */
+  int count;
+  float *bubbles;		/* x, y, z of each live bubble */
+} snapshot;
+
+/* Constants */
+#define MAX_BUBBLES 60
+#define TIME_BETWEEN_BUBBLES 0.3
+#define BUBBLE_SPREAD 4.0
+#define BOUYANCY 10
+#define BUBBLE_BOUNCE 0.3
+/* drawn with, and how far bubbles stop short of anything they hit */
+#define BUBBLE_RADIUS 0.8
+#define WATER_RESISTANCE 0.7
+#define SUB_BOUNCE 0.5
+/* left between the submarine and whatever it hits */
+#define SUB_CLEARANCE 0.01
+#define SIMULATION_STEP 0.01
+#define MAX_SIMULATION_LAG 0.25
+/* bubbles touch this far apart */
+#define BUBBLE_CONTACT (2.0 * BUBBLE_RADIUS)
+/* how hard two bubbles right on top of each other push apart */
+#define BUBBLE_REPULSION 20.0
+/* hash buckets round the submarine, more than this and every bubble is tried */
+#define HULL_BUCKETS 4096
+/* the rest of the fleet cruise at about FLEET_THRUST / WATER_RESISTANCE */
+#define FLEET_THRUST 3.0
+#define FLEET_TURN_RATE 30.0
+#define FLEET_DIVE_RATE 10.0
+/* how quickly the water round a submarine or over an emitter takes up
+   its speed, per second */
+#define STIR_RATE 5.0
+/* what an emitter pushes the water up to, over how high a column */
+#define JET_SPEED 4.0
+#define JET_HEIGHT 8.0
+/* how quickly bubbles take up the water's speed, per second */
+#define BUBBLE_DRAG 1.0
+
+/* Variables */
+particles bubbles;
+int maxBubbles = MAX_BUBBLES;
+spatialHash bubbleHash;
+int bubbleInteraction = 1;
+/* the submarine's box in its own coordinates */
+float hullLow[3] = {-6.0, -1.5, -2.0};
+float hullHigh[3] = {7.25, 2.0, 2.0};
+/* everything the submarine can hit, filled in before InitSimulation() */
+collisionWorld tankWorld;
+/* and what the bubbles can, baked from it */
+distanceField tankField;
+/* the water's velocity, none if there are no cells */
+fluidGrid water;
+int fluidCells = FLUID_CELLS;
+double fluidBudget = FLUID_BUDGET;
+int subBody;
+fleet subs;
+int fleetSize = 1;
+int cameraSub = PLAYER_SUB;
+double simulationLag = 0.0;
+float simulationAlpha = 0.0;
+emitter *emitters = NULL;
+int emitterCount = 0;
+
+/* double buffered results, the front one is being drawn */
+snapshot snapshots[2];
+int frontSnapshot = 0;
+int snapshotReady = 0;
+double pendingTime = 0.0;
+double backgroundTime = 0.0;
+
+/* input waiting for the next step */
+float inputAcceleration = 0.0;
+float inputDive = 0.0;
+float inputTurn = 0.0;
+int inputCamera = 0;
+
+/* everything random in the simulation comes from here */
+randomState simulationRandom;
+/* and the fleet's starting places, kept apart so they change nothing else */
+randomState fleetRandom;
+
+void InitSimulation(unsigned int);
+void AdvanceSimulation(double);
+void StepSimulation(void);
+void UpdateSubmarine(float);
+void UpdateBubbles(float);
+void StirWater(float);
+void InteractBubbles(float);
+void PushBubblesFromHull(void);
+void PushBubbleFromHull(int, float[3][3]);
+void LaunchFleet(void);
+int CompareBuckets(const void *, const void *);
+void AddEmitter(float, float, float, float, int);
+void ReleaseBubbles(emitter *, float);
+void UpdateSimulation(double);
+void AdvanceSimulationNow(double);
+void AdvanceInBackground(void);
+void ApplyInput(void);
+void PushSubmarine(float);
+void SteerSubmarine(float, float);
+void NextCamera(void);
+void InitSnapshot(snapshot *);
+void TakeSnapshot(snapshot *);
+void InterpolateBubbleChunk(void *, int, int);
+snapshot *CurrentSnapshot(void);
+void MoveSubmarine(float[3]);
+void FillNoiseChunk(void *, int, int);
+
+/* the same seed and input always give the same run */
+void InitSimulation(unsigned int seed) {
+  int i;
+
+  PROFILE_BEGIN("InitSimulation");
+  SeedRandom(&simulationRandom, seed, 0);
+  SeedRandom(&fleetRandom, seed, 1);
+  InitParticles(&bubbles, maxBubbles);
+  InitSpatialHash(&bubbleHash, BUBBLE_CONTACT);
+  BakeDistanceField(&tankField, &tankWorld);
+  if(fluidCells > 0) InitFluid(&water, &tankWorld, fluidCells, fluidBudget);
+  subBody = AddCollisionBody(&tankWorld);
+  for(i = 0; i < emitterCount; i++) emitters[i].timeSinceBurst = 0.0;
+
+  InitFleet(&subs, fleetSize, hullLow, hullHigh);
+  KeepFleetInWorld(&subs, &tankWorld);
+  AddSubmarine(&subs, 0.0, 20.0, 0.0, 0.0, 0.0);
+  LaunchFleet();
+  if(cameraSub < 0 || cameraSub >= subs.count) cameraSub = PLAYER_SUB;
+
+  simulationLag = 0.0;
+  simulationAlpha = 0.0;
+
+  InitSnapshot(&snapshots[0]);
+  InitSnapshot(&snapshots[1]);
+  TakeSnapshot(&snapshots[frontSnapshot]);
+  PROFILE_END();
+}
+
+/* called every frame. Collects the last result, if there is one, and sets
+   the next lot of time going in the background. Never waits */
+void UpdateSimulation(double elapsed) {
+  pendingTime += elapsed;
+  if(BackgroundBusy()) return;
+
+  if(snapshotReady) {
+    frontSnapshot = 1 - frontSnapshot;
+    snapshotReady = 0;
+  }
+  ApplyInput();
+  backgroundTime = pendingTime;
+  pendingTime = 0.0;
+  StartBackground(AdvanceInBackground);
+}
+
+/* the same but waits for the result, for benchmarking */
+void AdvanceSimulationNow(double elapsed) {
+  ApplyInput();
+  AdvanceSimulation(elapsed);
+  TakeSnapshot(&snapshots[1 - frontSnapshot]);
+  frontSnapshot = 1 - frontSnapshot;
+}
+
+void AdvanceInBackground(void) {
+  AdvanceSimulation(backgroundTime);
+  TakeSnapshot(&snapshots[1 - frontSnapshot]);
+  snapshotReady = 1;
+}
+
+/* only called while the background thread is idle */
+void ApplyInput(void) {
+  float *dive = &subs.dive[PLAYER_SUB], *turn = &subs.turn[PLAYER_SUB];
+
+  if(inputDive != 0.0 || inputTurn != 0.0) {
+    *dive += inputDive;
+    if(*dive < -60.0) *dive = -60.0;
+    if(*dive > 60.0) *dive = 60.0;
+    *turn += inputTurn;
+    while(*turn > 360.0) *turn -= 360.0;
+    while(*turn < 0.0) *turn += 360.0;
+    OrientSubmarine(&subs, PLAYER_SUB);
+  }
+  if(inputAcceleration != 0.0) AccelerateSubmarine(&subs, PLAYER_SUB, inputAcceleration);
+  cameraSub = (cameraSub + inputCamera) % subs.count;
+
+  inputAcceleration = 0.0;
+  inputDive = 0.0;
+  inputTurn = 0.0;
+  inputCamera = 0;
+}
+
+void PushSubmarine(float acceleration) {
+  inputAcceleration += acceleration;
+}
+
+void SteerSubmarine(float dive, float turn) {
+  inputDive += dive;
+  inputTurn += turn;
+}
+
+/* look out of the next one in the fleet */
+void NextCamera(void) {
+  inputCamera++;
+}
+
+/* run as many whole steps as fit in the elapsed time, the remainder is
+   carried over and used to interpolate what gets drawn */
+void AdvanceSimulation(double elapsed) {
+  simulationLag += elapsed;
+  /* don't try to catch up after a long stall */
+  if(simulationLag > MAX_SIMULATION_LAG) simulationLag = MAX_SIMULATION_LAG;
+
+  while(simulationLag >= SIMULATION_STEP) {
+    StepSimulation();
+    simulationLag -= SIMULATION_STEP;
+  }
+  simulationAlpha = simulationLag / SIMULATION_STEP;
+}
+
+void StepSimulation(void) {
+  PROFILE_BEGIN("StepSimulation");
+  /* remember where everything was for interpolation */
+  SaveFleetPositions(&subs);
+  SaveParticlePositions(&bubbles);
+
+  UpdateSubmarine(SIMULATION_STEP);
+  MoveFleet(&subs, PLAYER_SUB + 1, SIMULATION_STEP, WATER_RESISTANCE, SUB_BOUNCE, SUB_CLEARANCE);
+  if(fluidCells > 0) StirWater(SIMULATION_STEP);
+  UpdateBubbles(SIMULATION_STEP);
+  PROFILE_END();
+}
+
+/* the one steered from the keyboard */
+void UpdateSubmarine(float elapsedSecs) {
+  float velAdj, motion[3];
+  int i = PLAYER_SUB;
+
+  velAdj = WATER_RESISTANCE * elapsedSecs;
+  motion[0] = subs.xVelocity[i] * elapsedSecs;
+  motion[1] = subs.yVelocity[i] * elapsedSecs;
+  motion[2] = subs.zVelocity[i] * elapsedSecs;
+  MoveSubmarine(motion);
+  /* water resistance */
+  subs.xVelocity[i] -= velAdj * subs.xVelocity[i];
+  subs.yVelocity[i] -= velAdj * subs.yVelocity[i];
+  subs.zVelocity[i] -= velAdj * subs.zVelocity[i];
+}
+
+void UpdateBubbles(float elapsed) {
+  unsigned int noiseSeed;
+  int i;
+
+  /* each block of bubbles seeds its own generator from where it is, so the
+     noise is the same however many threads share the work */
+  noiseSeed = NextRandom(&simulationRandom);
+  ParallelFor(FillNoiseChunk, &noiseSeed, bubbles.count, PARTICLE_GRAIN);
+  MoveParticles(&bubbles, elapsed, BOUYANCY);
+  if(fluidCells > 0) DragParticles(&water, &bubbles, BUBBLE_DRAG * elapsed);
+  CollideParticles(&tankField, &bubbles, BUBBLE_RADIUS, BUBBLE_BOUNCE);
+  RemoveBurstParticles(&bubbles);
+  if(bubbleInteraction) InteractBubbles(elapsed);
+
+  /* release new bubbles */
+  for(i = 0; i < emitterCount; i++) ReleaseBubbles(&emitters[i], elapsed);
+}
+
+/* the water round every submarine dragged along with it and pushed up
+   over every emitter, then moved on */
+void StirWater(float elapsed) {
+  orientedBox box;
+  float low[3], high[3], velocity[3];
+  int i, k;
+
+  for(i = 0; i < subs.count; i++) {
+    SubmarineBox(&subs, i, &box);
+    BoxBounds(&box, low, high);
+    velocity[0] = subs.xVelocity[i];
+    velocity[1] = subs.yVelocity[i];
+    velocity[2] = subs.zVelocity[i];
+    StirFluid(&water, low, high, velocity, STIR_RATE * elapsed);
+  }
+  velocity[0] = velocity[2] = 0.0;
+  velocity[1] = JET_SPEED;
+  for(i = 0; i < emitterCount; i++) {
+    if(emitters[i].rate <= 0.0 || emitters[i].burst <= 0) continue;
+    for(k = 0; k < 3; k++) low[k] = high[k] = emitters[i].position[k];
+    high[1] += JET_HEIGHT;
+    StirFluid(&water, low, high, velocity, STIR_RATE * elapsed);
+  }
+  StepFluid(&water, elapsed);
+}
+
+/* bubbles pushing each other apart and pushed out of the way by the
+   submarine, both found through the hash */
+void InteractBubbles(float elapsed) {
+  BuildSpatialHash(&bubbleHash, &bubbles);
+  RepelParticles(&bubbleHash, BUBBLE_CONTACT, BUBBLE_REPULSION * elapsed);
+  PushBubblesFromHull();
+}
+
+/* only the bubbles in the cells round the steered submarine are tried,
+   unless there are more cells than bubbles */
+void PushBubblesFromHull(void) {
+  spatialHash *h = &bubbleHash;
+  float axes[3][3], centre[3], reach[3];
+  int buckets[HULL_BUCKETS], low[3], high[3];
+  int cx, cy, cz, i, j, k, n = 0, cells = 1;
+
+  SubmarineAxes(&subs, PLAYER_SUB, axes);
+  /* the world box round the hull, out as far as a bubble touching it */
+  centre[0] = subs.x[PLAYER_SUB];
+  centre[1] = subs.y[PLAYER_SUB];
+  centre[2] = subs.z[PLAYER_SUB];
+  reach[0] = reach[1] = reach[2] = 0.0;
+  for(j = 0; j < 3; j++)
+    for(k = 0; k < 3; k++) {
+      centre[k] += axes[j][k] * (hullLow[j] + hullHigh[j]) / 2;
+      reach[k] += fabs(axes[j][k]) * ((hullHigh[j] - hullLow[j]) / 2 + BUBBLE_CONTACT / 2);
+    }
+  for(k = 0; k < 3; k++) {
+    low[k] = CellCoordinate(h, centre[k] - reach[k]);
+    high[k] = CellCoordinate(h, centre[k] + reach[k]);
+    cells *= high[k] - low[k] + 1;
+  }
+  if(cells > HULL_BUCKETS || cells >= h->count) {
+    for(i = 0; i < h->count; i++) PushBubbleFromHull(i, axes);
+    return;
+  }
+
+  /* each bucket once, however many of the cells hash to it */
+  for(cx = low[0]; cx <= high[0]; cx++)
+    for(cy = low[1]; cy <= high[1]; cy++)
+      for(cz = low[2]; cz <= high[2]; cz++)
+	buckets[n++] = HashCell(h, cx, cy, cz);
+  qsort(buckets, n, sizeof(int), CompareBuckets);
+  for(j = 0; j < n; j++) {
+    if(j > 0 && buckets[j] == buckets[j-1]) continue;
+    for(k = h->start[buckets[j]]; k < h->start[buckets[j] + 1]; k++)
+      PushBubbleFromHull(h->sorted[k], axes);
+  }
+}
+
+/* out through the nearest side of the hull, and no longer moving into
+   it faster than the submarine is */
+void PushBubbleFromHull(int i, float axes[3][3]) {
+  float offset[3], local[3], velocity[3], depth, deepest = 0.0, side = 0.0, closing;
+  int j, k, nearest = -1;
+
+  offset[0] = bubbles.x[i] - subs.x[PLAYER_SUB];
+  offset[1] = bubbles.y[i] - subs.y[PLAYER_SUB];
+  offset[2] = bubbles.z[i] - subs.z[PLAYER_SUB];
+  for(j = 0; j < 3; j++) {
+    local[j] = axes[j][0] * offset[0] + axes[j][1] * offset[1] + axes[j][2] * offset[2];
+    if(local[j] <= hullLow[j] - BUBBLE_CONTACT / 2 || local[j] >= hullHigh[j] + BUBBLE_CONTACT / 2)
+      return;
+  }
+  for(j = 0; j < 3; j++) {
+    depth = local[j] - (hullLow[j] - BUBBLE_CONTACT / 2);
+    if(nearest < 0 || depth < deepest) {
+      nearest = j;
+      deepest = depth;
+      side = -1.0;
+    }
+    depth = hullHigh[j] + BUBBLE_CONTACT / 2 - local[j];
+    if(depth < deepest) {
+      nearest = j;
+      deepest = depth;
+      side = 1.0;
+    }
+  }
+
+  bubbles.x[i] += axes[nearest][0] * side * deepest;
+  bubbles.y[i] += axes[nearest][1] * side * deepest;
+  bubbles.z[i] += axes[nearest][2] * side * deepest;
+  velocity[0] = bubbles.xVelocity[i] - subs.xVelocity[PLAYER_SUB];
+  velocity[1] = bubbles.yVelocity[i] - subs.yVelocity[PLAYER_SUB];
+  velocity[2] = bubbles.zVelocity[i] - subs.zVelocity[PLAYER_SUB];
+  closing = side * (axes[nearest][0] * velocity[0] + axes[nearest][1] * velocity[1] +
+		    axes[nearest][2] * velocity[2]);
+  if(closing >= 0.0) return;
+  for(k = 0; k < 3; k++) velocity[k] = -axes[nearest][k] * side * closing * (1.0 + BUBBLE_BOUNCE);
+  bubbles.xVelocity[i] += velocity[0];
+  bubbles.yVelocity[i] += velocity[1];
+  bubbles.zVelocity[i] += velocity[2];
+}
+
+/* the rest of the fleet anywhere in open water, cruising round on
+   their own. Any that start in something are pushed out the first step */
+void LaunchFleet(void) {
+  randomState *r = &fleetRandom;
+  int i;
+
+  while(subs.count < subs.size) {
+    i = AddSubmarine(&subs, RandomFloat(r) * 80.0 - 40.0, RandomFloat(r) * 30.0 + 5.0,
+		     RandomFloat(r) * 36.0 - 18.0,
+		     (RandomFloat(r) * 2.0 - 1.0) * FLEET_MAX_DIVE, RandomFloat(r) * 360.0);
+    subs.diveRate[i] = (RandomFloat(r) * 2.0 - 1.0) * FLEET_DIVE_RATE;
+    subs.turnRate[i] = (RandomFloat(r) * 2.0 - 1.0) * FLEET_TURN_RATE;
+    subs.thrust[i] = FLEET_THRUST;
+  }
+}
+
+int CompareBuckets(const void *a, const void *b) {
+  return *(const int *) a - *(const int *) b;
+}
+
+void AddEmitter(float x, float y, float z, float rate, int burst) {
+  emitter *e;
+
+  emitters = realloc(emitters, (emitterCount + 1) * sizeof(emitter));
+  if(emitters == NULL) {
+    fprintf(stderr, "ERROR: Unable to allocate bubble emitter\n");
+    exit(1);
+  }
+  e = &emitters[emitterCount++];
+  e->position[0] = x;
+  e->position[1] = y;
+  e->position[2] = z;
+  e->spread = BUBBLE_SPREAD;
+  e->rate = rate;
+  e->burst = burst;
+  e->timeSinceBurst = 0.0;
+}
+
+/* all the bursts due this step, each moved on by how long ago in the
+   step it should have happened. Anything that doesn't fit is lost */
+void ReleaseBubbles(emitter *e, float elapsed) {
+  int bursts, i;
+
+  if(e->rate <= 0.0 || e->burst <= 0) return;
+  e->timeSinceBurst += elapsed;
+  bursts = (int) (e->timeSinceBurst * e->rate);
+  e->timeSinceBurst -= bursts / e->rate;
+
+  for(i = bursts - 1; i >= 0; i--) {
+    if(EmitParticles(&bubbles, e->burst, e->position, e->spread,
+		     e->timeSinceBurst + i / e->rate, &simulationRandom) < e->burst) break;
+  }
+}
+
+/* a fresh generator every PARTICLE_GRAIN bubbles, however the range
+   was split up */
+void FillNoiseChunk(void *seed, int begin, int end) {
+  randomBatch b;
+  int i, n;
+
+  for(i = begin; i < end; i += PARTICLE_GRAIN) {
+    n = end - i < PARTICLE_GRAIN ? end - i : PARTICLE_GRAIN;
+    SeedRandomBatch(&b, *(unsigned int *) seed, i / PARTICLE_GRAIN);
+    RandomFloats(&b, bubbles.noise + i, n);
+  }
+}
+
+void InitSnapshot(snapshot *s) {
+  s->bubbles = malloc(bubbles.size * 3 * sizeof(float));
+  s->fleet = malloc(subs.size * 12 * sizeof(float));
+  if(s->bubbles == NULL || s->fleet == NULL) {
+    fprintf(stderr, "ERROR: Unable to allocate snapshot of %d bubbles and %d submarines\n",
+	    bubbles.size, subs.size);
+    exit(1);
+  }
+  s->count = 0;
+}
+
+/* everything interpolated between the last two steps */
+void TakeSnapshot(snapshot *s) {
+  int c = cameraSub;
+
+  s->sub[0] = subs.lastX[c] + (subs.x[c] - subs.lastX[c]) * simulationAlpha;
+  s->sub[1] = subs.lastY[c] + (subs.y[c] - subs.lastY[c]) * simulationAlpha;
+  s->sub[2] = subs.lastZ[c] + (subs.z[c] - subs.lastZ[c]) * simulationAlpha;
+  s->dive = subs.dive[c];
+  s->turn = subs.turn[c];
+  s->camera = c;
+  s->subs = subs.count;
+  FleetMatrices(&subs, simulationAlpha, s->fleet);
+  s->count = bubbles.count;
+  ParallelFor(InterpolateBubbleChunk, s->bubbles, bubbles.count, PARTICLE_GRAIN);
+}
+
+void InterpolateBubbleChunk(void *data, int begin, int end) {
+  float *positions = data;
+  int i;
+
+  for(i = begin; i < end; i++) {
+    positions[3*i] = bubbles.lastX[i] + (bubbles.x[i] - bubbles.lastX[i]) * simulationAlpha;
+    positions[3*i+1] = bubbles.lastY[i] + (bubbles.y[i] - bubbles.lastY[i]) * simulationAlpha;
+    positions[3*i+2] = bubbles.lastZ[i] + (bubbles.z[i] - bubbles.lastZ[i]) * simulationAlpha;
+  }
+}
+
+snapshot *CurrentSnapshot(void) {
+  return &snapshots[frontSnapshot];
+}
+
+/* as far as it can go towards where motion would take it. If it hits
+   anything it stops just short and bounces off, if it started inside
+   anything it is pushed out the shortest way */
+void MoveSubmarine(float motion[3]) {
+  orientedBox box;
+  contact c;
+  float move[3], along;
+  int i = PLAYER_SUB, k;
+
+  PROFILE_BEGIN("MoveSubmarine");
+  SubmarineBox(&subs, i, &box);
+  MoveCollisionBody(&tankWorld, subBody, &box, motion);
+  FindCollisionPairs(&tankWorld);
+  if(!FirstContact(&tankWorld, subBody, &c)) {
+    subs.x[i] += motion[0];
+    subs.y[i] += motion[1];
+    subs.z[i] += motion[2];
+    PROFILE_END();
+    return;
+  }
+
+  for(k = 0; k < 3; k++) {
+    if(c.time < 0.0) move[k] = c.normal[k] * (c.depth + SUB_CLEARANCE);
+    else move[k] = motion[k] * c.time + c.normal[k] * SUB_CLEARANCE;
+  }
+  subs.x[i] += move[0];
+  subs.y[i] += move[1];
+  subs.z[i] += move[2];
+  along = subs.xVelocity[i] * c.normal[0] + subs.yVelocity[i] * c.normal[1] +
+    subs.zVelocity[i] * c.normal[2];
+  if(along < 0.0) {
+    subs.xVelocity[i] -= (1.0 + SUB_BOUNCE) * along * c.normal[0];
+    subs.yVelocity[i] -= (1.0 + SUB_BOUNCE) * along * c.normal[1];
+    subs.zVelocity[i] -= (1.0 + SUB_BOUNCE) * along * c.normal[2];
+  }
+  PROFILE_END();
+}
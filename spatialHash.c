@@ -0,0 +1,235 @@
+/*************************************************************************
+ * Uniform grid spatial hash over the particles, for finding the ones   *
+ * close to each other or to something else in about linear time. The   *
+ * cells are as big as the distance things interact over and hash into  *
+ * a table of buckets with at least twice as many buckets as particles, *
+ * so it works however far the particles spread. Rebuilt every step     *
+ * with a counting sort: the hashing and the copy of the positions into *
+ * bucket order are split across the thread pool, the count and the     *
+ * scatter stay on one thread so each bucket lists its particles in     *
+ * order and a run repeats exactly whatever the number of threads       *
+ *************************************************************************/
+
+#define HASH_MIN_BUCKETS 64
+/* runs of buckets round a point: the 9 rows of 3 cells along x, each
+   possibly split where it wraps round the end of the table */
+#define HASH_RUNS 18
+
+typedef struct {
+  float cellSize, inverse;	/* inverse is 1 / cellSize */
+  int buckets;			/* a power of 2 */
+  int *start;			/* buckets + 1, bucket b is start[b] to start[b+1]-1 */
+  int *sorted;			/* particle numbers in bucket order */
+  int *bucketOf;		/* each particle's bucket */
+  float *x, *y, *z;		/* positions in bucket order, next to each other for the search */
+  particles *p;			/* what was hashed */
+  int count;			/* how many of them */
+  int size;			/* particles there is room for */
+} spatialHash;
+
+/* what every chunk of a repulsion needs to know */
+typedef struct {
+  spatialHash *h;
+  float contact, push;
+} particleRepulsion;
+
+void InitSpatialHash(spatialHash *, float);
+void FreeSpatialHash(spatialHash *);
+void BuildSpatialHash(spatialHash *, particles *);
+int CellCoordinate(spatialHash *, float);
+int HashCell(spatialHash *, int, int, int);
+int NeighbourRuns(spatialHash *, float, float, float, int[HASH_RUNS][2]);
+void RepelParticles(spatialHash *, float, float);
+void GrowSpatialHash(spatialHash *, int);
+void HashParticleChunk(void *, int, int);
+void SortPositionChunk(void *, int, int);
+void RepelParticleChunk(void *, int, int);
+
+/* particles within cellSize of each other are always in neighbouring cells */
+void InitSpatialHash(spatialHash *h, float cellSize) {
+  h->cellSize = cellSize;
+  h->inverse = 1.0 / cellSize;
+  h->buckets = 0;
+  h->start = h->sorted = h->bucketOf = NULL;
+  h->x = h->y = h->z = NULL;
+  h->p = NULL;
+  h->count = h->size = 0;
+}
+
+void FreeSpatialHash(spatialHash *h) {
+  free(h->start);
+  free(h->sorted);
+  free(h->bucketOf);
+  free(h->x);
+  InitSpatialHash(h, h->cellSize);
+}
+
+/* from where the particles are now */
+void BuildSpatialHash(spatialHash *h, particles *p) {
+  int i, b;
+
+  PROFILE_BEGIN("BuildSpatialHash");
+  if(p->count > h->size || h->start == NULL) GrowSpatialHash(h, p->count);
+  h->p = p;
+  h->count = p->count;
+  ParallelFor(HashParticleChunk, h, h->count, PARTICLE_GRAIN);
+
+  /* count each bucket, then sum so start[b] is where bucket b ends */
+  memset(h->start, 0, (h->buckets + 1) * sizeof(int));
+  for(i = 0; i < h->count; i++) h->start[h->bucketOf[i]]++;
+  for(b = 1; b <= h->buckets; b++) h->start[b] += h->start[b-1];
+  /* and fill each from its end back, which leaves start[b] where it begins
+     and the particles in order */
+  for(i = h->count - 1; i >= 0; i--) h->sorted[--h->start[h->bucketOf[i]]] = i;
+
+  ParallelFor(SortPositionChunk, h, h->count, PARTICLE_GRAIN);
+  PROFILE_END();
+}
+
+int CellCoordinate(spatialHash *h, float position) {
+  return (int) floor(position * h->inverse);
+}
+
+/* each row of cells along x starts somewhere scattered by large primes
+   (Teschner et al. 2003) and runs on through the buckets after it, so
+   cells next to each other in x are next to each other in the table */
+int HashCell(spatialHash *h, int x, int y, int z) {
+  return (int) ((((unsigned int) y * 19349663u ^ (unsigned int) z * 83492791u) + (unsigned int) x) &
+		(h->buckets - 1));
+}
+
+/* the particles that can be within cellSize of a point, as runs first to
+   end-1 of the bucket ordered arrays, each particle in only one however
+   the rows overlap in the table. Returns how many runs */
+int NeighbourRuns(spatialHash *h, float x, float y, float z, int runs[HASH_RUNS][2]) {
+  int cx = CellCoordinate(h, x), cy = CellCoordinate(h, y), cz = CellCoordinate(h, z);
+  int buckets[HASH_RUNS][2], swap[2];
+  int i, j, k, b, n = 0, merged = 0;
+
+  /* first and last bucket of each row of three */
+  for(j = -1; j <= 1; j++)
+    for(k = -1; k <= 1; k++) {
+      b = HashCell(h, cx - 1, cy + j, cz + k);
+      buckets[n][0] = b;
+      buckets[n++][1] = b + 2 < h->buckets ? b + 2 : h->buckets - 1;
+      if(b + 2 >= h->buckets) {
+	buckets[n][0] = 0;
+	buckets[n++][1] = b + 2 - h->buckets;
+      }
+    }
+  /* in order, a handful so insertion sort, then joined where they meet */
+  for(i = 1; i < n; i++)
+    for(j = i; j > 0 && buckets[j-1][0] > buckets[j][0]; j--) {
+      swap[0] = buckets[j][0];
+      swap[1] = buckets[j][1];
+      buckets[j][0] = buckets[j-1][0];
+      buckets[j][1] = buckets[j-1][1];
+      buckets[j-1][0] = swap[0];
+      buckets[j-1][1] = swap[1];
+    }
+  for(i = 0; i < n; i++) {
+    if(merged > 0 && buckets[i][0] <= buckets[merged-1][1] + 1) {
+      if(buckets[i][1] > buckets[merged-1][1]) buckets[merged-1][1] = buckets[i][1];
+      continue;
+    }
+    buckets[merged][0] = buckets[i][0];
+    buckets[merged++][1] = buckets[i][1];
+  }
+  for(i = 0, n = 0; i < merged; i++) {
+    runs[n][0] = h->start[buckets[i][0]];
+    runs[n][1] = h->start[buckets[i][1] + 1];
+    if(runs[n][1] > runs[n][0]) n++;
+  }
+  return n;
+}
+
+/* push every pair of hashed particles closer than contact apart, by up to
+   push at no distance at all, along the line between them. Each particle
+   only changes its own velocity, so chunks never share anything they write */
+void RepelParticles(spatialHash *h, float contact, float push) {
+  particleRepulsion r;
+
+  PROFILE_BEGIN("RepelParticles");
+  r.h = h;
+  r.contact = contact;
+  r.push = push;
+  ParallelFor(RepelParticleChunk, &r, h->count, PARTICLE_GRAIN);
+  PROFILE_END();
+}
+
+/* room for at least count particles, with twice as many buckets */
+void GrowSpatialHash(spatialHash *h, int count) {
+  int buckets = HASH_MIN_BUCKETS;
+
+  while(buckets < 2 * count) buckets *= 2;
+  FreeSpatialHash(h);
+  h->buckets = buckets;
+  h->size = count;
+  h->start = malloc((buckets + 1) * sizeof(int));
+  h->sorted = malloc((count + 1) * sizeof(int));
+  h->bucketOf = malloc((count + 1) * sizeof(int));
+  h->x = malloc((3 * count + 1) * sizeof(float));
+  if(h->start == NULL || h->sorted == NULL || h->bucketOf == NULL || h->x == NULL) {
+    fprintf(stderr, "ERROR: Unable to allocate spatial hash of %d particles\n", count);
+    exit(1);
+  }
+  h->y = h->x + count;
+  h->z = h->x + 2 * count;
+}
+
+void HashParticleChunk(void *data, int begin, int end) {
+  spatialHash *h = data;
+  particles *p = h->p;
+  int i;
+
+  for(i = begin; i < end; i++)
+    h->bucketOf[i] = HashCell(h, CellCoordinate(h, p->x[i]), CellCoordinate(h, p->y[i]),
+			      CellCoordinate(h, p->z[i]));
+}
+
+void SortPositionChunk(void *data, int begin, int end) {
+  spatialHash *h = data;
+  particles *p = h->p;
+  int k;
+
+  for(k = begin; k < end; k++) {
+    h->x[k] = p->x[h->sorted[k]];
+    h->y[k] = p->y[h->sorted[k]];
+    h->z[k] = p->z[h->sorted[k]];
+  }
+}
+
+/* through the particles in bucket order, so one after another mostly
+   search the same runs, which are still in the cache */
+void RepelParticleChunk(void *data, int begin, int end) {
+  particleRepulsion *r = data;
+  spatialHash *h = r->h;
+  particles *p = h->p;
+  int runs[HASH_RUNS][2];
+  float dx, dy, dz, distance, strength, push[3];
+  float contactSquared = r->contact * r->contact;
+  int i, j, k, n, run;
+
+  for(j = begin; j < end; j++) {
+    i = h->sorted[j];
+    n = NeighbourRuns(h, h->x[j], h->y[j], h->z[j], runs);
+    push[0] = push[1] = push[2] = 0.0;
+    for(run = 0; run < n; run++)
+      for(k = runs[run][0]; k < runs[run][1]; k++) {
+	dx = h->x[j] - h->x[k];
+	dy = h->y[j] - h->y[k];
+	dz = h->z[j] - h->z[k];
+	distance = dx * dx + dy * dy + dz * dz;
+	/* too far, or itself, or right on top with no way to tell which way */
+	if(distance >= contactSquared || distance < 1e-12f) continue;
+	distance = sqrt(distance);
+	strength = r->push * (r->contact - distance) / (r->contact * distance);
+	push[0] += dx * strength;
+	push[1] += dy * strength;
+	push[2] += dz * strength;
+      }
+    p->xVelocity[i] += push[0];
+    p->yVelocity[i] += push[1];
+    p->zVelocity[i] += push[2];
+  }
+}
@@ -0,0 +1,118 @@
+/*************************************************************************
+ * The last frame's GL call totals, what was culled and the levels of   *
+ * detail, drawn over the top left of the view in a small built in      *
+ * bitmap font so it needs nothing from GLUT and works headless too     *
+ *************************************************************************/
+
+#define OVERLAY_LINES 6
+#define OVERLAY_LINE 80
+#define GLYPH_WIDTH 5
+#define GLYPH_HEIGHT 7
+#define GLYPH_SPACING 6
+#define LINE_SPACING 10
+
+/* only what the overlay writes, anything else is left blank */
+char glyphCharacters[] = "0123456789.abcdeiklmnprstuvw";
+
+/* rows from the top, the leftmost pixel in bit 4 */
+unsigned char glyphs[][GLYPH_HEIGHT] = {
+  {0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e},	/* 0 */
+  {0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e},
+  {0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f},
+  {0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e},
+  {0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02},
+  {0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e},
+  {0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e},
+  {0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08},
+  {0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e},
+  {0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c},	/* 9 */
+  {0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x0c},	/* . */
+  {0x00, 0x00, 0x0e, 0x01, 0x0f, 0x11, 0x0f},	/* a */
+  {0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x1e},
+  {0x00, 0x00, 0x0e, 0x10, 0x10, 0x11, 0x0e},
+  {0x01, 0x01, 0x0d, 0x13, 0x11, 0x11, 0x0f},
+  {0x00, 0x00, 0x0e, 0x11, 0x1f, 0x10, 0x0e},	/* e */
+  {0x04, 0x00, 0x0c, 0x04, 0x04, 0x04, 0x0e},	/* i */
+  {0x10, 0x10, 0x12, 0x14, 0x18, 0x14, 0x12},	/* k */
+  {0x0c, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0e},
+  {0x00, 0x00, 0x1a, 0x15, 0x15, 0x11, 0x11},
+  {0x00, 0x00, 0x16, 0x19, 0x11, 0x11, 0x11},	/* n */
+  {0x00, 0x00, 0x1e, 0x11, 0x1e, 0x10, 0x10},	/* p */
+  {0x00, 0x00, 0x16, 0x19, 0x10, 0x10, 0x10},
+  {0x00, 0x00, 0x0e, 0x10, 0x0e, 0x01, 0x1e},
+  {0x08, 0x08, 0x1c, 0x08, 0x08, 0x09, 0x06},	/* t */
+  {0x00, 0x00, 0x11, 0x11, 0x11, 0x13, 0x0d},
+  {0x00, 0x00, 0x11, 0x11, 0x11, 0x0a, 0x04},
+  {0x00, 0x00, 0x11, 0x11, 0x15, 0x15, 0x0a}	/* w */
+};
+
+int statsOverlay = 0;
+
+void DrawStatsOverlay(void);
+void DrawOverlayText(char *);
+
+/* queued last in the overlay pass, so everything else is drawn */
+void DrawStatsOverlay(void) {
+  char lines[OVERLAY_LINES][OVERLAY_LINE];
+  int i;
+
+  sprintf(lines[0], "%.1f ms  %d calls", lastFrame.seconds * 1000.0, lastFrame.calls);
+  sprintf(lines[1], "%d draws  %ldk verts", lastFrame.draws, (lastFrame.vertices + 500) / 1000);
+  sprintf(lines[2], "%d state  %d binds  %ldk up", lastFrame.state, lastFrame.binds,
+	  (lastFrame.uploaded + 512) / 1024);
+  sprintf(lines[3], "%d parts  %d culled", cullCount.partsVisible, cullCount.partsCulled);
+  sprintf(lines[4], "%d bubbles  %d culled", cullCount.bubblesVisible, cullCount.bubblesCulled);
+  sprintf(lines[5], "detail %d %d %d", meshesAtLevel[0] + pointsAtLevel[0],
+	  meshesAtLevel[1] + pointsAtLevel[1], meshesAtLevel[2] + pointsAtLevel[2]);
+
+  StateEnable(GL_LIGHTING, 0);
+  StateEnable(GL_DEPTH_TEST, 0);
+  glMatrixMode(GL_PROJECTION);
+  glPushMatrix();
+  glLoadIdentity();
+  glMatrixMode(GL_MODELVIEW);
+  glPushMatrix();
+  glLoadIdentity();
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glColor3f(1.0, 1.0, 0.0);
+
+  /* the top left corner, then moved down a line at a time in pixels */
+  glRasterPos2f(-0.97, 0.97);
+  for(i = 0; i < OVERLAY_LINES; i++) {
+    glBitmap(0, 0, 0, 0, 0, -LINE_SPACING, NULL);
+    DrawOverlayText(lines[i]);
+  }
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glPopMatrix();
+  glMatrixMode(GL_PROJECTION);
+  glPopMatrix();
+  glMatrixMode(GL_MODELVIEW);
+  StateEnable(GL_DEPTH_TEST, 1);
+  StateEnable(GL_LIGHTING, 1);
+}
+
+/* as one bitmap at the current raster position, which is left as it is */
+void DrawOverlayText(char *text) {
+  GLubyte bitmap[GLYPH_HEIGHT][OVERLAY_LINE * GLYPH_SPACING / 8 + 1];
+  int width = strlen(text) * GLYPH_SPACING, rowBytes = (width + 7) / 8;
+  int i, row, x, bit;
+  char *found;
+
+  memset(bitmap, 0, sizeof(bitmap));
+  for(i = 0; text[i]; i++) {
+    found = text[i] != ' ' ? strchr(glyphCharacters, text[i]) : NULL;
+    if(found == NULL) continue;
+    /* glBitmap wants the bottom row first, leftmost pixel in the top bit */
+    for(row = 0; row < GLYPH_HEIGHT; row++)
+      for(x = 0; x < GLYPH_WIDTH; x++) {
+	if(!(glyphs[found - glyphCharacters][row] >> (GLYPH_WIDTH - 1 - x) & 1)) continue;
+	bit = i * GLYPH_SPACING + x;
+	bitmap[GLYPH_HEIGHT - 1 - row][bit / 8] |= 0x80 >> (bit % 8);
+      }
+  }
+  /* rows packed to rowBytes */
+  for(row = 1; row < GLYPH_HEIGHT; row++)
+    memmove(bitmap[0] + row * rowBytes, bitmap[row], rowBytes);
+  glBitmap(width, GLYPH_HEIGHT, 0, 0, 0, 0, bitmap[0]);
+}
@@ -0,0 +1,310 @@
+/*************************************************************************
+ * Decoded textures and their mipmaps, block compressed when the driver *
+ * can take it, and kept on disk so later runs can skip decoding and    *
+ * compressing. Each source file gets one cache file, named from a      *
+ * hash of its path and checked against its size and modification time *
+ * before use. Cache files are mapped and the levels handed straight to *
+ * GL, so nothing is copied on the way                                  *
+ *************************************************************************/
+
+#include <sys/stat.h>
+#ifdef MAPPED_FILES
+#include <errno.h>
+#endif
+
+#define TEXTURE_CACHE_DIR ".texture-cache"
+#define TEXTURE_CACHE_MAGIC "SUBTEX2"
+#define TEXTURE_CACHE_ALIGN 64
+#define TEXTURE_CACHE_PATH 256
+#define MAX_MIP_LEVELS 16
+
+/* where LoadMipChain found the texture */
+#define TEXTURE_DECODED 1
+#define TEXTURE_FROM_CACHE 2
+
+/* levels down to 1x1, all in the same format */
+typedef struct {
+  int width, height;		/* of level 0 */
+  int format;			/* TEXTURE_RGBA, TEXTURE_BC1 or TEXTURE_BC3 */
+  int levels;
+  unsigned char *level[MAX_MIP_LEVELS];
+  unsigned char *block;		/* everything, either mapped or allocated */
+  long blockSize;
+  int mapped;
+} mipChain;
+
+/* the start of every cache file, levels follow at the offsets given */
+typedef struct {
+  char magic[8];
+  long sourceSize;
+  long sourceTime;
+  int width, height, format, levels;
+  long offset[MAX_MIP_LEVELS];
+  char source[TEXTURE_CACHE_PATH];
+} textureCacheHeader;
+
+int useTextureCache = 1;
+/* set before any loading starts, if the driver takes BC1 and BC3 */
+int compressTextures = 0;
+
+int LoadMipChain(char *, mipChain *);
+void BuildMipChain(image *, mipChain *);
+void CompressMipChain(mipChain *, int);
+void HalveLevel(unsigned char *, int, int, unsigned char *, int, int);
+long MipChainLayout(int, int, int, long, long[MAX_MIP_LEVELS]);
+int MipLevelWidth(mipChain *, int);
+int MipLevelHeight(mipChain *, int);
+long MipLevelSize(mipChain *, int);
+void FreeMipChain(mipChain *);
+int LoadCachedTexture(char *, mipChain *);
+void SaveCachedTexture(char *, mipChain *);
+void RemoveCachedTexture(char *);
+int SourceStamp(char *, long *, long *);
+void TextureCacheName(char *, char *);
+
+/* from the cache if it is up to date, otherwise decode the source and
+   cache the result. Returns 0 if the source can't be loaded. Safe to
+   call from any thread */
+int LoadMipChain(char *source, mipChain *m) {
+  image img;
+
+  if(LoadCachedTexture(source, m)) return TEXTURE_FROM_CACHE;
+  if(!open_image_file(source, &img)) return 0;
+  BuildMipChain(&img, m);
+  free_image(&img);
+  if(compressTextures)
+    CompressMipChain(m, ImageIsOpaque(m->level[0], m->width, m->height) ?
+		     TEXTURE_BC1 : TEXTURE_BC3);
+  SaveCachedTexture(source, m);
+  return TEXTURE_DECODED;
+}
+
+/* level 0 is a copy of the image, each level after is half the size */
+void BuildMipChain(image *img, mipChain *m) {
+  long offset[MAX_MIP_LEVELS];
+  int i, w, h;
+
+  m->width = img->width;
+  m->height = img->height;
+  m->format = TEXTURE_RGBA;
+  m->blockSize = MipChainLayout(img->width, img->height, TEXTURE_RGBA, 0, offset);
+  m->block = malloc(m->blockSize);
+  if(m->block == NULL) {
+    fprintf(stderr, "ERROR: Unable to allocate mipmaps for %d x %d texture\n",
+	    img->width, img->height);
+    exit(1);
+  }
+  m->mapped = 0;
+
+  w = img->width;
+  h = img->height;
+  m->levels = 0;
+  for(i = 0; i < MAX_MIP_LEVELS && offset[i] >= 0; i++) {
+    m->level[i] = m->block + offset[i];
+    if(i == 0) memcpy(m->level[0], img->pixels, (long) w * h * 4);
+    else {
+      HalveLevel(m->level[i-1], w, h, m->level[i], w > 1 ? w / 2 : 1, h > 1 ? h / 2 : 1);
+      if(w > 1) w /= 2;
+      if(h > 1) h /= 2;
+    }
+    m->levels++;
+  }
+}
+
+/* replaces the RGBA levels */
+void CompressMipChain(mipChain *m, int format) {
+  long offset[MAX_MIP_LEVELS];
+  unsigned char *block;
+  int i;
+
+  block = malloc(MipChainLayout(m->width, m->height, format, 0, offset));
+  if(block == NULL) {
+    fprintf(stderr, "ERROR: Unable to allocate compressed %d x %d texture\n",
+	    m->width, m->height);
+    exit(1);
+  }
+  for(i = 0; i < m->levels; i++) {
+    CompressImage(m->level[i], MipLevelWidth(m, i), MipLevelHeight(m, i), format,
+		  block + offset[i]);
+    m->level[i] = block + offset[i];
+  }
+  free(m->block);
+  m->block = block;
+  m->blockSize = MipChainLayout(m->width, m->height, format, 0, offset);
+  m->format = format;
+}
+
+/* average each 2x2 block, odd edges reuse the last row or column */
+void HalveLevel(unsigned char *in, int w, int h, unsigned char *out, int outW, int outH) {
+  unsigned char *a, *b, *c, *d;
+  int x, y, x1, y1, k;
+
+  for(y = 0; y < outH; y++) {
+    y1 = 2*y + 1 < h ? 2*y + 1 : h - 1;
+    for(x = 0; x < outW; x++) {
+      x1 = 2*x + 1 < w ? 2*x + 1 : w - 1;
+      a = in + ((long) 2*y * w + 2*x) * 4;
+      b = in + ((long) 2*y * w + x1) * 4;
+      c = in + ((long) y1 * w + 2*x) * 4;
+      d = in + ((long) y1 * w + x1) * 4;
+      for(k = 0; k < 4; k++) out[((long) y * outW + x) * 4 + k] = (a[k] + b[k] + c[k] + d[k] + 2) / 4;
+    }
+  }
+}
+
+/* where each level goes after start, aligned, returns the end. Unused
+   levels are -1 */
+long MipChainLayout(int w, int h, int format, long start, long offset[MAX_MIP_LEVELS]) {
+  long end = start;
+  int i;
+
+  for(i = 0; i < MAX_MIP_LEVELS; i++) offset[i] = -1;
+  for(i = 0; i < MAX_MIP_LEVELS; i++) {
+    end = (end + TEXTURE_CACHE_ALIGN - 1) / TEXTURE_CACHE_ALIGN * TEXTURE_CACHE_ALIGN;
+    offset[i] = end;
+    end += CompressedSize(w, h, format);
+    if(w == 1 && h == 1) break;
+    if(w > 1) w /= 2;
+    if(h > 1) h /= 2;
+  }
+  return end;
+}
+
+int MipLevelWidth(mipChain *m, int level) {
+  return m->width >> level ? m->width >> level : 1;
+}
+
+int MipLevelHeight(mipChain *m, int level) {
+  return m->height >> level ? m->height >> level : 1;
+}
+
+long MipLevelSize(mipChain *m, int level) {
+  return CompressedSize(MipLevelWidth(m, level), MipLevelHeight(m, level), m->format);
+}
+
+void FreeMipChain(mipChain *m) {
+  if(m->mapped) unmap_file(m->block, m->blockSize);
+  else free(m->block);
+  m->block = NULL;
+  m->levels = 0;
+}
+
+/* returns 0 if there is no cache file or it is out of date */
+int LoadCachedTexture(char *source, mipChain *m) {
+  char name[TEXTURE_CACHE_PATH + 32];
+  textureCacheHeader *header;
+  long offset[MAX_MIP_LEVELS];
+  long size, sourceSize, sourceTime;
+  unsigned char *data;
+  int i;
+
+  if(!useTextureCache || !SourceStamp(source, &sourceSize, &sourceTime)) return 0;
+  TextureCacheName(source, name);
+  data = map_file(name, &size);
+  if(data == NULL) return 0;
+
+  header = (textureCacheHeader *) data;
+  if(size < (long) sizeof(textureCacheHeader) ||
+     memcmp(header->magic, TEXTURE_CACHE_MAGIC, 8) != 0 ||
+     header->sourceSize != sourceSize || header->sourceTime != sourceTime ||
+     strncmp(header->source, source, TEXTURE_CACHE_PATH) != 0 ||
+     header->width < 1 || header->height < 1 || header->width > 65535 || header->height > 65535 ||
+     (compressTextures ? header->format != TEXTURE_BC1 && header->format != TEXTURE_BC3 :
+      header->format != TEXTURE_RGBA) ||
+     MipChainLayout(header->width, header->height, header->format,
+		    sizeof(textureCacheHeader), offset) > size) {
+    unmap_file(data, size);
+    return 0;
+  }
+
+  m->width = header->width;
+  m->height = header->height;
+  m->format = header->format;
+  m->levels = 0;
+  for(i = 0; i < MAX_MIP_LEVELS && offset[i] >= 0; i++) {
+    if(header->offset[i] != offset[i]) {
+      unmap_file(data, size);
+      return 0;
+    }
+    m->level[m->levels++] = data + offset[i];
+  }
+  m->block = data;
+  m->blockSize = size;
+  m->mapped = 1;
+  return 1;
+}
+
+/* written to a temporary file and renamed, so a half written cache file
+   is never seen. Failing to write just means no cache next time */
+void SaveCachedTexture(char *source, mipChain *m) {
+#ifdef MAPPED_FILES
+  char name[TEXTURE_CACHE_PATH + 32], temporary[TEXTURE_CACHE_PATH + 48];
+  textureCacheHeader header;
+  long offset[MAX_MIP_LEVELS], position, size;
+  char padding[TEXTURE_CACHE_ALIGN];
+  FILE *out;
+  int i, ok;
+
+  if(!useTextureCache || strlen(source) >= TEXTURE_CACHE_PATH) return;
+  memset(&header, 0, sizeof(header));
+  if(!SourceStamp(source, &header.sourceSize, &header.sourceTime)) return;
+  memcpy(header.magic, TEXTURE_CACHE_MAGIC, 8);
+  header.width = m->width;
+  header.height = m->height;
+  header.format = m->format;
+  header.levels = m->levels;
+  MipChainLayout(m->width, m->height, m->format, sizeof(textureCacheHeader), offset);
+  memcpy(header.offset, offset, sizeof(offset));
+  strcpy(header.source, source);
+
+  if(mkdir(TEXTURE_CACHE_DIR, 0755) != 0 && errno != EEXIST) return;
+  TextureCacheName(source, name);
+  sprintf(temporary, "%s.%ld", name, (long) getpid());
+  out = fopen(temporary, "wb");
+  if(out == NULL) {
+    fprintf(stderr, "WARNING: Unable to write texture cache %s\n", temporary);
+    return;
+  }
+
+  memset(padding, 0, sizeof(padding));
+  ok = fwrite(&header, sizeof(header), 1, out) == 1;
+  position = sizeof(header);
+  for(i = 0; ok && i < m->levels; i++) {
+    ok = fwrite(padding, 1, offset[i] - position, out) == (size_t) (offset[i] - position);
+    size = MipLevelSize(m, i);
+    ok = ok && fwrite(m->level[i], 1, size, out) == (size_t) size;
+    position = offset[i] + size;
+  }
+  if(fclose(out) != 0) ok = 0;
+  if(!ok || rename(temporary, name) != 0) {
+    fprintf(stderr, "WARNING: Unable to write texture cache %s\n", name);
+    remove(temporary);
+  }
+#endif
+}
+
+void RemoveCachedTexture(char *source) {
+  char name[TEXTURE_CACHE_PATH + 32];
+
+  TextureCacheName(source, name);
+  remove(name);
+}
+
+/* size and modification time of the source, 0 if it is missing */
+int SourceStamp(char *source, long *size, long *time) {
+  struct stat info;
+
+  if(stat(source, &info) != 0) return 0;
+  *size = (long) info.st_size;
+  *time = (long) info.st_mtime;
+  return 1;
+}
+
+/* FNV-1a of the path, the header holds the whole path to catch clashes */
+void TextureCacheName(char *source, char *name) {
+  unsigned long hash = 2166136261UL;
+  char *c;
+
+  for(c = source; *c; c++) hash = ((hash ^ (unsigned char) *c) * 16777619UL) & 0xffffffffUL;
+  sprintf(name, "%s/%08lx.tex", TEXTURE_CACHE_DIR, hash);
+}
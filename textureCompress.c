@@ -0,0 +1,180 @@
+/*************************************************************************
+ * BC1 and BC3 (DXT1 and DXT5) block compression of RGBA images. Each  *
+ * 4x4 block's colours are fitted to the corners of their bounding box, *
+ * pulled in a little, which is quick and looks fine on these textures. *
+ * BC1 is 8 bytes a block and only for opaque images, BC3 adds 8 bytes *
+ * of alpha                                                              *
+ *************************************************************************/
+
+#define TEXTURE_RGBA 0
+#define TEXTURE_BC1 1
+#define TEXTURE_BC3 2
+
+char *textureFormatNames[] = {"RGBA", "BC1", "BC3"};
+
+long CompressedSize(int, int, int);
+int ImageIsOpaque(unsigned char *, int, int);
+void CompressImage(unsigned char *, int, int, int, unsigned char *);
+void FetchBlock(unsigned char *, int, int, int, int, unsigned char[64]);
+void EncodeColorBlock(unsigned char[64], unsigned char *);
+void EncodeAlphaBlock(unsigned char[64], unsigned char *);
+int PackColor(int, int, int);
+void UnpackColor(int, int[3]);
+
+/* bytes for a w x h image in format */
+long CompressedSize(int w, int h, int format) {
+  long blocks = (long) ((w + 3) / 4) * ((h + 3) / 4);
+
+  if(format == TEXTURE_BC1) return blocks * 8;
+  if(format == TEXTURE_BC3) return blocks * 16;
+  return (long) w * h * 4;
+}
+
+int ImageIsOpaque(unsigned char *rgba, int w, int h) {
+  long i, n = (long) w * h;
+
+  for(i = 0; i < n; i++) if(rgba[4*i+3] != 255) return 0;
+  return 1;
+}
+
+void CompressImage(unsigned char *rgba, int w, int h, int format, unsigned char *out) {
+  unsigned char block[64];
+  int x, y;
+
+  for(y = 0; y < h; y += 4) {
+    for(x = 0; x < w; x += 4) {
+      FetchBlock(rgba, w, h, x, y, block);
+      if(format == TEXTURE_BC3) {
+	EncodeAlphaBlock(block, out);
+	out += 8;
+      }
+      EncodeColorBlock(block, out);
+      out += 8;
+    }
+  }
+}
+
+/* 4x4 texels from x, y, repeating the last row and column of images
+   smaller than a block */
+void FetchBlock(unsigned char *rgba, int w, int h, int x, int y, unsigned char block[64]) {
+  int i, j, u, v;
+
+  for(j = 0; j < 4; j++) {
+    v = y + j < h ? y + j : h - 1;
+    for(i = 0; i < 4; i++) {
+      u = x + i < w ? x + i : w - 1;
+      memcpy(block + 4 * (4*j + i), rgba + 4 * ((long) v * w + u), 4);
+    }
+  }
+}
+
+void EncodeColorBlock(unsigned char block[64], unsigned char *out) {
+  int low[3] = {255, 255, 255}, high[3] = {0, 0, 0};
+  int palette[4][3];
+  int color0, color1, inset, best, distance, bestDistance, d;
+  unsigned long indices = 0;
+  int i, k, p;
+
+  /* bounding box, pulled in by a sixteenth to allow for rounding */
+  for(i = 0; i < 16; i++) {
+    for(k = 0; k < 3; k++) {
+      if(block[4*i+k] < low[k]) low[k] = block[4*i+k];
+      if(block[4*i+k] > high[k]) high[k] = block[4*i+k];
+    }
+  }
+  for(k = 0; k < 3; k++) {
+    inset = (high[k] - low[k]) >> 4;
+    low[k] += inset;
+    high[k] -= inset;
+  }
+
+  /* color0 > color1 picks the four colour mode */
+  color0 = PackColor(high[0], high[1], high[2]);
+  color1 = PackColor(low[0], low[1], low[2]);
+  if(color0 < color1) {
+    p = color0;
+    color0 = color1;
+    color1 = p;
+  }
+
+  if(color0 != color1) {
+    UnpackColor(color0, palette[0]);
+    UnpackColor(color1, palette[1]);
+    for(k = 0; k < 3; k++) {
+      palette[2][k] = (2 * palette[0][k] + palette[1][k]) / 3;
+      palette[3][k] = (palette[0][k] + 2 * palette[1][k]) / 3;
+    }
+    for(i = 0; i < 16; i++) {
+      best = 0;
+      bestDistance = 1 << 30;
+      for(p = 0; p < 4; p++) {
+	for(distance = 0, k = 0; k < 3; k++) {
+	  d = block[4*i+k] - palette[p][k];
+	  distance += d * d;
+	}
+	if(distance < bestDistance) {
+	  bestDistance = distance;
+	  best = p;
+	}
+      }
+      indices |= (unsigned long) best << (2*i);
+    }
+  }
+
+  /* all little endian */
+  out[0] = color0 & 0xff;
+  out[1] = color0 >> 8;
+  out[2] = color1 & 0xff;
+  out[3] = color1 >> 8;
+  for(i = 0; i < 4; i++) out[4+i] = (indices >> (8*i)) & 0xff;
+}
+
+void EncodeAlphaBlock(unsigned char block[64], unsigned char *out) {
+  int alpha0 = 0, alpha1 = 255, palette[8];
+  int best, distance, bestDistance;
+  unsigned long bits[2] = {0, 0};
+  int i, p, bit;
+
+  for(i = 0; i < 16; i++) {
+    if(block[4*i+3] > alpha0) alpha0 = block[4*i+3];
+    if(block[4*i+3] < alpha1) alpha1 = block[4*i+3];
+  }
+
+  /* alpha0 > alpha1 picks the eight alpha mode */
+  palette[0] = alpha0;
+  palette[1] = alpha1;
+  for(p = 1; p < 7; p++) palette[p+1] = ((7 - p) * alpha0 + p * alpha1) / 7;
+
+  for(i = 0; i < 16 && alpha0 != alpha1; i++) {
+    best = 0;
+    bestDistance = 256;
+    for(p = 0; p < 8; p++) {
+      distance = abs(block[4*i+3] - palette[p]);
+      if(distance < bestDistance) {
+	bestDistance = distance;
+	best = p;
+      }
+    }
+    /* 48 bits of indices, kept as two 24 bit halves */
+    bit = 3*i;
+    bits[bit / 24] |= (unsigned long) best << (bit % 24);
+  }
+
+  out[0] = alpha0;
+  out[1] = alpha1;
+  for(i = 0; i < 3; i++) {
+    out[2+i] = (bits[0] >> (8*i)) & 0xff;
+    out[5+i] = (bits[1] >> (8*i)) & 0xff;
+  }
+}
+
+/* to and from 5:6:5 */
+int PackColor(int r, int g, int b) {
+  return ((r * 31 + 127) / 255) << 11 | ((g * 63 + 127) / 255) << 5 | (b * 31 + 127) / 255;
+}
+
+void UnpackColor(int c, int rgb[3]) {
+  rgb[0] = (c >> 11) * 255 / 31;
+  rgb[1] = ((c >> 5) & 63) * 255 / 63;
+  rgb[2] = (c & 31) * 255 / 31;
+}
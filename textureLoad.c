@@ -1,111 +1,123 @@
 /*************************************************************************
- * The functions for reading in 256 X 256 X 3 RLE encoded SGI RGB files  *
+ * The functions for reading in SGI RGB files, RLE encoded or verbatim,  *
+ * of any size with 1 to 4 channels. The file is mapped into memory and  *
+ * every offset checked against its size before anything is decoded.    *
+ * Images always come out as RGBA                                        *
  *************************************************************************/
 
-void open_image_file(char *, unsigned char [256][256][4]);
-void decode_texel_line(unsigned char *, unsigned char [256][256][4], int, int);
-
-void open_image_file(char *fileName, unsigned char out_bytes[256][256][4]){
-  FILE *inFile;
-  int i, j, sum;
-  int out_pos, in_pos;
-  unsigned char tmp, count;
-
-  short imagic;
-  char storage;
-  char bpc;
-  unsigned short dim;
-  unsigned short sizeX, sizeY, sizeZ;
-
-  unsigned char in_bytes[1024];
-  int offset_table[768][2];
-
-  /* open file and read type details out of header */
-  inFile = fopen(fileName, "rb");
-  if(inFile==NULL){
+#ifndef WIN32
+#define MAPPED_FILES
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define SGI_HEADER_SIZE 512
+
+typedef struct {
+  int width, height;
+  int channels;			/* in the file, pixels are always RGBA */
+  unsigned char *pixels;
+} image;
+
+int open_image_file(char *, image *);
+int decode_image(unsigned char *, long, image *);
+int decode_texel_line(unsigned char *, long, unsigned char *, int);
+void interleave_texel_line(unsigned char *, int, int, unsigned char *);
+void free_image(image *);
+unsigned char *map_file(char *, long *);
+void unmap_file(unsigned char *, long);
+unsigned long read_long(unsigned char *);
+
+/* returns 0 if the file is missing or not a usable SGI image */
+int open_image_file(char *fileName, image *img){
+  unsigned char *data;
+  long size;
+  int ok;
+
+  data = map_file(fileName, &size);
+  if(data == NULL){
     fprintf(stdout, "Can not open file %s\n", fileName);
-    exit(1);
-  }
-  fread(in_bytes, 1, 12, inFile);
-
-  /* convert type details */
-  imagic = (in_bytes[0]<<8) + in_bytes[1];
-  storage = in_bytes[2];
-  bpc = in_bytes[3];
-  dim = (in_bytes[4]<<8) + in_bytes[5];
-  sizeX = (in_bytes[6]<<8) + in_bytes[7];
-  sizeY = (in_bytes[8]<<8) + in_bytes[9];
-  sizeZ = (in_bytes[10]<<8) + in_bytes[11];
-
-  /* test for correct file type */
-
-  if(imagic!=474){
-    printf("Bad SGI magic number: %d\n", imagic);
-    exit(0);
-  }
-
-  if(storage!=1){
-    printf("Storage is not run length encoded.\n");
-    exit(0);
-  }
-
-  if(bpc!=1){
-    printf("Bad number of bytes per pixel: %d\n", bpc);
-    exit(0);
+    return 0;
   }
+  ok = decode_image(data, size, img);
+  unmap_file(data, size);
+  if(!ok) fprintf(stderr, "WARNING: Unable to decode %s\n", fileName);
+  return ok;
+}
 
-  if(dim!=3){
-    printf("Bad dimension: %d\n", dim);
-    exit(0);
+int decode_image(unsigned char *data, long size, image *img){
+  int storage, bpc, dim;
+  int sizeX, sizeY, sizeZ;
+  int y, z;
+  unsigned long start, length;
+  unsigned char *tables, *planes;
+
+  if(size < SGI_HEADER_SIZE) return 0;
+
+  /* check the header */
+  storage = data[2];
+  bpc = data[3];
+  dim = (data[4]<<8) + data[5];
+  sizeX = (data[6]<<8) + data[7];
+  sizeY = (data[8]<<8) + data[9];
+  sizeZ = (data[10]<<8) + data[11];
+  if(dim < 3) sizeZ = 1;
+  if(dim < 2) sizeY = 1;
+
+  if((data[0]<<8) + data[1] != 474){
+    fprintf(stderr, "WARNING: Bad SGI magic number: %d\n", (data[0]<<8) + data[1]);
+    return 0;
   }
-
-  if(sizeX!=256 || sizeY!=256 || sizeZ!=3){
-    printf("Bad file size: X is %d, Y is %d, Z is %d\n\n", sizeX, sizeY, sizeZ);
-    exit(0);
+  if(storage > 1 || bpc != 1 || dim < 1 || dim > 3){
+    fprintf(stderr, "WARNING: Unsupported SGI format: storage %d, %d bytes per channel, "
+	    "%d dimensions\n", storage, bpc, dim);
+    return 0;
   }
-
-  /* skip remains of header and move to start of offset table */
-  fseek(inFile, 512, SEEK_SET);
-
-  /**************************************
-   * read the table of offsets to lines *
-   **************************************/
-  for(i=0; i<768; i++){
-    fread(in_bytes, 1, 4, inFile);
-    offset_table[i][0] =  (in_bytes[0]<<24) + (in_bytes[1]<<16) + (in_bytes[2]<<8) + in_bytes[3];
+  if(sizeX == 0 || sizeY == 0 || sizeZ < 1 || sizeZ > 4){
+    fprintf(stderr, "WARNING: Bad SGI size: X is %d, Y is %d, Z is %d\n", sizeX, sizeY, sizeZ);
+    return 0;
   }
 
-  for(i=0; i<768; i++){
-    fread(in_bytes, 1, 4, inFile);
-    offset_table[i][1] =  (in_bytes[0]<<24) + (in_bytes[1]<<16) + (in_bytes[2]<<8) + in_bytes[3];
+  /* verbatim files are planes of whole lines after the header */
+  if(storage == 0 && size < SGI_HEADER_SIZE + (long) sizeX * sizeY * sizeZ) return 0;
+  /* RLE files have a start and a length for every line of every channel */
+  tables = data + SGI_HEADER_SIZE;
+  if(storage == 1 && size < SGI_HEADER_SIZE + 8L * sizeY * sizeZ) return 0;
+
+  img->width = sizeX;
+  img->height = sizeY;
+  img->channels = sizeZ;
+  img->pixels = malloc((size_t) sizeX * sizeY * 4);
+  planes = malloc((size_t) sizeX * sizeZ);
+  if(img->pixels == NULL || planes == NULL){
+    fprintf(stderr, "ERROR: Unable to allocate %d x %d image\n", sizeX, sizeY);
+    exit(1);
   }
 
-  /* loop for each line */
-  for(i=0; i<256; i++){
-    /* find the red line */
-    fseek(inFile,  offset_table[i][0], SEEK_SET);
-
-    /* read the red line */
-    fread(in_bytes, 1, offset_table[i][1], inFile);
-
-    /* decode the red line */
-    decode_texel_line(in_bytes, out_bytes, i, 0);
-
-    /* repeat for blue and green */
-    fseek(inFile,  offset_table[i+256][0], SEEK_SET);
-    fread(in_bytes, 1, offset_table[i+256][1], inFile);
-    decode_texel_line(in_bytes, out_bytes, i, 1);
-
-    fseek(inFile,  offset_table[i+512][0], SEEK_SET);
-    fread(in_bytes, 1, offset_table[i+512][1], inFile);
-    decode_texel_line(in_bytes, out_bytes, i, 2);
-
-    /* set alpha to one */
-    for(j=0; j<256; j++)
-      out_bytes[i][j][3] = 255;
+  /* a line of every channel, then merge them into RGBA */
+  for(y=0; y<sizeY; y++){
+    for(z=0; z<sizeZ; z++){
+      if(storage == 0){
+	memcpy(planes + z*sizeX, data + SGI_HEADER_SIZE + ((long) z*sizeY + y) * sizeX, sizeX);
+	continue;
+      }
+      start = read_long(tables + 4L * (z*sizeY + y));
+      length = read_long(tables + 4L * (sizeY*sizeZ + z*sizeY + y));
+      if(start > (unsigned long) size || length > (unsigned long) size - start ||
+	 !decode_texel_line(data + start, (long) length, planes + z*sizeX, sizeX)){
+	fprintf(stderr, "WARNING: Bad SGI line %d of channel %d\n", y, z);
+	free(planes);
+	free_image(img);
+	return 0;
+      }
+    }
+    interleave_texel_line(planes, sizeX, sizeZ, img->pixels + (long) y*sizeX*4);
   }
 
-  return;
+  free(planes);
+  return 1;
 }
 
 /****************************************************
@@ -114,29 +126,112 @@ void open_image_file(char *fileName, unsigned char out_bytes[256][256][4]){
  * ELSE the next 7 bits specify the number of times *
  * the next byte must be repeated                   *
  * loop ends when 7 bits are zero                   *
+ * Returns 0 if the runs don't fit either buffer    *
  ****************************************************/
-void decode_texel_line(unsigned char in_bytes[], unsigned char out_bytes[256][256][4], int line, int colour){
-  int j;
-  int out_pos=0;
-  int in_pos=1;
-  unsigned char tmp = in_bytes[0] & 0x80;
-  unsigned char count = in_bytes[0] & 0x7f;
-
-  while(count){
-    if(tmp){
-      for(j=0; j<count; j++)
-        out_bytes[line][out_pos+j][colour] = in_bytes[in_pos+j];
-      out_pos += count;
-      in_pos  += count;
+int decode_texel_line(unsigned char *in_bytes, long in_length, unsigned char *out_bytes,
+		      int width){
+  long in_pos = 0;
+  int out_pos = 0;
+  int count;
+
+  while(in_pos < in_length){
+    count = in_bytes[in_pos] & 0x7f;
+    if(count == 0) return out_pos == width;
+    if(out_pos + count > width) return 0;
+
+    if(in_bytes[in_pos++] & 0x80){
+      if(in_pos + count > in_length) return 0;
+      memcpy(out_bytes + out_pos, in_bytes + in_pos, count);
+      in_pos += count;
     }else{
-      for(j=0; j<count; j++)
-        out_bytes[line][out_pos+j][colour] = in_bytes[in_pos];
-      out_pos += count;
-      in_pos++;
+      if(in_pos >= in_length) return 0;
+      memset(out_bytes + out_pos, in_bytes[in_pos++], count);
     }
-    count = in_bytes[in_pos] & 0x7f;
-    tmp = in_bytes[in_pos] & 0x80;
-    in_pos++;
+    out_pos += count;
+  }
+  /* some writers leave out the final zero */
+  return out_pos == width;
+}
+
+/* channel lines to RGBA, grey is copied to red, green and blue and alpha
+   is opaque unless there is a fourth (or second) channel */
+void interleave_texel_line(unsigned char *planes, int width, int channels,
+			   unsigned char *out_bytes){
+  unsigned char *r = planes;
+  unsigned char *g = channels >= 3 ? planes + width : planes;
+  unsigned char *b = channels >= 3 ? planes + 2*width : planes;
+  unsigned char *a = channels == 4 ? planes + 3*width : channels == 2 ? planes + width : NULL;
+  int j;
+
+  if(a == NULL){
+    for(j=0; j<width; j++){
+      out_bytes[4*j] = r[j];
+      out_bytes[4*j+1] = g[j];
+      out_bytes[4*j+2] = b[j];
+      out_bytes[4*j+3] = 255;
+    }
+  }else{
+    for(j=0; j<width; j++){
+      out_bytes[4*j] = r[j];
+      out_bytes[4*j+1] = g[j];
+      out_bytes[4*j+2] = b[j];
+      out_bytes[4*j+3] = a[j];
+    }
+  }
+}
+
+void free_image(image *img){
+  free(img->pixels);
+  img->pixels = NULL;
+}
+
+/* the whole file, read only. Without mmap it is read into memory */
+unsigned char *map_file(char *fileName, long *size){
+#ifdef MAPPED_FILES
+  struct stat info;
+  void *data;
+  int file;
+
+  file = open(fileName, O_RDONLY);
+  if(file < 0) return NULL;
+  if(fstat(file, &info) != 0 || info.st_size == 0){
+    close(file);
+    return NULL;
+  }
+  data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+  close(file);
+  if(data == MAP_FAILED) return NULL;
+  *size = (long) info.st_size;
+  return data;
+#else
+  FILE *inFile;
+  unsigned char *data;
+
+  inFile = fopen(fileName, "rb");
+  if(inFile == NULL) return NULL;
+  fseek(inFile, 0, SEEK_END);
+  *size = ftell(inFile);
+  fseek(inFile, 0, SEEK_SET);
+  data = *size > 0 ? malloc(*size) : NULL;
+  if(data != NULL && fread(data, 1, *size, inFile) != (size_t) *size){
+    free(data);
+    data = NULL;
   }
-  return;
+  fclose(inFile);
+  return data;
+#endif
+}
+
+void unmap_file(unsigned char *data, long size){
+#ifdef MAPPED_FILES
+  munmap(data, size);
+#else
+  free(data);
+#endif
+}
+
+/* big endian */
+unsigned long read_long(unsigned char *bytes){
+  return ((unsigned long) bytes[0]<<24) + ((unsigned long) bytes[1]<<16) +
+    ((unsigned long) bytes[2]<<8) + bytes[3];
 }
@@ -0,0 +1,281 @@
+/*************************************************************************
+ * Textures loaded in the background. Each texture starts as a plain    *
+ * placeholder while loader threads fetch it from the cache or decode   *
+ * it, then the render thread uploads the finished mipmaps a few at a   *
+ * time through a ring of pixel buffer objects, so it never waits on    *
+ * the disk or for GL to copy from client memory                         *
+ *************************************************************************/
+
+#define MAX_TEXTURE_JOBS 32
+#define TEXTURE_LOADERS 2
+#define TEXTURE_PBO_COUNT 3
+
+#define TEXTURE_WAITING 0
+#define TEXTURE_LOADING 1
+#define TEXTURE_READY 2
+#define TEXTURE_DONE 3
+
+typedef struct {
+  char *source;
+  GLuint name;
+  int state;
+  int result;			/* from LoadMipChain */
+  mipChain mips;
+} textureJob;
+
+/* what each texture ended up as, for the memory report */
+typedef struct {
+  char *source;
+  int width, height, format, levels;
+  long bytes;
+  long rgbaBytes;		/* as plain RGBA mipmaps */
+} textureStats;
+
+textureJob textureJobs[MAX_TEXTURE_JOBS];
+int textureJobCount = 0;
+int nextTextureJob = 0;		/* next one for a loader to take */
+int texturesPending = 0;	/* queued but not yet uploaded */
+int texturesCached = 0;		/* since the last reset, for reporting */
+int texturesDecoded = 0;
+
+textureStats uploadedTextures[MAX_TEXTURE_JOBS];
+int uploadedTextureCount = 0;
+
+GLuint texturePixelBuffers[TEXTURE_PBO_COUNT];
+int nextTexturePixelBuffer = 0;
+
+#ifdef THREADS
+pthread_mutex_t textureLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t textureLoaded = PTHREAD_COND_INITIALIZER;
+#endif
+
+void QueueTexture(char *, GLuint);
+void StartTextureLoading(void);
+int UploadLoadedTextures(int);
+void FinishTextureLoading(void);
+void LoadTextureJobs(void);
+void UploadTexture(textureJob *);
+void RecordTexture(textureJob *);
+void ReportTextures(void);
+#ifdef THREADS
+void *TextureLoader(void *);
+#endif
+
+/* call once the placeholder for name is in place */
+void QueueTexture(char *source, GLuint name) {
+  textureJob *job;
+
+#ifdef THREADS
+  pthread_mutex_lock(&textureLock);
+#endif
+  if(textureJobCount == 0) uploadedTextureCount = 0;
+  if(textureJobCount < MAX_TEXTURE_JOBS) {
+    job = &textureJobs[textureJobCount++];
+    job->source = source;
+    job->name = name;
+    job->state = TEXTURE_WAITING;
+    texturesPending++;
+  }
+  else fprintf(stderr, "WARNING: Too many textures, %s left as a placeholder\n", source);
+#ifdef THREADS
+  pthread_mutex_unlock(&textureLock);
+#endif
+}
+
+/* load everything queued so far in the background */
+void StartTextureLoading(void) {
+#ifdef THREADS
+  pthread_t loader;
+  int i;
+
+  for(i = 0; i < TEXTURE_LOADERS && i < textureJobCount - nextTextureJob; i++) {
+    if(pthread_create(&loader, NULL, TextureLoader, NULL) != 0) break;
+    pthread_detach(loader);
+  }
+  if(i > 0) return;
+#endif
+  /* no threads, load them now and upload them as usual */
+  LoadTextureJobs();
+}
+
+/* upload up to max finished textures, returns how many are still to come */
+int UploadLoadedTextures(int max) {
+  int i, pending;
+
+#ifdef THREADS
+  pthread_mutex_lock(&textureLock);
+#endif
+  for(i = 0; i < textureJobCount && max > 0; i++) {
+    if(textureJobs[i].state != TEXTURE_READY) continue;
+    /* the loaders are done with it */
+#ifdef THREADS
+    pthread_mutex_unlock(&textureLock);
+#endif
+    UploadTexture(&textureJobs[i]);
+#ifdef THREADS
+    pthread_mutex_lock(&textureLock);
+#endif
+    textureJobs[i].state = TEXTURE_DONE;
+    texturesPending--;
+    max--;
+  }
+  pending = texturesPending;
+  /* start again with the next lot queued */
+  if(pending == 0) textureJobCount = nextTextureJob = 0;
+#ifdef THREADS
+  pthread_mutex_unlock(&textureLock);
+#endif
+  return pending;
+}
+
+/* wait for and upload everything queued */
+void FinishTextureLoading(void) {
+  int i, ready;
+
+  while(UploadLoadedTextures(MAX_TEXTURE_JOBS) > 0) {
+#ifdef THREADS
+    /* sleep until a loader finishes something */
+    pthread_mutex_lock(&textureLock);
+    for(;;) {
+      for(ready = 0, i = 0; i < textureJobCount; i++)
+	ready |= textureJobs[i].state == TEXTURE_READY;
+      if(ready || texturesPending == 0) break;
+      pthread_cond_wait(&textureLoaded, &textureLock);
+    }
+    pthread_mutex_unlock(&textureLock);
+#endif
+  }
+}
+
+/* take jobs until there are none left */
+void LoadTextureJobs(void) {
+  textureJob *job;
+  int result;
+
+  for(;;) {
+#ifdef THREADS
+    pthread_mutex_lock(&textureLock);
+#endif
+    job = nextTextureJob < textureJobCount ? &textureJobs[nextTextureJob++] : NULL;
+    if(job != NULL) job->state = TEXTURE_LOADING;
+#ifdef THREADS
+    pthread_mutex_unlock(&textureLock);
+#endif
+    if(job == NULL) return;
+
+    PROFILE_BEGIN("LoadMipChain");
+    result = LoadMipChain(job->source, &job->mips);
+    PROFILE_END();
+
+#ifdef THREADS
+    pthread_mutex_lock(&textureLock);
+#endif
+    job->result = result;
+    job->state = TEXTURE_READY;
+    if(result == TEXTURE_FROM_CACHE) texturesCached++;
+    if(result == TEXTURE_DECODED) texturesDecoded++;
+#ifdef THREADS
+    pthread_cond_signal(&textureLoaded);
+    pthread_mutex_unlock(&textureLock);
+#endif
+  }
+}
+
+#ifdef THREADS
+void *TextureLoader(void *unused) {
+  PROFILE_THREAD("texture loader", -1);
+  LoadTextureJobs();
+  return NULL;
+}
+#endif
+
+/* replace the placeholder with the real thing, a missing texture keeps
+   its placeholder */
+void UploadTexture(textureJob *job) {
+  GLenum formats[] = {GL_RGBA, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT};
+  unsigned char *data;
+  long size, offset;
+  int level;
+
+  if(job->result == 0) return;
+  RecordTexture(job);
+
+  StateBindTexture(job->name);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+  data = NULL;
+  if(havePixelBuffers) {
+    if(texturePixelBuffers[0] == 0) glGenBuffers(TEXTURE_PBO_COUNT, texturePixelBuffers);
+    for(size = 0, level = 0; level < job->mips.levels; level++)
+      size += MipLevelSize(&job->mips, level);
+
+    /* the next buffer in the ring, orphaned so GL can still be reading
+       the last thing uploaded from it */
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, texturePixelBuffers[nextTexturePixelBuffer]);
+    nextTexturePixelBuffer = (nextTexturePixelBuffer + 1) % TEXTURE_PBO_COUNT;
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+    data = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+    if(data != NULL) {
+      for(offset = 0, level = 0; level < job->mips.levels; level++) {
+	memcpy(data + offset, job->mips.level[level], MipLevelSize(&job->mips, level));
+	offset += MipLevelSize(&job->mips, level);
+      }
+      if(!glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER)) data = NULL;
+    }
+    /* fall back to uploading from the mipmaps themselves */
+    if(data == NULL) glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  }
+
+  for(offset = 0, level = 0; level < job->mips.levels; level++) {
+    if(job->mips.format == TEXTURE_RGBA)
+      glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA,
+		   MipLevelWidth(&job->mips, level), MipLevelHeight(&job->mips, level), 0,
+		   GL_RGBA, GL_UNSIGNED_BYTE,
+		   data != NULL ? (GLvoid *) offset : (GLvoid *) job->mips.level[level]);
+    else
+      glCompressedTexImage2D(GL_TEXTURE_2D, level, formats[job->mips.format],
+			     MipLevelWidth(&job->mips, level), MipLevelHeight(&job->mips, level),
+			     0, MipLevelSize(&job->mips, level),
+			     data != NULL ? (GLvoid *) offset : (GLvoid *) job->mips.level[level]);
+    offset += MipLevelSize(&job->mips, level);
+  }
+  if(data != NULL) glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  FreeMipChain(&job->mips);
+}
+
+void RecordTexture(textureJob *job) {
+  textureStats *t = &uploadedTextures[uploadedTextureCount++];
+  int level;
+
+  t->source = job->source;
+  t->width = job->mips.width;
+  t->height = job->mips.height;
+  t->format = job->mips.format;
+  t->levels = job->mips.levels;
+  /* the levels alone, without the cache's padding between them */
+  for(t->bytes = t->rgbaBytes = 0, level = 0; level < job->mips.levels; level++) {
+    t->bytes += MipLevelSize(&job->mips, level);
+    t->rgbaBytes += CompressedSize(MipLevelWidth(&job->mips, level),
+				   MipLevelHeight(&job->mips, level), TEXTURE_RGBA);
+  }
+}
+
+/* texture memory used, against plain RGBA */
+void ReportTextures(void) {
+  textureStats *t;
+  long bytes = 0, rgbaBytes = 0;
+  int i;
+
+  printf("%-12s %9s %6s %6s %10s %10s %6s\n",
+	 "texture", "size", "format", "levels", "bytes", "as RGBA", "saved");
+  for(i = 0; i < uploadedTextureCount; i++) {
+    t = &uploadedTextures[i];
+    printf("%-12s %4dx%-4d %6s %6d %10ld %10ld %5.0f%%\n", t->source, t->width, t->height,
+	   textureFormatNames[t->format], t->levels, t->bytes, t->rgbaBytes,
+	   100.0 - 100.0 * t->bytes / t->rgbaBytes);
+    bytes += t->bytes;
+    rgbaBytes += t->rgbaBytes;
+  }
+  if(rgbaBytes > 0)
+    printf("%-12s %9s %6s %6s %10ld %10ld %5.0f%%\n", "total", "", "", "",
+	   bytes, rgbaBytes, 100.0 - 100.0 * bytes / rgbaBytes);
+}
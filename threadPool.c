@@ -0,0 +1,251 @@
+/*************************************************************************
+ * Worker threads for the simulation. ParallelFor() splits a range into  *
+ * chunks, deals each worker a run of them and lets workers that finish  *
+ * early steal from the far end of the others' queues. There is also a  *
+ * single background thread for running a whole task off the GLUT       *
+ * thread. Without pthreads everything just runs on the calling thread  *
+ *************************************************************************/
+
+#ifndef WIN32
+#define THREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+typedef void (*chunkFunction)(void *, int, int);
+
+#define MAX_THREADS 64
+
+int poolSize = 1;		/* threads including the caller */
+int activeThreads = 1;		/* how many of them ParallelFor uses */
+
+#ifdef THREADS
+typedef struct {
+  pthread_mutex_t lock;
+  int top, bottom;		/* chunks top to bottom-1 are left */
+} chunkQueue;
+
+pthread_t workers[MAX_THREADS];
+chunkQueue queues[MAX_THREADS];
+pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t workReady = PTHREAD_COND_INITIALIZER;
+pthread_cond_t workDone = PTHREAD_COND_INITIALIZER;
+int generation = 0;
+int chunksLeft = 0;
+int busyWorkers = 0;
+
+/* the current job */
+chunkFunction jobFunction;
+void *jobData;
+int jobCount, jobGrain;
+
+/* background task */
+pthread_t backgroundThread;
+pthread_mutex_t backgroundLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t backgroundReady = PTHREAD_COND_INITIALIZER;
+void (*backgroundTask)(void) = NULL;
+int backgroundBusy = 0;
+#endif
+
+void InitThreadPool(int);
+int ProcessorCount(void);
+void SetActiveThreads(int);
+void ParallelFor(chunkFunction, void *, int, int);
+void StartBackground(void (*)(void));
+int BackgroundBusy(void);
+#ifdef THREADS
+void *Worker(void *);
+void *BackgroundWorker(void *);
+void RunChunks(int);
+int TakeChunk(int, int);
+#endif
+
+/* threads <= 0 means one per processor */
+void InitThreadPool(int threads) {
+#ifdef THREADS
+  int i;
+
+  if(threads <= 0) threads = ProcessorCount();
+  if(threads > MAX_THREADS) threads = MAX_THREADS;
+  poolSize = activeThreads = threads;
+
+  for(i = 0; i < poolSize; i++) pthread_mutex_init(&queues[i].lock, NULL);
+  /* the calling thread is worker 0 */
+  for(i = 1; i < poolSize; i++) {
+    if(pthread_create(&workers[i], NULL, Worker, (void *) &queues[i]) != 0) {
+      fprintf(stderr, "WARNING: Unable to start worker thread, using %d\n", i);
+      poolSize = activeThreads = i;
+      break;
+    }
+  }
+  if(pthread_create(&backgroundThread, NULL, BackgroundWorker, NULL) != 0) {
+    fprintf(stderr, "ERROR: Unable to start the simulation thread\n");
+    exit(1);
+  }
+#endif
+}
+
+int ProcessorCount(void) {
+#ifdef _SC_NPROCESSORS_ONLN
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+  if(n > 0) return (int) n;
+#endif
+  return 1;
+}
+
+/* use fewer than all the threads, for measuring how things scale */
+void SetActiveThreads(int threads) {
+  if(threads < 1) threads = 1;
+  if(threads > poolSize) threads = poolSize;
+  activeThreads = threads;
+}
+
+/* call function(data, begin, end) over 0 to count-1 in pieces of grain,
+   returns once every piece is done */
+void ParallelFor(chunkFunction function, void *data, int count, int grain) {
+#ifdef THREADS
+  int chunks, i;
+
+  if(grain < 1) grain = 1;
+  chunks = (count + grain - 1) / grain;
+  if(activeThreads == 1 || chunks < 2) {
+    if(count > 0) function(data, 0, count);
+    return;
+  }
+
+  pthread_mutex_lock(&poolLock);
+  jobFunction = function;
+  jobData = data;
+  jobCount = count;
+  jobGrain = grain;
+  /* deal each worker a run of neighbouring chunks */
+  for(i = 0; i < activeThreads; i++) {
+    pthread_mutex_lock(&queues[i].lock);
+    queues[i].top = (int) ((long) chunks * i / activeThreads);
+    queues[i].bottom = (int) ((long) chunks * (i + 1) / activeThreads);
+    pthread_mutex_unlock(&queues[i].lock);
+  }
+  chunksLeft = chunks;
+  generation++;
+  pthread_cond_broadcast(&workReady);
+  pthread_mutex_unlock(&poolLock);
+
+  RunChunks(0);
+
+  /* wait for the other workers to finish and leave the queues alone */
+  pthread_mutex_lock(&poolLock);
+  while(chunksLeft > 0 || busyWorkers > 0) pthread_cond_wait(&workDone, &poolLock);
+  pthread_mutex_unlock(&poolLock);
+#else
+  if(count > 0) function(data, 0, count);
+#endif
+}
+
+/* run task on the background thread, only one at a time */
+void StartBackground(void (*task)(void)) {
+#ifdef THREADS
+  pthread_mutex_lock(&backgroundLock);
+  backgroundTask = task;
+  backgroundBusy = 1;
+  pthread_cond_signal(&backgroundReady);
+  pthread_mutex_unlock(&backgroundLock);
+#else
+  task();
+#endif
+}
+
+int BackgroundBusy(void) {
+#ifdef THREADS
+  int busy;
+
+  pthread_mutex_lock(&backgroundLock);
+  busy = backgroundBusy;
+  pthread_mutex_unlock(&backgroundLock);
+  return busy;
+#else
+  return 0;
+#endif
+}
+
+#ifdef THREADS
+void *Worker(void *queue) {
+  int id = (chunkQueue *) queue - queues;
+  int seen = 0;
+
+  PROFILE_THREAD("worker", id);
+  for(;;) {
+    pthread_mutex_lock(&poolLock);
+    while(generation == seen || id >= activeThreads) {
+      seen = generation;
+      pthread_cond_wait(&workReady, &poolLock);
+    }
+    seen = generation;
+    busyWorkers++;
+    pthread_mutex_unlock(&poolLock);
+
+    RunChunks(id);
+
+    pthread_mutex_lock(&poolLock);
+    if(--busyWorkers == 0 && chunksLeft == 0) pthread_cond_signal(&workDone);
+    pthread_mutex_unlock(&poolLock);
+  }
+  return NULL;
+}
+
+/* work through our own queue, then steal until nothing is left */
+void RunChunks(int id) {
+  int chunk, victim, done;
+
+  for(;;) {
+    chunk = TakeChunk(id, 0);
+    for(victim = (id + 1) % activeThreads; chunk < 0 && victim != id;
+	victim = (victim + 1) % activeThreads)
+      chunk = TakeChunk(victim, 1);
+    if(chunk < 0) return;
+
+    PROFILE_BEGIN("chunk");
+    jobFunction(jobData, chunk * jobGrain,
+		chunk * jobGrain + jobGrain < jobCount ? chunk * jobGrain + jobGrain : jobCount);
+    PROFILE_END();
+
+    pthread_mutex_lock(&poolLock);
+    done = --chunksLeft == 0;
+    if(done && busyWorkers == 0) pthread_cond_signal(&workDone);
+    pthread_mutex_unlock(&poolLock);
+  }
+}
+
+/* owners take from the bottom, thieves from the top, -1 if empty */
+int TakeChunk(int id, int steal) {
+  chunkQueue *q = &queues[id];
+  int chunk = -1;
+
+  pthread_mutex_lock(&q->lock);
+  if(q->top < q->bottom) chunk = steal ? q->top++ : --q->bottom;
+  pthread_mutex_unlock(&q->lock);
+  return chunk;
+}
+
+void *BackgroundWorker(void *unused) {
+  void (*task)(void);
+
+  PROFILE_THREAD("background", -1);
+  for(;;) {
+    pthread_mutex_lock(&backgroundLock);
+    while(backgroundTask == NULL) pthread_cond_wait(&backgroundReady, &backgroundLock);
+    task = backgroundTask;
+    backgroundTask = NULL;
+    pthread_mutex_unlock(&backgroundLock);
+
+    PROFILE_BEGIN("background task");
+    task();
+    PROFILE_END();
+
+    pthread_mutex_lock(&backgroundLock);
+    backgroundBusy = 0;
+    pthread_mutex_unlock(&backgroundLock);
+  }
+  return NULL;
+}
+#endif
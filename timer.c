@@ -0,0 +1,121 @@
+/*************************************************************************
+ * Wall clock timing and frame time statistics for the benchmark runner *
+ * and a pacer that sleeps until each frame is due                      *
+ *************************************************************************/
+
+#ifndef WIN32
+#include <errno.h>
+#endif
+
+typedef struct {
+  double *samples;
+  int count;
+  int size;
+} timings;
+
+typedef struct {
+  double interval;		/* seconds a frame, 0 for as fast as possible */
+  double next;			/* when the next frame is due */
+} framePacer;
+
+double Now(void);
+void InitTimings(timings *, int);
+void AddTiming(timings *, double);
+void ReportTimings(char *, timings *);
+double MedianTiming(timings *);
+int CompareDoubles(const void *, const void *);
+void InitPacer(framePacer *, double);
+double PaceFrame(framePacer *);
+void SleepUntil(double);
+
+/* seconds from an arbitrary fixed point, unaffected by sleeping */
+double Now(void) {
+#ifdef WIN32
+  return clock() / (double) CLOCKS_PER_SEC;
+#else
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec * 1e-9;
+#endif
+}
+
+void InitTimings(timings *t, int size) {
+  t->samples = malloc(size * sizeof(double));
+  if(t->samples == NULL) {
+    fprintf(stderr, "ERROR: Unable to allocate %d timing samples\n", size);
+    exit(1);
+  }
+  t->count = 0;
+  t->size = size;
+}
+
+void AddTiming(timings *t, double seconds) {
+  if(t->count < t->size) t->samples[t->count++] = seconds;
+}
+
+/* print min, median, p99 and max in milliseconds */
+void ReportTimings(char *name, timings *t) {
+  double *s = t->samples;
+  int n = t->count;
+
+  if(n == 0) return;
+  qsort(s, n, sizeof(double), CompareDoubles);
+  printf("%-12s %10.3f %10.3f %10.3f %10.3f\n", name,
+	 s[0] * 1000.0,
+	 s[n/2] * 1000.0,
+	 s[(int) ((n - 1) * 0.99)] * 1000.0,
+	 s[n-1] * 1000.0);
+}
+
+double MedianTiming(timings *t) {
+  if(t->count == 0) return 0.0;
+  qsort(t->samples, t->count, sizeof(double), CompareDoubles);
+  return t->samples[t->count/2];
+}
+
+int CompareDoubles(const void *a, const void *b) {
+  double x = *(const double *) a;
+  double y = *(const double *) b;
+
+  if(x < y) return -1;
+  if(x > y) return 1;
+  return 0;
+}
+
+/* rate in frames a second, 0 or less for no limit */
+void InitPacer(framePacer *p, double rate) {
+  p->interval = rate > 0.0 ? 1.0 / rate : 0.0;
+  p->next = Now();
+}
+
+/* sleeps until the next frame is due and returns the time then. A frame
+   that is late pushes the rest back rather than them being rushed to
+   catch up */
+double PaceFrame(framePacer *p) {
+  double now = Now();
+
+  if(p->interval <= 0.0) return now;
+  if(now < p->next) {
+    SleepUntil(p->next);
+    now = Now();
+  }
+  p->next += p->interval;
+  if(p->next < now) p->next = now + p->interval;
+  return now;
+}
+
+/* a time from Now() */
+void SleepUntil(double when) {
+#ifdef WIN32
+  double wait = when - Now();
+
+  if(wait > 0.0) Sleep((DWORD) (wait * 1000.0));
+#else
+  struct timespec deadline;
+
+  deadline.tv_sec = (time_t) when;
+  deadline.tv_nsec = (long) ((when - deadline.tv_sec) * 1e9);
+  while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR);
+#endif
+}